@@ -21,7 +21,7 @@ void Generator::Update(Operator * H_s, Operator * Eta_s)
 
 void Generator::AddToEta(Operator * H_s, Operator * Eta_s)
 {
-   double start_time = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("UpdateEta");
    H = H_s;
    Eta = Eta_s;
    modelspace = H->GetModelSpace();
@@ -40,7 +40,8 @@ void Generator::AddToEta(Operator * H_s, Operator * Eta_s)
    {
       cout << "Error. Unkown generator_type: " << generator_type << endl;
    }
-   Eta->profiler.timer["UpdateEta"] += omp_get_wtime() - start_time;
+   // Record which ket-class blocks of eta are nonzero so the commutators can skip the rest
+   Eta->TwoBody.FindBlockStructure();
 }
 
 
@@ -1,6 +1,7 @@
 
 #include "HartreeFock.hh"
 #include "ModelSpace.hh"
+#include "imsrg_util.hh" // for GetSecondOrderOneBodyDensity
 #include <iomanip>
 #include <vector>
 #include <array>
@@ -235,7 +236,7 @@ void HartreeFock::BuildMonopoleV()
 //*********************************************************************
 void HartreeFock::BuildMonopoleV3()
 {
-   double start_time = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("HF_BuildMonopoleV3");
   // First, allocate. This is fast so don't parallelize.
   size_t norbits = modelspace->GetNumberOrbits();
   for (uint64_t i=0; i<norbits; ++i)
@@ -313,7 +314,6 @@ void HartreeFock::BuildMonopoleV3()
    std::cout << "HartreeFock::BuildMonopoleV3  storing " << Vmon3.size() << " doubles for Vmon3 and "
              << Vmon3_keys.size() << " uint64's for Vmon3_keys." << std::endl;
 
-   profiler.timer["HF_BuildMonopoleV3"] += omp_get_wtime() - start_time;
 }
 
 
@@ -414,7 +414,7 @@ void HartreeFock::FillLowestOrbits()
 //*********************************************************************
 void HartreeFock::UpdateF()
 {
-   double start_time = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("HF_UpdateF");
    int norbits = modelspace->GetNumberOrbits();
    Vij.zeros();
    V3ij.zeros();
@@ -470,7 +470,6 @@ void HartreeFock::UpdateF()
 
    F = KE + Vij + 0.5*V3ij;
 
-   profiler.timer["HF_UpdateF"] += omp_get_wtime() - start_time;
 }
 
 
@@ -678,7 +677,7 @@ Operator HartreeFock::GetNormalOrderedH(arma::mat& Cin)
 ///
 Operator HartreeFock::GetNormalOrderedH() 
 {
-   double start_time = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("HF_GetNormalOrderedH");
    std::cout << "Getting normal-ordered H in HF basis" << std::endl;
 
    // First, check if we need to update the occupation numbers for the reference
@@ -765,7 +764,6 @@ Operator HartreeFock::GetNormalOrderedH()
    
 //   FreeVmon();
 
-   profiler.timer["HF_GetNormalOrderedH"] += omp_get_wtime() - start_time;
    
    return HNO;
 
@@ -806,6 +804,57 @@ Operator HartreeFock::GetOmega()
 }
 
 
+//**************************************************************************
+/// Replace the HF orbits by natural orbits, which diagonalize the one-body density matrix
+/// evaluated to second order with the normal-ordered H in the HF basis (see imsrg_util::GetSecondOrderOneBodyDensity()),
+/// so the NO2B part of the 3N force is included. Within each \f$ (l,j,t_z) \f$ block, the natural orbits are sorted
+/// by decreasing occupation, so the orbit labeled n is the n-th most occupied one, and truncating to a smaller emax
+/// (see Operator::Truncate()) drops the least occupied ones. The reference keeps its occupations and F and EHF
+/// are recomputed for it, so GetNormalOrderedH() and TransformToHFBasis() then give operators in the natural orbit basis.
+//**************************************************************************
+void HartreeFock::GetNaturalOrbitals()
+{
+   IMSRGProfiler::ScopedTimer st("HF_GetNaturalOrbitals");
+   Operator HNO = GetNormalOrderedH();
+   arma::mat rho_2nd = imsrg_util::GetSecondOrderOneBodyDensity( HNO );
+
+   arma::mat C_nat(arma::size(C), arma::fill::zeros);
+   nat_occ.zeros(C.n_cols);
+   for ( auto& it : Hbare.OneBodyChannels )
+   {
+      arma::uvec orbvec(it.second);
+      arma::vec occ_ch;
+      arma::mat vec_ch;
+      arma::eig_sym(occ_ch, vec_ch, rho_2nd.submat(orbvec,orbvec));
+      // eig_sym gives ascending order, and we want the most occupied first
+      occ_ch = arma::flipud(occ_ch);
+      vec_ch = arma::fliplr(vec_ch);
+      for (index_t i=0;i<orbvec.size();++i)
+      {
+         if (vec_ch(i,i) < 0) vec_ch.col(i) *= -1;
+      }
+      C_nat.submat(orbvec,orbvec) = vec_ch;
+      nat_occ(orbvec) = occ_ch;
+   }
+   C = C * C_nat;
+
+   UpdateDensityMatrix();
+   UpdateF();
+   CalcEHF();
+   energies = arma::mat(C.t() * F * C).diag();
+
+   auto coutflags = std::cout.flags();
+   std::cout << "Natural orbital occupations:" << std::endl;
+   for (int i=0;i<modelspace->GetNumberOrbits();++i)
+   {
+     Orbit& oi = modelspace->GetOrbit(i);
+     std::cout << std::fixed << std::setw(3) << oi.n << " " << std::setw(3) << oi.l << " "
+          << std::setw(3) << oi.j2 << " " << std::setw(3) << oi.tz2 << "   " << std::scientific << std::setw(12) << nat_occ(i) << std::endl;
+   }
+   std::cout.flags(coutflags);
+}
+
+
 void HartreeFock::PrintSPE()
 {
   arma::mat F_trans = C.t() * F * C;
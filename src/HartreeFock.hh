@@ -44,6 +44,7 @@ class HartreeFock
    arma::uvec holeorbs;     ///< list of hole orbits for generating density matrix
    arma::rowvec hole_occ; /// occupations of hole orbits
    arma::vec energies;      ///< vector of single particle energies
+   arma::vec nat_occ;       ///< occupations of the natural orbitals, if GetNaturalOrbitals() was called
    arma::vec prev_energies; ///< SPE's from last iteration
    double tolerance;        ///< tolerance for convergence
    double EHF;              ///< Hartree-Fock energy (Normal-ordered 0-body term)
@@ -76,6 +77,7 @@ class HartreeFock
    Operator GetNormalOrderedH();  ///< Return the Hamiltonian in the HF basis at the normal-ordered 2body level.
    Operator GetNormalOrderedH(arma::mat& Cin);  ///< Return the Hamiltonian in the HF basis at the normal-ordered 2body level.
    Operator GetOmega();           ///< Return a generator of the Hartree Fock transformation
+   void GetNaturalOrbitals();     ///< Switch C from the HF orbits to the natural orbits of the second-order density matrix
    Operator GetHbare(){return Hbare;}; ///< Getter function for Hbare
    void PrintSPE(); ///< Print out the single-particle energies
    void PrintSPEandWF(); ///< Print out the single-particle energies and wave functions
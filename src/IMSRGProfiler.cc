@@ -7,11 +7,210 @@
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <mutex>
+#include <thread>
 
 
 std::map<std::string, double> IMSRGProfiler::timer;
 std::map<std::string, int> IMSRGProfiler::counter;
 float IMSRGProfiler::start_time = -1;
+bool IMSRGProfiler::trace_enabled = false;
+size_t IMSRGProfiler::max_trace_events = 1000000;
+
+
+// Everything that is written from inside parallel blocks lives in a ThreadProfile, which belongs to one thread.
+// The registry keeps a pointer to the profile of each live thread. The owner locks its profile's mutex to write to it,
+// and readers lock the registry and then each profile, so a lock is never contended except while the results are read.
+// When a thread other than the main one exits (e.g. one started by std::async), its results are folded into
+// RetiredProfile() and its profile is freed, so short-lived threads don't pile up in the registry.
+// The registry and the trace origin are function-local statics so that Operators constructed
+// during static initialization can already use the profiler.
+namespace {
+
+ struct TraceEvent
+ {
+   std::string name;
+   int index;
+   int tid;
+   double t_start;
+   double duration;
+ };
+
+ struct ThreadProfile
+ {
+   int tid;
+   bool dropped_events = false;
+   std::mutex mtx; // guards tree, counters and events. path_stack is only used by the owner.
+   std::vector<std::string> path_stack;
+   std::map<std::string,IMSRGProfiler::TimerNode> tree;
+   std::map<std::string,long long> counters;
+   std::vector<TraceEvent> events;
+ };
+
+ std::mutex& RegistryMutex()
+ {
+   static std::mutex m;
+   return m;
+ }
+
+ std::vector<ThreadProfile*>& Registry()
+ {
+   static std::vector<ThreadProfile*> registry;
+   return registry;
+ }
+
+ // The results of the threads which have exited, guarded by RegistryMutex
+ ThreadProfile& RetiredProfile()
+ {
+   static ThreadProfile retired;
+   return retired;
+ }
+
+ std::vector<int>& DroppedEventThreads()
+ {
+   static std::vector<int> tids;
+   return tids;
+ }
+
+ std::vector<std::pair<double,size_t>>& MemorySamples()
+ {
+   static std::vector<std::pair<double,size_t>> samples; // time, RSS in kB
+   return samples;
+ }
+
+ // The flat timer map is only written by the thread which first constructed an IMSRGProfiler
+ // (normally the main thread), so that work handed off to other threads doesn't race on it.
+ std::thread::id FlatTimerThread()
+ {
+   static std::thread::id id = std::this_thread::get_id();
+   return id;
+ }
+
+ double TraceOrigin()
+ {
+   static double origin = omp_get_wtime();
+   return origin;
+ }
+
+ ThreadProfile* NewProfile()
+ {
+   static int next_tid = 0;
+   ThreadProfile* tp = new ThreadProfile;
+   std::lock_guard<std::mutex> lock(RegistryMutex());
+   tp->tid = next_tid++;
+   Registry().push_back(tp);
+   return tp;
+ }
+
+ // Fold the results of an exiting thread into RetiredProfile() and free its profile.
+ void RetireProfile(ThreadProfile* tp)
+ {
+   std::lock_guard<std::mutex> lock(RegistryMutex());
+   auto& registry = Registry();
+   registry.erase( std::remove(registry.begin(), registry.end(), tp), registry.end() );
+   ThreadProfile& retired = RetiredProfile();
+   for (auto& it : tp->tree)
+   {
+     IMSRGProfiler::TimerNode& node = retired.tree[it.first];
+     node.time += it.second.time;
+     node.calls += it.second.calls;
+     node.nthreads += it.second.nthreads;
+   }
+   for (auto& it : tp->counters) retired.counters[it.first] += it.second;
+   retired.events.insert(retired.events.end(), tp->events.begin(), tp->events.end());
+   if (tp->dropped_events) DroppedEventThreads().push_back(tp->tid);
+   delete tp;
+ }
+
+ struct ThreadProfileOwner
+ {
+   ThreadProfile* tp = NULL;
+   ~ThreadProfileOwner() { if (tp != NULL) RetireProfile(tp); }
+ };
+
+ // The main thread's profile is never retired, since Operators with static storage duration
+ // still increment counters when they're destroyed, after the thread_local objects are gone.
+ ThreadProfile& LocalProfile()
+ {
+   if (std::this_thread::get_id() == FlatTimerThread())
+   {
+     static ThreadProfile* main_tp = NewProfile();
+     return *main_tp;
+   }
+   thread_local ThreadProfileOwner owner;
+   if (owner.tp == NULL) owner.tp = NewProfile();
+   return *owner.tp;
+ }
+
+ // Call f on RetiredProfile() and the profile of each live thread, each one locked in turn.
+ template <typename F>
+ void ForEachProfile(F f)
+ {
+   std::lock_guard<std::mutex> lock(RegistryMutex());
+   f(RetiredProfile());
+   for (auto tp : Registry())
+   {
+     std::lock_guard<std::mutex> lock_tp(tp->mtx);
+     f(*tp);
+   }
+ }
+
+ std::string JSONEscape(const std::string& s)
+ {
+   std::string out;
+   for (char c : s)
+   {
+     if (c=='"' or c=='\\') out += '\\';
+     out += c;
+   }
+   return out;
+ }
+
+}
+
+
+IMSRGProfiler::ScopedTimer::ScopedTimer(const std::string& nm, int ind)
+ : name(nm), index(ind), serial(not omp_in_parallel() and std::this_thread::get_id()==FlatTimerThread()), running(true)
+{
+  ThreadProfile& tp = LocalProfile();
+  if (tp.path_stack.empty())
+    tp.path_stack.push_back(name);
+  else
+    tp.path_stack.push_back(tp.path_stack.back() + "/" + name);
+  t_start = omp_get_wtime();
+}
+
+IMSRGProfiler::ScopedTimer::~ScopedTimer()
+{
+  Stop();
+}
+
+void IMSRGProfiler::ScopedTimer::Stop()
+{
+  if (not running) return;
+  running = false;
+  double t_stop = omp_get_wtime();
+  double dt = t_stop - t_start;
+  ThreadProfile& tp = LocalProfile();
+  {
+    std::lock_guard<std::mutex> lock(tp.mtx);
+    TimerNode& node = tp.tree[tp.path_stack.back()];
+    node.time += dt;
+    node.calls += 1;
+    node.nthreads = 1;
+    if (trace_enabled)
+    {
+      if (tp.events.size() < max_trace_events)
+        tp.events.push_back( {name, index, tp.tid, t_start-TraceOrigin(), dt} );
+      else
+        tp.dropped_events = true;
+    }
+  }
+  tp.path_stack.pop_back();
+  if (serial) timer[name] += dt;
+}
 
 IMSRGProfiler::IMSRGProfiler()
 {
@@ -19,23 +218,34 @@ IMSRGProfiler::IMSRGProfiler()
   {
     start_time = omp_get_wtime();
     counter["N_Threads"] = omp_get_max_threads();
+    FlatTimerThread();
   }
 }
 /// Check how much memory is being used.
-///
+/// This reads /proc/self/statm, which is cheap enough to call every iteration.
+/// The results are in kB. If tracing is enabled, the RSS is also recorded as a counter in the trace.
 std::map<std::string,size_t> IMSRGProfiler::CheckMem()
 {
-  char commandstr[100],outbuf[500],buf[100];
   std::map<std::string,size_t> s;
-  sprintf(commandstr,"pmap -x %d | tail -1",getpid()); // TODO make this more portable. On OSX, use vmmap. no idea for Windows...
+  s["Kbytes"]=0;s["RSS"]=0;s["SHARED"]=0;s["DATA"]=0;
 #ifndef __APPLE__
-  FILE* output = popen(commandstr,"r");
-  if (output==NULL or fgets(outbuf,500,output) == NULL)
-    std::cout << " <<< IMSRGProfiler::CheckMem():  Problem reading output of pmap (pid = " << getpid() << ")" << std::endl;
-  else
-    std::istringstream(outbuf) >> commandstr >> buf >> s["Kbytes"] >> s["RSS"] >> s["DIRTY"];
-#else
-  s["Kbytes"]=0;s["RSS"]=0;s["DIRTY"]=0;
+  size_t size=0,resident=0,shared=0,text=0,lib=0,data=0;
+  std::ifstream statm("/proc/self/statm");
+  if ( not (statm >> size >> resident >> shared >> text >> lib >> data) )
+  {
+    std::cout << " <<< IMSRGProfiler::CheckMem():  Problem reading /proc/self/statm (pid = " << getpid() << ")" << std::endl;
+    return s;
+  }
+  size_t page_kb = sysconf(_SC_PAGESIZE) / 1024;
+  s["Kbytes"] = size * page_kb;
+  s["RSS"]    = resident * page_kb;
+  s["SHARED"] = shared * page_kb;
+  s["DATA"]   = data * page_kb;
+  if (trace_enabled)
+  {
+    std::lock_guard<std::mutex> lock(RegistryMutex());
+    MemorySamples().push_back( {omp_get_wtime()-TraceOrigin(), s["RSS"]} );
+  }
 #endif
   return s;
 }
@@ -80,11 +290,80 @@ void IMSRGProfiler::PrintTimes()
      std::cout << std::setw(40) << std::left << it.first + ":  " << std::setw(12) << std::setprecision(5) << std::right << it.second  << std::endl;
 }
 
+/// Add n to the counter name. Unlike counter[name] += n, this is safe to call inside a parallel block.
+void IMSRGProfiler::IncrementCounter(const std::string& name, long long n)
+{
+  ThreadProfile& tp = LocalProfile();
+  std::lock_guard<std::mutex> lock(tp.mtx);
+  tp.counters[name] += n;
+}
+
+/// Value of the counter name, summed over the counter map and all the per-thread counters.
+/// This can be called while other threads are incrementing counters.
+long long IMSRGProfiler::GetCounter(const std::string& name)
+{
+  long long total = 0;
+  auto it = counter.find(name);
+  if (it != counter.end()) total += it->second;
+  ForEachProfile( [&](ThreadProfile& tp)
+  {
+    auto itc = tp.counters.find(name);
+    if (itc != tp.counters.end()) total += itc->second;
+  });
+  return total;
+}
+
+std::map<std::string,long long> IMSRGProfiler::GetCounters()
+{
+  std::map<std::string,long long> merged;
+  for (auto& it : counter) merged[it.first] += it.second;
+  ForEachProfile( [&](ThreadProfile& tp)
+  {
+    for (auto& it : tp.counters) merged[it.first] += it.second;
+  });
+  return merged;
+}
+
+/// Scoped timer results, merged over threads. The time is summed over threads,
+/// so for nodes that were timed inside a parallel block it can exceed the wall time.
+std::map<std::string,IMSRGProfiler::TimerNode> IMSRGProfiler::GetTimerTree()
+{
+  std::map<std::string,TimerNode> merged;
+  ForEachProfile( [&](ThreadProfile& tp)
+  {
+    for (auto& it : tp.tree)
+    {
+      TimerNode& node = merged[it.first];
+      node.time += it.second.time;
+      node.calls += it.second.calls;
+      node.nthreads += it.second.nthreads;
+    }
+  });
+  return merged;
+}
+
+void IMSRGProfiler::PrintTimerTree()
+{
+   auto tree = GetTimerTree();
+   if (tree.empty()) return;
+   std::cout << "=================== TIMER TREE (s) =================" << std::endl;
+   std::cout << std::setw(50) << std::left << "path" << std::setw(12) << std::right << "time" << std::setw(10) << "calls" << std::setw(9) << "threads" << std::endl;
+   for ( auto& it : tree )
+   {
+     // indent by depth and only print the last part of the path
+     size_t depth = std::count(it.first.begin(), it.first.end(), '/');
+     size_t pos = it.first.rfind('/');
+     std::string label = std::string(2*depth,' ') + (pos==std::string::npos ? it.first : it.first.substr(pos+1));
+     std::cout << std::setw(50) << std::left << label << std::fixed << std::setw(12) << std::setprecision(5) << std::right << it.second.time
+               << std::setw(10) << it.second.calls << std::setw(9) << it.second.nthreads << std::endl;
+   }
+}
+
 void IMSRGProfiler::PrintCounters()
 {
    std::cout << "===================== COUNTERS =====================" << std::endl;
    std::cout.setf(std::ios::fixed);
-   for ( auto it : counter )
+   for ( auto it : GetCounters() )
      std::cout << std::setw(40) << std::left << it.first + ":  " << std::setw(12) << std::setprecision(0) << std::right << it.second  << std::endl;
 }
 
@@ -101,7 +380,71 @@ void IMSRGProfiler::PrintAll()
 {
   PrintCounters();
   PrintTimes();
+  PrintTimerTree();
   PrintMemory();
 }
 
+/// Write the flat timers, the timer tree and the counters to a csv file
+/// with columns  type,name,threads,calls,value
+void IMSRGProfiler::WriteTimesCSV(std::string filename)
+{
+  std::ofstream outfile(filename);
+  if (not outfile.good())
+  {
+    std::cout << " <<< IMSRGProfiler::WriteTimesCSV():  Problem opening " << filename << std::endl;
+    return;
+  }
+  outfile << "type,name,threads,calls,value" << std::endl;
+  outfile << std::setprecision(9);
+  for (auto& it : timer)
+    outfile << "timer," << it.first << ",,," << it.second << std::endl;
+  for (auto& it : GetTimerTree())
+    outfile << "tree," << it.first << "," << it.second.nthreads << "," << it.second.calls << "," << it.second.time << std::endl;
+  for (auto& it : GetCounters())
+    outfile << "counter," << it.first << ",,," << it.second << std::endl;
+  for (auto& it : GetTimes())
+    outfile << "total," << it.first << ",,," << it.second << std::endl;
+}
 
+/// Write the events recorded by scoped timers (and memory samples from CheckMem)
+/// in the Chrome trace-event format. Only does something useful if EnableTrace() was called.
+void IMSRGProfiler::WriteTraceJSON(std::string filename)
+{
+  std::ofstream outfile(filename);
+  if (not outfile.good())
+  {
+    std::cout << " <<< IMSRGProfiler::WriteTraceJSON():  Problem opening " << filename << std::endl;
+    return;
+  }
+  int pid = getpid();
+  bool first = true;
+  outfile << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+  outfile << std::fixed << std::setprecision(3);
+  std::vector<int> dropped_tids;
+  ForEachProfile( [&](ThreadProfile& tp)
+  {
+    for (auto& ev : tp.events)
+    {
+      if (not first) outfile << "," << std::endl;
+      first = false;
+      // timestamps are in microseconds
+      outfile << "{\"name\":\"" << JSONEscape(ev.name) << "\",\"cat\":\"imsrg\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << ev.tid
+              << ",\"ts\":" << 1e6*ev.t_start << ",\"dur\":" << 1e6*ev.duration;
+      if (ev.index >= 0) outfile << ",\"args\":{\"index\":" << ev.index << "}";
+      outfile << "}";
+    }
+    if (tp.dropped_events) dropped_tids.push_back(tp.tid);
+  });
+  std::lock_guard<std::mutex> lock(RegistryMutex());
+  dropped_tids.insert(dropped_tids.end(), DroppedEventThreads().begin(), DroppedEventThreads().end());
+  for (int tid : dropped_tids)
+    std::cout << " <<< IMSRGProfiler::WriteTraceJSON():  thread " << tid << " hit max_trace_events = " << max_trace_events << ". Later events were dropped." << std::endl;
+  for (auto& sample : MemorySamples())
+  {
+    if (not first) outfile << "," << std::endl;
+    first = false;
+    outfile << "{\"name\":\"memory\",\"ph\":\"C\",\"pid\":" << pid << ",\"tid\":0,\"ts\":" << 1e6*sample.first
+            << ",\"args\":{\"RSS_MB\":" << sample.second/1024. << "}}";
+  }
+  outfile << std::endl << "]}" << std::endl;
+}
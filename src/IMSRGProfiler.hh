@@ -21,19 +21,20 @@
 #ifndef IMSRGProfiler_h
 #define IMSRGProfiler_h 1
 
-//#include <unistd.h>
-//#include <sstream>
-//#include <stdio.h>
-//#include <iostream>
-//#include <iomanip>
 #include <map>
 #include <string>
+#include <vector>
 
 /// Profiling class with all static data members.
 /// This is for keeping track of timing and memory usage, etc.
-/// IMSRGProfiler methods should probably not be called inside parallel blocks.
-
-//using namespace std;
+///
+/// The timer and counter maps are shared and not thread-safe, so they should only be touched outside
+/// of parallel blocks. Inside parallel blocks, use ScopedTimer and IncrementCounter(), which write
+/// to storage owned by the calling thread and are merged when the results are read, printed or written.
+/// The counters and the timer tree can be read from any thread while other threads are still writing to them.
+/// Scoped timers nest, so that the time is also aggregated in a call tree, e.g. BCH_Transform/Commutator/comm222_phss.
+/// If tracing is switched on with EnableTrace(), each scoped timer also records an event which can be written
+/// out with WriteTraceJSON() and viewed in chrome://tracing or https://ui.perfetto.dev.
 
 class IMSRGProfiler
 {
@@ -42,14 +43,55 @@ class IMSRGProfiler
   static std::map<std::string, double> timer; ///< For keeping timing information for various method calls
   static std::map<std::string, int> counter;
   static float start_time;
+  static bool trace_enabled;       ///< Record an event for each ScopedTimer (needed for WriteTraceJSON)
+  static size_t max_trace_events;  ///< Per thread. Once this is reached, further events are dropped.
+
+  /// Timing information accumulated for one node in the call tree
+  struct TimerNode
+  {
+    double time;
+    long long calls;
+    int nthreads;
+  };
+
+  /// Times the enclosing scope. The time is accumulated under the full path of the enclosing
+  /// scoped timers on this thread. When constructed on the main thread outside of a parallel block,
+  /// the time is also added to the flat timer map, so that it shows up in PrintTimes() as before.
+  /// The optional index (e.g. a channel number) is not used for aggregation, but is attached to the trace event.
+  /// Stop() ends the timing early, for timing one section of a function. Timers on the same thread
+  /// have to be stopped in the reverse order that they were started.
+  /// Constructing a ScopedTimer costs a string concatenation and a map lookup, so keep them out of inner loops.
+  class ScopedTimer
+  {
+   public:
+    ScopedTimer(const std::string& name, int index=-1);
+    ~ScopedTimer();
+    void Stop();
+   private:
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+    std::string name;
+    int index;
+    double t_start;
+    bool serial;
+    bool running;
+  };
 
   IMSRGProfiler();
-  std::map<std::string,size_t> CheckMem(); // Kbytes  RSS  DIRTY
+  std::map<std::string,size_t> CheckMem(); // Kbytes  RSS  SHARED  DATA
   std::map<std::string,float> GetTimes(); // real  user  sys
+  static void IncrementCounter(const std::string& name, long long n=1); // thread-safe
+  long long GetCounter(const std::string& name);
+  std::map<std::string,long long> GetCounters(); // counter plus the per-thread counters
+  std::map<std::string,TimerNode> GetTimerTree(); // merged over threads
+  void EnableTrace(bool tf=true){trace_enabled = tf;};
   void PrintTimes();
+  void PrintTimerTree();
   void PrintCounters();
   void PrintMemory();
   void PrintAll();
+  void WriteTimesCSV(std::string filename);
+  void WriteTraceJSON(std::string filename);
   size_t MaxMemUsage();
 };
 
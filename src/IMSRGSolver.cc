@@ -1,6 +1,10 @@
 
 #include "IMSRGSolver.hh"
 #include <iomanip>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <omp.h>
 
 #ifndef NO_ODE
 #include <boost/numeric/odeint.hpp>
@@ -14,7 +18,10 @@ IMSRGSolver::~IMSRGSolver()
 IMSRGSolver::IMSRGSolver()
     : rw(NULL),s(0),ds(0.1),ds_max(0.5),
      norm_domega(0.1), omega_norm_max(2.0),eta_criterion(1e-6),method("magnus_euler"),
-     flowfile(""), n_omega_written(0),max_omega_written(50),magnus_adaptive(true)
+     flowfile(""), n_omega_written(0),max_omega_written(50),magnus_adaptive(true),flow_failed(false),euler_step_control(false),H_resync_interval(0),H_s_incremental(false),omega_compression_tol(0)
+     ,scratch_cache_bytes(0),omega_cache(make_shared<map<int,shared_ptr<Operator>>>()),omega_cache_lru(make_shared<list<int>>()),omega_cache_mutex(make_shared<mutex>()),omega_unwritten(make_shared<map<int,shared_ptr<Operator>>>())
+     ,flowstatus_interval(1),flowstatus_async(false),flowstatus_count(0),flowstatus_last_s(-1)
+     ,stop_requested(make_shared<atomic<bool>>(false)),flowstatus_mutex(make_shared<mutex>()),flowstatus_last(make_shared<FlowStatus>())
      ,ode_monitor(*this),ode_mode("H"),ode_e_abs(1e-6),ode_e_rel(1e-6)
 {}
 
@@ -23,7 +30,10 @@ IMSRGSolver::IMSRGSolver( Operator &H_in)
    : modelspace(H_in.GetModelSpace()),rw(NULL), H_0(&H_in), FlowingOps(1,H_in), Eta(H_in), 
     istep(0), s(0),ds(0.1),ds_max(0.5),
     smax(2.0), norm_domega(0.1), omega_norm_max(2.0),eta_criterion(1e-6),method("magnus_euler"),
-    flowfile(""), n_omega_written(0),max_omega_written(50),magnus_adaptive(true)
+    flowfile(""), n_omega_written(0),max_omega_written(50),magnus_adaptive(true),flow_failed(false),euler_step_control(false),H_resync_interval(0),H_s_incremental(false),omega_compression_tol(0)
+    ,scratch_cache_bytes(0),omega_cache(make_shared<map<int,shared_ptr<Operator>>>()),omega_cache_lru(make_shared<list<int>>()),omega_cache_mutex(make_shared<mutex>()),omega_unwritten(make_shared<map<int,shared_ptr<Operator>>>())
+    ,flowstatus_interval(1),flowstatus_async(false),flowstatus_count(0),flowstatus_last_s(-1)
+    ,stop_requested(make_shared<atomic<bool>>(false)),flowstatus_mutex(make_shared<mutex>()),flowstatus_last(make_shared<FlowStatus>())
     ,ode_monitor(*this),ode_mode("H"),ode_e_abs(1e-6),ode_e_rel(1e-6)
 {
    Eta.Erase();
@@ -35,22 +45,38 @@ IMSRGSolver::IMSRGSolver( Operator &H_in)
 
 void IMSRGSolver::NewOmega()
 {
+  if (H_s_incremental) UpdateH(); // don't carry the drift into H_saved
   H_saved = FlowingOps[0];
   cout << "pushing back another Omega. Omega.size = " << Omega.size()
-       << " , operator size = " << Omega.front().Size()/1024./1024. << " MB"
+       << " , operator size = " << Omega.back().Size()/1024./1024. << " MB"
        << ",  memory usage = " << profiler.CheckMem()["RSS"]/1024./1024. << " GB"
        << endl;
   if ((rw != NULL) and (rw->GetScratchDir() !=""))
   {
-    
-    char tmp[512];
-    sprintf(tmp,"%s/OMEGA_%06d_%03d",rw->GetScratchDir().c_str(), getpid(), n_omega_written);
-    string fname(tmp);
-    ofstream ofs(fname, ios::binary);
-    Omega.back().WriteBinary(ofs);
-    if (Omega.back().GetModelSpace() != Eta.GetModelSpace()) Omega.back() = Eta;
+    // Hand the finished Omega off to be written in the background, and keep flowing.
+    // Only one write is in flight at a time.
+    WaitForOmegaWrite();
+    int i_omega = n_omega_written;
+    string fname = ScratchOmegaFileName(i_omega);
+    auto omega_out = make_shared<Operator>( std::move(Omega.back()) );
+    CacheScratchOmega(i_omega, omega_out);
+    auto unwritten = omega_unwritten;
+    auto cache_mutex = omega_cache_mutex;
+    auto write_omega = [omega_out,fname,i_omega,unwritten,cache_mutex]() -> bool
+    {
+      omp_set_num_threads(1); // don't compete with the flow for cores
+      ReadWrite writer;
+      writer.WriteOperatorBinary(*omega_out, fname);
+      if (writer.InGoodState()) return true;
+      // Don't lose it. It stays in memory for good, and GetScratchOmega() finds it there.
+      lock_guard<mutex> lock(*cache_mutex);
+      (*unwritten)[i_omega] = omega_out;
+      return false;
+    };
+    omega_write_pending = make_shared<future<bool>>( async(launch::async, write_omega) );
+    Omega.back() = Eta;
     n_omega_written++;
-    cout << "Omega written to file " << fname << "  written " << n_omega_written << " so far." << endl;
+    cout << "Writing Omega to file " << fname << "  written " << n_omega_written << " so far." << endl;
     if (n_omega_written > max_omega_written)
     {
       cout << "n_omega_written > max_omega_written.  (" << n_omega_written << " > " << max_omega_written
@@ -61,12 +87,44 @@ void IMSRGSolver::NewOmega()
   }
   else
   {
+    if (omega_compression_tol > 0) CompressOmega(Omega.back());
     Omega.emplace_back(Eta);
   }
   Omega.back().Erase();
 
 }
 
+/// Store the two-body part of a finished Omega as a truncated SVD of each channel block (see TwoBodyME::Compress()),
+/// to fit more Omegas in memory. The blocks are multiplied back out when the Omega is applied, see GetOmega().
+/// Since H_s is carried along in H_saved, this only affects operators transformed afterwards.
+/// The energy shift which the truncation would cause is estimated to first order as \f$ \langle [\delta\Omega, H(s)] \rangle \f$.
+void IMSRGSolver::CompressOmega(Operator& omega)
+{
+  IMSRGProfiler::ScopedTimer st("CompressOmega");
+  double size_before = omega.Size();
+  Operator omega_full = omega;
+  double norm_discarded = omega.TwoBody.Compress(omega_compression_tol);
+  if (not omega.TwoBody.IsCompressed()) return;
+  Operator delta = omega;
+  delta.TwoBody.Decompress();
+  delta.TwoBody -= omega_full.TwoBody;
+  delta.OneBody.zeros();
+  Operator dE(*modelspace,0,0,0,1);
+  dE.comm220ss(delta, FlowingOps[0]);
+  auto coutflags = cout.flags();
+  cout << "Compressed Omega: " << size_before/1024./1024. << " MB -> " << omega.Size()/1024./1024. << " MB"
+       << " , discarded norm = " << scientific << norm_discarded << " , estimated dE0 = " << dE.ZeroBody << endl;
+  cout.flags(coutflags);
+}
+
+/// Returns Omega number i of the ones kept in memory, with its channel blocks multiplied back out if it was compressed.
+Operator IMSRGSolver::GetOmega(int i)
+{
+  Operator omega = Omega[i];
+  if (omega.TwoBody.IsCompressed()) omega.TwoBody.Decompress();
+  return omega;
+}
+
 void IMSRGSolver::SetHin( Operator & H_in)
 {
    modelspace = H_in.GetModelSpace();
@@ -97,6 +155,53 @@ void IMSRGSolver::SetOmega(size_t i, Operator& om)
  Omega[i] = om;
 }
 
+/// Warm start: continue the flow from om, e.g. the Omega from a neighboring hw, nucleus or emax,
+/// rather than from zero. The flowing operators are transformed with om right away.
+void IMSRGSolver::SetInitialOmega(Operator& om)
+{
+  if (Omega.back().Norm() > 1e-6) NewOmega();
+  Omega.back() = om;
+  if ((Omega.size()+n_omega_written)<2)
+    FlowingOps[0] = H_0->BCH_Transform( Omega.back() );
+  else
+    FlowingOps[0] = H_saved.BCH_Transform( Omega.back() );
+  for (size_t i=1;i<FlowingOps.size();++i)
+    FlowingOps[i] = FlowingOps[i].BCH_Transform( Omega.back() );
+}
+
+IMSRGSolver::Checkpoint IMSRGSolver::GetCheckpoint()
+{
+  WaitForOmegaWrite();
+  return {s, ds, istep, n_omega_written, modelspace, generator, *H_0, Omega, FlowingOps, H_saved};
+}
+
+/// Go back to the state saved with GetCheckpoint(). Scratch Omegas written since then
+/// belong to the abandoned branch, so they're deleted.
+/// The solver refers to the copy of the starting Hamiltonian in cp afterwards, so cp needs to stay around.
+void IMSRGSolver::RestoreCheckpoint(Checkpoint& cp)
+{
+  WaitForOmegaWrite();
+  for (int i=cp.n_omega_written; i<n_omega_written; i++) DropScratchOmega(i);
+  s = cp.s;
+  ds = cp.ds;
+  istep = cp.istep;
+  n_omega_written = cp.n_omega_written;
+  modelspace = cp.modelspace;
+  generator = cp.generator;
+  H_0 = &cp.H_0;
+  Omega = cp.Omega;
+  FlowingOps = cp.FlowingOps;
+  H_saved = cp.H_saved;
+  // The core/valence classes of the kets may have changed (e.g. another valence space with the same core),
+  // so any block structure found for the old classes has to be found again.
+  for (auto op : {&H_saved, H_0} ) if (op->TwoBody.HasBlockStructure()) op->TwoBody.FindBlockStructure();
+  for (auto& op : Omega ) if (op.TwoBody.HasBlockStructure()) op.TwoBody.FindBlockStructure();
+  for (auto& op : FlowingOps ) if (op.TwoBody.HasBlockStructure()) op.TwoBody.FindBlockStructure();
+  Eta = FlowingOps[0];
+  Eta.Erase();
+  Eta.SetAntiHermitian();
+}
+
 void IMSRGSolver::Reset()
 {
    s=0;
@@ -115,20 +220,27 @@ void IMSRGSolver::SetGenerator(string gen)
   }
 }
 
+/// Open (and truncate) the flow file. It stays open for the rest of the flow.
+/// If the file name ends in .csv, the flow status is written as comma-separated values.
 void IMSRGSolver::SetFlowFile(string str)
 {
+   FlushFlowStatus();
    flowfile = str;
-   ofstream flowf;
+   flowfile_stream.reset();
    if (flowfile != "")
    {
-      flowf.open(flowfile,ofstream::out);
-      flowf.close();
+      flowfile_stream = make_shared<ofstream>(flowfile,ofstream::out);
+      if ( not flowfile_stream->good() )
+        cout << "IMSRGSolver::SetFlowFile: trouble opening " << flowfile << endl;
+      else if (FlowFileIsCSV())
+        *flowfile_stream << "istep,s,E0,norm_H,trace_H,norm_omega1,norm_omega2,norm_eta1,norm_eta2,ncomm,E_MP2,n_ops,walltime,rss_MB,max_rss_MB" << endl;
    }
 }
 
 
 void IMSRGSolver::Solve()
 {
+  flow_failed = false;
   if (s<1e-4)
    WriteFlowStatusHeader(cout);
 
@@ -137,6 +249,8 @@ void IMSRGSolver::Solve()
     Solve_magnus_euler();
   else if (method == "magnus_modified_euler")
     Solve_magnus_modified_euler();
+  else if (method == "magnus_rkmk4")
+    Solve_magnus_rkmk4();
   else if (method == "flow_adaptive" or method == "flow")
     Solve_ode_adaptive();
   else if (method == "magnus_adaptive")
@@ -150,6 +264,13 @@ void IMSRGSolver::Solve()
   }
   else
     cout << "IMSRGSolver: I don't know method " << method << endl;
+
+  FlushFlowStatus();
+  if (StopRequested())
+  {
+    cout << "IMSRGSolver: stopped on request at s = " << s << endl;
+    *stop_requested = false;
+  }
 }
 
 void IMSRGSolver::UpdateEta()
@@ -157,6 +278,15 @@ void IMSRGSolver::UpdateEta()
    generator.Update(&FlowingOps[0],&Eta);
 }
 
+/// Euler integration of the Magnus flow, \f$ e^{\Omega(s+ds)} = e^{ds\,\eta(s)} e^{\Omega(s)} \f$.
+/// By default ds is chosen so that \f$ \| ds\,\eta \| \f$ is at most norm_domega, and no more than ds_max.
+/// Late in the flow, where the generator decays smoothly, it is ds_max that sets the number of steps.
+/// With euler_step_control, steps longer than ds_max (but still within the norm_domega and omega_norm_max limits)
+/// are taken when the flow allows it. The change in the energy is compared with the trapezoid estimate
+/// \f$ \frac{ds}{2}(E'(s)+E'(s+ds)) \f$, with \f$ E' = [\eta,H]_{(0)} \f$ (see EnergySlope()),
+/// and the difference should be less than ode_e_abs + ode_e_rel * \f$ |E| \f$. The norm of the generator
+/// should also not grow, which would mean we're over-rotating. Longer steps that fail either test are redone
+/// with a smaller ds, and the next ds is chosen by a PI controller on the energy error.
 void IMSRGSolver::Solve_magnus_euler()
 {
    istep = 0;
@@ -168,11 +298,17 @@ void IMSRGSolver::Solve_magnus_euler()
    }
 
     // Write details of the flow
-   WriteFlowStatus(flowfile);
-   WriteFlowStatus(cout);
+   WriteFlowStatus();
+
+   double safety = 0.9;
+   double max_growth = 2.0;
+   double min_shrink = 0.2;
+   double slope = euler_step_control ? EnergySlope() : 0;
+   double err_last = -1;
 
    for (istep=1;s<smax;++istep)
    {
+      if (StopRequested()) break;
 
       double norm_eta = Eta.Norm();
       if (norm_eta < eta_criterion )
@@ -186,43 +322,150 @@ void IMSRGSolver::Solve_magnus_euler()
         norm_omega = 0;
       }
       // ds should never be more than 1, as this is over-rotating
+      double ds_rotation = min( min(norm_domega/norm_eta, norm_domega / norm_eta / (norm_omega+1.0e-9)), omega_norm_max/norm_eta);
+      double ds_controller = ds;
       if (magnus_adaptive)
-         ds = min( min( min(norm_domega/norm_eta, norm_domega / norm_eta / (norm_omega+1.0e-9)), omega_norm_max/norm_eta), ds_max); 
+         ds = min( ds_rotation, ds_max); 
       ds = min(ds,smax-s);
+      double ds_default = ds;
+      if (euler_step_control and istep>1)
+         ds = min( max(ds_default, min(ds_controller, ds_rotation)), smax-s);
 //      if (s+ds > smax) ds = smax-s;
-      s += ds;
-      Eta *= ds; // Here's the Euler step.
-
-      // accumulated generator (aka Magnus operator) exp(Omega) = exp(dOmega) * exp(Omega_last)
-      Omega.back() = Eta.BCH_Product( Omega.back() ); 
 
-      // transformed Hamiltonian H_s = exp(Omega) H_0 exp(-Omega)
-      if ((Omega.size()+n_omega_written)<2)
+      if (not euler_step_control)
       {
-        FlowingOps[0] = H_0->BCH_Transform( Omega.back() );
+        s += ds;
+        Eta *= ds; // Here's the Euler step.
+
+        // accumulated generator (aka Magnus operator) exp(Omega) = exp(dOmega) * exp(Omega_last)
+        Omega.back() = Eta.BCH_Product( Omega.back() ); 
+
+        // transformed Hamiltonian H_s = exp(Omega) H_0 exp(-Omega)
+        UpdateH( Eta );
+
+        if (norm_eta<1.0 and generator.GetType() == "shell-model-atan")
+        {
+          generator.SetDenominatorCutoff(1e-6);
+        }
+
+        generator.Update(&FlowingOps[0],&Eta);
       }
       else
       {
-        FlowingOps[0] = H_saved.BCH_Transform( Omega.back() );
-      }
-
-      if (norm_eta<1.0 and generator.GetType() == "shell-model-atan")
-      {
-        generator.SetDenominatorCutoff(1e-6);
+        if (norm_eta<1.0 and generator.GetType() == "shell-model-atan")
+        {
+          generator.SetDenominatorCutoff(1e-6);
+        }
+        Operator& H_s = FlowingOps[0];
+        Operator H_last = H_s;
+        Operator Eta_last = Eta;
+        Operator Omega_last = Omega.back();
+        bool H_last_incremental = H_s_incremental;
+        while (true)
+        {
+          Eta = ds * Eta_last;  // Here's the Euler step.
+          Omega.back() = Eta.BCH_Product( Omega_last );
+          UpdateH( Eta );
+          generator.Update(&H_s,&Eta);
+
+          double slope_new = EnergySlope();
+          double err = std::abs( H_s.ZeroBody - H_last.ZeroBody - 0.5*ds*(slope+slope_new) );
+          double norm_eta_new = Eta.Norm();
+          double tol = ode_e_abs + ode_e_rel * std::abs(H_s.ZeroBody);
+          // error is second order in ds. PI controller with the usual 0.7/k and 0.4/k exponents, k=2.
+          double factor = max_growth;
+          if (err > 0)
+          {
+            factor = safety * pow(tol/err, 0.35);
+            if (err_last > 0) factor *= pow(err_last/tol, 0.2);
+          }
+          factor = min( max(factor,min_shrink), max_growth);
+
+          if ( ds <= ds_default or (err <= tol and norm_eta_new <= norm_eta) )
+          {
+            s += ds;
+            slope = slope_new;
+            err_last = max(err, 1e-4*tol);
+            ds *= factor;
+            break;
+          }
+          cout << "  euler: rejecting step ds = " << ds << "  energy error = " << err << " (" << tol << ")  norm eta = " << norm_eta_new << " (" << norm_eta << ")" << endl;
+          IMSRGProfiler::IncrementCounter("N_RejectedSteps");
+          Omega.back() = Omega_last;
+          H_s = H_last;
+          H_s_incremental = H_last_incremental;
+          double shrink = (err > tol) ? min(safety*sqrt(tol/err), 0.5) : 0.5;
+          ds = max( ds * max(shrink,min_shrink), ds_default);
+        }
       }
-        
-      generator.Update(&FlowingOps[0],&Eta);
 
       // Write details of the flow
-      WriteFlowStatus(flowfile);
-      WriteFlowStatus(cout);
+      WriteFlowStatus();
 //      profiler.PrintMemory();
 
    }
+   if (H_s_incremental) UpdateH();
+   WriteFlowStatus(true); // make sure the last step gets written
 
 }
 
 
+/// Recompute \f$ H(s) = e^{\Omega} H e^{-\Omega} \f$ from the Hamiltonian at the start of the current Omega.
+void IMSRGSolver::UpdateH()
+{
+   if ((Omega.size()+n_omega_written)<2)
+   {
+     FlowingOps[0] = H_0->BCH_Transform( Omega.back() );
+   }
+   else
+   {
+     FlowingOps[0] = H_saved.BCH_Transform( Omega.back() );
+   }
+   H_s_incremental = false;
+}
+
+/// Update H(s) after a step which took \f$ e^{\Omega} \rightarrow e^{d\Omega} e^{\Omega} \f$.
+/// Normally H(s) is recomputed from scratch with the full Omega. With H_resync_interval>0, it is instead
+/// updated as \f$ e^{d\Omega} H(s) e^{-d\Omega} \f$, which needs far fewer nested commutators since
+/// \f$ \|d\Omega\| \ll \|\Omega\| \f$. This is only exact without truncations, so every H_resync_interval
+/// steps it is recomputed from scratch and the difference to the incremental update is reported.
+void IMSRGSolver::UpdateH(const Operator& dOmega)
+{
+   if (H_resync_interval<1)
+   {
+     UpdateH();
+     return;
+   }
+   if (istep % H_resync_interval != 0)
+   {
+     FlowingOps[0] = FlowingOps[0].BCH_Transform( dOmega );
+     H_s_incremental = true;
+     return;
+   }
+   IMSRGProfiler::ScopedTimer st_incremental("UpdateH_incremental");
+   Operator H_incremental = FlowingOps[0].BCH_Transform( dOmega );
+   st_incremental.Stop();
+   UpdateH();
+   double dE = FlowingOps[0].ZeroBody - H_incremental.ZeroBody;
+   H_incremental -= FlowingOps[0];
+   auto coutflags = cout.flags();
+   cout << "  UpdateH: recomputed H(s) at step " << istep << ".  Incremental update was off by ||dH|| = " << scientific << H_incremental.Norm()
+        << " , dE = " << dE << endl;
+   cout.flags(coutflags);
+}
+
+
+/// The zero-body part of \f$ [\eta,H(s)] \f$, i.e. \f$ dE/ds \f$ at the current point in the flow.
+/// This only needs the [1,1]->0 and [2,2]->0 terms, so it's cheap compared to a full commutator.
+double IMSRGSolver::EnergySlope()
+{
+   Operator dEds( *modelspace, 0,0,0,1 );
+   dEds.comm110ss( Eta, FlowingOps[0] );
+   dEds.comm220ss( Eta, FlowingOps[0] );
+   return dEds.ZeroBody;
+}
+
+
 void IMSRGSolver::Solve_magnus_modified_euler()
 {
    istep = 0;
@@ -230,11 +473,11 @@ void IMSRGSolver::Solve_magnus_modified_euler()
 
    Operator H_temp;
     // Write details of the flow
-   WriteFlowStatus(flowfile);
-   WriteFlowStatus(cout);
+   WriteFlowStatus();
 
    for (istep=1;s<smax;++istep)
    {
+      if (StopRequested()) break;
       double norm_eta = Eta.Norm();
       double norm_omega = Omega.back().Norm();
       if (norm_omega > omega_norm_max)
@@ -267,10 +510,143 @@ void IMSRGSolver::Solve_magnus_modified_euler()
       generator.Update(&FlowingOps[0],&Eta);
 
       // Write details of the flow
-      WriteFlowStatus(flowfile);
-      WriteFlowStatus(cout);
+      WriteFlowStatus();
+
+   }
+   WriteFlowStatus(true); // make sure the last step gets written
+
+}
+
+
+/// Truncated inverse of the derivative of the exponential map
+/// \f[ \mathrm{dexp}^{-1}_{\theta}(\eta) = \eta - \frac{1}{2}[\theta,\eta] + \frac{1}{12}[\theta,[\theta,\eta]] + \ldots \f]
+/// The terms kept here are enough for a 4th-order Runge-Kutta-Munthe-Kaas step.
+Operator IMSRGSolver::DexpInv( const Operator& theta, const Operator& eta)
+{
+   Operator theta_eta = Commutator(theta,eta);
+   return eta - 0.5*theta_eta + (1./12)*Commutator(theta,theta_eta);
+}
+
+
+/// 4th-order Runge-Kutta-Munthe-Kaas integration of the Magnus flow.
+/// Each step solves for the increment \f$ \theta \f$ with \f$ e^{\Omega(s+ds)} = e^{\theta} e^{\Omega(s)} \f$,
+/// where \f$ d\theta/ds = \mathrm{dexp}^{-1}_{\theta}(\eta(e^{\theta}H(s)e^{-\theta})) \f$, using the classical RK4 tableau.
+/// The generator at the end of the step is needed for the next step anyway, and it gives the extra stage
+/// \f$ k_5 \f$ of the embedded 3rd-order solution \f$ (k_1 + 2k_2 + 2k_3 + k_5)/6 \f$.
+/// The difference between the two, \f$ \|k_4 - k_5\|/6 \f$, is compared to
+/// ode_e_abs + ode_e_rel * \f$ \|\theta\| \f$ to accept or reject the step and to choose the next ds.
+/// With SetMagnusAdaptive(false), ds is kept fixed and the error estimate is skipped.
+void IMSRGSolver::Solve_magnus_rkmk4()
+{
+   istep = 0;
+   generator.Update(&FlowingOps[0],&Eta);
+
+   // Write details of the flow
+   WriteFlowStatus();
+
+   double safety = 0.9;
+   double max_growth = 4.0;
+   double min_shrink = 0.2;
+   double ds_min = 1e-6; // below this, the step size has collapsed and the flow is abandoned
+   Operator H_stage = FlowingOps[0];
+   Operator Eta_stage = Eta;
+
+   for (istep=1;s<smax;++istep)
+   {
+      if (StopRequested()) break;
+      double norm_eta = Eta.Norm();
+      if (norm_eta < eta_criterion )
+      {
+        break;
+      }
+      double norm_omega = Omega.back().Norm();
+      if (norm_omega > omega_norm_max)
+      {
+        NewOmega();
+        norm_omega = 0;
+      }
+      // on the first step, start with the same step size as the Euler method would
+      if (istep==1 and magnus_adaptive)
+         ds = min( min(norm_domega/norm_eta, omega_norm_max/norm_eta), ds_max);
+
+      Operator& H_s = FlowingOps[0];
+      Operator H_last = H_s;
+      Operator Eta_last = Eta;
+      Operator Omega_last = Omega.back();
+      while (true)
+      {
+        ds = min(ds,smax-s);
+        Operator k1 = ds * Eta_last;
+
+        H_stage = H_last.BCH_Transform( 0.5*k1 );
+        generator.Update(&H_stage,&Eta_stage);
+        Operator k2 = ds * DexpInv( 0.5*k1, Eta_stage);
+
+        H_stage = H_last.BCH_Transform( 0.5*k2 );
+        generator.Update(&H_stage,&Eta_stage);
+        Operator k3 = ds * DexpInv( 0.5*k2, Eta_stage);
+
+        H_stage = H_last.BCH_Transform( k3 );
+        generator.Update(&H_stage,&Eta_stage);
+        Operator k4 = ds * DexpInv( k3, Eta_stage);
+
+        Operator theta = (1./6) * (k1 + 2*k2 + 2*k3 + k4);
+
+        // accumulated generator exp(Omega) = exp(theta) * exp(Omega_last)
+        Omega.back() = theta.BCH_Product( Omega_last );
+        if ((Omega.size()+n_omega_written)<2)
+        {
+          H_s = H_0->BCH_Transform( Omega.back() );
+        }
+        else
+        {
+          H_s = H_saved.BCH_Transform( Omega.back() );
+        }
+        generator.Update(&H_s,&Eta);
+
+        // with a fixed step size, there's no need for the error estimate and its extra commutators
+        if (not magnus_adaptive)
+        {
+          s += ds;
+          break;
+        }
+
+        // FSAL stage for the embedded 3rd-order solution
+        Operator k5 = ds * DexpInv( theta, Eta);
+        double err = (k4-k5).Norm()/6;
+        double tol = ode_e_abs + ode_e_rel * theta.Norm();
+        double factor = (err>0) ? safety * pow(tol/err, 0.25) : max_growth;
+        factor = min( max(factor,min_shrink), max_growth);
+
+        if (err <= tol)
+        {
+          s += ds;
+          ds = min(ds*factor, ds_max);
+          break;
+        }
+        cout << "  rkmk4: rejecting step ds = " << ds << "  error = " << err << " > " << tol << endl;
+        IMSRGProfiler::IncrementCounter("N_RejectedSteps");
+        Omega.back() = Omega_last;
+        H_s = H_last;
+        Eta = Eta_last;
+        ds *= factor;
+        if (ds < ds_min)
+        {
+          ios::fmtflags fmt = cout.flags();
+          cout << scientific << "IMSRGSolver: rkmk4 step size collapsed to ds = " << ds << " at s = " << s
+               << " with error " << err << " > " << tol << ". Stopping the flow." << endl;
+          cout.flags(fmt);
+          flow_failed = true;
+          break;
+        }
+      }
+      if (flow_failed) break;
+
+      // Write details of the flow
+      WriteFlowStatus();
 
    }
+   WriteFlowStatus(true); // make sure the last step gets written
 
 }
 
@@ -288,6 +664,7 @@ deque<Operator> operator/ (const deque<Operator>& num, const deque<Operator>& de
    {
      quotient[i].ZeroBody /= denom[i].ZeroBody;
      quotient[i].OneBody /= denom[i].OneBody;
+     quotient[i].TwoBody.ClearBlockStructure();
      for ( auto& itmat: quotient[i].TwoBody.MatEl )    itmat.second /= denom[i].TwoBody.GetMatrix(itmat.first[0],itmat.first[1]);
    }
    return quotient;
@@ -321,6 +698,7 @@ deque<Operator> operator+ (const double a, const deque<Operator>& X)
    {
      y.ZeroBody += a;
      y.OneBody += a;
+     y.TwoBody.ClearBlockStructure();
 //     for( auto& v : y.OneBody ) v += a;
      for ( auto& itmat: y.TwoBody.MatEl )
       itmat.second += a;
@@ -398,7 +776,7 @@ void IMSRGSolver::Solve_ode()
 
    ode_mode = "H";
    WriteFlowStatusHeader(cout);
-   WriteFlowStatus(flowfile);
+   WriteFlowStatus();
    using namespace boost::numeric::odeint;
 //   runge_kutta4< vector<Operator>, double, vector<Operator>, double, vector_space_algebra> stepper;
    runge_kutta4< deque<Operator>, double, deque<Operator>, double, vector_space_algebra> stepper;
@@ -414,7 +792,7 @@ void IMSRGSolver::Solve_ode_adaptive()
    ode_mode = "H";
    if (method == "restore_4th_order") ode_mode = "Restored";
    WriteFlowStatusHeader(cout);
-   WriteFlowStatus(flowfile);
+   WriteFlowStatus();
    cout << "done writing header and status" << endl;
    using namespace boost::numeric::odeint;
    auto system = *this;
@@ -511,8 +889,7 @@ void IMSRGSolver::operator()( const deque<Operator>& x, deque<Operator>& dxdt, c
      }
 
    }
-   WriteFlowStatus(flowfile);
-   WriteFlowStatus(cout);
+   WriteFlowStatus();
 }
 
 
@@ -520,8 +897,7 @@ void IMSRGSolver::operator()( const deque<Operator>& x, deque<Operator>& dxdt, c
 void IMSRGSolver::Solve_ode_magnus()
 {
    ode_mode = "Omega";
-   WriteFlowStatus(cout);
-   WriteFlowStatus(flowfile);
+   WriteFlowStatus();
    using namespace boost::numeric::odeint;
    namespace pl = std::placeholders;
 //   runge_kutta4<vector<Operator>, double, vector<Operator>, double, vector_space_algebra> stepper;
@@ -560,9 +936,9 @@ Operator IMSRGSolver::InverseTransform(Operator& OpIn)
 //    OpIn.ResetTensorTransformFirstPass();
 //  }
   Operator OpOut = OpIn;
-  for (auto omega=Omega.rbegin(); omega !=Omega.rend(); ++omega )
+  for (int i=Omega.size()-1; i>=0; --i )
   {
-    Operator negomega = -(*omega);
+    Operator negomega = -GetOmega(i);
     OpOut = OpOut.BCH_Transform( negomega );
   }
   return OpOut;
@@ -575,25 +951,15 @@ Operator IMSRGSolver::Transform_Partial(Operator& OpIn, int n)
 //  cout << "Begin Transform_Partial" << endl;
   Operator OpOut = OpIn;
   if ((rw != NULL) and rw->GetScratchDir() != "")
-  {
-    Operator omega(OpIn);
-    char tmp[512];
-    for (int i=n;i<n_omega_written;i++)
-    {
-     sprintf(tmp,"%s/OMEGA_%06d_%03d",rw->GetScratchDir().c_str(), getpid(), i);
-     string fname(tmp);
-     ifstream ifs(fname,ios::binary);
-     omega.ReadBinary(ifs);
-//     if (OpIn.GetJRank()>0) cout << "step " << i << endl;
-     OpOut = OpOut.BCH_Transform( omega );
-//     if (OpIn.GetJRank()>0)cout << "done" << endl;
-    }
-  }
+    TransformWithScratchOmegas(OpOut, n);
 
   for (size_t i=max(n-n_omega_written,0); i<Omega.size();++i)
   {
 //     if (OpIn.GetJRank()>0) cout << "step " << i << endl;
-    OpOut = OpOut.BCH_Transform( Omega[i] );
+    if (Omega[i].TwoBody.IsCompressed())
+      OpOut = OpOut.BCH_Transform( GetOmega(i) );
+    else
+      OpOut = OpOut.BCH_Transform( Omega[i] );
 //     if (OpIn.GetJRank()>0)cout << "done" << endl;
   }
 
@@ -606,24 +972,174 @@ Operator IMSRGSolver::Transform_Partial(Operator&& OpIn, int n)
 //  cout << "Calling r-value version of Transform_Partial, n = " << n << endl;
   Operator OpOut = OpIn;
   if ((rw != NULL) and rw->GetScratchDir() != "")
+    TransformWithScratchOmegas(OpOut, n);
+
+  for (size_t i=max(n-n_omega_written,0); i<Omega.size();++i)
+  {
+    if (Omega[i].TwoBody.IsCompressed())
+      OpOut = OpOut.BCH_Transform( GetOmega(i) );
+    else
+      OpOut = OpOut.BCH_Transform( Omega[i] );
+  }
+  return OpOut;
+}
+
+/// Apply the Omegas with index n and up which were written to the scratch directory.
+/// While one Omega is being applied, the next one is read on a background thread.
+/// If one can't be read, the std::runtime_error from GetScratchOmega() is rethrown here, on the calling thread.
+void IMSRGSolver::TransformWithScratchOmegas(Operator& OpOut, int n)
+{
+  WaitForOmegaWrite();
+  if (n >= n_omega_written) return;
+  auto fetch = [this](int i)
+  {
+    omp_set_num_threads(1);
+    return GetScratchOmega(i);
+  };
+  future<shared_ptr<Operator>> next = async(launch::async, fetch, n);
+  for (int i=n;i<n_omega_written;i++)
+  {
+    shared_ptr<Operator> omega = next.get();
+    if (i+1 < n_omega_written) next = async(launch::async, fetch, i+1);
+    OpOut = OpOut.BCH_Transform( *omega );
+  }
+}
+
+/// Write all the Omegas, including the ones which were moved to scratch, in the order they are applied,
+/// so that operators can be transformed later without redoing the flow. Returns the number written,
+/// or -1 if one of them couldn't be written.
+int IMSRGSolver::WriteOmegaSequence(string basename)
+{
+  WaitForOmegaWrite();
+  ReadWrite writer;
+  int n_omega = n_omega_written + Omega.size();
+  for (int i=0;i<n_omega;i++)
   {
-    Operator omega(OpIn);
-    char tmp[512];
-    for (int i=n;i<n_omega_written;i++)
+    string fname = OmegaSequenceFileName(basename,i);
+    if (i<n_omega_written)
+    {
+      try
+      {
+        writer.WriteOperatorBinary(*GetScratchOmega(i), fname, true);
+      }
+      catch (runtime_error& e)
+      {
+        cout << "ERROR in WriteOmegaSequence: " << e.what() << endl;
+        return -1;
+      }
+    }
+    else
+    {
+      Operator omega = GetOmega(i-n_omega_written);
+      writer.WriteOperatorBinary(omega, fname, true);
+    }
+    if (not writer.InGoodState())
     {
-     sprintf(tmp,"%s/OMEGA_%06d_%03d",rw->GetScratchDir().c_str(), getpid(), i);
-     string fname(tmp);
-     ifstream ifs(fname,ios::binary);
-     omega.ReadBinary(ifs);
-     OpOut = OpOut.BCH_Transform( omega );
+      cout << "ERROR in WriteOmegaSequence: failed to write " << fname << endl;
+      return -1;
     }
   }
+  return n_omega;
+}
 
-  for (size_t i=max(n-n_omega_written,0); i<Omega.size();++i)
+string IMSRGSolver::OmegaSequenceFileName(string basename, int i)
+{
+  char tmp[16];
+  sprintf(tmp,"_%03d.bin", i);
+  return basename + tmp;
+}
+
+string IMSRGSolver::ScratchOmegaFileName(int i)
+{
+  char tmp[512];
+  sprintf(tmp,"%s/OMEGA_%06d_%03d",rw->GetScratchDir().c_str(), getpid(), i);
+  return string(tmp);
+}
+
+/// Block until the Omega being written in the background (if any) is on disk.
+/// Returns false if the write failed. In that case the Omega is kept in memory instead.
+bool IMSRGSolver::WaitForOmegaWrite()
+{
+  bool ok = true;
+  if (omega_write_pending and omega_write_pending->valid()) ok = omega_write_pending->get();
+  omega_write_pending.reset();
+  if (not ok)
   {
-    OpOut = OpOut.BCH_Transform( Omega[i] );
+    cout << "ERROR in WaitForOmegaWrite: failed to write an Omega to " << rw->GetScratchDir()
+         << ". Keeping it in memory. " << GetNOmegaUnwritten() << " Omegas are in memory instead of on disk." << endl;
   }
-  return OpOut;
+  return ok;
+}
+
+int IMSRGSolver::GetNOmegaUnwritten()
+{
+  lock_guard<mutex> lock(*omega_cache_mutex);
+  return omega_unwritten->size();
+}
+
+/// Get scratch Omega number i, from memory if it's cached, otherwise from disk.
+/// This is thread-safe, so it can be called for prefetching. Throws std::runtime_error if the file can't be read.
+shared_ptr<Operator> IMSRGSolver::GetScratchOmega(int i)
+{
+  {
+    lock_guard<mutex> lock(*omega_cache_mutex);
+    auto it_unwritten = omega_unwritten->find(i);
+    if (it_unwritten != omega_unwritten->end()) return it_unwritten->second;
+    auto it = omega_cache->find(i);
+    if (it != omega_cache->end())
+    {
+      omega_cache_lru->remove(i);
+      omega_cache_lru->push_front(i);
+      return it->second;
+    }
+  }
+  auto omega = make_shared<Operator>(*modelspace);
+  string fname = ScratchOmegaFileName(i);
+  ReadWrite reader;
+  if (not reader.ReadOperatorBinary(*omega, fname))
+  {
+    // Carrying on with a half-read Omega would silently give a wrong transformation.
+    // This may run on a prefetch thread, so the error is thrown and resurfaces in future::get() on the caller.
+    throw runtime_error("GetScratchOmega: failed to read " + fname);
+  }
+  CacheScratchOmega(i, omega);
+  return omega;
+}
+
+/// Forget scratch Omega number i, and delete its file if it was written.
+void IMSRGSolver::DropScratchOmega(int i)
+{
+  {
+    lock_guard<mutex> lock(*omega_cache_mutex);
+    omega_cache->erase(i);
+    omega_cache_lru->remove(i);
+    if (omega_unwritten->erase(i) > 0) return;
+  }
+  string fname = ScratchOmegaFileName(i);
+  if ( remove(fname.c_str()) !=0 )
+  {
+    cout << "Error when attempting to delete " << fname << endl;
+  }
+}
+
+/// Keep Omega number i in memory, if it fits in the budget, dropping the least recently used ones to make room.
+void IMSRGSolver::CacheScratchOmega(int i, shared_ptr<Operator> omega)
+{
+  size_t omega_size = omega->Size();
+  if (omega_size > scratch_cache_bytes) return;
+  lock_guard<mutex> lock(*omega_cache_mutex);
+  size_t cached_size = 0;
+  for (auto& it : *omega_cache) cached_size += it.second->Size();
+  while (cached_size + omega_size > scratch_cache_bytes and not omega_cache_lru->empty())
+  {
+    int iold = omega_cache_lru->back();
+    cached_size -= (*omega_cache)[iold]->Size();
+    omega_cache->erase(iold);
+    omega_cache_lru->pop_back();
+  }
+  (*omega_cache)[i] = omega;
+  omega_cache_lru->remove(i);
+  omega_cache_lru->push_front(i);
 }
 
 // count number of equations to be solved
@@ -642,17 +1158,9 @@ int IMSRGSolver::GetSystemDimension()
 void IMSRGSolver::CleanupScratch()
 {
   if (n_omega_written<=0) return;
+  WaitForOmegaWrite();
   cout << "Cleaning up files written to scratch space" << endl;
-  char tmp[512];
-  for (int i=0;i<n_omega_written;i++)
-  {
-    sprintf(tmp,"%s/OMEGA_%06d_%03d",rw->GetScratchDir().c_str(), getpid(), i);
-    string fname(tmp);
-    if ( remove(tmp) !=0 )
-    {
-      cout << "Error when attempting to delete " << fname << endl;
-    }
-  }
+  for (int i=0;i<n_omega_written;i++) DropScratchOmega(i);
 }
 
 
@@ -661,39 +1169,173 @@ void IMSRGSolver::WriteFlowStatus(string fname)
 {
    if (fname !="")
    {
-     ofstream ff(fname,ios::app);
-     WriteFlowStatus(ff);
+     bool csv = fname.size()>4 and fname.substr(fname.size()-4)==".csv";
+     if (fname == flowfile and flowfile_stream)
+     {
+       WriteFlowStatusLine(*flowfile_stream, GetFlowStatus(), csv);
+     }
+     else
+     {
+       ofstream ff(fname,ios::app);
+       WriteFlowStatusLine(ff, GetFlowStatus(), csv);
+     }
    }
 }
 void IMSRGSolver::WriteFlowStatus(ostream& f)
 {
-   if ( f.good() )
+   WriteFlowStatusLine(f, GetFlowStatus());
+}
+
+/// Evaluate the diagnostics for the current step once and write them to cout and the flow file.
+/// Only every flowstatus_interval-th call actually writes something, unless force is true and
+/// the current s hasn't been written yet.
+/// With flowstatus_async, the cheap quantities are taken right away, while the norm, trace and MP2 energy
+/// are evaluated from a copy of H(s) on a background thread. That line is written once the next one is
+/// requested (or in FlushFlowStatus), so the output lags by one line.
+void IMSRGSolver::WriteFlowStatus(bool force)
+{
+   if (force)
    {
-      int fwidth = 16;
-      int fprecision = 9;
-      auto& H_s = FlowingOps[0];
-      f.setf(ios::fixed);
-      f << fixed << setw(5) << istep
-        << setw(10) << setprecision(3) << s
-        << setw(fwidth) << setprecision(fprecision) << H_s.ZeroBody 
-        << setw(fwidth) << setprecision(fprecision) << H_s.Norm()
-        << setw(fwidth) << setprecision(fprecision) << H_s.Trace( modelspace->GetAref(), modelspace->GetZref() )
-//        << setw(fwidth) << setprecision(fprecision) << H_s.OneBodyNorm()
-//        << setw(fwidth) << setprecision(fprecision) << H_s.TwoBodyNorm()
-//        << setw(fwidth) << setprecision(fprecision) << Omega.Norm()
-        << setw(fwidth) << setprecision(fprecision) << Omega.back().OneBodyNorm()
-        << setw(fwidth) << setprecision(fprecision) << Omega.back().TwoBodyNorm()
-        << setw(fwidth) << setprecision(fprecision) << Eta.OneBodyNorm()
-        << setw(fwidth) << setprecision(fprecision) << Eta.TwoBodyNorm()
-        << setw(7)      << setprecision(0)          << profiler.counter["N_ScalarCommutators"] + profiler.counter["N_TensorCommutators"]
-        << setw(fwidth) << setprecision(fprecision) << H_s.GetMP2_Energy()
-        << setw(7)      << setprecision(0)          << profiler.counter["N_Operators"]
-        << setprecision(fprecision)
-        << setw(12) << setprecision(3) << profiler.GetTimes()["real"]
-        << setw(12) << setprecision(3) << profiler.CheckMem()["RSS"]/1024. << " / " << skipws << profiler.MaxMemUsage()/1024. << fixed
-        << endl;
+     if (s == flowstatus_last_s) return;
    }
+   else if ( (flowstatus_count++ % flowstatus_interval) != 0 ) return;
+   flowstatus_last_s = s;
 
+   if ( not flowstatus_async )
+   {
+     ReportFlowStatus( GetFlowStatus() );
+     return;
+   }
+
+   // Only keep one snapshot around, and keep the lines in order.
+   FlushFlowStatus();
+   FlowStatus status = GetFlowStatus(true);
+   auto H_snapshot = make_shared<Operator>(FlowingOps[0]);
+   auto skip = flowstatus_skip;
+   int Aref = modelspace->GetAref();
+   int Zref = modelspace->GetZref();
+   auto evaluate = [status,H_snapshot,skip,Aref,Zref]() mutable
+   {
+     omp_set_num_threads(1); // don't compete with the flow for cores
+     if (skip.count("norm")<1)  status.norm_H = H_snapshot->Norm();
+     if (skip.count("trace")<1) status.trace_H = H_snapshot->Trace(Aref,Zref);
+     if (skip.count("mp2")<1)   status.Emp2 = H_snapshot->GetMP2_Energy();
+     return status;
+   };
+   flowstatus_pending = make_shared<future<FlowStatus>>( async(launch::async, evaluate) );
+}
+
+/// Wait for the line being evaluated in the background (if there is one), write it, and flush the flow file.
+void IMSRGSolver::FlushFlowStatus()
+{
+   if (flowstatus_pending and flowstatus_pending->valid())
+   {
+     ReportFlowStatus( flowstatus_pending->get() );
+   }
+   flowstatus_pending.reset();
+   if (flowfile_stream) flowfile_stream->flush();
+}
+
+/// Write a finished flow status line to cout and the flow file, keep it for GetLastFlowStatus()
+/// and pass it to the callback, if one is set.
+void IMSRGSolver::ReportFlowStatus(const FlowStatus& status)
+{
+   WriteFlowStatusLine(cout, status);
+   if (flowfile_stream) WriteFlowStatusLine(*flowfile_stream, status, FlowFileIsCSV());
+   {
+     lock_guard<mutex> lock(*flowstatus_mutex);
+     *flowstatus_last = status;
+   }
+   if (flowstatus_callback and *flowstatus_callback) (*flowstatus_callback)(status);
+}
+
+/// The most recent flow status line. This can be polled from another thread while Solve() is running.
+IMSRGSolver::FlowStatus IMSRGSolver::GetLastFlowStatus()
+{
+   lock_guard<mutex> lock(*flowstatus_mutex);
+   return *flowstatus_last;
+}
+
+/// Evaluate the quantities written to the flow file. Quantities in flowstatus_skip are set to NaN.
+/// If defer_expensive is true, the norm, trace and MP2 energy are also left as NaN.
+IMSRGSolver::FlowStatus IMSRGSolver::GetFlowStatus(bool defer_expensive)
+{
+   auto& H_s = FlowingOps[0];
+   double nan = numeric_limits<double>::quiet_NaN();
+   bool skip_norm = defer_expensive or flowstatus_skip.count("norm")>0;
+   bool skip_trace = defer_expensive or flowstatus_skip.count("trace")>0;
+   bool skip_mp2 = defer_expensive or flowstatus_skip.count("mp2")>0;
+   bool skip_mem = flowstatus_skip.count("memory")>0;
+   FlowStatus status;
+   status.istep = istep;
+   status.s = s;
+   status.E0 = H_s.ZeroBody;
+   status.norm_H = skip_norm ? nan : H_s.Norm();
+   status.trace_H = skip_trace ? nan : H_s.Trace( modelspace->GetAref(), modelspace->GetZref() );
+   status.norm_omega1 = Omega.back().OneBodyNorm();
+   status.norm_omega2 = Omega.back().TwoBodyNorm();
+   status.norm_eta1 = Eta.OneBodyNorm();
+   status.norm_eta2 = Eta.TwoBodyNorm();
+   status.ncomm = profiler.GetCounter("N_ScalarCommutators") + profiler.GetCounter("N_TensorCommutators");
+   status.Emp2 = skip_mp2 ? nan : H_s.GetMP2_Energy();
+   status.n_ops = profiler.GetCounter("N_Operators");
+   status.walltime = profiler.GetTimes()["real"];
+   status.rss = skip_mem ? nan : profiler.CheckMem()["RSS"]/1024.;
+   status.max_rss = skip_mem ? nan : profiler.MaxMemUsage()/1024.;
+   return status;
+}
+
+void IMSRGSolver::WriteFlowStatusLine(ostream& f, const FlowStatus& status, bool csv)
+{
+   if ( not f.good() ) return;
+   if (csv)
+   {
+      // NaN means it wasn't evaluated, so leave the field empty
+      auto field = [&f](double x){ if (not std::isnan(x)) f << x; };
+      f << status.istep << "," << setprecision(6) << status.s << "," << setprecision(10);
+      field(status.E0); f << ",";
+      field(status.norm_H); f << ",";
+      field(status.trace_H); f << ",";
+      field(status.norm_omega1); f << ",";
+      field(status.norm_omega2); f << ",";
+      field(status.norm_eta1); f << ",";
+      field(status.norm_eta2); f << ",";
+      f << status.ncomm << ",";
+      field(status.Emp2); f << ",";
+      f << status.n_ops << "," << setprecision(6) << status.walltime << ",";
+      field(status.rss); f << ",";
+      field(status.max_rss);
+      f << "\n";
+      return;
+   }
+   int fwidth = 16;
+   int fprecision = 9;
+   auto field = [&f,fwidth,fprecision](double x)
+   {
+     if (std::isnan(x)) f << setw(fwidth) << "-";
+     else f << setw(fwidth) << setprecision(fprecision) << x;
+   };
+   f.setf(ios::fixed);
+   f << fixed << setw(5) << status.istep
+     << setw(10) << setprecision(3) << status.s;
+   field(status.E0);
+   field(status.norm_H);
+   field(status.trace_H);
+   field(status.norm_omega1);
+   field(status.norm_omega2);
+   field(status.norm_eta1);
+   field(status.norm_eta2);
+   f << setw(7) << setprecision(0) << status.ncomm;
+   field(status.Emp2);
+   f << setw(7) << setprecision(0) << status.n_ops
+     << setw(12) << setprecision(3) << status.walltime;
+   if (std::isnan(status.rss))
+     f << setw(12) << "-" << " / " << "-";
+   else
+     f << setw(12) << setprecision(3) << status.rss << " / " << status.max_rss;
+   // only flush the terminal, the flow file gets flushed in FlushFlowStatus
+   if (&f == &cout) f << endl;
+   else f << "\n";
 }
 
 void IMSRGSolver::WriteFlowStatusHeader(string fname)
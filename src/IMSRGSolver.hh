@@ -23,6 +23,14 @@
 #include <fstream>
 #include <string>
 #include <deque>
+#include <set>
+#include <map>
+#include <list>
+#include <memory>
+#include <future>
+#include <functional>
+#include <atomic>
+#include <mutex>
 #include "Operator.hh"
 #include "Generator.hh"
 #include "IMSRGProfiler.hh"
@@ -43,6 +51,9 @@ class IMSRGSolver
   deque<Operator> FlowingOps;
   Operator H_saved;
   Operator Eta;
+  /// The Omegas kept in memory, applied in order. With omega_compression_tol>0, all but the last one may have
+  /// their two-body part stored as factors, with the blocks of TwoBody.MatEl empty (see CompressOmega()).
+  /// So use GetOmega(i) rather than reading Omega[i] directly. The last one is never compressed.
   deque<Operator> Omega;
   Generator generator;
   int istep;
@@ -59,6 +70,70 @@ class IMSRGSolver
   int n_omega_written;
   int max_omega_written;
   bool magnus_adaptive;
+  bool flow_failed; ///< set by Solve() if the flow was abandoned before reaching smax, e.g. because the step size collapsed
+  bool euler_step_control; ///< choose ds in magnus_euler from an embedded error estimate on the energy, see Solve_magnus_euler()
+  int H_resync_interval; ///< if >0, magnus_euler updates H_s with just the step, and recomputes it from the start of the Omega every this many steps
+  bool H_s_incremental; ///< H_s has been updated incrementally since it was last recomputed
+  double omega_compression_tol; ///< if >0, finished Omegas kept in memory are stored as truncated SVDs, see CompressOmega()
+  // Omegas in the scratch directory are written behind the flow on a background thread, and Transform_Partial
+  // reads the next one while the current one is applied. As many as fit in scratch_cache_bytes are also kept in memory.
+  size_t scratch_cache_bytes;
+  shared_ptr<future<bool>> omega_write_pending; ///< true if the write succeeded
+  shared_ptr<map<int,shared_ptr<Operator>>> omega_cache;
+  shared_ptr<list<int>> omega_cache_lru; ///< indices in omega_cache, most recently used first
+  shared_ptr<mutex> omega_cache_mutex;
+  shared_ptr<map<int,shared_ptr<Operator>>> omega_unwritten; ///< scratch Omegas whose write failed. These are never evicted.
+
+  /// Everything that goes into one line of the flow file. It is evaluated once per step
+  /// and then written to the flow file and to cout.
+  struct FlowStatus
+  {
+    int istep;
+    double s;
+    double E0;
+    double norm_H;
+    double trace_H;
+    double norm_omega1;
+    double norm_omega2;
+    double norm_eta1;
+    double norm_eta2;
+    long long ncomm;
+    double Emp2;
+    long long n_ops;
+    double walltime;
+    double rss;
+    double max_rss;
+  };
+  /// The state of the flow at some point, so that several flows can branch off from it,
+  /// e.g. decouplings of several valence spaces which share the same core decoupling.
+  /// Omegas which were written to scratch stay on disk and are shared by the branches.
+  /// A copy of the starting Hamiltonian is kept, since a branch may call SetHin().
+  struct Checkpoint
+  {
+    double s;
+    double ds;
+    int istep;
+    int n_omega_written;
+    ModelSpace* modelspace;
+    Generator generator;
+    Operator H_0;
+    deque<Operator> Omega;
+    deque<Operator> FlowingOps;
+    Operator H_saved;
+  };
+  int flowstatus_interval; ///< only write the flow status every this many steps
+  bool flowstatus_async; ///< evaluate the expensive diagnostics on a background thread
+  set<string> flowstatus_skip; ///< diagnostics that shouldn't be evaluated. Can contain norm, trace, mp2, memory
+  int flowstatus_count;
+  double flowstatus_last_s;
+  // These are shared_ptrs so that the solver can still be copied (the odeint code does that).
+  shared_ptr<ofstream> flowfile_stream;
+  shared_ptr<future<FlowStatus>> flowstatus_pending;
+  // For driving the solver from another thread, e.g. from python.
+  shared_ptr<function<void(const FlowStatus&)>> flowstatus_callback; ///< called with every flow status line, on the solver's thread
+  shared_ptr<atomic<bool>> stop_requested; ///< checked once per step by the magnus solvers
+  shared_ptr<mutex> flowstatus_mutex;
+  shared_ptr<FlowStatus> flowstatus_last;
 
 
 
@@ -75,17 +150,34 @@ class IMSRGSolver
   void SetMethod(string m){method=m;};
   void Solve();
   void Solve_magnus_euler();
+  double EnergySlope();
   void Solve_magnus_modified_euler();
+  void Solve_magnus_rkmk4();
+  Operator DexpInv( const Operator& theta, const Operator& eta);
 
   Operator Transform(Operator& OpIn);
   Operator Transform(Operator&& OpIn);
   Operator InverseTransform(Operator& OpIn);
-  Operator GetOmega(int i){return Omega[i];};
+  Operator GetOmega(int i);
+  void CompressOmega(Operator& omega);
   void SetOmega(size_t i, Operator& om);
+  void SetInitialOmega(Operator& om);
+  Checkpoint GetCheckpoint();
+  void RestoreCheckpoint(Checkpoint& cp);
   size_t GetOmegaSize(){return Omega.size();};
   int GetNOmegaWritten(){return n_omega_written;};
   Operator Transform_Partial(Operator& OpIn, int n);
   Operator Transform_Partial(Operator&& OpIn, int n);
+  void SetScratchCacheSize(double MB){scratch_cache_bytes = (size_t)(MB*1024*1024);};
+  string ScratchOmegaFileName(int i);
+  bool WaitForOmegaWrite();
+  int GetNOmegaUnwritten();
+  shared_ptr<Operator> GetScratchOmega(int i);
+  void DropScratchOmega(int i);
+  void CacheScratchOmega(int i, shared_ptr<Operator> omega);
+  void TransformWithScratchOmegas(Operator& OpOut, int n);
+  int WriteOmegaSequence(string basename);
+  static string OmegaSequenceFileName(string basename, int i);
 
   void SetFlowFile(string s);
   void SetDs(double d){ds = d;};
@@ -97,6 +189,9 @@ class IMSRGSolver
   void SetODETolerance(float x){ode_e_abs=x;ode_e_rel=x;};
   void SetEtaCriterion(float x){eta_criterion = x;};
   void SetMagnusAdaptive(bool b){magnus_adaptive = b;};
+  void SetEulerStepControl(bool b){euler_step_control = b;};
+  void SetHResyncInterval(int n){H_resync_interval = n;};
+  void SetOmegaCompressionTol(double x){omega_compression_tol = x;};
 
   int GetSystemDimension();
   Operator& GetH_s(){return FlowingOps[0];};
@@ -105,11 +200,26 @@ class IMSRGSolver
 
   void UpdateOmega();
   void UpdateH();
+  void UpdateH(const Operator& dOmega);
 
   void WriteFlowStatus(ostream&);
   void WriteFlowStatusHeader(ostream&);
   void WriteFlowStatus(string);
   void WriteFlowStatusHeader(string);
+  void WriteFlowStatus(bool force=false);
+  void FlushFlowStatus();
+  FlowStatus GetFlowStatus(bool defer_expensive=false);
+  void WriteFlowStatusLine(ostream&, const FlowStatus&, bool csv=false);
+  bool FlowFileIsCSV(){return flowfile.size()>4 and flowfile.substr(flowfile.size()-4)==".csv";};
+  void SetFlowStatusInterval(int n){flowstatus_interval = max(n,1);};
+  void SetFlowStatusAsync(bool tf){flowstatus_async = tf;};
+  void SetFlowStatusSkip(vector<string> quantities){flowstatus_skip = set<string>(quantities.begin(),quantities.end());};
+  void SetFlowStatusCallback(function<void(const FlowStatus&)> f){flowstatus_callback = make_shared<function<void(const FlowStatus&)>>(f);};
+  void ReportFlowStatus(const FlowStatus&);
+  FlowStatus GetLastFlowStatus();
+  void RequestStop(){*stop_requested = true;};
+  bool StopRequested() const {return *stop_requested;};
+  bool FlowFailed() const {return flow_failed;};
 
   void SetDenominatorCutoff(double c){generator.SetDenominatorCutoff(c);};
   void SetDenominatorDelta(double d){generator.SetDenominatorDelta(d);};
@@ -7,6 +7,7 @@
 #include <string>
 #include <cmath>
 #include <sstream>
+#include <algorithm>
 #include "omp.h"
 #include <cstdlib> // for EXIT_FAILURE
 //#include <inttypes.h> // for PRIx64  // This made some compilers angry
@@ -229,9 +230,14 @@ bool TwoBodyChannel_CC::CheckChannel_ket(Orbit* op, Orbit* oq) const
 
 // Static members
 
+std::shared_ptr<const std::unordered_map<uint64_t,double>> ModelSpace::SixJTable;
+std::shared_ptr<const std::unordered_map<uint64_t,double>> ModelSpace::MoshTable;
 std::unordered_map<uint64_t,double> ModelSpace::SixJList;
 std::unordered_map<uint64_t,double> ModelSpace::NineJList;
 std::unordered_map<uint64_t,double> ModelSpace::MoshList;
+std::mutex ModelSpace::AngMomCacheMutex;
+std::map<std::array<int,2>,TensorNineJTable> ModelSpace::TensorNineJTables;
+std::mutex ModelSpace::TensorNineJTablesMutex;
 std::map< std::string, std::vector<std::string> > ModelSpace::ValenceSpaces  {
 { "s-shell"  ,         {"vacuum", "p0s1","n0s1"}},
 { "p-shell"  ,         {"He4", "p0p3","n0p3","p0p1","n0p1"}},
@@ -264,7 +270,7 @@ ModelSpace::~ModelSpace()
 ModelSpace::ModelSpace()
 :  Emax(0), E2max(0), E3max(0), Lmax2(0), Lmax3(0), OneBodyJmax(0), TwoBodyJmax(0), ThreeBodyJmax(0), norbits(0),
   hbar_omega(20), target_mass(16),sixj_has_been_precalculated(false), moshinsky_has_been_precalculated(false),
-  scalar_transform_first_pass(true), tensor_transform_first_pass(40,true)
+  scalar_transform_first_pass(true), tensor_transform_first_pass(40,true), cache_mutex(std::make_shared<std::mutex>())
 {
   std::cout << "In default constructor" << std::endl;
 }
@@ -295,9 +301,12 @@ ModelSpace::ModelSpace(const ModelSpace& ms)
    Orbits(ms.Orbits), Kets(ms.Kets),
    TwoBodyChannels(ms.TwoBodyChannels), TwoBodyChannels_CC(ms.TwoBodyChannels_CC),
    PandyaLookup(ms.PandyaLookup),
-   sixj_has_been_precalculated(ms.sixj_has_been_precalculated),
-   moshinsky_has_been_precalculated(ms.moshinsky_has_been_precalculated),
-   scalar_transform_first_pass(true), tensor_transform_first_pass(40,true)
+   TensorPandyaChannelPairs(ms.TensorPandyaChannelPairs), TensorPandyaPairIndex(ms.TensorPandyaPairIndex),
+   LabToRelCMTransform(ms.LabToRelCMTransform), RelCMBasis(ms.RelCMBasis),
+   sixj_has_been_precalculated(ms.sixj_has_been_precalculated.load()),
+   moshinsky_has_been_precalculated(ms.moshinsky_has_been_precalculated.load()),
+   scalar_transform_first_pass(true), tensor_transform_first_pass(40,true), cache_mutex(std::make_shared<std::mutex>()),
+   sixj_table(ms.sixj_table), mosh_table(ms.mosh_table)
 {
    for (TwoBodyChannel& tbc : TwoBodyChannels)   tbc.modelspace = this;
    for (TwoBodyChannel_CC& tbc_cc : TwoBodyChannels_CC)   tbc_cc.modelspace = this;
@@ -329,9 +338,12 @@ ModelSpace::ModelSpace(ModelSpace&& ms)
    Orbits(std::move(ms.Orbits)), Kets(std::move(ms.Kets)),
    TwoBodyChannels(std::move(ms.TwoBodyChannels)), TwoBodyChannels_CC(std::move(ms.TwoBodyChannels_CC)),
    PandyaLookup(ms.PandyaLookup),
-   sixj_has_been_precalculated(ms.sixj_has_been_precalculated),
-   moshinsky_has_been_precalculated(ms.moshinsky_has_been_precalculated),
-   scalar_transform_first_pass(true), tensor_transform_first_pass(40,true)
+   TensorPandyaChannelPairs(ms.TensorPandyaChannelPairs), TensorPandyaPairIndex(ms.TensorPandyaPairIndex),
+   LabToRelCMTransform(ms.LabToRelCMTransform), RelCMBasis(ms.RelCMBasis),
+   sixj_has_been_precalculated(ms.sixj_has_been_precalculated.load()),
+   moshinsky_has_been_precalculated(ms.moshinsky_has_been_precalculated.load()),
+   scalar_transform_first_pass(true), tensor_transform_first_pass(40,true), cache_mutex(std::make_shared<std::mutex>()),
+   sixj_table(ms.sixj_table), mosh_table(ms.mosh_table)
 {
    for (TwoBodyChannel& tbc : TwoBodyChannels)   tbc.modelspace = this;
    for (TwoBodyChannel_CC& tbc_cc : TwoBodyChannels_CC)   tbc_cc.modelspace = this;
@@ -344,7 +356,7 @@ ModelSpace::ModelSpace(ModelSpace&& ms)
 // Assumes that the core is hole states that aren't in the valence space.
 ModelSpace::ModelSpace(int emax, std::vector<std::string> hole_list, std::vector<std::string> valence_list)
 :  Emax(emax), E2max(2*emax), E3max(3*emax), Lmax2(emax), Lmax3(emax), OneBodyJmax(0), TwoBodyJmax(0), ThreeBodyJmax(0), norbits(0), hbar_omega(20), target_mass(16),
-     moshinsky_has_been_precalculated(false), scalar_transform_first_pass(true), tensor_transform_first_pass(40,true)
+     sixj_has_been_precalculated(false), moshinsky_has_been_precalculated(false), scalar_transform_first_pass(true), tensor_transform_first_pass(40,true), cache_mutex(std::make_shared<std::mutex>())
 {
    Init(emax, hole_list, hole_list, valence_list); 
 }
@@ -352,7 +364,7 @@ ModelSpace::ModelSpace(int emax, std::vector<std::string> hole_list, std::vector
 // If we don't want the reference to be the core
 ModelSpace::ModelSpace(int emax, std::vector<std::string> hole_list, std::vector<std::string> core_list, std::vector<std::string> valence_list)
 : Emax(emax), E2max(2*emax), E3max(3*emax), Lmax2(emax), Lmax3(emax), OneBodyJmax(0), TwoBodyJmax(0), ThreeBodyJmax(0), norbits(0), hbar_omega(20), target_mass(16),
-     sixj_has_been_precalculated(false),moshinsky_has_been_precalculated(false), scalar_transform_first_pass(true), tensor_transform_first_pass(40,true)
+     sixj_has_been_precalculated(false),moshinsky_has_been_precalculated(false), scalar_transform_first_pass(true), tensor_transform_first_pass(40,true), cache_mutex(std::make_shared<std::mutex>())
 {
    Init(emax, hole_list, core_list, valence_list); 
 }
@@ -360,14 +372,14 @@ ModelSpace::ModelSpace(int emax, std::vector<std::string> hole_list, std::vector
 // Most conventient interface
 ModelSpace::ModelSpace(int emax, std::string reference, std::string valence)
 : Emax(emax), E2max(2*emax), E3max(3*emax), Lmax2(emax), Lmax3(emax), OneBodyJmax(0), TwoBodyJmax(0), ThreeBodyJmax(0),hbar_omega(20),
-     sixj_has_been_precalculated(false),moshinsky_has_been_precalculated(false), scalar_transform_first_pass(true), tensor_transform_first_pass(40,true)
+     sixj_has_been_precalculated(false),moshinsky_has_been_precalculated(false), scalar_transform_first_pass(true), tensor_transform_first_pass(40,true), cache_mutex(std::make_shared<std::mutex>())
 {
   Init(emax,reference,valence);
 }
 
 ModelSpace::ModelSpace(int emax, std::string valence)
 : Emax(emax), E2max(2*emax), E3max(3*emax), Lmax2(emax), Lmax3(emax), OneBodyJmax(0), TwoBodyJmax(0), ThreeBodyJmax(0),hbar_omega(20),
-     sixj_has_been_precalculated(false),moshinsky_has_been_precalculated(false), scalar_transform_first_pass(true), tensor_transform_first_pass(40,true)
+     sixj_has_been_precalculated(false),moshinsky_has_been_precalculated(false), scalar_transform_first_pass(true), tensor_transform_first_pass(40,true), cache_mutex(std::make_shared<std::mutex>())
 {
   auto itval = ValenceSpaces.find(valence);
   if ( itval != ValenceSpaces.end() ) // we've got a valence space
@@ -769,6 +781,8 @@ ModelSpace ModelSpace::operator=(const ModelSpace& ms)
    Kets = ms.Kets;
    TwoBodyChannels = ms.TwoBodyChannels;
    TwoBodyChannels_CC = ms.TwoBodyChannels_CC;
+   LabToRelCMTransform = ms.LabToRelCMTransform;
+   RelCMBasis = ms.RelCMBasis;
    for (TwoBodyChannel& tbc : TwoBodyChannels)   tbc.modelspace = this;
    for (TwoBodyChannel_CC& tbc_cc : TwoBodyChannels_CC)   tbc_cc.modelspace = this;
 
@@ -819,6 +833,8 @@ ModelSpace ModelSpace::operator=(ModelSpace&& ms)
    Kets = std::move(ms.Kets);
    TwoBodyChannels = std::move(ms.TwoBodyChannels);
    TwoBodyChannels_CC = std::move(ms.TwoBodyChannels_CC);
+   LabToRelCMTransform = std::move(ms.LabToRelCMTransform);
+   RelCMBasis = std::move(ms.RelCMBasis);
    for (TwoBodyChannel& tbc : TwoBodyChannels)   tbc.modelspace = this;
    for (TwoBodyChannel_CC& tbc_cc : TwoBodyChannels_CC)   tbc_cc.modelspace = this;
    for (TwoBodyChannel& tbc : ms.TwoBodyChannels)   tbc.modelspace = NULL;
@@ -987,6 +1003,11 @@ void ModelSpace::ClearVectors()
    SortedTwoBodyChannels.clear();
    SortedTwoBodyChannels_CC.clear();
    PandyaLookup.clear();
+   TensorPandyaChannelPairs.clear();
+   TensorPandyaPairIndex.clear();
+   MirrorBases.clear();
+   LabToRelCMTransform.clear();
+   RelCMBasis.clear();
 }
 
 
@@ -1021,6 +1042,23 @@ void ModelSpace::SixJUnHash(uint64_t key, uint64_t& j1, uint64_t& j2, uint64_t&
    J3 = (key      ) & 0x3FFL;
 }
 
+/// FNV-1a hash of the quantum numbers of the orbits, in index order.
+/// Two model spaces with the same hash label their one- and two-body
+/// matrix elements identically, so operators can be exchanged between them.
+uint64_t ModelSpace::GetOrbitListHash()
+{
+   uint64_t hash = 14695981039346656037ULL;
+   for (auto& orb : Orbits)
+   {
+     for (int x : {orb.n, orb.l, orb.j2, orb.tz2})
+     {
+       hash ^= (uint64_t)(x + 128);
+       hash *= 1099511628211ULL;
+     }
+   }
+   return hash;
+}
+
 uint64_t ModelSpace::MoshinskyHash(uint64_t N, uint64_t Lam, uint64_t n, uint64_t lam, uint64_t n1, uint64_t l1, uint64_t n2, uint64_t l2, uint64_t L)
 {
    return   (N   << 54)
@@ -1053,37 +1091,20 @@ double ModelSpace::GetSixJ(double j1, double j2, double j3, double J1, double J2
 // { J1 J2 J3 }
    uint64_t key = SixJHash(j1,j2,j3,J1,J2,J3);
 
-   const auto it = SixJList.find(key);
-   double sixj=0.0;
-   if (it != SixJList.end() )
+   // The precalculated table is never modified, so it can be read without locking.
+   if (sixj_has_been_precalculated)
    {
-     sixj = it->second;
-   }
-   else
-   {
-    sixj = AngMom::SixJ(j1,j2,j3,J1,J2,J3);
-    if (omp_get_num_threads()<2)
-    {
-      #pragma omp critical
-      {
-        SixJList[key] = sixj;
-      }
-    }
-    else
-    {
-//      printf("DANGER!!!!!!!  Updating SixJList inside a parellel loop breaks thread safety!\n");
-//      printf(" I shouldn't be here in GetSixJ(%.1f %.1f %.1f %.1f %.1f %.1f).  key =%" PRIx64 "   sixj=%f\n",j1,j2,j3,J1,J2,J3,key,sixj); //PRIx64 is portable uint64_t format
-      std::cout << "DANGER!!!!!!!  Updating SixJList inside a parellel loop breaks thread safety!" << std::endl;
-      std::cout << "  I shouldn't be here in GetSixJ("
-                << std::setprecision(1) << std::fixed << j1 << " " << std::setprecision(1) << std::fixed << j2 << " "
-                << std::setprecision(1) << std::fixed << j3 << " " << std::setprecision(1) << std::fixed << J1 << " "
-                << std::setprecision(1) << std::fixed << J2 << " " << std::setprecision(1) << std::fixed << J3 << "). key = "
-                << std::hex << key << "   sixj = " << std::dec << sixj << std::endl;
-      profiler.counter["N_CalcSixJ_in_Parallel_loop"] +=1;
-//      quick_exit(EXIT_FAILURE);
-      exit(EXIT_FAILURE);
-    }
+     const auto it = sixj_table->find(key);
+     if (it != sixj_table->end()) return it->second;
    }
+
+   std::lock_guard<std::mutex> lock(AngMomCacheMutex);
+   const auto it = SixJList.find(key);
+   if (it != SixJList.end()) return it->second;
+   // This is safe, but everyone waits on the lock, so these should have been precalculated.
+   if (omp_get_num_threads()>1) IMSRGProfiler::IncrementCounter("N_CalcSixJ_in_Parallel_loop");
+   double sixj = AngMom::SixJ(j1,j2,j3,J1,J2,J3);
+   SixJList[key] = sixj;
    return sixj;
 }
 
@@ -1104,12 +1125,18 @@ double ModelSpace::GetSixJ(double j1, double j2, double j3, double J1, double J2
 /// since the 3N recoupling requires it to go up to e(emax+1/2).
 /// I haven't yet bothered using the symmetry properties of the
 /// 6j symbol.
+/// The table is shared with the other model spaces. If it is missing some of these,
+/// an extended copy replaces it, so that a model space using the old one isn't disturbed.
 ///
 void ModelSpace::PreCalculateSixJ()
 {
+  if (sixj_has_been_precalculated) return;
+  std::lock_guard<std::mutex> lock(AngMomCacheMutex);
   if (sixj_has_been_precalculated) return;
   std::cout << "Precalculating SixJ's" << std::endl;
-  double t_start = omp_get_wtime();
+  IMSRGProfiler::ScopedTimer st("PreCalculateSixJ");
+  std::unordered_map<uint64_t,double> empty_table;
+  const std::unordered_map<uint64_t,double>& old_table = SixJTable ? *SixJTable : empty_table;
   std::vector<uint64_t> KEYS;
   for (int j2a=1; j2a<=(2*Emax+1); j2a+=2)
   {
@@ -1130,11 +1157,7 @@ void ModelSpace::PreCalculateSixJ()
        for (int J2=J2_min; J2<=J2_max; J2+=2)
        {
          uint64_t key = SixJHash(0.5*j2a,0.5*j2b,0.5*J1,0.5*j2c,0.5*j2d,0.5*J2);
-         if ( SixJList.count(key) == 0 ) 
-         {
-           KEYS.push_back(key);
-           SixJList[key] = 0.; // Make sure eveything's in there to avoid a rehash in the parallel loop
-         }
+         if ( old_table.count(key) == 0 ) KEYS.push_back(key);
        } // for J2
       } // for J1
      } // for j2d
@@ -1154,11 +1177,7 @@ void ModelSpace::PreCalculateSixJ()
        for (int J3=J3_min; J3<=J3_max; J3+=2)
        {
          uint64_t key = SixJHash(0.5*J1,0.5*J2,0.5*J3,0.5*j2a,0.5*j2b,0.5*j2c);
-         if ( SixJList.count(key) == 0 ) 
-         {
-           KEYS.push_back(key);
-           SixJList[key] = 0.; // Make sure eveything's in there to avoid a rehash in the parallel loop
-         }
+         if ( old_table.count(key) == 0 ) KEYS.push_back(key);
        }// for J3
       }// for J2
      }// for J1
@@ -1166,28 +1185,43 @@ void ModelSpace::PreCalculateSixJ()
    }// for j2b
   }// for j2a
 
-  #pragma omp parallel for schedule(dynamic,1)
-  for (size_t i=0;i< KEYS.size(); ++i)
+  std::sort(KEYS.begin(),KEYS.end());
+  KEYS.erase( std::unique(KEYS.begin(),KEYS.end()), KEYS.end() );
+
+  if (not KEYS.empty())
   {
-    uint64_t j1,j2,j3,J1,J2,J3;
-    uint64_t key = KEYS[i];
-    SixJUnHash(key, j1,j2,j3,J1,J2,J3);
-    SixJList[key] = AngMom::SixJ(0.5*j1,0.5*j2,0.5*j3,0.5*J1,0.5*J2,0.5*J3);
+    auto new_table = std::make_shared<std::unordered_map<uint64_t,double>>(old_table);
+    for (uint64_t key : KEYS) (*new_table)[key] = 0.; // Make sure eveything's in there to avoid a rehash in the parallel loop
+    #pragma omp parallel for schedule(dynamic,1)
+    for (size_t i=0;i< KEYS.size(); ++i)
+    {
+      uint64_t j1,j2,j3,J1,J2,J3;
+      uint64_t key = KEYS[i];
+      SixJUnHash(key, j1,j2,j3,J1,J2,J3);
+      new_table->at(key) = AngMom::SixJ(0.5*j1,0.5*j2,0.5*j3,0.5*J1,0.5*J2,0.5*J3);
+    }
+    SixJTable = new_table;
   }
+  sixj_table = SixJTable;
   sixj_has_been_precalculated = true;
   std::cout << "done calculating sixJs (" << KEYS.size() << " of them)" << std::endl;
-  std::cout << "Hash table has " << SixJList.bucket_count() << " buckets and a load factor " << SixJList.load_factor() 
-       << "  estimated storage ~ " << ((SixJList.bucket_count()+SixJList.size()) * (sizeof(size_t)+sizeof(void*))) / (1024.*1024.*1024.) << " GB" << std::endl;
-  profiler.timer["PreCalculateSixJ"] += omp_get_wtime() - t_start;
+  std::cout << "Hash table has " << sixj_table->bucket_count() << " buckets and a load factor " << sixj_table->load_factor() 
+       << "  estimated storage ~ " << ((sixj_table->bucket_count()+sixj_table->size()) * (sizeof(size_t)+sizeof(void*))) / (1024.*1024.*1024.) << " GB" << std::endl;
 }
 
 
 
 
+/// Like the 6j table, the Moshinsky table is shared with the other model spaces
+/// and is replaced by an extended copy, rather than modified, when it is missing something.
 void ModelSpace::PreCalculateMoshinsky()
 {
   if (moshinsky_has_been_precalculated) return;
-  double t_start = omp_get_wtime();
+  std::lock_guard<std::mutex> lock(AngMomCacheMutex);
+  if (moshinsky_has_been_precalculated) return;
+  IMSRGProfiler::ScopedTimer st("PreCalculateMoshinsky");
+  std::unordered_map<uint64_t,double> empty_table;
+  const std::unordered_map<uint64_t,double>& old_table = MoshTable ? *MoshTable : empty_table;
 
   // generating all the keys is fast, so we do this first without parallelization
 //  std::vector<unsigned long long int> KEYS;
@@ -1234,8 +1268,7 @@ void ModelSpace::PreCalculateMoshinsky()
 //                          + ((uint64_t) n2  << 12)
 //                          + ((uint64_t) l2  << 6 )
 //                          +  L;
-          KEYS.push_back(key);
-          MoshList[key] = 0.; // Make sure eveything's in there to avoid a rehash in the parallel loop
+          if ( old_table.count(key) == 0 ) KEYS.push_back(key);
          }
         }
        }
@@ -1244,6 +1277,10 @@ void ModelSpace::PreCalculateMoshinsky()
     }
    }
   }
+  if (not KEYS.empty())
+  {
+  auto new_table = std::make_shared<std::unordered_map<uint64_t,double>>(old_table);
+  for (uint64_t key : KEYS) (*new_table)[key] = 0.; // Make sure eveything's in there to avoid a rehash in the parallel loop
   // Now we calculate the Moshinsky brackets in parallel
 //  std::vector<double> mosh_vals( KEYS.size() );
   #pragma omp parallel for schedule(dynamic,1)
@@ -1262,14 +1299,16 @@ void ModelSpace::PreCalculateMoshinsky()
 //    int n2  = (key >> 12) & 0xf;
 //    int l2  = (key >> 6 ) & 0xf;
 //    int L   =  key & 0x3f;
-    MoshList[key] = AngMom::Moshinsky(N,Lam,n,lam,n1,l1,n2,l2,L);
+    new_table->at(key) = AngMom::Moshinsky(N,Lam,n,lam,n1,l1,n2,l2,L);
+  }
+  MoshTable = new_table;
   }
 
+  mosh_table = MoshTable;
   moshinsky_has_been_precalculated = true;
   std::cout << "done calculating moshinsky" << std::endl;
-  std::cout << "Hash table has " << MoshList.bucket_count() << " buckets and a load factor " << MoshList.load_factor() 
-       << "  estimated storage ~ " << ((MoshList.bucket_count()+MoshList.size()) * (sizeof(size_t)+sizeof(void*))) / (1024.*1024.*1024.) << " GB" << std::endl;
-  profiler.timer["PreCalculateMoshinsky"] += omp_get_wtime() - t_start;
+  std::cout << "Hash table has " << mosh_table->bucket_count() << " buckets and a load factor " << mosh_table->load_factor() 
+       << "  estimated storage ~ " << ((mosh_table->bucket_count()+mosh_table->size()) * (sizeof(size_t)+sizeof(void*))) / (1024.*1024.*1024.) << " GB" << std::endl;
 }
 
 
@@ -1320,12 +1359,19 @@ double ModelSpace::GetMoshinsky( int N, int Lam, int n, int lam, int n1, int l1,
 //                                       +  L;
 
 
+   // The precalculated table is never modified, so it can be read without locking.
+   if (moshinsky_has_been_precalculated)
+   {
+     auto it = mosh_table->find(key);
+     if ( it != mosh_table->end() )  return it->second * phase_mosh;
+   }
+
+   std::lock_guard<std::mutex> lock(AngMomCacheMutex);
    auto it = MoshList.find(key);
    if ( it != MoshList.end() )  return it->second * phase_mosh;
 
    // if we didn't find it, we need to calculate it.
    double mosh = AngMom::Moshinsky(N,Lam,n,lam,n1,l1,n2,l2,L);
-//   #pragma omp atomic
    MoshList[key] = mosh;
    return mosh * phase_mosh;
 
@@ -1333,6 +1379,113 @@ double ModelSpace::GetMoshinsky( int N, int Lam, int n, int lam, int n1, int l1,
 
 
 
+/// For each two-body channel, build the matrix \f$ T \f$ which takes the normalized, antisymmetrized
+/// lab-frame kets \f$ |ab;J\rangle \f$ to the oscillator states \f$ |N\Lambda,n\lambda;(LS)J\rangle \f$ of the
+/// center of mass and relative motion, with elements
+/// \f[
+/// T_{N\Lambda n\lambda LS, ab} = \frac{c_{ab}^{\lambda S}}{\sqrt{1+\delta_{ab}}}
+/// \left[ \begin{array}{ccc} \ell_a & s_a & j_a \\ \ell_b & s_b & j_b \\ L & S & J \end{array} \right]
+/// \left\langle N\Lambda n \lambda | n_a \ell_a n_b \ell_b \right\rangle_L .
+/// \f]
+/// The isospin factor \f$ c \f$ is \f$ \sqrt{2} \f$ in the pp and nn channels, where only \f$ \lambda+S \f$ even is kept,
+/// and \f$ \pm 1 \f$ in the pn channel, where the sign for \f$ \lambda+S \f$ odd depends on whether a is the proton.
+/// A two-body operator which is diagonal in \f$ L,S \f$ and doesn't care about isospin then goes to the lab frame as
+/// \f$ T^{T} O_{rel/CM} T \f$, see imsrg_util::RelCMToLab().
+/// This only depends on the orbits, so it is done once and reused for any operator and any hbar omega.
+void ModelSpace::PreCalculateLabToRelCM()
+{
+  std::lock_guard<std::mutex> lock(*cache_mutex);
+  if (LabToRelCMTransform.size() == TwoBodyChannels.size()) return;
+  IMSRGProfiler::ScopedTimer st("PreCalculateLabToRelCM");
+  PreCalculateMoshinsky();
+  int nchan = TwoBodyChannels.size();
+  LabToRelCMTransform.resize(nchan);
+  RelCMBasis.resize(nchan);
+
+  #pragma omp parallel for schedule(dynamic,1)
+  for (int ch=0; ch<nchan; ++ch)
+  {
+    TwoBodyChannel& tbc = TwoBodyChannels[ch];
+    int J = tbc.J;
+    int nkets = tbc.GetNumberKets();
+    std::vector<std::array<int,6>>& basis = RelCMBasis[ch];
+    basis.clear();
+    int emax_ch = 0;
+    for (int iket=0; iket<nkets; ++iket)
+    {
+      Ket& ket = tbc.GetKet(iket);
+      emax_ch = std::max(emax_ch, 2*(ket.op->n+ket.oq->n)+ket.op->l+ket.oq->l);
+    }
+
+    for (int L=std::max(J-1,0); L<=J+1; ++L)
+    {
+     for (int S=std::abs(J-L); S<=std::min(1,J+L); ++S)
+     {
+      for (int N=0; N<=emax_ch/2; ++N)
+      {
+       for (int Lam=0; Lam<=emax_ch-2*N; ++Lam)
+       {
+        for (int lam=std::abs(L-Lam); lam<=std::min(Lam+L,emax_ch-2*N-Lam); ++lam)
+        {
+         if ( (Lam+lam)%2 != tbc.parity ) continue;
+         if ( std::abs(tbc.Tz)==1 and (lam+S)%2>0 ) continue; // Pauli principle for like particles
+         for (int n=0; n<=(emax_ch-2*N-Lam-lam)/2; ++n)
+         {
+           basis.push_back({N,Lam,n,lam,L,S});
+         }
+        }
+       }
+      }
+     }
+    }
+
+    int nrel = basis.size();
+    arma::mat& T = LabToRelCMTransform[ch];
+    T.zeros(nrel,nkets);
+    for (int iket=0; iket<nkets; ++iket)
+    {
+      Ket& ket = tbc.GetKet(iket);
+      Orbit& oa = GetOrbit(ket.p);
+      Orbit& ob = GetOrbit(ket.q);
+      int eab = 2*(oa.n+ob.n)+oa.l+ob.l;
+      double norm = 1.0 / sqrt(1.0+ket.delta_pq());
+      for (int irel=0; irel<nrel; ++irel)
+      {
+        int N   = basis[irel][0];
+        int Lam = basis[irel][1];
+        int n   = basis[irel][2];
+        int lam = basis[irel][3];
+        int L   = basis[irel][4];
+        int S   = basis[irel][5];
+        if ( 2*(N+n)+Lam+lam != eab ) continue;
+        if ( L<std::abs(oa.l-ob.l) or L>oa.l+ob.l ) continue;
+        double ninej = AngMom::NormNineJ(oa.l,0.5,0.5*oa.j2, ob.l,0.5,0.5*ob.j2, L,S,J);
+        if (ninej == 0) continue;
+        // brackets above E2max aren't in the table, and adding them to it would serialize this loop on the cache lock
+        double mosh = (eab <= E2max) ? GetMoshinsky(N,Lam,n,lam,oa.n,oa.l,ob.n,ob.l,L)
+                                     : AngMom::Moshinsky(N,Lam,n,lam,oa.n,oa.l,ob.n,ob.l,L);
+        double isospin_factor = SQRT2;
+        if (tbc.Tz==0)  isospin_factor = ( (lam+S)%2==0 or oa.tz2<0 ) ? 1 : -1;
+        T(irel,iket) = norm * isospin_factor * ninej * mosh;
+      }
+    }
+  }
+}
+
+arma::mat& ModelSpace::GetLabToRelCMTransform(int ch)
+{
+  PreCalculateLabToRelCM();
+  return LabToRelCMTransform[ch];
+}
+
+std::vector<std::array<int,6>>& ModelSpace::GetRelCMBasis(int ch)
+{
+  PreCalculateLabToRelCM();
+  return RelCMBasis[ch];
+}
+
+
+
 
 double ModelSpace::GetNineJ(double j1, double j2, double J12, double j3, double j4, double J34, double J13, double J24, double J)
 {
@@ -1397,35 +1550,216 @@ double ModelSpace::GetNineJ(double j1, double j2, double J12, double j3, double
       factor *=91;
 //      factor *=100;
    }
+   std::lock_guard<std::mutex> lock(AngMomCacheMutex);
    auto it = NineJList.find(key);
    if (it != NineJList.end() )
    {
      return it->second;
    }
    double ninej = AngMom::NineJ(jlist[0],jlist[1],jlist[2],jlist[3],jlist[4],jlist[5],jlist[6],jlist[7],jlist[8]);
-   #pragma omp critical
    NineJList[key] = ninej;
    return ninej;
 
 }
 
 
+/// Get the table of 9j symbols for the tensor Pandya transformation of rank Lambda, calculating it if we haven't yet.
+/// This covers every combination of j's in the model space, so it is reused by all the commutators of a flow.
+/// The tables are shared by all model spaces, so the lookup and the insertion are done under a lock.
+/// References to elements of a std::map stay valid when other elements are inserted, so the caller doesn't need the lock.
+const TensorNineJTable& ModelSpace::GetTensorNineJTable(int Lambda)
+{
+  std::lock_guard<std::mutex> lock(TensorNineJTablesMutex);
+  auto it = TensorNineJTables.find({Lambda,Emax});
+  if (it != TensorNineJTables.end()) return it->second;
+
+  IMSRGProfiler::ScopedTimer st("GetTensorNineJTable");
+  TensorNineJTable& table = TensorNineJTables[{Lambda,Emax}];
+  table.Lambda = Lambda;
+  table.nj = Emax+1;
+  int nj = table.nj;
+  int nj4 = nj*nj*nj*nj;
+  table.offsets.resize(nj4,0);
+  size_t offset = 0;
+  for (int jq=0; jq<nj4; ++jq)
+  {
+    int j2_1 = 2*(jq/(nj*nj*nj))+1, j2_2 = 2*((jq/(nj*nj))%nj)+1, j2_3 = 2*((jq/nj)%nj)+1;
+    if (j2_2 > j2_3) continue;
+    table.offsets[jq] = offset;
+    offset += table.NRows(j2_1,j2_2) * table.NRows(j2_1,j2_3);
+  }
+  table.ninej.resize(offset,0.);
+
+  #pragma omp parallel for schedule(dynamic,1)
+  for (int jq=0; jq<nj4; ++jq)
+  {
+    int j2_1 = 2*(jq/(nj*nj*nj))+1, j2_2 = 2*((jq/(nj*nj))%nj)+1, j2_3 = 2*((jq/nj)%nj)+1, j2_4 = 2*(jq%nj)+1;
+    if (j2_2 > j2_3) continue;
+    double* mat = table.ninej.data() + table.offsets[jq];
+    int nrows = table.NRows(j2_1,j2_2);
+    for (int X13=std::abs(j2_1-j2_3)/2; X13<=(j2_1+j2_3)/2; ++X13)
+    {
+      for (int X24=std::max(std::abs(j2_2-j2_4)/2,std::abs(X13-Lambda)); X24<=std::min((j2_2+j2_4)/2,X13+Lambda); ++X24)
+      {
+        double* column = mat + nrows*table.Row(j2_1,j2_3,X13,X24);
+        for (int X12=std::abs(j2_1-j2_2)/2; X12<=(j2_1+j2_2)/2; ++X12)
+        {
+          for (int X34=std::max(std::abs(j2_3-j2_4)/2,std::abs(X12-Lambda)); X34<=std::min((j2_3+j2_4)/2,X12+Lambda); ++X34)
+          {
+            column[table.Row(j2_1,j2_2,X12,X34)] = AngMom::NineJ(0.5*j2_1,0.5*j2_2,X12,0.5*j2_3,0.5*j2_4,X34,X13,X24,Lambda);
+          }
+        }
+      }
+    }
+  }
+  std::cout << "Tabulated 9j symbols for rank " << Lambda << " Pandya transformation (" << offset*sizeof(double)/(1024.*1024.) << " MB)" << std::endl;
+  return table;
+}
+
+/// The 9j tables can take up most of a GB per Lambda at large emax, and they stick around otherwise.
+void ModelSpace::ClearTensorNineJTables()
+{
+  std::lock_guard<std::mutex> lock(TensorNineJTablesMutex);
+  TensorNineJTables.clear();
+}
+
+
 //std::map<std::array<int,2>,std::vector<std::array<int,2>>>& ModelSpace::GetPandyaLookup(int rank_J, int rank_T, int parity)
 std::map<std::array<int,2>,std::array<std::vector<int>,2>>& ModelSpace::GetPandyaLookup(int rank_J, int rank_T, int parity)
 {
    CalculatePandyaLookup(rank_J,rank_T,parity);
+   std::lock_guard<std::mutex> lock(*cache_mutex);
    return PandyaLookup[{rank_J,rank_T,parity}];
 
 }
 
+/// The cross-coupled channel pairs with ch_bra_cc <= ch_ket_cc which can give a nonzero contribution
+/// to the Pandya-transformed part of the tensor commutator, i.e. those with a non-empty Pandya lookup
+/// and the right angular momentum and parity for a rank rank_J operator. This is typically
+/// a small fraction of all the pairs, so the tensor commutator only loops over and allocates these.
+const std::vector<std::array<index_t,2>>& ModelSpace::GetTensorPandyaChannelPairs(int rank_J, int rank_T, int parity)
+{
+   CalculatePandyaLookup(rank_J,rank_T,parity);
+   std::lock_guard<std::mutex> lock(*cache_mutex);
+   return TensorPandyaChannelPairs[{rank_J,rank_T,parity}];
+}
+
+/// Position of the pair {ch_bra_cc,ch_ket_cc} in GetTensorPandyaChannelPairs(), stored at ch_bra_cc*nchannels_cc+ch_ket_cc.
+/// Pairs that aren't in the list (including all those with ch_bra_cc>ch_ket_cc) give -1.
+const std::vector<int>& ModelSpace::GetTensorPandyaPairIndex(int rank_J, int rank_T, int parity)
+{
+   CalculatePandyaLookup(rank_J,rank_T,parity);
+   std::lock_guard<std::mutex> lock(*cache_mutex);
+   return TensorPandyaPairIndex[{rank_J,rank_T,parity}];
+}
+
+
+/// Orbits are indexed so that the mirror of orbit i is i^1 (protons even, neutrons odd).
+bool ModelSpace::IsChargeSymmetric() const
+{
+   if (norbits%2 != 0) return false;
+   for (int i=0; i<norbits; i+=2)
+   {
+      const Orbit& op = Orbits[i];
+      const Orbit& on = Orbits[i+1];
+      if (op.n!=on.n or op.l!=on.l or op.j2!=on.j2 or op.tz2!=-on.tz2) return false;
+      if (std::abs(op.occ-on.occ)>1e-8 or op.cvq!=on.cvq) return false;
+   }
+   return true;
+}
+
+
+/// Set up the MirrorBasis of each Tz=0 channel. If \f$ M|pq\rangle = s|p'q'\rangle \f$, where the primes denote the mirror orbits and
+/// s is the phase from reordering the stored ket, the eigenkets are \f$ (|pq\rangle \pm s|p'q'\rangle)/\sqrt{2} \f$ (or just \f$ |pq\rangle \f$
+/// if p'q' is the same ket, with eigenvalue s).
+/// Only the first call does anything.
+void ModelSpace::CalculateMirrorBases()
+{
+   std::lock_guard<std::mutex> lock(*cache_mutex);
+   if (not MirrorBases.empty()) return;
+   IMSRGProfiler::ScopedTimer st("CalculateMirrorBases");
+   for (int ch=0; ch<nTwoBodyChannels; ++ch)
+   {
+      TwoBodyChannel& tbc = TwoBodyChannels[ch];
+      if (tbc.Tz != 0) continue;
+      int nkets = tbc.GetNumberKets();
+      // class 0=pp, 1=hh, 2=ph of each ket, and its position in the corresponding list
+      std::vector<int> ket_class(nkets,0), ket_position(nkets,0);
+      for (index_t i=0; i<tbc.KetIndex_hh.n_elem; ++i) { ket_class[tbc.KetIndex_hh[i]] = 1; ket_position[tbc.KetIndex_hh[i]] = i; }
+      for (index_t i=0; i<tbc.KetIndex_ph.n_elem; ++i) { ket_class[tbc.KetIndex_ph[i]] = 2; ket_position[tbc.KetIndex_ph[i]] = i; }
+
+      // each eigenket is (representative ket, list of (ket, coefficient))
+      std::array<std::vector<std::pair<int,std::vector<std::pair<int,double>>>>,2> eigenkets;
+      for (int iket=0; iket<nkets; ++iket)
+      {
+         Ket& ket = tbc.GetKet(iket);
+         int pm = ket.p^1;
+         int qm = ket.q^1;
+         int imirror = tbc.GetLocalIndex(std::min(pm,qm), std::max(pm,qm));
+         double s = (pm<qm) ? 1 : tbc.GetKet(imirror).Phase(tbc.J);
+         if (imirror == iket)
+           eigenkets[s>0 ? 0 : 1].push_back( {iket, {{iket,1.0}}} );
+         else if (imirror > iket)
+         {
+           eigenkets[0].push_back( {iket, {{iket,1/SQRT2},{imirror, s/SQRT2}}} );
+           eigenkets[1].push_back( {iket, {{iket,1/SQRT2},{imirror,-s/SQRT2}}} );
+         }
+      }
+
+      MirrorBasis& mb = MirrorBases[ch];
+      std::array<std::vector<arma::uword>,2> ket;
+      std::array<std::vector<double>,2> coeff;
+      index_t col = 0;
+      for (int b=0; b<2; ++b)
+      {
+         mb.offset[b] = col;
+         mb.dim[b] = eigenkets[b].size();
+         std::array<std::vector<arma::uword>,3> kets_class;
+         std::vector<double> occ_hh, unocc_hh, unocc_ph;
+         for (index_t i=0; i<eigenkets[b].size(); ++i)
+         {
+            int iket = eigenkets[b][i].first;
+            kets_class[ket_class[iket]].push_back(i);
+            if (ket_class[iket]==1)
+            {
+              occ_hh.push_back( tbc.Ket_occ_hh[ket_position[iket]] );
+              unocc_hh.push_back( tbc.Ket_unocc_hh[ket_position[iket]] );
+            }
+            else if (ket_class[iket]==2)
+              unocc_ph.push_back( tbc.Ket_unocc_ph[ket_position[iket]] );
+            auto& entries = eigenkets[b][i].second;
+            for (int k=0; k<2; ++k)
+            {
+              ket[k].push_back( entries[std::min<int>(k,entries.size()-1)].first );
+              coeff[k].push_back( k<(int)entries.size() ? entries[k].second : 0.0 );
+            }
+            ++col;
+         }
+         mb.kets_pp[b] = arma::uvec(kets_class[0]);
+         mb.kets_hh[b] = arma::uvec(kets_class[1]);
+         mb.kets_ph[b] = arma::uvec(kets_class[2]);
+         mb.occ_hh[b] = arma::vec(occ_hh);
+         mb.unocc_hh[b] = arma::vec(unocc_hh);
+         mb.unocc_ph[b] = arma::vec(unocc_ph);
+      }
+      for (int k=0; k<2; ++k)
+      {
+        mb.ket[k] = arma::uvec(ket[k]);
+        mb.coeff[k] = arma::vec(coeff[k]);
+      }
+   }
+}
+
 
 // Generate a lookup table of all the channels that depend on a given set of Pandya-transformed channels
 // this is used in the 222ph commutators to avoid calculating things that won't be used.
+// The lock is held throughout, so another thread never sees a half-filled lookup.
 void ModelSpace::CalculatePandyaLookup(int rank_J, int rank_T, int parity)
 {
+   std::lock_guard<std::mutex> lock(*cache_mutex);
    if (PandyaLookup.find({rank_J, rank_T, parity})!=PandyaLookup.end()) return; 
    std::cout << "CalculatePandyaLookup( " << rank_J << ", " << rank_T << ", " << parity << ") " << std::endl;
-   double t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("CalculatePandyaLookup");
 //   PandyaLookup[{rank_J,rank_T,parity}] = std::map<std::array<int,2>,std::vector<std::array<int,2>>>();
    PandyaLookup[{rank_J,rank_T,parity}] = std::map<std::array<int,2>,std::array<std::vector<int>,2>>();
    auto& lookup = PandyaLookup[{rank_J,rank_T,parity}];
@@ -1533,7 +1867,26 @@ void ModelSpace::CalculatePandyaLookup(int rank_J, int rank_T, int parity)
        lookup.at({ch_bra_cc,ch_ket_cc})[1].assign( begin(ket_list),end(ket_list) );
      }
    }
-   profiler.timer["CalculatePandyaLookup"] += omp_get_wtime() - t_start;
+
+   // Now make the compact list of channel pairs which are actually needed, in the order of SortedTwoBodyChannels_CC
+   auto& channel_pairs = TensorPandyaChannelPairs[{rank_J,rank_T,parity}];
+   auto& pair_index = TensorPandyaPairIndex[{rank_J,rank_T,parity}];
+   channel_pairs.clear();
+   pair_index.assign(ntbc_cc*ntbc_cc,-1);
+   for (auto ch_bra_cc : SortedTwoBodyChannels_CC)
+   {
+     TwoBodyChannel_CC& tbc_bra_cc = TwoBodyChannels_CC[ch_bra_cc];
+     for (auto ch_ket_cc : SortedTwoBodyChannels_CC)
+     {
+       if (ch_bra_cc>ch_ket_cc) continue;
+       TwoBodyChannel_CC& tbc_ket_cc = TwoBodyChannels_CC[ch_ket_cc];
+       if ( (tbc_bra_cc.J+tbc_ket_cc.J < rank_J) or std::abs(tbc_bra_cc.J-tbc_ket_cc.J)>rank_J ) continue;
+       if ( (tbc_bra_cc.parity + tbc_ket_cc.parity + parity)%2>0 ) continue;
+       if ( lookup.at({(int)ch_bra_cc,(int)ch_ket_cc})[0].size()<1 ) continue;
+       pair_index[ch_bra_cc*ntbc_cc+ch_ket_cc] = channel_pairs.size();
+       channel_pairs.push_back({ch_bra_cc,ch_ket_cc});
+     }
+   }
    std::cout << "done." << std::endl;
 }
 
@@ -25,6 +25,9 @@
 #include <unordered_map>
 #include <map>
 #include <array>
+#include <memory>
+#include <mutex>
+#include <atomic>
 #include <armadillo>
 #include "IMSRGProfiler.hh"
 #ifndef SQRT2
@@ -175,6 +178,47 @@ class TwoBodyChannel_CC : public TwoBodyChannel
 
 
 
+/// The 9j symbols \f$ \{ j_1 j_2 X_{12} ; j_3 j_4 X_{34} ; X_{13} X_{24} \Lambda \} \f$ used in the tensor Pandya transformation,
+/// tabulated so they can be looked up without hashing or locking inside the parallel loops.
+/// For each set of j's there is a dense column-major matrix with rows (X12,X34) and columns (X13,X24).
+/// X34 takes the 2*Lambda+1 slots from X12-Lambda to X12+Lambda, and likewise X24 for X13. Disallowed ones are zero.
+/// Since the 9j is unchanged by transposing it, only j2<=j3 is stored and the rest is read transposed.
+struct TensorNineJTable
+{
+  int Lambda;
+  int nj; // number of distinct j's, i.e. emax+1
+  std::vector<size_t> offsets;
+  std::vector<double> ninej;
+
+  /// A column (X13,X24) of the matrix for j1..j4 (given as 2j), which is read as column[stride*Row(...)]
+  struct Column {const double* column; int stride;};
+  Column GetColumn(int j2_1, int j2_2, int j2_3, int j2_4, int X13, int X24) const
+  {
+    if (j2_2 <= j2_3)
+      return { ninej.data() + offsets[Index(j2_1,j2_2,j2_3,j2_4)] + NRows(j2_1,j2_2)*Row(j2_1,j2_3,X13,X24), 1 };
+    return { ninej.data() + offsets[Index(j2_1,j2_3,j2_2,j2_4)] + Row(j2_1,j2_3,X13,X24), NRows(j2_1,j2_3) };
+  };
+  int Index(int j2_1, int j2_2, int j2_3, int j2_4) const { return (((j2_1/2)*nj + j2_2/2)*nj + j2_3/2)*nj + j2_4/2; };
+  int NRows(int j2_1, int j2_2) const { return (std::min(j2_1,j2_2)+1)*(2*Lambda+1); };
+  int Row(int j2_1, int j2_2, int X12, int X34) const { return (X12-std::abs(j2_1-j2_2)/2)*(2*Lambda+1) + X34-X12+Lambda; };
+};
+
+
+/// For a Tz=0 two-body channel, the orthogonal transformation to eigenkets of the mirror operation, which swaps protons and neutrons.
+/// For a pn ket, these are the isospin-coupled combinations of it and its mirror ket. Charge-symmetric operators are
+/// block diagonal in this basis, with a mirror-even and a mirror-odd block (T=1 and T=0 up to phase conventions), each about half the size.
+/// The kets in each block are classified and weighted like the pn kets they're built from, which assumes the reference is charge symmetric.
+struct MirrorBasis
+{
+  std::array<arma::uvec,2> ket; // eigenket c (a column of the transformation U, mirror-even first) is coeff[0](c)|ket[0](c)> + coeff[1](c)|ket[1](c)>
+  std::array<arma::vec,2> coeff;
+  std::array<index_t,2> offset; // first column of each block
+  std::array<index_t,2> dim; // size of each block
+  std::array<arma::uvec,2> kets_pp, kets_hh, kets_ph; // within each block
+  std::array<arma::vec,2> occ_hh, unocc_hh, unocc_ph;
+};
+
+
 class ModelSpace
 {
 
@@ -255,7 +299,7 @@ class ModelSpace
    double GetSixJ(double j1, double j2, double j3, double J1, double J2, double J3);
    double GetNineJ(double j1, double j2, double j3, double j4, double j5, double j6, double j7, double j8, double j9);
    double GetMoshinsky( int N, int Lam, int n, int lam, int n1, int l1, int n2, int l2, int L); // Inconsistent notation. Not ideal.
-   bool SixJ_is_empty(){ return SixJList.empty(); };
+   bool SixJ_is_empty(){ std::lock_guard<std::mutex> lock(AngMomCacheMutex); return (SixJTable==nullptr or SixJTable->empty()) and SixJList.empty(); };
 
    int GetOrbitIndex(std::string);
    int GetTwoBodyChannelIndex(int j, int p, int t);
@@ -268,15 +312,26 @@ class ModelSpace
 
    void PreCalculateMoshinsky();
    void PreCalculateSixJ();
+   const TensorNineJTable& GetTensorNineJTable(int Lambda); // thread safe, calculated the first time for a given Lambda
+   static void ClearTensorNineJTables(); // free the 9j tables. Not while a tensor commutator is running, since it refers to them.
+   void PreCalculateLabToRelCM(); // Talmi-Moshinsky transformation from lab kets to relative/CM states, one matrix per two-body channel
+   arma::mat& GetLabToRelCMTransform(int ch);
+   std::vector<std::array<int,6>>& GetRelCMBasis(int ch);
    void ClearVectors();
    void ResetFirstPass();
    void CalculatePandyaLookup(int rank_J, int rank_T, int parity); // construct a lookup table for more efficient pandya transformation
 //   map<array<int,2>,vector<array<int,2>>>& GetPandyaLookup(int rank_J, int rank_T, int parity);
    std::map<std::array<int,2>,std::array<std::vector<int>,2>>& GetPandyaLookup(int rank_J, int rank_T, int parity);
+   const std::vector<std::array<index_t,2>>& GetTensorPandyaChannelPairs(int rank_J, int rank_T, int parity);
+   const std::vector<int>& GetTensorPandyaPairIndex(int rank_J, int rank_T, int parity);
+   bool IsChargeSymmetric() const; ///< true if the reference and the valence space are unchanged by swapping protons and neutrons
+   const MirrorBasis& GetMirrorBasis(int ch) const {return MirrorBases.at(ch);};
+   void CalculateMirrorBases(); // thread safe, only calculated the first time
    uint64_t SixJHash(double j1, double j2, double j3, double J1, double J2, double J3);
    void SixJUnHash(uint64_t key, uint64_t& j1, uint64_t& j2, uint64_t& j3, uint64_t& J1, uint64_t& J2, uint64_t& J3);
    uint64_t MoshinskyHash(uint64_t N,uint64_t Lam,uint64_t n,uint64_t lam,uint64_t n1,uint64_t l1,uint64_t n2,uint64_t l2,uint64_t L);
    void MoshinskyUnHash(uint64_t key,uint64_t& N,uint64_t& Lam,uint64_t& n,uint64_t& lam,uint64_t& n1,uint64_t& l1,uint64_t& n2,uint64_t& l2,uint64_t& L);
+   uint64_t GetOrbitListHash(); ///< Fingerprint of the ordered orbit list (n,l,j2,tz2), used to check operators read from file
 
 
    // Data members
@@ -337,16 +392,32 @@ class ModelSpace
    std::vector<TwoBodyChannel> TwoBodyChannels;
    std::vector<TwoBodyChannel_CC> TwoBodyChannels_CC;
    std::map< std::array<int,3>, std::map< std::array<int,2>,std::array<std::vector<int>,2> > > PandyaLookup;
-   bool sixj_has_been_precalculated;
-   bool moshinsky_has_been_precalculated;
+   std::map< std::array<int,3>, std::vector<std::array<index_t,2>> > TensorPandyaChannelPairs; // channel pairs ch_bra_cc<=ch_ket_cc which are actually needed in comm222_phst
+   std::map< std::array<int,3>, std::vector<int> > TensorPandyaPairIndex; // position of {ch_bra_cc,ch_ket_cc} in TensorPandyaChannelPairs, or -1. Indexed by ch_bra_cc*nchannels_cc+ch_ket_cc
+   std::map<int,MirrorBasis> MirrorBases; // for the Tz=0 channels, filled by CalculateMirrorBases()
+   std::vector<arma::mat> LabToRelCMTransform; // rows are relative/CM states, columns are the kets of the channel
+   std::vector<std::vector<std::array<int,6>>> RelCMBasis; // {N,Lam,n,lam,L,S} labelling the rows of LabToRelCMTransform
+   std::atomic<bool> sixj_has_been_precalculated; // set once sixj_table is in place, so it can be read without locking
+   std::atomic<bool> moshinsky_has_been_precalculated; // likewise for mosh_table
    bool scalar_transform_first_pass;
    std::vector<bool> tensor_transform_first_pass;
+   std::shared_ptr<std::mutex> cache_mutex; // for the tables filled on demand: Pandya lookups, mirror bases, lab to rel/CM
+   std::shared_ptr<const std::unordered_map<uint64_t,double>> sixj_table; // the precalculated 6j's, which are never modified
+   std::shared_ptr<const std::unordered_map<uint64_t,double>> mosh_table; // the precalculated Moshinsky brackets, likewise
    IMSRGProfiler profiler;
 //   map<long int,double> SixJList;
 
+   // The precalculated 6j's and Moshinsky brackets are shared by the model spaces. A model space with a larger emax
+   // publishes an extended copy rather than adding to a table that others may be reading.
+   static std::shared_ptr<const std::unordered_map<uint64_t,double>> SixJTable;
+   static std::shared_ptr<const std::unordered_map<uint64_t,double>> MoshTable;
+   // The rest are calculated as they come up, and kept in these under AngMomCacheMutex.
    static std::unordered_map<uint64_t,double> SixJList;
    static std::unordered_map<uint64_t,double> NineJList;
    static std::unordered_map<uint64_t,double> MoshList;
+   static std::mutex AngMomCacheMutex;
+   static std::map<std::array<int,2>,TensorNineJTable> TensorNineJTables; // keyed by Lambda, emax
+   static std::mutex TensorNineJTablesMutex;
 
 };
 
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <iomanip>
 #include <deque>
+#include <stdexcept>
 #include <gsl/gsl_math.h>
 #include <math.h>
 #include "omp.h"
@@ -46,16 +47,16 @@ Operator& Operator::TempOp(size_t n)
 //////////////////// DESTRUCTOR //////////////////////////////////////////
 Operator::~Operator()
 {
-  profiler.counter["N_Operators"] --;
+  IMSRGProfiler::IncrementCounter("N_Operators",-1);
 }
 
 /////////////////// CONSTRUCTORS /////////////////////////////////////////
 Operator::Operator()
  :   modelspace(NULL), 
     rank_J(0), rank_T(0), parity(0), particle_rank(2),
-    hermitian(true), antihermitian(false), nChannels(0)
+    hermitian(true), antihermitian(false), charge_symmetric(false), nChannels(0)
 {
-  profiler.counter["N_Operators"] ++;
+  IMSRGProfiler::IncrementCounter("N_Operators");
 }
 
 
@@ -65,12 +66,12 @@ Operator::Operator(ModelSpace& ms, int Jrank, int Trank, int p, int part_rank) :
     TwoBody(&ms,Jrank,Trank,p),  ThreeBody(&ms),
     rank_J(Jrank), rank_T(Trank), parity(p), particle_rank(part_rank),
     E3max(ms.GetE3max()),
-    hermitian(true), antihermitian(false),  
+    hermitian(true), antihermitian(false), charge_symmetric(false),  
     nChannels(ms.GetNumberTwoBodyChannels()) 
 {
   SetUpOneBodyChannels();
   if (particle_rank >=3) ThreeBody.Allocate();
-  profiler.counter["N_Operators"] ++;
+  IMSRGProfiler::IncrementCounter("N_Operators");
 }
 
 Operator::Operator(ModelSpace& ms) :
@@ -78,11 +79,11 @@ Operator::Operator(ModelSpace& ms) :
     TwoBody(&ms),  ThreeBody(&ms),
     rank_J(0), rank_T(0), parity(0), particle_rank(2),
     E3max(ms.GetE3max()),
-    hermitian(true), antihermitian(false),  
+    hermitian(true), antihermitian(false), charge_symmetric(false),  
     nChannels(ms.GetNumberTwoBodyChannels())
 {
   SetUpOneBodyChannels();
-  profiler.counter["N_Operators"] ++;
+  IMSRGProfiler::IncrementCounter("N_Operators");
 }
 
 Operator::Operator(const Operator& op)
@@ -90,10 +91,10 @@ Operator::Operator(const Operator& op)
   OneBody(op.OneBody), TwoBody(op.TwoBody) ,ThreeBody(op.ThreeBody),
   rank_J(op.rank_J), rank_T(op.rank_T), parity(op.parity), particle_rank(op.particle_rank),
   E2max(op.E2max), E3max(op.E3max), 
-  hermitian(op.hermitian), antihermitian(op.antihermitian),
+  hermitian(op.hermitian), antihermitian(op.antihermitian), charge_symmetric(op.charge_symmetric),
   nChannels(op.nChannels), OneBodyChannels(op.OneBodyChannels)
 {
-  profiler.counter["N_Operators"] ++;
+  IMSRGProfiler::IncrementCounter("N_Operators");
 }
 
 Operator::Operator(Operator&& op)
@@ -101,10 +102,10 @@ Operator::Operator(Operator&& op)
   OneBody(move(op.OneBody)), TwoBody(move(op.TwoBody)) , ThreeBody(move(op.ThreeBody)),
   rank_J(op.rank_J), rank_T(op.rank_T), parity(op.parity), particle_rank(op.particle_rank),
   E2max(op.E2max), E3max(op.E3max), 
-  hermitian(op.hermitian), antihermitian(op.antihermitian),
+  hermitian(op.hermitian), antihermitian(op.antihermitian), charge_symmetric(op.charge_symmetric),
   nChannels(op.nChannels), OneBodyChannels(op.OneBodyChannels)
 {
-  profiler.counter["N_Operators"] ++;
+  IMSRGProfiler::IncrementCounter("N_Operators");
 }
 
 
@@ -162,6 +163,7 @@ Operator& Operator::operator+=(const Operator& rhs)
    OneBody  += rhs.OneBody;
    if (rhs.GetParticleRank() > 1)
      TwoBody  += rhs.TwoBody;
+   charge_symmetric = charge_symmetric and rhs.charge_symmetric;
    return *this;
 }
 
@@ -191,6 +193,7 @@ Operator& Operator::operator-=(const Operator& rhs)
    OneBody -= rhs.OneBody;
    if (rhs.GetParticleRank() > 1)
      TwoBody -= rhs.TwoBody;
+   charge_symmetric = charge_symmetric and rhs.charge_symmetric;
    return *this;
 }
 
@@ -286,7 +289,7 @@ double Operator::GetTwoBody(int ch_bra, int ch_ket, int ibra, int iket)
 
 void Operator::WriteBinary(ofstream& ofs)
 {
-  double tstart = omp_get_wtime();
+  IMSRGProfiler::ScopedTimer st("Write Binary Op");
   ofs.write((char*)&rank_J,sizeof(rank_J));
   ofs.write((char*)&rank_T,sizeof(rank_T));
   ofs.write((char*)&parity,sizeof(parity));
@@ -302,13 +305,12 @@ void Operator::WriteBinary(ofstream& ofs)
     TwoBody.WriteBinary(ofs);
   if (particle_rank > 2)
     ThreeBody.WriteBinary(ofs);
-  profiler.timer["Write Binary Op"] += omp_get_wtime() - tstart;
 }
 
 
 void Operator::ReadBinary(ifstream& ifs)
 {
-  double tstart = omp_get_wtime();
+  IMSRGProfiler::ScopedTimer st("Read Binary Op");
   ifs.read((char*)&rank_J,sizeof(rank_J));
   ifs.read((char*)&rank_T,sizeof(rank_T));
   ifs.read((char*)&parity,sizeof(parity));
@@ -325,7 +327,6 @@ void Operator::ReadBinary(ifstream& ifs)
     TwoBody.ReadBinary(ifs);
   if (particle_rank > 2)
     ThreeBody.ReadBinary(ifs);
-  profiler.timer["Read Binary Op"] += omp_get_wtime() - tstart;
 }
 
 
@@ -359,7 +360,6 @@ Operator Operator::DoNormalOrdering2()
         opNO.ZeroBody += (ok.j2+1) * ok.occ * OneBody(k,k);
      }
    }
-   cout << "OneBody contribution: " << opNO.ZeroBody << endl;
 
    index_t norbits = modelspace->GetNumberOrbits();
    if (TwoBody.Norm() > 1e-7)
@@ -451,40 +451,87 @@ Operator Operator::DoNormalOrdering2()
 Operator Operator::DoNormalOrdering3()
 {
    Operator opNO3 = Operator(*modelspace);
-//   #pragma omp parallel for
+
+   // The isospin recoupling done in ThreeBodyME::GetME_pn only depends on the isospin projections of i,j,k,l and a,
+   // so the products of Clebsch-Gordan coefficients are worked out once here, with the same loops so the result is unchanged.
+   // The index is 16*i + 8*j + 4*k + 2*l + a, where each one is 0 for a proton and 1 for a neutron.
+   std::array<std::vector<std::pair<std::array<int,3>,double>>,32> isospin_recoupling;
+   for (int itz=0; itz<32; ++itz)
+   {
+      double tza = ((itz>>4)&1) - 0.5;
+      double tzb = ((itz>>3)&1) - 0.5;
+      double tzc = (itz&1) - 0.5;
+      double tzd = ((itz>>2)&1) - 0.5;
+      double tze = ((itz>>1)&1) - 0.5;
+      double tzf = tzc;
+      int Tmin = std::min( std::abs(tza+tzb+tzc), std::abs(tzd+tze+tzf) );
+      for (int tab=std::abs(tza+tzb); tab<=1; ++tab)
+      {
+         double CG1 = AngMom::CG(0.5,tza, 0.5,tzb, tab, tza+tzb);
+         for (int tde=std::abs(tzd+tze); tde<=1; ++tde)
+         {
+            double CG2 = AngMom::CG(0.5,tzd, 0.5,tze, tde, tzd+tze);
+            if (CG1*CG2==0) continue;
+            for (int T=Tmin; T<=3; ++T)
+            {
+              double CG3 = AngMom::CG(tab,tza+tzb, 0.5,tzc, T/2., tza+tzb+tzc);
+              double CG4 = AngMom::CG(tde,tzd+tze, 0.5,tzf, T/2., tzd+tze+tzf);
+              if (CG3*CG4==0) continue;
+              isospin_recoupling[itz].push_back( { {tab,tde,T}, CG1*CG2*CG3*CG4 } );
+            }
+         }
+      }
+   }
+
+   // Each bra is a separate piece of work, so that the large channels get spread over the threads.
+   std::vector<std::tuple<arma::mat*,int,int>> bra_list;
    for ( auto& itmat : opNO3.TwoBody.MatEl )
    {
       int ch = itmat.first[0]; // assume ch_bra = ch_ket for 3body...
-      TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
-      arma::mat& Gamma = (arma::mat&) itmat.second;
-      for (int ibra=0; ibra<tbc.GetNumberKets(); ++ibra)
+      int nkets = modelspace->GetTwoBodyChannel(ch).GetNumberKets();
+      for (int ibra=0; ibra<nkets; ++ibra) bra_list.push_back( std::make_tuple(&itmat.second, ch, ibra) );
+   }
+
+   modelspace->PreCalculateSixJ(); // the recoupling in ThreeBody.GetME needs them, and they can't be added in the parallel loop
+   #pragma omp parallel for schedule(dynamic,1)
+   for (size_t ilist=0; ilist<bra_list.size(); ++ilist)
+   {
+      arma::mat& Gamma = *std::get<0>(bra_list[ilist]);
+      TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(std::get<1>(bra_list[ilist]));
+      int ibra = std::get<2>(bra_list[ilist]);
+      Ket & bra = tbc.GetKet(ibra);
+      int i = bra.p;
+      int j = bra.q;
+      Orbit & oi = modelspace->GetOrbit(i);
+      Orbit & oj = modelspace->GetOrbit(j);
+      for (int iket=ibra; iket<tbc.GetNumberKets(); ++iket)
       {
-         Ket & bra = tbc.GetKet(ibra);
-         int i = bra.p;
-         int j = bra.q;
-         Orbit & oi = modelspace->GetOrbit(i);
-         Orbit & oj = modelspace->GetOrbit(j);
-         for (int iket=ibra; iket<tbc.GetNumberKets(); ++iket)
+         Ket & ket = tbc.GetKet(iket);
+         int k = ket.p;
+         int l = ket.q;
+         Orbit & ok = modelspace->GetOrbit(k);
+         Orbit & ol = modelspace->GetOrbit(l);
+         int itz_ijkl = 8*(oi.tz2>0) + 4*(oj.tz2>0) + 2*(ok.tz2>0) + (ol.tz2>0);
+         double Gamma_ijkl = 0;
+         for (auto& a : modelspace->holes)
          {
-            Ket & ket = tbc.GetKet(iket);
-            int k = ket.p;
-            int l = ket.q;
-            Orbit & ok = modelspace->GetOrbit(k);
-            Orbit & ol = modelspace->GetOrbit(l);
-            for (auto& a : modelspace->holes)
+            Orbit & oa = modelspace->GetOrbit(a);
+            if ( (2*(oi.n+oj.n+oa.n)+oi.l+oj.l+oa.l)>E3max) continue;
+            if ( (2*(ok.n+ol.n+oa.n)+ok.l+ol.l+oa.l)>E3max) continue;
+            auto& recoupling = isospin_recoupling[2*itz_ijkl + (oa.tz2>0)];
+            int kmin2 = std::abs(2*tbc.J-oa.j2);
+            int kmax2 = 2*tbc.J+oa.j2;
+            for (int K2=kmin2; K2<=kmax2; K2+=2)
             {
-               Orbit & oa = modelspace->GetOrbit(a);
-               if ( (2*(oi.n+oj.n+oa.n)+oi.l+oj.l+oa.l)>E3max) continue;
-               if ( (2*(ok.n+ol.n+oa.n)+ok.l+ol.l+oa.l)>E3max) continue;
-               int kmin2 = std::abs(2*tbc.J-oa.j2);
-               int kmax2 = 2*tbc.J+oa.j2;
-               for (int K2=kmin2; K2<=kmax2; K2+=2)
+               double Vpn = 0;
+               for (auto& iso : recoupling)
                {
-                  Gamma(ibra,iket) += (K2+1) * oa.occ * ThreeBody.GetME_pn(tbc.J,tbc.J,K2,i,j,a,k,l,a); // This is unnormalized, but it should be normalized!!!!
+                  Vpn += iso.second * ThreeBody.GetME(tbc.J,tbc.J,K2,iso.first[0],iso.first[1],iso.first[2],i,j,a,k,l,a);
                }
+               Gamma_ijkl += (K2+1) * oa.occ * ThreeBME_type(Vpn); // This is unnormalized, but it should be normalized!!!!
             }
-            Gamma(ibra,iket) /= (2*tbc.J+1)* sqrt((1+bra.delta_pq())*(1+ket.delta_pq()));
          }
+         Gamma(ibra,iket) = Gamma_ijkl / ((2*tbc.J+1)* sqrt((1+bra.delta_pq())*(1+ket.delta_pq())));
       }
    }
    opNO3.Symmetrize();
@@ -600,6 +647,11 @@ Operator Operator::UndoNormalOrdering() const
 /// A corresponding ModelSpace object must be
 /// created at the appropriate scope. That's why
 /// the new operator is passed as a 
+/// reference. Orbits have the same index in both
+/// model spaces, but kets don't, since the ket index
+/// depends on the number of orbits. So the kets are
+/// matched up through their orbit indices.
+/// Only for scalar two-body operators, see Embed().
 //********************************************
 Operator Operator::Truncate(ModelSpace& ms_new)
 {
@@ -632,7 +684,8 @@ Operator Operator::Truncate(ModelSpace& ms_new)
     arma::uvec ibra_old(nkets);
     for (int ibra=0;ibra<nkets;++ibra)
     {
-      ibra_old(ibra) = tbc.GetLocalIndex(tbc_new.GetKetIndex(ibra));
+      Ket& ket_new = tbc_new.GetKet(ibra); // ket indices depend on the number of orbits, so go through the orbit indices
+      ibra_old(ibra) = tbc.GetLocalIndex(ket_new.p, ket_new.q);
     }
     Mat_new = Mat.submat(ibra_old,ibra_old);
   }
@@ -640,6 +693,168 @@ Operator Operator::Truncate(ModelSpace& ms_new)
 }
 
 
+// The mirror images of the kets in channel tbc, which are in channel ch_mirror: M|pq> = sign |p'q'>,
+// where the sign comes from putting p'q' in the stored order. Orbits are indexed so that the mirror of orbit i is i^1.
+static void GetMirrorKets(ModelSpace* modelspace, TwoBodyChannel& tbc, int ch_mirror, arma::uvec& mirror_kets, arma::vec& sign)
+{
+  int nkets = tbc.GetNumberKets();
+  TwoBodyChannel& tbc_mirror = modelspace->GetTwoBodyChannel(ch_mirror);
+  mirror_kets.set_size(nkets);
+  sign.set_size(nkets);
+  for (int iket=0; iket<nkets; ++iket)
+  {
+    Ket& ket = tbc.GetKet(iket);
+    int pm = ket.p^1;
+    int qm = ket.q^1;
+    mirror_kets(iket) = tbc_mirror.GetLocalIndex(std::min(pm,qm), std::max(pm,qm));
+    sign(iket) = (pm<=qm) ? 1 : tbc_mirror.GetKet(mirror_kets(iket)).Phase(tbc.J);
+  }
+}
+
+/// Replace the operator by the average of itself and its mirror image, with protons and neutrons swapped,
+/// and flag it as charge symmetric, so the commutators can use the isospin symmetry (see ConstructScalarMpp_Mhh()).
+/// Returns the norm of the charge-symmetry breaking part which was dropped. Only for scalar operators, and the three-body part is untouched.
+double Operator::MakeChargeSymmetric()
+{
+  if (rank_J+rank_T+parity > 0)
+  {
+    cout << "Error: MakeChargeSymmetric() is only implemented for scalar operators" << endl;
+    return 0;
+  }
+  // Orbits are indexed so that the mirror of orbit i is i^1
+  int norb = modelspace->GetNumberOrbits();
+  arma::uvec mirror_orbits(norb);
+  for (int i=0; i<norb; ++i) mirror_orbits(i) = i^1;
+  Operator breaking(*modelspace,0,0,0,2);
+  breaking.OneBody = 0.5 * ( OneBody - OneBody.submat(mirror_orbits,mirror_orbits) );
+  for (auto& itmat : TwoBody.MatEl)
+  {
+    int ch = itmat.first[0];
+    TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
+    int ch_mirror = modelspace->GetTwoBodyChannelIndex(tbc.J, tbc.parity, -tbc.Tz);
+    arma::uvec mirror_kets;
+    arma::vec sign;
+    GetMirrorKets(modelspace, tbc, ch_mirror, mirror_kets, sign);
+    arma::mat mirror = TwoBody.GetMatrix(ch_mirror,ch_mirror).submat(mirror_kets,mirror_kets) % (sign * sign.t());
+    breaking.TwoBody.GetMatrix(ch,ch) = 0.5 * (itmat.second - mirror);
+  }
+  OneBody -= breaking.OneBody;
+  TwoBody -= breaking.TwoBody;
+  charge_symmetric = true;
+  return breaking.Norm();
+}
+
+/// Check that the one- and two-body parts are unchanged, to within tol, by swapping protons and neutrons.
+/// The charge_symmetric flag isn't cleared when the matrix elements are modified directly (e.g. with TwoBody.SetTBME()
+/// or through the python views), so ConstructScalarMpp_Mhh() checks this before it relies on the flag.
+/// Stops at the first element which breaks the symmetry, so it's cheap compared to a commutator.
+bool Operator::CheckChargeSymmetric(double tol) const
+{
+  if (rank_J+rank_T+parity > 0) return false;
+  int norb = modelspace->GetNumberOrbits();
+  if (norb%2 != 0) return false;
+  for (int i=0; i<norb; ++i)
+  {
+    for (int j=0; j<norb; ++j)
+    {
+      if (std::abs(OneBody(i,j) - OneBody(i^1,j^1)) > tol) return false;
+    }
+  }
+  for (auto& itmat : TwoBody.MatEl)
+  {
+    int ch = itmat.first[0];
+    TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
+    if (tbc.Tz > 0) continue; // already compared with its mirror
+    int ch_mirror = modelspace->GetTwoBodyChannelIndex(tbc.J, tbc.parity, -tbc.Tz);
+    arma::uvec mirror_kets;
+    arma::vec sign;
+    GetMirrorKets(modelspace, tbc, ch_mirror, mirror_kets, sign);
+    const arma::mat& M = itmat.second;
+    const arma::mat& M_mirror = TwoBody.GetMatrix(ch_mirror,ch_mirror);
+    int nkets = tbc.GetNumberKets();
+    for (int j=0; j<nkets; ++j)
+    {
+      for (int i=0; i<nkets; ++i)
+      {
+        if (std::abs(M(i,j) - sign(i)*sign(j)*M_mirror(mirror_kets(i),mirror_kets(j))) > tol) return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+/// Returns the operator in the model space ms_new, which may have a larger or smaller emax
+/// than the current one. The orbits common to both spaces must have the same indices (which
+/// is the case when they are built the usual way). Matrix elements involving orbits that are only
+/// in ms_new are set to zero. Unlike Truncate(), this also works for tensor operators.
+/// The three-body part is not carried over. If the orbits don't line up, there is no sensible
+/// answer, so this throws std::invalid_argument rather than hand back an operator of zeros.
+Operator Operator::Embed(ModelSpace& ms_new)
+{
+  Operator OpNew(ms_new, rank_J, rank_T, parity, min(particle_rank,2));
+  OpNew.ZeroBody = ZeroBody;
+  OpNew.hermitian = hermitian;
+  OpNew.antihermitian = antihermitian;
+  if (particle_rank > 2)
+    cout << "Warning: Operator::Embed doesn't embed the three-body part" << endl;
+
+  int norb = min( ms_new.GetNumberOrbits(), modelspace->GetNumberOrbits() );
+  for (int i=0;i<norb;++i)
+  {
+    Orbit& oi = modelspace->GetOrbit(i);
+    Orbit& oi_new = ms_new.GetOrbit(i);
+    if (oi.n!=oi_new.n or oi.l!=oi_new.l or oi.j2!=oi_new.j2 or oi.tz2!=oi_new.tz2)
+    {
+      throw invalid_argument("Operator::Embed: orbit " + to_string(i) + " is not the same in both model spaces");
+    }
+  }
+  OpNew.OneBody.submat(0,0,norb-1,norb-1) = OneBody.submat(0,0,norb-1,norb-1);
+
+  int nch_old = modelspace->GetNumberTwoBodyChannels();
+  auto find_old_channel = [&](TwoBodyChannel& tbc_new)
+  {
+    int ch = modelspace->GetTwoBodyChannelIndex(tbc_new.J,tbc_new.parity,tbc_new.Tz);
+    if (ch<0 or ch>=nch_old) return -1;
+    TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
+    if (tbc.J!=tbc_new.J or tbc.parity!=tbc_new.parity or tbc.Tz!=tbc_new.Tz) return -1;
+    return ch;
+  };
+  // local indices of the kets of tbc_new which are also in tbc_old, in both channels
+  auto common_kets = [&](TwoBodyChannel& tbc_new, TwoBodyChannel& tbc_old, arma::uvec& ind_new, arma::uvec& ind_old)
+  {
+    vector<arma::uword> inew,iold;
+    for (int iket=0;iket<tbc_new.GetNumberKets();++iket)
+    {
+      Ket& ket = tbc_new.GetKet(iket);
+      if (ket.p>=norb or ket.q>=norb) continue;
+      int iket_old = tbc_old.GetLocalIndex(ket.p,ket.q);
+      if (iket_old<0 or iket_old>=tbc_old.GetNumberKets()) continue;
+      inew.push_back(iket);
+      iold.push_back(iket_old);
+    }
+    ind_new = arma::uvec(inew);
+    ind_old = arma::uvec(iold);
+  };
+
+  for (auto& itmat : OpNew.TwoBody.MatEl )
+  {
+    TwoBodyChannel& tbc_bra_new = ms_new.GetTwoBodyChannel(itmat.first[0]);
+    TwoBodyChannel& tbc_ket_new = ms_new.GetTwoBodyChannel(itmat.first[1]);
+    int chbra = find_old_channel(tbc_bra_new);
+    int chket = find_old_channel(tbc_ket_new);
+    if (chbra<0 or chket<0) continue;
+    auto it_old = TwoBody.MatEl.find({chbra,chket});
+    if (it_old == TwoBody.MatEl.end()) continue;
+    arma::uvec bra_new,bra_old,ket_new,ket_old;
+    common_kets(tbc_bra_new, modelspace->GetTwoBodyChannel(chbra), bra_new, bra_old);
+    common_kets(tbc_ket_new, modelspace->GetTwoBodyChannel(chket), ket_new, ket_old);
+    if (bra_new.n_elem==0 or ket_new.n_elem==0) continue;
+    itmat.second.submat(bra_new,ket_new) = it_old->second.submat(bra_old,ket_old);
+  }
+  return OpNew;
+}
+
 
 ModelSpace* Operator::GetModelSpace()
 {
@@ -801,7 +1016,7 @@ void Operator::Eye()
 ///
 double Operator::GetMP2_Energy()
 {
-   double t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("GetMP2_Energy");
    double Emp2 = 0;
    int nparticles = modelspace->particles.size();
    #pragma omp parallel for reduction(+:Emp2)
@@ -839,7 +1054,6 @@ double Operator::GetMP2_Energy()
        }
      }
    }
-   profiler.timer["GetMP2_Energy"] += omp_get_wtime() - t_start;
    return Emp2;
 }
 
@@ -855,7 +1069,7 @@ double Operator::GetMP2_Energy()
 double Operator::GetMP3_Energy()
 {
    // So far, the pp and hh parts seem to work. No such luck for the ph.
-   double t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("GetMP3_Energy");
    double Emp3 = 0;
    // This can certainly be optimized, but I'll wait until this is the bottleneck.
    int nch = modelspace->GetNumberTwoBodyChannels();
@@ -976,7 +1190,6 @@ double Operator::GetMP3_Energy()
    } // for i
 
 
-   profiler.timer["GetMP3_Energy"] += omp_get_wtime() - t_start;
    return Emp3;
 }
 
@@ -984,7 +1197,7 @@ double Operator::GetMP3_Energy()
 /*
 double Operator::GetMP3_Energy()
 {
-   double t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("GetMP3_Energy");
    double Emp3 = 0;
    // This can certainly be optimized, but I'll wait until this is the bottleneck.
    index_t nholes = modelspace->holes.size();
@@ -1042,7 +1255,6 @@ double Operator::GetMP3_Energy()
      }
    }
 
-   profiler.timer["GetMP3_Energy"] += omp_get_wtime() - t_start;
    return Emp3;
 }
 */
@@ -1126,6 +1338,7 @@ double Operator::MP1_Eval(Operator& H)
 /// with all commutators truncated at the two-body level.
 Operator Operator::BCH_Transform( const Operator &Omega)
 {
+   if (Omega.GetParticleRank()==1 and particle_rank<3 and rank_J==0 and rank_T==0 and parity==0) return OneBody_BCH_Transform( Omega );
    return use_brueckner_bch ? Brueckner_BCH_Transform( Omega ) :  Standard_BCH_Transform( Omega );
 }
 
@@ -1135,7 +1348,7 @@ Operator Operator::BCH_Transform( const Operator &Omega)
 /// with all commutators truncated at the two-body level.
 Operator Operator::Standard_BCH_Transform( const Operator &Omega)
 {
-   double t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("BCH_Transform");
    int max_iter = 40;
    int warn_iter = 12;
    double nx = Norm();
@@ -1185,7 +1398,6 @@ Operator Operator::Standard_BCH_Transform( const Operator &Omega)
         else if (i == max_iter)   cout << "Warning: BCH_Transform didn't coverge after "<< max_iter << " nested commutators" << endl;
      }
    }
-   profiler.timer["BCH_Transform"] += omp_get_wtime() - t_start;
    return OpOut;
 }
 
@@ -1196,7 +1408,7 @@ Operator Operator::Standard_BCH_Transform( const Operator &Omega)
 // 
 void Operator::GooseTankUpdate( const Operator& Omega, const Operator& OpNested)
 {
-   double t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("GooseTankUpdate");
    auto& goosetank_chi = *this;
    goosetank_chi.EraseOneBody();
    if (this->rank_J==0 )
@@ -1218,14 +1430,13 @@ void Operator::GooseTankUpdate( const Operator& Omega, const Operator& OpNested)
       goosetank_chi.OneBody(i,j) *=  oi.occ*oj.occ + (1.0-oi.occ)*(1.0-oj.occ) ;
       }
    }
-   profiler.timer["GooseTankUpdate"] += omp_get_wtime() - t_start;
 }
 
 
 /*
 Operator Operator::Standard_BCH_Transform( const Operator &Omega)
 {
-   double t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("BCH_Transform");
    int max_iter = 40;
    int warn_iter = 12;
    double nx = Norm();
@@ -1254,7 +1465,6 @@ Operator Operator::Standard_BCH_Transform( const Operator &Omega)
         else if (i == max_iter)   cout << "Warning: BCH_Transform didn't coverge after "<< max_iter << " nested commutators" << endl;
      }
    }
-   profiler.timer["BCH_Transform"] += omp_get_wtime() - t_start;
    return OpOut;
 }
 
@@ -1274,12 +1484,76 @@ Operator Operator::Brueckner_BCH_Transform( const Operator &Omega)
    Omega1.SetParticleRank(1);
    Omega1.EraseTwoBody();
    Omega2.EraseOneBody();
-   Operator OpOut = this->Standard_BCH_Transform(Omega1);
+   bool scalar = (rank_J==0 and rank_T==0 and parity==0);
+   Operator OpOut = (scalar and particle_rank<3) ? this->OneBody_BCH_Transform(Omega1) : this->Standard_BCH_Transform(Omega1);
    OpOut = OpOut.Standard_BCH_Transform(Omega2);
    return OpOut;
 }
 
 
+/// X.OneBody_BCH_Transform(Y) returns \f$ Z = e^{Y} X e^{-Y} \f$ for a one-body \f$ Y \f$.
+/// In this case the BCH series doesn't get truncated, and \f$ e^{Y} \f$ is just a rotation of the single-particle basis.
+/// So rather than summing nested commutators, we undo the normal ordering, transform the one-body part with
+/// \f$ U=e^{Y} \f$ as \f$ U X U^{-1} \f$ and the two-body part with the matrices
+/// \f$ D(ij,ab) = \langle ij | ab \rangle \f$, like in HartreeFock::TransformToHFBasis(), and normal order again.
+/// Any two-body part of Y is ignored. This relies on the normal ordering, so it's only used automatically
+/// in BCH_Transform() for scalar two-body operators.
+Operator Operator::OneBody_BCH_Transform( const Operator &Omega)
+{
+   IMSRGProfiler::ScopedTimer st("OneBody_BCH_Transform");
+   // the basis rotation is done in the vacuum-normal-ordered form
+   Operator OpOut = this->UndoNormalOrdering();
+   arma::mat U = arma::expmat( Omega.OneBody );
+   arma::mat Uinv = arma::expmat( -Omega.OneBody );
+   OpOut.OneBody = U * OpOut.OneBody * Uinv;
+
+   // Build D for the bra (rotated by U^T) and the ket (rotated by U^-1) of each channel.
+   int nch = modelspace->GetNumberTwoBodyChannels();
+   vector<arma::mat> Dbra(nch), Dket(nch);
+   #pragma omp parallel for schedule(dynamic,1)
+   for (int ch=0; ch<nch; ++ch)
+   {
+      TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
+      int nkets = tbc.GetNumberKets();
+      Dbra[ch].zeros(nkets,nkets);
+      Dket[ch].zeros(nkets,nkets);
+      for (int i=0; i<nkets; ++i)
+      {
+         Ket & ket_old = tbc.GetKet(i);
+         for (int j=0; j<nkets; ++j)
+         {
+            Ket & ket_new = tbc.GetKet(j);
+            double dbra = U(ket_new.p,ket_old.p) * U(ket_new.q,ket_old.q);
+            double dket = Uinv(ket_old.p,ket_new.p) * Uinv(ket_old.q,ket_new.q);
+            if (ket_old.p!=ket_old.q)
+            {
+               dbra += U(ket_new.p,ket_old.q) * U(ket_new.q,ket_old.p) * ket_old.Phase(tbc.J);
+               dket += Uinv(ket_old.q,ket_new.p) * Uinv(ket_old.p,ket_new.q) * ket_old.Phase(tbc.J);
+            }
+            double norm = 1.0;
+            if (ket_old.p==ket_old.q) norm *= SQRT2;
+            if (ket_new.p==ket_new.q) norm /= SQRT2;
+            Dbra[ch](i,j) = dbra * norm;
+            Dket[ch](i,j) = dket * norm;
+         }
+      }
+   }
+
+   vector<map<array<int,2>,arma::mat>::iterator> iteratorlist;
+   for (auto iter=OpOut.TwoBody.MatEl.begin(); iter!=OpOut.TwoBody.MatEl.end(); ++iter) iteratorlist.push_back(iter);
+   OpOut.TwoBody.ClearBlockStructure();
+   int nmat = iteratorlist.size();
+   #pragma omp parallel for schedule(dynamic,1)
+   for (int imat=0; imat<nmat; ++imat)
+   {
+      auto& itmat = *iteratorlist[imat];
+      itmat.second = Dbra[itmat.first[0]].t() * itmat.second * Dket[itmat.first[1]];
+   }
+
+   return OpOut.DoNormalOrdering();
+}
+
+
 //*****************************************************************************************
 // Baker-Campbell-Hausdorff formula
 //  returns Z, where
@@ -1296,7 +1570,7 @@ Operator Operator::Brueckner_BCH_Transform( const Operator &Omega)
 //*****************************************************************************************
 Operator Operator::BCH_Product(  Operator &Y)
 {
-   double tstart = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("BCH_Product");
    Operator& X = *this;
    double nx = X.Norm();
    vector<double> bernoulli = {1.0, -0.5, 1./6, 0.0, -1./30,  0.0 ,  1./42,     0,  -1./30};
@@ -1348,7 +1622,6 @@ Operator Operator::BCH_Product(  Operator &Y)
      k++;
    }
 
-   profiler.timer["BCH_Product"] += omp_get_wtime() - tstart;
    return Z;
 }
 
@@ -1427,7 +1700,7 @@ void Operator::ChangeNormalization(double factor)
 
 double Operator::Trace(int Atrace, int Ztrace) const
 {
-  double t_start = omp_get_wtime();
+  IMSRGProfiler::ScopedTimer st("Operator::Trace");
   int Ntrace = Atrace - Ztrace;
   Operator OpVac = UndoNormalOrdering();
   double trace = OpVac.ZeroBody;
@@ -1463,7 +1736,6 @@ double Operator::Trace(int Atrace, int Ztrace) const
       default: cout << "AAAHHH blew the switch statement. tbc.Tz = " << tbc.Tz << endl;
     }
   }
-  profiler.timer["Operator::Trace"] += omp_get_wtime() - t_start;
   return trace;
 }
 
@@ -1574,7 +1846,7 @@ Operator Commutator( const Operator& X, const Operator& Y)
 void Operator::SetToCommutator( const Operator& X, const Operator& Y)
 {
 //   profiler.counter["N_Commutators"] += 1;
-   double t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("Commutator");
    Operator& Z = *this;
    modelspace->PreCalculateSixJ();
    int xrank = X.rank_J + X.rank_T + X.parity;
@@ -1601,7 +1873,6 @@ void Operator::SetToCommutator( const Operator& X, const Operator& Y)
       cout <<                        "  Y.rank_J = " << Y.rank_J << "  Y.rank_T = " << Y.rank_T << "  Y.parity = " << Y.parity << endl;
       cout << " Tensor-Tensor commutator not yet implemented." << endl;
    }
-   profiler.timer["Commutator"] += omp_get_wtime() - t_start;
 }
 
 
@@ -1609,8 +1880,8 @@ void Operator::SetToCommutator( const Operator& X, const Operator& Y)
 /// Should be called through Commutator()
 void Operator::CommutatorScalarScalar( const Operator& X, const Operator& Y) 
 {
-   profiler.counter["N_ScalarCommutators"] += 1;
-   double t_css = omp_get_wtime();
+   IMSRGProfiler::IncrementCounter("N_ScalarCommutators");
+   IMSRGProfiler::ScopedTimer st("CommutatorScalarScalar");
    Operator& Z = *this;
    Z = X.GetParticleRank()>Y.GetParticleRank() ? X : Y;
    Z.EraseZeroBody();
@@ -1620,6 +1891,7 @@ void Operator::CommutatorScalarScalar( const Operator& X, const Operator& Y)
    if ( (X.IsHermitian() and Y.IsHermitian()) or (X.IsAntiHermitian() and Y.IsAntiHermitian()) ) Z.SetAntiHermitian();
    else if ( (X.IsHermitian() and Y.IsAntiHermitian()) or (X.IsAntiHermitian() and Y.IsHermitian()) ) Z.SetHermitian();
    else Z.SetNonHermitian();
+   Z.SetChargeSymmetric( X.IsChargeSymmetric() and Y.IsChargeSymmetric() );
 
    if ( not Z.IsAntiHermitian() )
    {
@@ -1628,27 +1900,29 @@ void Operator::CommutatorScalarScalar( const Operator& X, const Operator& Y)
         Z.comm220ss(X, Y) ;
    }
 
-   double t_start = omp_get_wtime();
-   Z.comm111ss(X, Y);
-   profiler.timer["comm111ss"] += omp_get_wtime() - t_start;
-
-    t_start = omp_get_wtime();
-   Z.comm121ss(X,Y);
-   profiler.timer["comm121ss"] += omp_get_wtime() - t_start;
-
-    t_start = omp_get_wtime();
-   Z.comm122ss(X,Y); 
-   profiler.timer["comm122ss"] += omp_get_wtime() - t_start;
+   {
+     IMSRGProfiler::ScopedTimer st_comm("comm111ss");
+     Z.comm111ss(X, Y);
+   }
+   {
+     IMSRGProfiler::ScopedTimer st_comm("comm121ss");
+     Z.comm121ss(X,Y);
+   }
+   {
+     IMSRGProfiler::ScopedTimer st_comm("comm122ss");
+     Z.comm122ss(X,Y); 
+   }
 
    if (X.particle_rank>1 and Y.particle_rank>1)
    {
-     t_start = omp_get_wtime();
-     Z.comm222_pp_hh_221ss(X, Y);
-     profiler.timer["comm222_pp_hh_221ss"] += omp_get_wtime() - t_start;
-      
-     t_start = omp_get_wtime();
-     Z.comm222_phss(X, Y);
-     profiler.timer["comm222_phss"] += omp_get_wtime() - t_start;
+     {
+       IMSRGProfiler::ScopedTimer st_comm("comm222_pp_hh_221ss");
+       Z.comm222_pp_hh_221ss(X, Y);
+     }
+     {
+       IMSRGProfiler::ScopedTimer st_comm("comm222_phss");
+       Z.comm222_phss(X, Y);
+     }
    }
 
 
@@ -1657,7 +1931,6 @@ void Operator::CommutatorScalarScalar( const Operator& X, const Operator& Y)
    else if (Z.IsAntiHermitian() )
       Z.AntiSymmetrize();
 
-   profiler.timer["CommutatorScalarScalar"] += omp_get_wtime() - t_css;
 
 }
 
@@ -1666,8 +1939,8 @@ void Operator::CommutatorScalarScalar( const Operator& X, const Operator& Y)
 /// Should be called through Commutator()
 void Operator::CommutatorScalarTensor( const Operator& X, const Operator& Y) 
 {
-   profiler.counter["N_TensorCommutators"] += 1;
-   double t_cst = omp_get_wtime();
+   IMSRGProfiler::IncrementCounter("N_TensorCommutators");
+   IMSRGProfiler::ScopedTimer st("CommutatorScalarTensor");
    Operator& Z = *this;
    Z = Y; // This ensures the commutator has the same tensor rank as Y
    Z.EraseZeroBody();
@@ -1677,28 +1950,16 @@ void Operator::CommutatorScalarTensor( const Operator& X, const Operator& Y)
    if ( (X.IsHermitian() and Y.IsHermitian()) or (X.IsAntiHermitian() and Y.IsAntiHermitian()) ) Z.SetAntiHermitian();
    else if ( (X.IsHermitian() and Y.IsAntiHermitian()) or (X.IsAntiHermitian() and Y.IsHermitian()) ) Z.SetHermitian();
    else Z.SetNonHermitian();
+   Z.SetChargeSymmetric( X.IsChargeSymmetric() and Y.IsChargeSymmetric() );
 
-   double t_start = omp_get_wtime();
-//   cout << "comm111st" << endl;
    Z.comm111st(X, Y);
-   profiler.timer["comm111st"] += omp_get_wtime() - t_start;
-//   cout << "comm121st" << endl;
-   t_start = omp_get_wtime();
    Z.comm121st(X, Y);
-   profiler.timer["comm121st"] += omp_get_wtime() - t_start;
-
-//   cout << "comm122st" << endl;
-   t_start = omp_get_wtime();
    Z.comm122st(X, Y);
-   profiler.timer["comm122st"] += omp_get_wtime() - t_start;
-//   cout << "comm222_pp_hh_st" << endl;
-   t_start = omp_get_wtime();
    Z.comm222_pp_hh_221st(X, Y);
-   profiler.timer["comm222_pp_hh_221st"] += omp_get_wtime() - t_start;
-//   cout << "comm222_phst" << endl;
-   t_start = omp_get_wtime();
-   Z.comm222_phst(X, Y);
-   profiler.timer["comm222_phst"] += omp_get_wtime() - t_start;
+   {
+     IMSRGProfiler::ScopedTimer st_comm("comm222_phst");
+     Z.comm222_phst(X, Y);
+   }
 
 //   cout << "symmetrize" << endl;
    if ( Z.IsHermitian() )
@@ -1706,7 +1967,6 @@ void Operator::CommutatorScalarTensor( const Operator& X, const Operator& Y)
    else if (Z.IsAntiHermitian() )
       Z.AntiSymmetrize();
 //   cout << "done." << endl;
-   profiler.timer["CommutatorScalarTensor"] += omp_get_wtime() - t_cst;
 //   return Z;
 }
 
@@ -1893,12 +2153,12 @@ void Operator::comm121ss( const Operator& X, const Operator& Y)
 void Operator::comm221ss( const Operator& X, const Operator& Y) 
 {
 
-   double t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("comm221ss");
    Operator& Z = *this;
    int norbits = modelspace->GetNumberOrbits();
 
-   static TwoBodyME Mpp = Y.TwoBody;
-   static TwoBodyME Mhh = Y.TwoBody;
+   TwoBodyME Mpp = Y.TwoBody;
+   TwoBodyME Mhh = Y.TwoBody;
 
    // Don't use omp, because the matrix multiplication is already
    // parallelized by armadillo.
@@ -1984,7 +2244,6 @@ void Operator::comm221ss( const Operator& X, const Operator& Y)
       } // for j
    }
 
-   profiler.timer["comm221ss"] += omp_get_wtime() - t_start;
 
 }
 
@@ -2132,10 +2391,10 @@ void Operator::comm222_pp_hhss( const Operator& X, const Operator& Y )
 {
    Operator& Z = *this;
 
-   static TwoBodyME Mpp = Z.TwoBody;
-   static TwoBodyME Mhh = Z.TwoBody;
+   TwoBodyME Mpp = Z.TwoBody;
+   TwoBodyME Mhh = Z.TwoBody;
 
-   double t = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("pphh TwoBody bit");
    // Don't use omp, because the matrix multiplication is already
    // parallelized by armadillo.
    int nch = modelspace->SortedTwoBodyChannels.size();
@@ -2193,7 +2452,6 @@ void Operator::comm222_pp_hhss( const Operator& X, const Operator& Y )
       // The two body part
       OUT += Matrixpp - Matrixhh;
    } //for ch
-   profiler.timer["pphh TwoBody bit"] += omp_get_wtime() - t;
 }
 
 
@@ -2203,14 +2461,96 @@ void Operator::comm222_pp_hhss( const Operator& X, const Operator& Y )
 
 
 
+/// Return A*U, where U is the transformation to the MirrorBasis mb. Each column of U has at most two nonzero entries,
+/// so this is just a combination of columns of A, and is much cheaper than a matrix multiplication.
+static arma::mat MultiplyMirrorU(const arma::mat& A, const MirrorBasis& mb)
+{
+  arma::mat AU(A.n_rows, mb.ket[0].n_elem);
+  for (index_t c=0; c<AU.n_cols; ++c)
+    AU.col(c) = mb.coeff[0](c) * A.col(mb.ket[0](c)) + mb.coeff[1](c) * A.col(mb.ket[1](c));
+  return AU;
+}
+
+/// Return A*U.t(), the inverse of MultiplyMirrorU().
+static arma::mat MultiplyMirrorUt(const arma::mat& A, const MirrorBasis& mb)
+{
+  arma::mat AUt(A.n_rows, A.n_cols, arma::fill::zeros);
+  for (index_t c=0; c<A.n_cols; ++c)
+  {
+    AUt.col(mb.ket[0](c)) += mb.coeff[0](c) * A.col(c);
+    AUt.col(mb.ket[1](c)) += mb.coeff[1](c) * A.col(c);
+  }
+  return AUt;
+}
+
+/// Add sign * A * diag(w) * B to Mpp and Mhh, as in ConstructScalarMpp_Mhh(), for a Tz=0 channel in the MirrorBasis mb.
+/// A and B are already transformed to that basis, where they are block diagonal, so the two blocks are multiplied separately.
+static void AddMirrorBlockProducts(arma::mat& Mpp, arma::mat& Mhh, const arma::mat& A, const arma::mat& B, const MirrorBasis& mb, double sign)
+{
+  for (int b=0; b<2; ++b)
+  {
+    if (mb.dim[b]<1) continue;
+    arma::span block(mb.offset[b], mb.offset[b]+mb.dim[b]-1);
+    arma::mat Ab = A(block,block);
+    arma::mat Bb = B(block,block);
+    const arma::uvec& kets_pp = mb.kets_pp[b];
+    const arma::uvec& kets_hh = mb.kets_hh[b];
+    const arma::uvec& kets_ph = mb.kets_ph[b];
+    arma::mat Mpp_b = Ab.cols(kets_pp) * Bb.rows(kets_pp);
+    if (kets_hh.size()>0)
+    {
+      Mpp_b += Ab.cols(kets_hh) * arma::diagmat(mb.unocc_hh[b]) * Bb.rows(kets_hh);
+      Mhh(block,block) += sign * Ab.cols(kets_hh) * arma::diagmat(mb.occ_hh[b]) * Bb.rows(kets_hh);
+    }
+    if (kets_ph.size()>0)
+      Mpp_b += Ab.cols(kets_ph) * arma::diagmat(mb.unocc_ph[b]) * Bb.rows(kets_ph);
+    Mpp(block,block) += sign * Mpp_b;
+  }
+}
+
+/// Add sign * A * diag(w) * B to OUT in channel tbc, where the sum runs over the kets flagged by in_sum.
+/// Either A (sparse_left=true) or B is block-sparse, with the nonzero blocks given by blocks,
+/// so we only multiply the blocks which can contribute.
+static void AddBlockSparseProduct(arma::mat& OUT, const arma::mat& A, const arma::mat& B, const arma::vec& w, const arma::uvec& in_sum,
+                                  const std::vector<std::array<int,2>>& blocks, bool sparse_left, const TwoBodyChannel& tbc, double sign)
+{
+  int outer_side = sparse_left ? 0 : 1;
+  for (int k=0; k<TwoBodyME::nKetClasses; ++k)
+  {
+    const arma::uvec& outer = TwoBodyME::GetKetIndexByClass(tbc,k);
+    if (outer.size()<1) continue;
+    // collect the summed kets which are connected to class k by a nonzero block
+    arma::uvec inner;
+    for (auto& block : blocks)
+    {
+      if (block[outer_side] != k) continue;
+      const arma::uvec& kets = TwoBodyME::GetKetIndexByClass(tbc,block[1-outer_side]);
+      arma::uvec kets_in_sum = kets.elem( arma::find( in_sum.elem(kets) ) );
+      inner = arma::join_cols(inner, kets_in_sum);
+    }
+    if (inner.size()<1) continue;
+    if (sparse_left)
+      OUT.rows(outer) += sign * A.submat(outer,inner) * arma::diagmat(w.elem(inner)) * B.rows(inner);
+    else
+      OUT.cols(outer) += sign * A.cols(inner) * arma::diagmat(w.elem(inner)) * B.submat(inner,outer);
+  }
+}
+
 void Operator::ConstructScalarMpp_Mhh(const Operator& X, const Operator& Y, TwoBodyME& Mpp, TwoBodyME& Mhh) const
 {
+   IMSRGProfiler::ScopedTimer st("ConstructScalarMpp_Mhh");
    int nch = modelspace->SortedTwoBodyChannels.size();
 //   Operator& Z = *this;
    bool z_is_hermitian = IsHermitian();
    bool z_is_antihermitian = IsAntiHermitian();
 //   bool z_is_hermitian = X.IsHermitian() xor Y.IsHermitian();
 //   bool z_is_antihermitian = (X.IsHermitian() == Y.IsHermitian()) and (X.IsAntiHermitian() == Y.IsAntiHermitian());
+   // If X and Y are charge symmetric, the Tz=+1 channels are the mirror images of the Tz=-1 channels and are copied
+   // after the loop, and the Tz=0 channels are done in the isospin-coupled MirrorBasis, where they're block diagonal.
+   // The flags are only a hint, since the matrix elements may have been modified since they were set.
+   bool use_mirror = X.IsChargeSymmetric() and Y.IsChargeSymmetric() and modelspace->IsChargeSymmetric();
+   use_mirror = use_mirror and X.CheckChargeSymmetric() and (&Y==&X or Y.CheckChargeSymmetric());
+   if (use_mirror) modelspace->CalculateMirrorBases();
    #ifndef OPENBLAS_NOUSEOMP
    #pragma omp parallel for schedule(dynamic,1)
    #endif
@@ -2218,6 +2558,7 @@ void Operator::ConstructScalarMpp_Mhh(const Operator& X, const Operator& Y, TwoB
    {
       int ch = modelspace->SortedTwoBodyChannels[ich];
       TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
+      if (use_mirror and tbc.Tz==1) continue;
 
       auto& LHS = X.TwoBody.GetMatrix(ch,ch);
       auto& RHS = Y.TwoBody.GetMatrix(ch,ch);
@@ -2232,13 +2573,55 @@ void Operator::ConstructScalarMpp_Mhh(const Operator& X, const Operator& Y, TwoB
       auto& nanb = tbc.Ket_occ_hh;
       auto& nbarnbar_hh = tbc.Ket_unocc_hh;
       auto& nbarnbar_ph = tbc.Ket_unocc_ph;
-      
-      Matrixpp =  LHS.cols(kets_pp) * RHS.rows(kets_pp);
-      Matrixhh =  LHS.cols(kets_hh) * arma::diagmat(nanb) *  RHS.rows(kets_hh) ;
-      if (kets_hh.size()>0)
-        Matrixpp +=  LHS.cols(kets_hh) * arma::diagmat(nbarnbar_hh) *  RHS.rows(kets_hh); 
-      if (kets_ph.size()>0)
-        Matrixpp += LHS.cols(kets_ph) * arma::diagmat(nbarnbar_ph) *  RHS.rows(kets_ph) ;
+
+      // If X or Y is e.g. a generator, it only connects certain classes of kets (see TwoBodyME::FindBlockStructure).
+      // In that case, we do the multiplication block by block and skip the blocks which are zero.
+      bool x_has_blocks = X.TwoBody.HasBlockStructure();
+      bool y_has_blocks = Y.TwoBody.HasBlockStructure();
+      bool in_mirror_basis = use_mirror and tbc.Tz==0 and not (x_has_blocks or y_has_blocks);
+      arma::vec w_pp, w_hh;
+      arma::uvec all_kets, is_hh;
+      if (x_has_blocks or y_has_blocks)
+      {
+        index_t nkets = tbc.GetNumberKets();
+        w_pp.ones(nkets);
+        if (kets_hh.size()>0) w_pp.elem(kets_hh) = nbarnbar_hh;
+        if (kets_ph.size()>0) w_pp.elem(kets_ph) = nbarnbar_ph;
+        w_hh.zeros(nkets);
+        if (kets_hh.size()>0) w_hh.elem(kets_hh) = nanb;
+        all_kets.ones(nkets);
+        is_hh.zeros(nkets);
+        if (kets_hh.size()>0) is_hh.elem(kets_hh).ones();
+
+        Matrixpp.zeros(nkets,nkets);
+        Matrixhh.zeros(nkets,nkets);
+        const auto& blocks = x_has_blocks ? X.TwoBody.GetBlockStructure(ch) : Y.TwoBody.GetBlockStructure(ch);
+        AddBlockSparseProduct(Matrixpp, LHS, RHS, w_pp, all_kets, blocks, x_has_blocks, tbc, 1.0);
+        AddBlockSparseProduct(Matrixhh, LHS, RHS, w_hh, is_hh, blocks, x_has_blocks, tbc, 1.0);
+      }
+      else if (in_mirror_basis)
+      {
+        const MirrorBasis& mb = modelspace->GetMirrorBasis(ch);
+        // U.t() * M * U = ( (M*U).t() * U ).t()
+        arma::mat LHS_mirror = MultiplyMirrorU( MultiplyMirrorU(LHS,mb).t(), mb ).t();
+        arma::mat RHS_mirror = MultiplyMirrorU( MultiplyMirrorU(RHS,mb).t(), mb ).t();
+        arma::mat Mpp_mirror(arma::size(LHS), arma::fill::zeros);
+        arma::mat Mhh_mirror(arma::size(LHS), arma::fill::zeros);
+        AddMirrorBlockProducts(Mpp_mirror, Mhh_mirror, LHS_mirror, RHS_mirror, mb, 1.0);
+        if (not (z_is_hermitian or z_is_antihermitian))
+          AddMirrorBlockProducts(Mpp_mirror, Mhh_mirror, RHS_mirror, LHS_mirror, mb, -1.0);
+        Matrixpp = MultiplyMirrorUt( MultiplyMirrorUt(Mpp_mirror,mb).t(), mb ).t();
+        Matrixhh = MultiplyMirrorUt( MultiplyMirrorUt(Mhh_mirror,mb).t(), mb ).t();
+      }
+      else
+      {
+        Matrixpp =  LHS.cols(kets_pp) * RHS.rows(kets_pp);
+        Matrixhh =  LHS.cols(kets_hh) * arma::diagmat(nanb) *  RHS.rows(kets_hh) ;
+        if (kets_hh.size()>0)
+          Matrixpp +=  LHS.cols(kets_hh) * arma::diagmat(nbarnbar_hh) *  RHS.rows(kets_hh); 
+        if (kets_ph.size()>0)
+          Matrixpp += LHS.cols(kets_ph) * arma::diagmat(nbarnbar_ph) *  RHS.rows(kets_ph) ;
+      }
 
 
       if (z_is_hermitian)
@@ -2251,7 +2634,13 @@ void Operator::ConstructScalarMpp_Mhh(const Operator& X, const Operator& Y, TwoB
          Matrixpp -=  Matrixpp.t();
          Matrixhh -=  Matrixhh.t();
       }
-      else
+      else if (x_has_blocks or y_has_blocks)
+      {
+        const auto& blocks = y_has_blocks ? Y.TwoBody.GetBlockStructure(ch) : X.TwoBody.GetBlockStructure(ch);
+        AddBlockSparseProduct(Matrixpp, RHS, LHS, w_pp, all_kets, blocks, y_has_blocks, tbc, -1.0);
+        AddBlockSparseProduct(Matrixhh, RHS, LHS, w_hh, is_hh, blocks, y_has_blocks, tbc, -1.0);
+      }
+      else if (not in_mirror_basis)
       {
         Matrixpp -=  RHS.cols(kets_pp) * LHS.rows(kets_pp);
         Matrixhh -=  RHS.cols(kets_hh) * arma::diagmat(nanb) *  LHS.rows(kets_hh) ;
@@ -2265,6 +2654,18 @@ void Operator::ConstructScalarMpp_Mhh(const Operator& X, const Operator& Y, TwoB
 //      OUT += Matrixpp - Matrixhh;
    } //for ch
 
+   if (use_mirror)
+   {
+     // kets in the Tz=+1 channel are the mirrors of those in the Tz=-1 channel, in the same order
+     for (int ch=0; ch<nChannels; ++ch)
+     {
+       TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
+       if (tbc.Tz != 1) continue;
+       int ch_mirror = modelspace->GetTwoBodyChannelIndex(tbc.J, tbc.parity, -1);
+       Mpp.GetMatrix(ch,ch) = Mpp.GetMatrix(ch_mirror,ch_mirror);
+       Mhh.GetMatrix(ch,ch) = Mhh.GetMatrix(ch_mirror,ch_mirror);
+     }
+   }
 }
 
 
@@ -2278,10 +2679,10 @@ void Operator::comm222_pp_hh_221ss( const Operator& X, const Operator& Y )
    Operator& Z = *this;
    int norbits = modelspace->GetNumberOrbits();
 
-   static TwoBodyME Mpp = Z.TwoBody;
-   static TwoBodyME Mhh = Z.TwoBody;
+   TwoBodyME Mpp = Z.TwoBody;
+   TwoBodyME Mhh = Z.TwoBody;
 
-   double t = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st_pphh_TwoBody_bit("pphh TwoBody bit");
    ConstructScalarMpp_Mhh( X, Y, Mpp, Mhh);
 /*
    // Don't use omp, because the matrix multiplication is already
@@ -2345,9 +2746,9 @@ void Operator::comm222_pp_hh_221ss( const Operator& X, const Operator& Y )
    Z.TwoBody += Mpp;
    Z.TwoBody -= Mhh;
 //   OUT += Matrixpp - Matrixhh;
-   profiler.timer["pphh TwoBody bit"] += omp_get_wtime() - t;
+   st_pphh_TwoBody_bit.Stop();
 
-   t = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st_pphh_One_Body_bit("pphh One Body bit");
    // The one body part
    #pragma omp parallel for schedule(dynamic,1)
    for (int i=0;i<norbits;++i)
@@ -2378,7 +2779,7 @@ void Operator::comm222_pp_hh_221ss( const Operator& X, const Operator& Y )
          Z.OneBody(i,j) += cijJ /(oi.j2+1.0);
       } // for j
    } // for i
-   profiler.timer["pphh One Body bit"] += omp_get_wtime() - t;
+   st_pphh_One_Body_bit.Stop();
 }
 
 
@@ -2406,6 +2807,8 @@ void Operator::DoPandyaTransformation_SingleChannel(arma::mat& TwoBody_CC_ph, in
    arma::uvec kets_ph = arma::join_cols(tbc_cc.GetKetIndex_hh(), tbc_cc.GetKetIndex_ph() );
    int nph_kets = kets_ph.n_rows;
    int J_cc = tbc_cc.J;
+   // If we know the block structure, skip the recoupling for blocks which are zero
+   bool check_blocks = TwoBody.HasBlockStructure();
 
    if (orientation=="normal") TwoBody_CC_ph.zeros( 2*nph_kets, nKets_cc);
    else if (orientation=="transpose") TwoBody_CC_ph.zeros( nKets_cc, 2*nph_kets);
@@ -2442,6 +2845,7 @@ void Operator::DoPandyaTransformation_SingleChannel(arma::mat& TwoBody_CC_ph, in
 
          int jmin = max(std::abs(ja-jd),std::abs(jc-jb));
          int jmax = min(ja+jd,jc+jb);
+         if (check_blocks and not TwoBody.BlockMayBeNonzero( TwoBodyME::GetKetClass(oa.cvq,od.cvq), TwoBodyME::GetKetClass(oc.cvq,ob.cvq) ) ) jmax = jmin-1;
          double Xbar = 0;
          for (int J_std=jmin; J_std<=jmax; ++J_std)
          {
@@ -2462,6 +2866,7 @@ void Operator::DoPandyaTransformation_SingleChannel(arma::mat& TwoBody_CC_ph, in
          // Exchange (a <-> b) to account for the (n_a - n_b) term
          jmin = max(std::abs(jb-jd),std::abs(jc-ja));
          jmax = min(jb+jd,jc+ja);
+         if (check_blocks and not TwoBody.BlockMayBeNonzero( TwoBodyME::GetKetClass(ob.cvq,od.cvq), TwoBodyME::GetKetClass(oc.cvq,oa.cvq) ) ) jmax = jmin-1;
          Xbar = 0;
          for (int J_std=jmin; J_std<=jmax; ++J_std)
          {
@@ -2802,7 +3207,6 @@ void Operator::comm222_phss( const Operator& X, const Operator& Y )
    int hy = Y.IsHermitian() ? 1 : -1;
 //   Operator Z_debug(Z);
    // Create Pandya-transformed hp and ph matrix elements
-   double t_start = omp_get_wtime();
 //   deque<arma::mat> Y_bar_ph_all (InitializePandya( nChannels, "normal"));
 //   deque<arma::mat> Xt_bar_ph_all (InitializePandya( nChannels, "transpose"));
 
@@ -2813,7 +3217,7 @@ void Operator::comm222_phss( const Operator& X, const Operator& Y )
    // Construct the intermediate matrix Z_bar
    const auto& pandya_lookup = modelspace->GetPandyaLookup(rank_J, rank_T, parity);
    int nch = modelspace->SortedTwoBodyChannels_CC.size();
-   t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st_build_Z_bar("Build Z_bar");
    deque<arma::mat> Z_bar (nChannels );
    vector<bool> lookup_empty(nChannels,true);
    for (int ich=0;ich<nch;++ich)
@@ -2884,8 +3288,24 @@ void Operator::comm222_phss( const Operator& X, const Operator& Y )
 //      arma::mat Z_bar =  Xt_bar_ph * join_horiz(Y_bar_ph, join_vert(Y_bar_ph.tail_rows(halfnry)%PhaseMatY,
 //                                                                    Y_bar_ph.head_rows(halfnry)%PhaseMatY) );
 //      Z_bar[ch] =  Xt_bar_ph * join_horiz(Y_bar_ph, join_vert( Y_bar_ph.tail_rows(nph_kets)%PhaseMatY,
-      Zbar_ch =  Xt_bar_ph * join_horiz(Y_bar_ph, join_vert(   Y_bar_ph.tail_rows(nph_kets)%PhaseMatY,
-                                                               Y_bar_ph.head_rows(nph_kets)%PhaseMatY) );
+      if ( X.TwoBody.HasBlockStructure() )
+      {
+        // X is block-sparse, so only multiply the rows and columns of Xt_bar_ph which are not zero
+        arma::uvec xrows = arma::find( arma::any(Xt_bar_ph,1) );
+        arma::uvec xcols = arma::find( arma::any(Xt_bar_ph,0) );
+        Zbar_ch.zeros( nKets_cc, 2*nKets_cc );
+        if (xrows.size()>0 and xcols.size()>0)
+        {
+          arma::mat Y_bar_full = join_horiz(Y_bar_ph, join_vert(   Y_bar_ph.tail_rows(nph_kets)%PhaseMatY,
+                                                                   Y_bar_ph.head_rows(nph_kets)%PhaseMatY) );
+          Zbar_ch.rows(xrows) = Xt_bar_ph.submat(xrows,xcols) * Y_bar_full.rows(xcols);
+        }
+      }
+      else
+      {
+        Zbar_ch =  Xt_bar_ph * join_horiz(Y_bar_ph, join_vert(   Y_bar_ph.tail_rows(nph_kets)%PhaseMatY,
+                                                                 Y_bar_ph.head_rows(nph_kets)%PhaseMatY) );
+      }
 
 
 
@@ -2913,10 +3333,10 @@ void Operator::comm222_phss( const Operator& X, const Operator& Y )
 
    }
 
-   profiler.timer["Build Z_bar"] += omp_get_wtime() - t_start;
+   st_build_Z_bar.Stop();
 
    // Perform inverse Pandya transform on Z_bar to get Z
-   t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st_inversePandyaTransformation("InversePandyaTransformation");
    Z.AddInversePandyaTransformation(Z_bar);
 //   for (auto& itch : Z_debug.TwoBody.MatEl)
 //   {
@@ -2926,7 +3346,7 @@ void Operator::comm222_phss( const Operator& X, const Operator& Y )
 //   cout << "end of commutator: " << endl << Z.TwoBody.GetMatrix(0).submat(0,0,1,1) << endl << endl << Z_debug.TwoBody.GetMatrix(0).submat(0,0,1,1);
 //   cout << "done with ph commutator" << endl;
    modelspace->scalar_transform_first_pass = false;
-   profiler.timer["InversePandyaTransformation"] += omp_get_wtime() - t_start;
+   st_inversePandyaTransformation.Stop();
 
 }
 
@@ -2956,9 +3376,8 @@ void Operator::comm222_phss( const Operator& X, const Operator& Y )
 // This is no different from the scalar-scalar version
 void Operator::comm111st( const Operator & X, const Operator& Y)
 {
-   double tstart = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("comm111st");
    comm111ss(X,Y);
-   profiler.timer["comm111st"] += omp_get_wtime() - tstart;
 }
 
 
@@ -2979,7 +3398,7 @@ void Operator::comm111st( const Operator & X, const Operator& Y)
 void Operator::comm121st( const Operator& X, const Operator& Y) 
 {
 
-   double tstart = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("comm121st");
    Operator& Z = *this;
    int norbits = modelspace->GetNumberOrbits();
    int Lambda = Z.GetJRank();
@@ -3049,7 +3468,6 @@ void Operator::comm121st( const Operator& X, const Operator& Y)
       }
    }
    
-   profiler.timer["comm121st"] += omp_get_wtime() - tstart;
 }
 
 
@@ -3069,7 +3487,7 @@ void Operator::comm121st( const Operator& X, const Operator& Y)
 //void Operator::comm122st( Operator& Y, Operator& Z ) 
 void Operator::comm122st( const Operator& X, const Operator& Y ) 
 {
-   double tstart = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("comm122st");
    Operator& Z = *this;
    int Lambda = Z.rank_J;
 
@@ -3209,7 +3627,6 @@ void Operator::comm122st( const Operator& X, const Operator& Y )
          }
       }
    }
-   profiler.timer["comm122st"] += omp_get_wtime() - tstart;
 }
 
 
@@ -3224,7 +3641,7 @@ void Operator::comm122st( const Operator& X, const Operator& Y )
 void Operator::comm222_pp_hh_221st( const Operator& X, const Operator& Y )  
 {
 
-   double tstart = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("comm222_pp_hh_221st");
    Operator& Z = *this;
    int Lambda = Z.GetJRank();
 
@@ -3242,6 +3659,18 @@ void Operator::comm222_pp_hh_221st( const Operator& X, const Operator& Y )
      vmtx.push_back(&(itmat.second));
    }
    size_t nchan = vch_bra.size();
+   // In the diagonal blocks ch_bra==ch_ket, Y*X = flip_diagonal * (X*Y).t() if X and Y are hermitian or antihermitian.
+   int flip_diagonal = 0;
+   if ( (X.IsHermitian() or X.IsAntiHermitian()) and (Y.IsHermitian() or Y.IsAntiHermitian()) )
+     flip_diagonal = (X.IsHermitian() ? 1 : -1) * (Y.IsHermitian() ? 1 : -1);
+   // Mpp and Mhh are copies of Y.TwoBody, but they hold pieces of Z, which is antihermitian if hX*hY=1.
+   // The one-body part below reads the unstored ch_bra>ch_ket blocks through GetFlipPhase(), so this has to match Z.
+   for (TwoBodyME* M : {&Mpp, &Mhh})
+   {
+     if (flip_diagonal == 1) M->SetAntiHermitian();
+     else if (flip_diagonal == -1) M->SetHermitian();
+     else M->SetNonHermitian();
+   }
 //   for ( auto& itmat : Y.TwoBody.MatEl )
    #pragma omp parallel for schedule(dynamic,1)
    for (size_t i=0;i<nchan; ++i)
@@ -3270,6 +3699,26 @@ void Operator::comm222_pp_hh_221st( const Operator& X, const Operator& Y )
 
     // the complicated-looking construct after the % signs just multiply the matrix elements by the proper occupation numbers (nanb, etc.)
 
+    // In a diagonal block, X and Y are (anti)symmetric, so Y*X = hX*hY*(X*Y).t() and we only need the first product.
+    if (ch_bra==ch_ket and flip_diagonal != 0)
+    {
+      Matrixhh = LHS1.cols(bras_hh) * (RHS.rows(bras_hh) % tbc_bra.Ket_occ_hh.cols( arma::uvec(RHS.n_cols,arma::fill::zeros ) ));
+      Matrixhh -= flip_diagonal * Matrixhh.t();
+
+      arma::mat MLeft = LHS1.cols(join_vert(bras_pp,join_vert(bras_hh,bras_ph)));
+      arma::mat MRight = join_vert(     RHS.rows(bras_pp),
+                           join_vert( RHS.rows(bras_hh)  % tbc_bra.Ket_unocc_hh.cols( arma::uvec(RHS.n_cols,arma::fill::zeros) )  ,
+                                      RHS.rows(bras_ph)  % tbc_bra.Ket_unocc_ph.cols( arma::uvec(RHS.n_cols,arma::fill::zeros) ) ));
+      Matrixpp = MLeft * MRight;
+      Matrixpp -= flip_diagonal * Matrixpp.t();
+
+      if (Z.GetParticleRank()>1)
+      {
+        Z.TwoBody.GetMatrix(ch_bra,ch_ket) += Matrixpp - Matrixhh;
+      }
+      continue;
+    }
+
     arma::mat MLeft  = join_horiz( LHS1.cols(bras_hh) , -RHS.cols(kets_hh) );
     arma::mat MRight = join_vert( RHS.rows(bras_hh)  % tbc_bra.Ket_occ_hh.cols( arma::uvec(RHS.n_cols,arma::fill::zeros ) ),
                                  LHS2.rows(kets_hh)  % tbc_ket.Ket_occ_hh.cols( arma::uvec(LHS2.n_cols,arma::fill::zeros) ));
@@ -3355,7 +3804,6 @@ void Operator::comm222_pp_hh_221st( const Operator& X, const Operator& Y )
          Z.OneBody(i,j) += cijJ ;
       } // for j
     } // for i
-    profiler.timer["comm222_pp_hh_221st"] += omp_get_wtime() - tstart;
 }
 
 
@@ -3382,126 +3830,40 @@ void Operator::comm222_pp_hh_221st( const Operator& X, const Operator& Y )
 /// two arrays of matrices, one for hp terms and one for ph terms.
 //void Operator::DoTensorPandyaTransformation(vector<arma::mat>& TwoBody_CC_hp, vector<arma::mat>& TwoBody_CC_ph)
 //void Operator::DoTensorPandyaTransformation(map<array<int,2>,arma::mat>& TwoBody_CC_hp, map<array<int,2>,arma::mat>& TwoBody_CC_ph) const
-void Operator::DoTensorPandyaTransformation( map<array<index_t,2>,arma::mat>& TwoBody_CC_ph) const
+/// Pandya transform the channel pairs given by ModelSpace::GetTensorPandyaChannelPairs().
+/// For the i-th pair {ch_bra_cc,ch_ket_cc}, TwoBody_CC_ph[2*i] holds the {ch_bra_cc,ch_ket_cc} matrix
+/// and TwoBody_CC_ph[2*i+1] holds the {ch_ket_cc,ch_bra_cc} one.
+void Operator::DoTensorPandyaTransformation( vector<arma::mat>& TwoBody_CC_ph) const
 {
-   int Lambda = rank_J;
-   // loop over cross-coupled channels
-   index_t nch = modelspace->SortedTwoBodyChannels_CC.size();
-
-   // Allocate map for matrices -- this needs to be serial.
-   for ( index_t ch_bra_cc : modelspace->SortedTwoBodyChannels_CC )
-   {
-      TwoBodyChannel& tbc_bra_cc = modelspace->GetTwoBodyChannel_CC(ch_bra_cc);
-      arma::uvec bras_ph = arma::join_cols( tbc_bra_cc.GetKetIndex_hh(), tbc_bra_cc.GetKetIndex_ph() );
-      index_t nph_bras = bras_ph.n_rows;
-      for ( index_t ch_ket_cc : modelspace->SortedTwoBodyChannels_CC )
-      {
-        TwoBodyChannel& tbc_ket_cc = modelspace->GetTwoBodyChannel_CC(ch_ket_cc);
-        index_t nKets_cc = tbc_ket_cc.GetNumberKets();
+   const auto& channel_pairs = modelspace->GetTensorPandyaChannelPairs(rank_J, rank_T, parity);
+   modelspace->GetTensorNineJTable(rank_J);
+   index_t npairs = channel_pairs.size();
+   TwoBody_CC_ph.resize(2*npairs);
 
-         TwoBody_CC_ph[{ch_bra_cc,ch_ket_cc}] =  arma::mat(2*nph_bras,   nKets_cc, arma::fill::zeros);
-      }
-   }
-
-   #pragma omp parallel for schedule(dynamic,1) if (not modelspace->tensor_transform_first_pass.at(Lambda))
-   for (index_t ich=0;ich<nch;++ich)
+   #pragma omp parallel for schedule(dynamic,1)
+   for (index_t ipair=0; ipair<npairs; ++ipair)
    {
-      index_t ch_bra_cc = modelspace->SortedTwoBodyChannels_CC[ich];
-      TwoBodyChannel& tbc_bra_cc = modelspace->GetTwoBodyChannel_CC(ch_bra_cc);
-      int Jbra_cc = tbc_bra_cc.J;
-      arma::uvec bras_ph = arma::join_cols( tbc_bra_cc.GetKetIndex_hh(), tbc_bra_cc.GetKetIndex_ph() );
-//      arma::uvec& bras_ph = tbc_bra_cc.GetKetIndex_ph();
-      index_t nph_bras = bras_ph.size();
-
-      for ( index_t ch_ket_cc : modelspace->SortedTwoBodyChannels_CC )
-      {
-        TwoBodyChannel& tbc_ket_cc = modelspace->GetTwoBodyChannel_CC(ch_ket_cc);
-        int Jket_cc = tbc_ket_cc.J;
-        if ( (Jbra_cc+Jket_cc < rank_J) or std::abs(Jbra_cc-Jket_cc)>rank_J ) continue;
-        if ( (tbc_bra_cc.parity + tbc_ket_cc.parity + parity)%2>0 ) continue;
-
-        index_t nKets_cc = tbc_ket_cc.GetNumberKets();
-
-//        arma::mat& MatCC_hp = TwoBody_CC_hp[{ch_bra_cc,ch_ket_cc}];
-        arma::mat& MatCC_ph = TwoBody_CC_ph[{ch_bra_cc,ch_ket_cc}];
-        // loop over ph bras <ad| in this channel
-        for (index_t ibra=0; ibra<nph_bras; ++ibra)
-        {
-           Ket & bra_cc = tbc_bra_cc.GetKet( bras_ph[ibra] );
-           index_t a = bra_cc.p;
-           index_t b = bra_cc.q;
-           Orbit & oa = modelspace->GetOrbit(a);
-           Orbit & ob = modelspace->GetOrbit(b);
-           double ja = oa.j2*0.5;
-           double jb = ob.j2*0.5;
-
-           // loop over kets |bc> in this channel
-           index_t iket_max =  nKets_cc ;
-           for (index_t iket_cc=0; iket_cc<iket_max; ++iket_cc)
-           {
-              Ket & ket_cc = tbc_ket_cc.GetKet(iket_cc%nKets_cc);
-              index_t c = iket_cc < nKets_cc ? ket_cc.p : ket_cc.q;
-              index_t d = iket_cc < nKets_cc ? ket_cc.q : ket_cc.p;
-              Orbit & oc = modelspace->GetOrbit(c);
-              Orbit & od = modelspace->GetOrbit(d);
-              double jc = oc.j2*0.5;
-              double jd = od.j2*0.5;
-
-
-              int j1min = std::abs(ja-jd);
-              int j1max = ja+jd;
-              double sm = 0;
-              for (int J1=j1min; J1<=j1max; ++J1)
-              {
-                int j2min = max(int(std::abs(jc-jb)),std::abs(J1-Lambda));
-                int j2max = min(int(jc+jb),J1+Lambda);
-                for (int J2=j2min; J2<=j2max; ++J2)
-                {
-                  double ninej = modelspace->GetNineJ(ja,jd,J1,jb,jc,J2,Jbra_cc,Jket_cc,Lambda);
-                  if (std::abs(ninej) < 1e-8) continue;
-                  double hatfactor = sqrt( (2*J1+1)*(2*J2+1)*(2*Jbra_cc+1)*(2*Jket_cc+1) );
-                  double tbme = TwoBody.GetTBME_J(J1,J2,a,d,c,b);
-                  sm -= hatfactor * modelspace->phase(jb+jd+Jket_cc+J2) * ninej * tbme ;
-                }
-              }
-//              MatCC_hp(ibra,iket_cc) = sm;
-              MatCC_ph(ibra,iket_cc) = sm;
-
-              // Exchange (a <-> b) to account for the (n_a - n_b) term
-              // Get Tz,parity and range of J for <bd || ca > coupling
-              j1min = std::abs(jb-jd);
-              j1max = jb+jd;
-              sm = 0;
-              for (int J1=j1min; J1<=j1max; ++J1)
-              {
-                int j2min = max(int(std::abs(jc-ja)),std::abs(J1-Lambda));
-                int j2max = min(int(jc+ja),J1+Lambda);
-                for (int J2=j2min; J2<=j2max; ++J2)
-                {
-                  double ninej = modelspace->GetNineJ(jb,jd,J1,ja,jc,J2,Jbra_cc,Jket_cc,Lambda);
-                  if (std::abs(ninej) < 1e-8) continue;
-                  double hatfactor = sqrt( (2*J1+1)*(2*J2+1)*(2*Jbra_cc+1)*(2*Jket_cc+1) );
-                  double tbme = TwoBody.GetTBME_J(J1,J2,b,d,c,a);
-                  sm -= hatfactor * modelspace->phase(ja+jd+Jket_cc+J2) * ninej * tbme ;
-                }
-              }
-//              MatCC_ph(ibra,iket_cc) = sm;
-              MatCC_ph(ibra+nph_bras,iket_cc) = sm;
-
-           }
-        }
-    }
+      index_t ch_bra_cc = channel_pairs[ipair][0];
+      index_t ch_ket_cc = channel_pairs[ipair][1];
+      DoTensorPandyaTransformation_SingleChannel(TwoBody_CC_ph[2*ipair],ch_bra_cc,ch_ket_cc);
+      if (ch_bra_cc==ch_ket_cc)
+        TwoBody_CC_ph[2*ipair+1] = TwoBody_CC_ph[2*ipair];
+      else
+        DoTensorPandyaTransformation_SingleChannel(TwoBody_CC_ph[2*ipair+1],ch_ket_cc,ch_bra_cc);
    }
 }
 
 
 
-// This happens inside an OMP loop, and so everything here needs to be thread safe
+
+// This happens inside an OMP loop, and so everything here needs to be thread safe.
+// The 9j table for rank_J should already exist, see ModelSpace::GetTensorNineJTable().
 //
 //void Operator::DoTensorPandyaTransformation_SingleChannel( arma::mat& TwoBody_CC_ph, int ch_bra_cc, int ch_ket_cc) const
 void Operator::DoTensorPandyaTransformation_SingleChannel( arma::mat& MatCC_ph, int ch_bra_cc, int ch_ket_cc) const
 {
    int Lambda = rank_J;
+   const TensorNineJTable& ninej_table = modelspace->GetTensorNineJTable(Lambda);
 
    TwoBodyChannel& tbc_bra_cc = modelspace->GetTwoBodyChannel_CC(ch_bra_cc);
    arma::uvec bras_ph = arma::join_cols( tbc_bra_cc.GetKetIndex_hh(), tbc_bra_cc.GetKetIndex_ph() );
@@ -3547,6 +3909,7 @@ void Operator::DoTensorPandyaTransformation_SingleChannel( arma::mat& MatCC_ph,
 
          int j1min = std::abs(ja-jd);
          int j1max = ja+jd;
+         auto ninej_col = ninej_table.GetColumn(oa.j2,od.j2,ob.j2,oc.j2,Jbra_cc,Jket_cc);
          double sm = 0;
          for (int J1=j1min; J1<=j1max; ++J1)
          {
@@ -3554,7 +3917,7 @@ void Operator::DoTensorPandyaTransformation_SingleChannel( arma::mat& MatCC_ph,
            int j2max = min(int(jc+jb),J1+Lambda);
            for (int J2=j2min; J2<=j2max; ++J2)
            {
-             double ninej = modelspace->GetNineJ(ja,jd,J1,jb,jc,J2,Jbra_cc,Jket_cc,Lambda);
+             double ninej = ninej_col.column[ninej_col.stride*ninej_table.Row(oa.j2,od.j2,J1,J2)];
              if (std::abs(ninej) < 1e-8) continue;
              double hatfactor = sqrt( (2*J1+1)*(2*J2+1)*(2*Jbra_cc+1)*(2*Jket_cc+1) );
              double tbme = TwoBody.GetTBME_J(J1,J2,a,d,c,b);
@@ -3574,6 +3937,7 @@ void Operator::DoTensorPandyaTransformation_SingleChannel( arma::mat& MatCC_ph,
            // Get Tz,parity and range of J for <bd || ca > coupling
            j1min = std::abs(jb-jd);
            j1max = jb+jd;
+           ninej_col = ninej_table.GetColumn(ob.j2,od.j2,oa.j2,oc.j2,Jbra_cc,Jket_cc);
            sm = 0;
            for (int J1=j1min; J1<=j1max; ++J1)
            {
@@ -3581,7 +3945,7 @@ void Operator::DoTensorPandyaTransformation_SingleChannel( arma::mat& MatCC_ph,
              int j2max = min(int(jc+ja),J1+Lambda);
              for (int J2=j2min; J2<=j2max; ++J2)
              {
-               double ninej = modelspace->GetNineJ(jb,jd,J1,ja,jc,J2,Jbra_cc,Jket_cc,Lambda);
+               double ninej = ninej_col.column[ninej_col.stride*ninej_table.Row(ob.j2,od.j2,J1,J2)];
                if (std::abs(ninej) < 1e-8) continue;
                double hatfactor = sqrt( (2*J1+1)*(2*J2+1)*(2*Jbra_cc+1)*(2*Jket_cc+1) );
                double tbme = TwoBody.GetTBME_J(J1,J2,b,d,c,a);
@@ -3776,7 +4140,8 @@ void Operator::AddInverseTensorPandyaTransformation_SingleChannel(arma::mat& Zba
 
 
 
-void Operator::AddInverseTensorPandyaTransformation( const map<array<index_t,2>,arma::mat>&  Zbar )
+/// Zbar holds the Pandya-transformed matrices for the channel pairs given by ModelSpace::GetTensorPandyaChannelPairs()
+void Operator::AddInverseTensorPandyaTransformation( const vector<arma::mat>&  Zbar )
 {
     // Do the inverse Pandya transform
    Operator& Z = *this;
@@ -3785,8 +4150,10 @@ void Operator::AddInverseTensorPandyaTransformation( const map<array<index_t,2>,
    for (map<array<int,2>,arma::mat>::iterator iter= Z.TwoBody.MatEl.begin(); iter!= Z.TwoBody.MatEl.end(); ++iter) iteratorlist.push_back(iter);
    int niter = iteratorlist.size();
    int hZ = Z.IsHermitian() ? 1 : -1;
-    // Only go parallel if we've previously calculated the SixJs/NineJs. Otherwise, it's not thread safe.
-   #pragma omp parallel for schedule(dynamic,1) if (not modelspace->tensor_transform_first_pass.at(Lambda))
+   const TensorNineJTable& ninej_table = modelspace->GetTensorNineJTable(Lambda);
+   const auto& pair_index = modelspace->GetTensorPandyaPairIndex(Z.rank_J, Z.rank_T, Z.parity);
+   index_t nch_cc = modelspace->TwoBodyChannels_CC.size();
+   #pragma omp parallel for schedule(dynamic,1)
    for (int i=0; i<niter; ++i)
    {
       const auto iter = iteratorlist[i];
@@ -3830,6 +4197,7 @@ void Operator::AddInverseTensorPandyaTransformation( const map<array<index_t,2>,
             int Tz_ket_cc = std::abs(ok.tz2+oj.tz2)/2;
             int j3min = std::abs(int(ji-jl));
             int j3max = ji+jl;
+            auto ninej_col = ninej_table.GetColumn(oi.j2,ol.j2,oj.j2,ok.j2,J1,J2);
             for (int J3=j3min; J3<=j3max; ++J3)
             {
               index_t ch_bra_cc = modelspace->GetTwoBodyChannelIndex(J3,parity_bra_cc,Tz_bra_cc);
@@ -3845,15 +4213,15 @@ void Operator::AddInverseTensorPandyaTransformation( const map<array<index_t,2>,
                  index_t nkets = tbc_ket_cc.GetNumberKets();
                  index_t indx_kj = tbc_ket_cc.GetLocalIndex(min(j,k),max(j,k));
 
-                  double ninej = modelspace->GetNineJ(ji,jl,J3,jj,jk,J4,J1,J2,Lambda);
+                  double ninej = ninej_col.column[ninej_col.stride*ninej_table.Row(oi.j2,ol.j2,J3,J4)];
                   if (std::abs(ninej) < 1e-8) continue;
                   double hatfactor = sqrt( (2*J1+1)*(2*J2+1)*(2*J3+1)*(2*J4+1) );
                   double tbme = 0;
                   index_t ch_lo = min(ch_bra_cc,ch_ket_cc);
                   index_t ch_hi = max(ch_bra_cc,ch_ket_cc);
-                  auto zbar_iter = Zbar.find({ch_lo,ch_hi});
-                  if (zbar_iter == Zbar.end()) continue;
-                  const auto& Zmat = zbar_iter->second;
+                  int izbar = pair_index[ch_lo*nch_cc+ch_hi];
+                  if (izbar < 0) continue;
+                  const auto& Zmat = Zbar[izbar];
 
                   if (ch_bra_cc <= ch_ket_cc)
                   {
@@ -3887,6 +4255,7 @@ void Operator::AddInverseTensorPandyaTransformation( const map<array<index_t,2>,
               Tz_ket_cc = std::abs(ok.tz2+oi.tz2)/2;
               j3min = std::abs(int(jj-jl));
               j3max = jj+jl;
+              ninej_col = ninej_table.GetColumn(oj.j2,ol.j2,oi.j2,ok.j2,J1,J2);
   
               for (int J3=j3min; J3<=j3max; ++J3)
               {
@@ -3902,15 +4271,15 @@ void Operator::AddInverseTensorPandyaTransformation( const map<array<index_t,2>,
                    const TwoBodyChannel_CC& tbc_ket_cc = modelspace->GetTwoBodyChannel_CC(ch_ket_cc);
                    int nkets = tbc_ket_cc.GetNumberKets();
                    int indx_ki = tbc_ket_cc.GetLocalIndex(min(k,i),max(k,i));
-                    double ninej = modelspace->GetNineJ(jj,jl,J3,ji,jk,J4,J1,J2,Lambda);
+                    double ninej = ninej_col.column[ninej_col.stride*ninej_table.Row(oj.j2,ol.j2,J3,J4)];
                     if (std::abs(ninej) < 1e-8) continue;
                     double hatfactor = sqrt( (2*J1+1)*(2*J2+1)*(2*J3+1)*(2*J4+1) );
   
                     index_t ch_lo = min(ch_bra_cc,ch_ket_cc);
                     index_t ch_hi = max(ch_bra_cc,ch_ket_cc);
-                    auto zbar_iter = Zbar.find({ch_lo,ch_hi});
-                    if (zbar_iter == Zbar.end()) continue;
-                    const auto& Zmat = zbar_iter->second;
+                    int izbar = pair_index[ch_lo*nch_cc+ch_hi];
+                    if (izbar < 0) continue;
+                    const auto& Zmat = Zbar[izbar];
                     double tbme = 0;
                     if (ch_bra_cc <= ch_ket_cc)
                     {
@@ -4026,76 +4395,54 @@ void Operator::comm222_phst( const Operator& X, const Operator& Y )
    // Create Pandya-transformed hp and ph matrix elements
 //   deque<arma::mat> X_bar_hp = InitializePandya( nChannels, "transpose");
 
-   double t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st_doTensorPandyaTransformation("DoTensorPandyaTransformation");
    // We reuse Xt_bar multiple times, so it makes sense to calculate them once and store them in a deque.
    deque<arma::mat> Xt_bar_ph = InitializePandya( nChannels, "transpose"); // We re-use the scalar part multiple times, so there's a significant speed gain for saving it
-   map<array<index_t,2>,arma::mat> Y_bar_ph;
+   vector<arma::mat> Y_bar_ph;
    X.DoPandyaTransformation(Xt_bar_ph, "transpose" );
 //   Y.DoTensorPandyaTransformation(Y_bar_ph );
-   profiler.timer["DoTensorPandyaTransformation"] += omp_get_wtime() - t_start;
+   st_doTensorPandyaTransformation.Stop();
 
 
-   t_start = omp_get_wtime();
-   // Construct the intermediate matrix Z_bar
-   // First, we initialize the map Z_bar with empty matrices
-   // to avoid problems in the parallel loop -- (do we even want a parallel loop here?)
-   map<array<index_t,2>,arma::mat> Z_bar;
-//   vector<int> ybras(Y_bar_ph.size());
-//   vector<int> ykets(Y_bar_ph.size());
-//   int counter = 0;
-//   for (auto& iter : Y_bar_ph )
-//   {
-//      ybras[counter] = iter.first[0];
-//      ykets[counter] = iter.first[1];
-//      if (iter.first[0] > iter.first[1]) continue;
-//      Z_bar[iter.first].zeros( Xt_bar_ph[iter.first[0]].n_rows, 2*Xt_bar_ph[iter.first[1]].n_rows); // important to initialize this for parallelization
-//      counter++;
-//   }
+   IMSRGProfiler::ScopedTimer st_pandyaLookup("PandyaLookup");
+   // Construct the intermediate matrix Z_bar.
+   // Only the channel pairs which can contribute are included, and the matrices are views
+   // into one contiguous block of memory, allocated before the parallel loop.
+   const auto& channel_pairs = modelspace->GetTensorPandyaChannelPairs(rank_J, rank_T, parity);
+   modelspace->GetTensorNineJTable(rank_J); // make sure this exists before the parallel loops
+   st_pandyaLookup.Stop();
 
-   t_start = omp_get_wtime();
-//   auto& pandya_lookup = modelspace->GetPandyaLookup(rank_J, rank_T, parity);
-   const auto& pandya_lookup = modelspace->GetPandyaLookup(rank_J, rank_T, parity);
-   profiler.timer["PandyaLookup"] += omp_get_wtime() - t_start;
-
-   vector<index_t> ybras;
-   vector<index_t> ykets;
-//   cout << "start loop over TBC_CC" << endl;
-   for (auto ich_bra : modelspace->SortedTwoBodyChannels_CC)
+   IMSRGProfiler::ScopedTimer st_allocate_Z_bar_tensor("Allocate Z_bar_tensor");
+   int counter = channel_pairs.size();
+   vector<size_t> zbar_offsets(counter+1,0);
+   for (int i=0;i<counter;++i)
    {
-     int n_rows = modelspace->GetTwoBodyChannel_CC(ich_bra).GetNumberKets();
-     for (auto ich_ket : modelspace->SortedTwoBodyChannels_CC)
-     {
-       if (ich_bra>ich_ket) continue;
-       if (pandya_lookup.at({(int)ich_bra,(int)ich_ket})[0].size()<1) continue;
-         int n_cols = 2*modelspace->GetTwoBodyChannel_CC(ich_ket).GetNumberKets();
-         ybras.push_back(ich_bra);
-         ykets.push_back(ich_ket);
-         Z_bar[{ich_bra,ich_ket}] = arma::mat(n_rows,n_cols);
-     }
+     int n_rows = modelspace->GetTwoBodyChannel_CC(channel_pairs[i][0]).GetNumberKets();
+     int n_cols = 2*modelspace->GetTwoBodyChannel_CC(channel_pairs[i][1]).GetNumberKets();
+     zbar_offsets[i+1] = zbar_offsets[i] + n_rows*n_cols;
+   }
+   vector<double> Z_bar_data(zbar_offsets.back());
+   vector<arma::mat> Z_bar;
+   Z_bar.reserve(counter);
+   for (int i=0;i<counter;++i)
+   {
+     int n_rows = modelspace->GetTwoBodyChannel_CC(channel_pairs[i][0]).GetNumberKets();
+     int n_cols = 2*modelspace->GetTwoBodyChannel_CC(channel_pairs[i][1]).GetNumberKets();
+     Z_bar.emplace_back( Z_bar_data.data()+zbar_offsets[i], n_rows, n_cols, false, true);
    }
-   int counter = ybras.size();
-//  cout << "Done allocating" << endl;
-
 
-   profiler.timer["Allocate Z_bar_tensor"] += omp_get_wtime() - t_start;
+   st_allocate_Z_bar_tensor.Stop();
 
-   t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st_build_Z_bar_tensor("Build Z_bar_tensor");
 
    #ifndef OPENBLAS_NOUSEOMP
-   #pragma omp parallel for schedule(dynamic,1) if (not modelspace->tensor_transform_first_pass.at(rank_J))
+   #pragma omp parallel for schedule(dynamic,1)
    #endif
    for(int i=0;i<counter;++i)
    {
 //      double t_start2 = omp_get_wtime();
-      index_t ch_bra_cc = ybras[i];
-      index_t ch_ket_cc = ykets[i];
-//      cout << i << " " << ch_bra_cc << " " << ch_ket_cc << endl;
-      const auto plookup = pandya_lookup.find({(int)ch_bra_cc,(int)ch_ket_cc});
-      if ( plookup == pandya_lookup.end() or plookup->second[0].size()<1 )
-      {
-//       profiler.timer["BuildZbarTensor_setup"] += omp_get_wtime() - t_start2;
-       continue;
-      }
+      index_t ch_bra_cc = channel_pairs[i][0];
+      index_t ch_ket_cc = channel_pairs[i][1];
 
       const auto& tbc_bra_cc = modelspace->GetTwoBodyChannel_CC(ch_bra_cc);
       const auto& tbc_ket_cc = modelspace->GetTwoBodyChannel_CC(ch_ket_cc);
@@ -4170,8 +4517,7 @@ void Operator::comm222_phst( const Operator& X, const Operator& Y )
 //      t_start2 = omp_get_wtime();
       int halfncx2 = XJ2.n_cols/2;
       int halfnry12 = YJ1J2.n_rows/2;
-//      auto& Zmat = Z_bar[{ch_bra_cc,ch_ket_cc}];
-      auto& Zmat = Z_bar.at({ch_bra_cc,ch_ket_cc});
+      auto& Zmat = Z_bar[i];
 //      arma::mat Zmat ;
 
       arma::mat Mleft = join_horiz( XJ1,  -flipphaseY * YJ2J1.t() );
@@ -4188,16 +4534,16 @@ void Operator::comm222_phst( const Operator& X, const Operator& Y )
 //      Z_debug1.AddInverseTensorPandyaTransformation_SingleChannel(Zmat,ch_bra_cc,ch_ket_cc); 
 
    }
-   profiler.timer["Build Z_bar_tensor"] += omp_get_wtime() - t_start;
+   st_build_Z_bar_tensor.Stop();
 
 //   cout << "Done with parallel loop" << endl;
 
-   t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st_inverseTensorPandyaTransformation("InverseTensorPandyaTransformation");
 //   cout << "Adding INversePanyaTransformation" << endl;
    Z.AddInverseTensorPandyaTransformation(Z_bar); // TODO: Do this one channel at a time <-- done did it, and it's sloooowwww.
 //   cout << "done." << endl;
 
-   profiler.timer["InverseTensorPandyaTransformation"] += omp_get_wtime() - t_start;
+   st_inverseTensorPandyaTransformation.Stop();
 
    modelspace->tensor_transform_first_pass.at( rank_J ) = false;
 
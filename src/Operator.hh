@@ -57,6 +57,7 @@ class Operator
 
   bool hermitian;
   bool antihermitian;
+  bool charge_symmetric; ///< unchanged by swapping protons and neutrons, so kernels can use the isospin symmetry. See MakeChargeSymmetric()
   int nChannels; ///< Number of two-body channels \f$ J,\pi,T_z \f$ associated with the model space
 
 
@@ -128,6 +129,10 @@ class Operator
   bool IsHermitian()const {return hermitian;};
   bool IsAntiHermitian()const {return antihermitian;};
   bool IsNonHermitian()const {return not (hermitian or antihermitian);};
+  void SetChargeSymmetric(bool b) {charge_symmetric = b;};
+  bool IsChargeSymmetric()const {return charge_symmetric;};
+  double MakeChargeSymmetric();
+  bool CheckChargeSymmetric(double tol=1e-8) const;
   int GetParticleRank()const {return particle_rank;};
   int GetJRank()const {return rank_J;};
   int GetTRank()const {return rank_T;};
@@ -159,6 +164,7 @@ class Operator
   Operator DoNormalOrdering3(); ///< Returns the normal ordered three-body operator
   Operator UndoNormalOrdering() const; ///< Returns the operator normal-ordered wrt the vacuum
   Operator Truncate(ModelSpace& ms_new); ///< Returns the operator trunacted to the new model space
+  Operator Embed(ModelSpace& ms_new); ///< Returns the operator in a model space with larger or smaller emax
 
   void SetToCommutator(const Operator& X, const Operator& Y);
   void CommutatorScalarScalar( const Operator& X, const Operator& Y) ;
@@ -171,6 +177,7 @@ class Operator
   Operator BCH_Transform( const Operator& ) ; 
   Operator Standard_BCH_Transform( const Operator& ) ; 
   Operator Brueckner_BCH_Transform( const Operator& ) ; 
+  Operator OneBody_BCH_Transform( const Operator& ) ; ///< Exact \f$ e^{\Omega}Xe^{-\Omega}\f$ for one-body \f$\Omega\f$, done as a basis rotation
 
   void CalculateKineticEnergy(); // Deprecated
   void Eye(); ///< set to identity operator -- unused
@@ -228,9 +235,9 @@ class Operator
   void ConstructScalarMpp_Mhh(const Operator& X, const Operator& Y, TwoBodyME& Mpp, TwoBodyME& Mhh) const;
   void ConstructScalarMpp_Mhh_GooseTank(const Operator& X, const Operator& Y, TwoBodyME& Mpp, TwoBodyME& Mhh) const;
 //  void DoTensorPandyaTransformation(std::map<std::array<int,2>,arma::mat>&, std::map<std::array<int,2>,arma::mat>&) const;
-  void DoTensorPandyaTransformation(std::map<std::array<index_t,2>,arma::mat>&) const;
+  void DoTensorPandyaTransformation(std::vector<arma::mat>&) const;
   void DoTensorPandyaTransformation_SingleChannel(arma::mat& X, int ch_bra_cc, int ch_ket_cc) const;
-  void AddInverseTensorPandyaTransformation(const std::map<std::array<index_t,2>,arma::mat>&);
+  void AddInverseTensorPandyaTransformation(const std::vector<arma::mat>&);
   void AddInverseTensorPandyaTransformation_SingleChannel(arma::mat& Zbar, int ch_bra_cc, int ch_ket_cc);
 
   void comm111st( const Operator& X, const Operator& Y) ;
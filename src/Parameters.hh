@@ -57,10 +57,11 @@ map<string,string> Parameters::string_par = {
   {"intfile",			"default"},	// name of output interaction fille
   {"fmt2",			"me2j"},	// can also be navratil or Navratil to read Petr's TBME format
   {"fmt3",			"me3j"},	// can also be navratil or Navratil to read Petr's TBME format
+  {"3bme_shared",		"none"},	// name of a shared memory segment (or a file, if it's a path) to keep the 3N matrix elements in, so jobs on a node read them once and share them
   {"reference",			"default"},	// nucleus used for HF and normal ordering.
-  {"valence_space",		""},		// either valence space or nucleus for single reference
+  {"valence_space",		""},		// either valence space or nucleus for single reference. Several valence spaces with the same core can be given as sd-shell+sdpf-shell
   {"custom_valence_space",      ""},		// if the provided valence spaces just aren't good enough for you
-  {"basis",			"HF"},		// use HF basis or oscillator basis. HF is better.
+  {"basis",			"HF"},		// use HF basis or oscillator basis. HF is better. NAT uses the natural orbits of the second-order density
   {"method",			"magnus"},	// can be magnus or flow or a few other things
   {"denominator_delta_orbit",	"none"},	// pick specific orbit to apply the delta
   {"LECs",			"EM2.0_2.0"},	// low energy constants for the interaction, only used with Johannes' hdf5 file format
@@ -69,8 +70,15 @@ map<string,string> Parameters::string_par = {
   {"valence_file_format",       "nushellx"},	// file format for valence space interaction
   {"occ_file",			"none"},	// name of file containing orbit occupations
   {"goose_tank",		"false"},	// do goose_tank correction to commutators
-  {"write_omega",		"false"},	// write omega to disk
+  {"write_omega",		"false"},	// write omega to disk. true for text, binary for the compressed binary format (only if there is a single Omega, for omega_init)
+  {"omega_init",		"none"},	// file with an Omega to start the flow from (binary, or text if the emax isn't larger than this one)
+  {"write_transformation",	"false"},	// write the HF basis and all the Omegas to intfile_transformation.dat etc, for use with transform_only
+  {"transform_only",		"none"},	// intfile_transformation.dat from a previous run. Skip HF and the flow, and just transform the Operators
+  {"euler_step_control",	"false"},	// for method=magnus, choose ds from the energy error of each step and redo steps that fail. ode_tolerance sets the tolerance
   {"nucleon_mass_correction",	"false"},	// include effect of proton-neutron mass splitting
+  {"charge_symmetric",		"false"},	// drop the charge-symmetry breaking part of H (e.g. Coulomb) so the flow can use isospin symmetry. Needs N=Z
+  {"flowstatus_async",		"false"},	// evaluate the norm, trace and MP2 energy in the flow file on a background thread
+  {"profile_file",		"none"},	// if not none, write timings to profile_file.csv and a chrome trace to profile_file.json
 };
 
 
@@ -86,6 +94,7 @@ map<string,double> Parameters::double_par = {
   {"BetaCM",               0},  // Prefactor for Lawson-Glockner term
   {"hwBetaCM",            -1},  // Oscillator frequency used in the Lawson-Glockner term. Negative value means use the frequency of the basis
   {"eta_criterion",     1e-6},  // Threshold on ||eta|| for convergence in the flow
+  {"omega_compression_tol", 0},  // if >0, store finished Omegas in memory as truncated SVDs, dropping this fraction of the norm of each channel block
 
 };
 
@@ -94,7 +103,11 @@ map<string,int> Parameters::int_par = {
   {"e3max",		12},	
   {"emax",		6},
   {"lmax3",		-1}, // lmax for the 3body interaction
+  {"emax_nat",		-1}, // with basis=NAT, drop the natural orbits above this emax before the flow. -1 means keep them all
   {"nsteps",		-1},	// do the decoupling in 1 step or core-then-valence. -1 means default
+  {"flowstatus_interval",	1},	// write the flow status every this many steps
+  {"scratch_cache_mb",	0},	// memory budget (in MB) for keeping Omegas written to scratch in memory as well
+  {"Hs_resync_interval",	0},	// for method=magnus, if >0 update H(s) with only the latest step, and recompute it with the full Omega every this many steps
   {"file2e1max",	12},
   {"file2e2max",	24},
   {"file2lmax",		10},
@@ -107,6 +120,8 @@ map<string,vector<string>> Parameters::vec_par = {
  {"Operators", {} },
  {"OperatorsFromFile", {} },  // These will mostly be MECs for operators
  {"SPWF",{} }, // single-particle wave functions in HF basis
+ {"flowstatus_skip",{} }, // quantities not to evaluate for the flow file. Can be norm, trace, mp2, memory
+ {"batch",{} }, // list of targets reference:valence_space or reference:valence_space:A which share the interaction, done one after another. Not with occ_file.
 };
 
 
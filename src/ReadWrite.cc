@@ -10,6 +10,8 @@
 #include <ctime>
 #include <unordered_map>
 #include "omp.h"
+#include <zlib.h>
+#include <sys/stat.h>
 
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
@@ -732,12 +734,21 @@ void ReadWrite::ReadBareTBME_Darmstadt( std::string filename, Operator& Hbare, i
 void ReadWrite::Read_Darmstadt_3body( std::string filename, Operator& Hbare, int E1max, int E2max, int E3max)
 {
 
-  double start_time = omp_get_wtime();
+  IMSRGProfiler::ScopedTimer st("Read_3body_file");
   std::string extension = filename.substr( filename.find_last_of("."));
   File3N = filename;
   Aref = Hbare.GetModelSpace()->GetAref();
   Zref = Hbare.GetModelSpace()->GetZref();
 
+  if (threebody_shared_name != "")
+  {
+    uint64_t key = ThreeBodySharedKey(filename, Hbare, E1max, E2max, E3max);
+    if ( not Hbare.ThreeBody.AllocateShared(threebody_shared_name, key) )
+    {
+      return;
+    }
+  }
+
   if (extension == ".me3j")
   {
     std::ifstream infile(filename);
@@ -757,6 +768,7 @@ void ReadWrite::Read_Darmstadt_3body( std::string filename, Operator& Hbare, int
     if ( !infile.good() )
     {
       cerr << "problem opening " << filename << ". Exiting." << std::endl;
+      Hbare.ThreeBody.FinishSharedFill(false);
       return ;
     }
     
@@ -800,7 +812,47 @@ void ReadWrite::Read_Darmstadt_3body( std::string filename, Operator& Hbare, int
     Read_Darmstadt_3body_from_stream(infile, Hbare,  E1max, E2max, E3max);
   }
 
-  Hbare.profiler.timer["Read_3body_file"] += omp_get_wtime() - start_time;
+  if (Hbare.ThreeBody.IsShared()) Hbare.ThreeBody.FinishSharedFill(goodstate);
+}
+
+
+/// Something which identifies the 3N matrix elements which would be read from filename into Hbare,
+/// so that processes only share them if they would have read the same thing.
+/// The file is identified by its name, size, modification time and a checksum of the first MB.
+uint64_t ReadWrite::ThreeBodySharedKey(std::string filename, Operator& Hbare, int E1max, int E2max, int E3max)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  auto add = [&hash](uint64_t x){ hash ^= x; hash *= 1099511628211ULL; };
+  add( FileFingerprint(filename, true) );
+  ModelSpace* modelspace = Hbare.GetModelSpace();
+  for (int x : {E1max, E2max, E3max, modelspace->GetEmax(), modelspace->GetE3max(), modelspace->GetLmax3(), (int)sizeof(ThreeBME_type)} ) add(x);
+  add( modelspace->GetOrbitListHash() );
+  return hash;
+}
+
+/// Hash of a file's absolute path, its size and the crc32 of its first MB, to check cheaply that a file
+/// is the one that was used before. With with_mtime, the modification time goes in too, which also catches
+/// a file rewritten in place, but not one which was copied. If the file doesn't exist, only the name is used.
+uint64_t ReadWrite::FileFingerprint(std::string filename, bool with_mtime)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  auto add = [&hash](uint64_t x){ hash ^= x; hash *= 1099511628211ULL; };
+  char* fullpath = realpath(filename.c_str(), NULL);
+  if (fullpath != NULL)
+  {
+    filename = fullpath;
+    free(fullpath);
+  }
+  for (char c : filename) add(c);
+  struct stat st;
+  if (stat(filename.c_str(), &st)!=0) return hash;
+  add(st.st_size);
+  if (with_mtime) add(st.st_mtime);
+  std::ifstream infile(filename, std::ios::binary);
+  std::vector<char> buf(1<<20);
+  infile.read(buf.data(), buf.size());
+  add( crc32(0L, (const Bytef*)buf.data(), infile.gcount()) );
+  return hash;
 }
 
 
@@ -1172,7 +1224,7 @@ void ReadWrite::ReadBareTBME_Darmstadt_from_stream( T& infile, Operator& Hbare,
 /// and read from an emax=14 file, and the matrix elements with emax>10 would be ignored.
 size_t ReadWrite::Count_Darmstadt_3body_to_read( Operator& Hbare, int E1max, int E2max, int E3max, std::vector<int>& orbits_remap, std::vector<size_t>& nread_list)
 {
-  double t_start = omp_get_wtime();
+  IMSRGProfiler::ScopedTimer st("Count_3BME");
 //  if ( !infile.good() )
 //  {
 //     cerr << "************************************" << std::endl
@@ -1335,7 +1387,6 @@ size_t ReadWrite::Count_Darmstadt_3body_to_read( Operator& Hbare, int E1max, int
     }
   }
   
-  modelspace->profiler.timer["Count_3BME"] += omp_get_wtime() - t_start;
   return nread;
 }
 
@@ -1343,7 +1394,7 @@ template <class T>
 void ReadWrite::Read_Darmstadt_3body_from_stream( T& infile, Operator& Hbare, int E1max, int E2max, int E3max)
 {
 
-  double t_start = omp_get_wtime();
+  IMSRGProfiler::ScopedTimer st("Read_3BME");
   if ( !infile.good() )
   {
      cerr << "************************************" << std::endl
@@ -1397,7 +1448,7 @@ void ReadWrite::Read_Darmstadt_3body_from_stream( T& infile, Operator& Hbare, in
     }
   }
 
-  modelspace->profiler.timer["Read_3BME"] += omp_get_wtime() - t_start;
+  st.Stop(); // storing them is timed separately
   std::cout << "Read in " << nread << " floating point numbers (" << nread * sizeof(float)/1024./1024./1024. << " GB)" << std::endl;
   Store_Darmstadt_3body( ThreeBME, nread_list, orbits_remap, Hbare, E1max, E2max, E3max);
 
@@ -1411,7 +1462,7 @@ void ReadWrite::Read_Darmstadt_3body_from_stream( T& infile, Operator& Hbare, in
 void ReadWrite::Store_Darmstadt_3body( const std::vector<float>& ThreeBME, const std::vector<size_t>& nread_list, const std::vector<int>& orbits_remap, Operator& Hbare, int E1max, int E2max, int E3max)
 {
 
-  double t_start = omp_get_wtime();
+  IMSRGProfiler::ScopedTimer st("Store_3BME");
   ModelSpace * modelspace = Hbare.GetModelSpace();
   int e1max = modelspace->GetEmax();
 //  int e2max = modelspace->GetE2max(); // not used yet
@@ -1614,7 +1665,6 @@ void ReadWrite::Store_Darmstadt_3body( const std::vector<float>& ThreeBME, const
   
   std::cout << "Stored " << nkept << " floating point numbers (" << nkept * sizeof(float)/1024./1024./1024. << " GB)" << std::endl;
 
-  modelspace->profiler.timer["Store_3BME"] += omp_get_wtime() - t_start;
 }
 
 
@@ -3463,6 +3513,360 @@ void ReadWrite::ReadOperator(Operator &op, std::string filename)
    
 }
 
+//////////////////////////////////////////////////////////////////////////////////////
+/// Versioned binary operator format.
+/// The file begins with a fixed header containing a magic string, the format version,
+/// an endianness tag, the model space truncations and a fingerprint of the orbit list,
+/// followed by the operator ranks and hermiticity. Then comes a table of chunks and the
+/// chunks themselves. Each chunk is the one-body matrix, a single two-body channel block,
+/// or a slice of the three-body storage, with its own crc32 checksum and optionally
+/// compressed with zlib. Chunks are checksummed and (de)compressed in parallel; only the
+/// actual file access is serial.
+//////////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+  const char     OPBIN_MAGIC[8]     = {'I','M','S','R','G','O','P','\0'};
+  const uint64_t OPBIN_VERSION      = 1;
+  const uint64_t OPBIN_ENDIAN_TAG   = 0x0102030405060708ULL;
+  const size_t   OPBIN_3B_CHUNKSIZE = 1 << 24; // number of three-body matrix elements per chunk
+
+  enum { OPBIN_ONEBODY=0, OPBIN_TWOBODY=1, OPBIN_THREEBODY=2 };
+
+  /// Every field is 64 bits wide so that the layout on disk has no padding.
+  struct OpBinHeader
+  {
+    char     magic[8];
+    uint64_t version;
+    uint64_t endian_tag;
+    int64_t  emax, e2max, e3max;
+    int64_t  norbits;
+    uint64_t orbit_hash;
+    int64_t  nchannels;
+    int64_t  rank_J, rank_T, parity, particle_rank;
+    int64_t  op_E3max;
+    int64_t  hermitian, antihermitian;
+    double   zerobody;
+    int64_t  nchunks;
+  };
+
+  struct OpBinChunk
+  {
+    int64_t  kind;
+    int64_t  ch_bra, ch_ket;      // two-body channels, or the starting element for three-body
+    int64_t  nrows, ncols;
+    int64_t  elem_size;
+    uint64_t raw_bytes;
+    uint64_t stored_bytes;
+    uint64_t crc;
+    int64_t  compressed;
+    uint64_t offset;              // position of the data, relative to the end of the chunk table
+  };
+
+  /// Make a list of the chunks making up op, along with pointers to their data.
+  void OpBinListChunks(Operator& op, std::vector<OpBinChunk>& chunks, std::vector<char*>& data)
+  {
+    chunks.clear();
+    data.clear();
+    OpBinChunk c = {};
+    c.kind = OPBIN_ONEBODY;
+    c.nrows = op.OneBody.n_rows;
+    c.ncols = op.OneBody.n_cols;
+    c.elem_size = sizeof(double);
+    c.raw_bytes = op.OneBody.n_elem * sizeof(double);
+    chunks.push_back(c);
+    data.push_back( (char*) op.OneBody.memptr() );
+
+    if (op.GetParticleRank() > 1)
+    {
+      for ( auto& itmat : op.TwoBody.MatEl )
+      {
+        c.kind = OPBIN_TWOBODY;
+        c.ch_bra = itmat.first[0];
+        c.ch_ket = itmat.first[1];
+        c.nrows = itmat.second.n_rows;
+        c.ncols = itmat.second.n_cols;
+        c.raw_bytes = itmat.second.n_elem * sizeof(double);
+        chunks.push_back(c);
+        data.push_back( (char*) itmat.second.memptr() );
+      }
+    }
+    if (op.GetParticleRank() > 2)
+    {
+      size_t ntot = op.ThreeBody.IsShared() ? op.ThreeBody.total_dimension : op.ThreeBody.MatEl.size();
+      for (size_t start=0; start<ntot; start+=OPBIN_3B_CHUNKSIZE)
+      {
+        size_t n = std::min(OPBIN_3B_CHUNKSIZE, ntot-start);
+        c.kind = OPBIN_THREEBODY;
+        c.ch_bra = start;
+        c.ch_ket = 0;
+        c.nrows = n;
+        c.ncols = 1;
+        c.elem_size = sizeof(ThreeBME_type);
+        c.raw_bytes = n * sizeof(ThreeBME_type);
+        chunks.push_back(c);
+        data.push_back( (char*) (op.ThreeBody.GetMatElData()+start) );
+      }
+    }
+  }
+}
+
+
+/// Write an operator to a versioned binary file which can be read back with ReadOperatorBinary.
+/// If compress is true, each chunk is compressed with zlib. This is slower but typically saves
+/// a good deal of space for operators with many zeros.
+void ReadWrite::WriteOperatorBinary(Operator& op, std::string filename, bool compress)
+{
+   IMSRGProfiler::ScopedTimer st("WriteOperatorBinary");
+   ModelSpace* modelspace = op.GetModelSpace();
+
+   std::vector<OpBinChunk> chunks;
+   std::vector<char*> data;
+   OpBinListChunks(op, chunks, data);
+   size_t nchunks = chunks.size();
+   std::vector<std::vector<Bytef>> zbuffers(nchunks);
+
+   #pragma omp parallel for schedule(dynamic,1)
+   for (size_t ichunk=0; ichunk<nchunks; ++ichunk)
+   {
+     OpBinChunk& c = chunks[ichunk];
+     c.crc = crc32( crc32(0L,Z_NULL,0), (Bytef*)data[ichunk], c.raw_bytes);
+     c.stored_bytes = c.raw_bytes;
+     c.compressed = 0;
+     if (not compress or c.raw_bytes==0) continue;
+     uLongf zsize = compressBound(c.raw_bytes);
+     zbuffers[ichunk].resize(zsize);
+     if (compress2( zbuffers[ichunk].data(), &zsize, (Bytef*)data[ichunk], c.raw_bytes, 1) == Z_OK and zsize < c.raw_bytes)
+     {
+       zbuffers[ichunk].resize(zsize);
+       c.stored_bytes = zsize;
+       c.compressed = 1;
+     }
+     else
+     {
+       std::vector<Bytef>().swap(zbuffers[ichunk]); // not worth it. store it raw.
+     }
+   }
+
+   uint64_t offset = 0;
+   for (auto& c : chunks)
+   {
+     c.offset = offset;
+     offset += c.stored_bytes;
+   }
+
+   OpBinHeader header = {};
+   std::copy( OPBIN_MAGIC, OPBIN_MAGIC+8, header.magic);
+   header.version       = OPBIN_VERSION;
+   header.endian_tag    = OPBIN_ENDIAN_TAG;
+   header.emax          = modelspace->GetEmax();
+   header.e2max         = modelspace->GetE2max();
+   header.e3max         = modelspace->GetE3max();
+   header.norbits       = modelspace->GetNumberOrbits();
+   header.orbit_hash    = modelspace->GetOrbitListHash();
+   header.nchannels     = modelspace->GetNumberTwoBodyChannels();
+   header.rank_J        = op.GetJRank();
+   header.rank_T        = op.GetTRank();
+   header.parity        = op.GetParity();
+   header.particle_rank = op.GetParticleRank();
+   header.op_E3max      = op.GetE3max();
+   header.hermitian     = op.IsHermitian();
+   header.antihermitian = op.IsAntiHermitian();
+   header.zerobody      = op.ZeroBody;
+   header.nchunks       = nchunks;
+
+   std::ofstream opfile(filename, std::ios::binary);
+   if (not opfile.good() )
+   {
+     std::cout << "Trouble opening " << filename << ". Aborting WriteOperatorBinary." << std::endl;
+     goodstate = false;
+     return;
+   }
+   opfile.write( (char*)&header, sizeof(header) );
+   opfile.write( (char*)chunks.data(), nchunks*sizeof(OpBinChunk) );
+   for (size_t ichunk=0; ichunk<nchunks; ++ichunk)
+   {
+     char* ptr = chunks[ichunk].compressed ? (char*)zbuffers[ichunk].data() : data[ichunk];
+     opfile.write( ptr, chunks[ichunk].stored_bytes );
+   }
+   if (not opfile.good())
+   {
+     std::cout << "Error while writing " << filename << " in WriteOperatorBinary." << std::endl;
+     goodstate = false;
+   }
+   opfile.close();
+}
+
+
+/// Read an operator written by WriteOperatorBinary. The model space fingerprint
+/// stored in the file must match the model space of op. If the ranks of op do
+/// not match those of the file, op is reconstructed with the ranks from the file.
+/// Returns true if this read succeeded. On failure, an error is printed and InGoodState() returns
+/// false from then on, like for the other readers. If the failure is a checksum or truncation error,
+/// the contents of op should not be trusted.
+bool ReadWrite::ReadOperatorBinary(Operator& op, std::string filename)
+{
+   IMSRGProfiler::ScopedTimer st("ReadOperatorBinary");
+   ModelSpace* modelspace = op.GetModelSpace();
+   std::ifstream opfile(filename, std::ios::binary);
+   if (not opfile.good() )
+   {
+     std::cout << "Trouble opening " << filename << ". Aborting ReadOperatorBinary." << std::endl;
+     goodstate = false;
+     return false;
+   }
+
+   OpBinHeader header;
+   opfile.read( (char*)&header, sizeof(header) );
+   if ( (not opfile.good()) or (not std::equal(OPBIN_MAGIC, OPBIN_MAGIC+8, header.magic)) )
+   {
+     std::cout << "ReadOperatorBinary: " << filename << " is not a binary operator file." << std::endl;
+     goodstate = false;
+     return false;
+   }
+   if (header.endian_tag != OPBIN_ENDIAN_TAG)
+   {
+     std::cout << "ReadOperatorBinary: " << filename << " was written on a machine with different endianness." << std::endl;
+     goodstate = false;
+     return false;
+   }
+   if (header.version > OPBIN_VERSION)
+   {
+     std::cout << "ReadOperatorBinary: " << filename << " has format version " << header.version
+               << " but I only know up to version " << OPBIN_VERSION << std::endl;
+     goodstate = false;
+     return false;
+   }
+   if (   header.orbit_hash != modelspace->GetOrbitListHash()
+       or header.norbits    != modelspace->GetNumberOrbits()
+       or header.e2max      != modelspace->GetE2max()
+       or header.nchannels  != modelspace->GetNumberTwoBodyChannels()
+       or (header.particle_rank>2 and header.e3max != modelspace->GetE3max()) )
+   {
+     std::cout << "ReadOperatorBinary: model space of " << filename << " (emax,e2max,e3max,norbits = "
+               << header.emax << "," << header.e2max << "," << header.e3max << "," << header.norbits
+               << ") does not match the current model space ("
+               << modelspace->GetEmax() << "," << modelspace->GetE2max() << "," << modelspace->GetE3max()
+               << "," << modelspace->GetNumberOrbits() << ")" << std::endl;
+     goodstate = false;
+     return false;
+   }
+
+   std::vector<OpBinChunk> chunks_file(header.nchunks);
+   opfile.read( (char*)chunks_file.data(), header.nchunks*sizeof(OpBinChunk) );
+   std::streampos data_start = opfile.tellg();
+
+   // Fill op in place rather than through a temporary, since scratch operators can be large.
+   if (   op.GetJRank() != header.rank_J or op.GetTRank() != header.rank_T
+       or op.GetParity() != header.parity or op.GetParticleRank() != header.particle_rank)
+   {
+     op = Operator(*modelspace, header.rank_J, header.rank_T, header.parity, header.particle_rank);
+   }
+   if (header.hermitian) op.SetHermitian();
+   else if (header.antihermitian) op.SetAntiHermitian();
+   else op.SetNonHermitian();
+   op.ZeroBody = header.zerobody;
+   if (header.particle_rank > 2)
+   {
+     op.SetE3max(header.op_E3max);
+     if (op.ThreeBody.MatEl.empty()) op.ThreeBody.Allocate(); // this also detaches from shared matrix elements, which are read-only
+   }
+
+   std::vector<OpBinChunk> chunks;
+   std::vector<char*> data;
+   OpBinListChunks(op, chunks, data);
+   size_t nchunks = chunks.size();
+   if ( (int64_t)nchunks != header.nchunks )
+   {
+     std::cout << "ReadOperatorBinary: " << filename << " has " << header.nchunks << " chunks, but I expected "
+               << nchunks << std::endl;
+     goodstate = false;
+     return false;
+   }
+   for (size_t ichunk=0; ichunk<nchunks; ++ichunk)
+   {
+     OpBinChunk& cf = chunks_file[ichunk];
+     OpBinChunk& c  = chunks[ichunk];
+     if ( cf.kind != c.kind or cf.ch_bra != c.ch_bra or cf.ch_ket != c.ch_ket or cf.nrows != c.nrows
+          or cf.ncols != c.ncols or cf.elem_size != c.elem_size or cf.raw_bytes != c.raw_bytes )
+     {
+       std::cout << "ReadOperatorBinary: chunk " << ichunk << " of " << filename << " (kind " << cf.kind << " "
+                 << cf.ch_bra << " " << cf.ch_ket << " " << cf.nrows << "x" << cf.ncols
+                 << ") does not match the operator layout." << std::endl;
+       goodstate = false;
+       return false;
+     }
+   }
+
+   // The matrix elements are written behind the back of TwoBodyME, so the cached block structure goes stale,
+   // and whatever charge symmetry op had doesn't carry over to the new matrix elements.
+   op.TwoBody.ClearBlockStructure();
+   op.SetChargeSymmetric(false);
+
+   // Uncompressed chunks go straight into the operator; compressed ones are staged and inflated in parallel.
+   std::vector<std::vector<Bytef>> zbuffers(nchunks);
+   for (size_t ichunk=0; ichunk<nchunks; ++ichunk)
+   {
+     OpBinChunk& cf = chunks_file[ichunk];
+     opfile.seekg( data_start + (std::streamoff)cf.offset );
+     if (cf.compressed)
+     {
+       zbuffers[ichunk].resize(cf.stored_bytes);
+       opfile.read( (char*)zbuffers[ichunk].data(), cf.stored_bytes );
+     }
+     else
+     {
+       opfile.read( data[ichunk], cf.stored_bytes );
+     }
+   }
+   if (not opfile.good())
+   {
+     std::cout << "ReadOperatorBinary: " << filename << " is truncated." << std::endl;
+     goodstate = false;
+     return false;
+   }
+   opfile.close();
+
+   int nbad = 0;
+   #pragma omp parallel for schedule(dynamic,1) reduction(+:nbad)
+   for (size_t ichunk=0; ichunk<nchunks; ++ichunk)
+   {
+     OpBinChunk& cf = chunks_file[ichunk];
+     if (cf.compressed)
+     {
+       uLongf rawsize = cf.raw_bytes;
+       int status = uncompress( (Bytef*)data[ichunk], &rawsize, zbuffers[ichunk].data(), cf.stored_bytes);
+       std::vector<Bytef>().swap(zbuffers[ichunk]);
+       if (status != Z_OK or rawsize != cf.raw_bytes)
+       {
+         nbad++;
+         continue;
+       }
+     }
+     if ( crc32( crc32(0L,Z_NULL,0), (Bytef*)data[ichunk], cf.raw_bytes) != cf.crc ) nbad++;
+   }
+   if (nbad > 0)
+   {
+     std::cout << "ReadOperatorBinary: " << nbad << " chunks of " << filename << " failed the checksum." << std::endl;
+     goodstate = false;
+     return false;
+   }
+   return true;
+}
+
+
+/// Returns the emax of the model space a binary operator file was written in,
+/// or -1 if filename isn't a binary operator file.
+int ReadWrite::GetOperatorBinaryEmax(std::string filename)
+{
+   std::ifstream opfile(filename, std::ios::binary);
+   OpBinHeader header;
+   opfile.read( (char*)&header, sizeof(header) );
+   if ( (not opfile.good()) or (not std::equal(OPBIN_MAGIC, OPBIN_MAGIC+8, header.magic)) or header.endian_tag != OPBIN_ENDIAN_TAG )
+     return -1;
+   return header.emax;
+}
+
 /// Read an operator from a plain-text file
 void ReadWrite::ReadOperatorHuman(Operator &op, std::string filename)
 {
@@ -72,6 +72,9 @@ class ReadWrite
    void WriteOperatorHuman(Operator& op, std::string filename);
    void ReadOperator(Operator& op, std::string filename); 
    void ReadOperatorHuman(Operator& op, std::string filename); 
+   void WriteOperatorBinary(Operator& op, std::string filename, bool compress=false);
+   bool ReadOperatorBinary(Operator& op, std::string filename);
+   int GetOperatorBinaryEmax(std::string filename);
    void CompareOperators(Operator& op1, Operator& op2, std::string filename);
    void ReadOneBody_Takayuki(std::string filename, Operator& Hbare);
    void ReadTwoBody_Takayuki(std::string filename, Operator& Hbare);
@@ -96,12 +99,16 @@ class ReadWrite
    void SetAref(int a){Aref = a;};
    void SetZref(int z){Zref = z;};
    void Set3NFormat( std::string fmt ){format3N=fmt;};
+   void SetThreeBodySharedName( std::string name ){threebody_shared_name = name;};
+   uint64_t ThreeBodySharedKey(std::string filename, Operator& Hbare, int E1max, int E2max, int E3max);
+   static uint64_t FileFingerprint(std::string filename, bool with_mtime);
 
    // Fields
 
    std::map<std::string,std::string> InputParameters;
 
    bool InGoodState(){return goodstate;};
+   void ClearErrors(){goodstate = true;}; ///< forget about earlier failures, so InGoodState() is true again
    bool doCoM_corr;
    bool goodstate;
    std::array<double,5> LECs;
@@ -109,6 +116,7 @@ class ReadWrite
    std::string File2N;
    std::string File3N;
    std::string format3N;
+   std::string threebody_shared_name; ///< if not empty, 3N matrix elements are shared between processes with this name. See ThreeBodyME::AllocateShared()
    int Aref;
    int Zref;   
 
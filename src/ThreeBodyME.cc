@@ -1,5 +1,97 @@
 #include "ThreeBodyME.hh"
 #include "AngMom.hh"
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace {
+  const int SHARED_3B_MAX_ATTACH = 256;
+
+  /// Header at the start of a shared memory segment holding 3N matrix elements.
+  /// The matrix elements follow after one page.
+  struct SharedThreeBodyHeader
+  {
+    std::atomic<uint64_t> magic; ///< set last by the process which creates the segment
+    uint64_t key;                ///< identifies the interaction file and truncations
+    uint64_t total_dimension;
+    int64_t filler_pid;          ///< the process which reads the file into the segment
+    std::atomic<int64_t> ready;  ///< 0 while filling, 1 when done, -1 if the filling failed or the filler died
+    std::atomic<int32_t> attached_pid[SHARED_3B_MAX_ATTACH]; ///< processes using the segment, 0 for a free slot
+  };
+  const uint64_t SHARED_3B_MAGIC = 0x33424d45534d4532; // "3BMESME2"
+
+  /// The header takes up one page, so the matrix elements can be protected separately.
+  size_t SharedHeaderSize()
+  {
+    return std::max( (size_t)sysconf(_SC_PAGESIZE), sizeof(SharedThreeBodyHeader) );
+  }
+
+  /// A name with a slash anywhere but at the front is a file for a file-backed mapping,
+  /// otherwise it's the name of a POSIX shared memory segment.
+  bool SharedNameIsFile(const std::string& name)
+  {
+    return name.find('/',1) != std::string::npos;
+  }
+
+  void UnlinkShared(const std::string& name)
+  {
+    if (SharedNameIsFile(name)) unlink(name.c_str());
+    else shm_unlink(name.c_str());
+  }
+
+  /// Remove name, but only if it still refers to the segment we have (device dev, inode ino).
+  /// Someone else may have removed it and made a new one in the meantime.
+  void UnlinkSharedIfSame(const std::string& name, dev_t dev, ino_t ino)
+  {
+    int fd = SharedNameIsFile(name) ? open(name.c_str(), O_RDONLY) : shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) return;
+    struct stat st;
+    bool same = fstat(fd,&st)==0 and st.st_dev==dev and st.st_ino==ino;
+    close(fd);
+    if (same) UnlinkShared(name);
+  }
+
+  bool ProcessIsAlive(int64_t pid)
+  {
+    return kill(pid,0)==0 or errno != ESRCH;
+  }
+
+  /// Record this process as attached, reusing the slot of a process which is gone (e.g. was killed).
+  /// Returns the slot, or -1 if they're all taken.
+  int AttachSharedSlot(SharedThreeBodyHeader* header)
+  {
+    int32_t me = getpid();
+    for (int islot=0; islot<SHARED_3B_MAX_ATTACH; ++islot)
+    {
+      int32_t pid = header->attached_pid[islot].load();
+      if ( (pid==0 or not ProcessIsAlive(pid)) and header->attached_pid[islot].compare_exchange_strong(pid, me) )
+        return islot;
+    }
+    return -1;
+  }
+
+  /// Free the slot taken by AttachSharedSlot(), and return true if no process which is still alive is attached.
+  /// Without a slot we can't tell, so then it's false.
+  bool DetachSharedSlot(SharedThreeBodyHeader* header, int islot)
+  {
+    if (islot < 0) return false;
+    header->attached_pid[islot].store(0);
+    for (auto& slot : header->attached_pid)
+    {
+      int32_t pid = slot.load();
+      if (pid!=0 and ProcessIsAlive(pid)) return false;
+    }
+    return true;
+  }
+}
 
 
 ThreeBodyME::~ThreeBodyME()
@@ -149,10 +241,22 @@ void ThreeBodyME::Allocate()
 
 
 
-// Confusing nomenclature: J2 means 2 times the total J of the three body system
 void ThreeBodyME::Allocate()
 {
   MatEl.clear();
+  shared_MatEl.reset();
+  SetupIndex();
+  MatEl.resize(total_dimension,0.0);
+  std::cout << "Allocated " << total_dimension << " three body matrix elements (" <<  total_dimension * sizeof(ThreeBME_type)/1024./1024./1024. << " GB), "
+       << std::endl << "  number of buckets in hash table: " << OrbitIndexHash.bucket_count() << "  and load factor = " << OrbitIndexHash.load_factor()
+       << "  estimated storage ~ " << ((OrbitIndexHash.bucket_count()+OrbitIndexHash.size()) * (sizeof(size_t)+sizeof(void*))) / (1024.*1024.*1024.) << " GB"
+       << std::endl;
+}
+
+/// Work out where each block of matrix elements goes in MatEl, and the total number of them.
+// Confusing nomenclature: J2 means 2 times the total J of the three body system
+void ThreeBodyME::SetupIndex()
+{
   OrbitIndexHash.clear();
   E3max = modelspace->GetE3max();
   int norbits = modelspace->GetNumberOrbits();
@@ -221,12 +325,6 @@ void ThreeBodyME::Allocate()
      } //c
    } //b
   } //a
-  MatEl.resize(total_dimension,0.0);
-  std::cout << "Allocated " << total_dimension << " three body matrix elements (" <<  total_dimension * sizeof(ThreeBME_type)/1024./1024./1024. << " GB), "
-       << std::endl << "  number of buckets in hash table: " << OrbitIndexHash.bucket_count() << "  and load factor = " << OrbitIndexHash.load_factor()
-       << "  estimated storage ~ " << ((OrbitIndexHash.bucket_count()+OrbitIndexHash.size()) * (sizeof(size_t)+sizeof(void*))) / (1024.*1024.*1024.) << " GB"
-       << std::endl;
-
 }
 
 
@@ -287,8 +385,9 @@ ThreeBME_type ThreeBodyME::GetME_pn(int Jab_in, int Jde_in, int J2, int a, int b
 ThreeBME_type ThreeBodyME::GetME(int Jab_in, int Jde_in, int J2, int tab_in, int tde_in, int T2, int a_in, int b_in, int c_in, int d_in, int e_in, int f_in) const
 {
    auto elements =  AccessME(Jab_in,Jde_in,J2,tab_in,tde_in,T2,a_in,b_in,c_in,d_in,e_in,f_in);
+   const ThreeBME_type* matel = GetMatElData();
    double me = 0;
-   for (auto elem : elements) me += MatEl.at(elem.first) * elem.second;
+   for (auto elem : elements) me += matel[elem.first] * elem.second;
    return me;
 }
 
@@ -299,10 +398,12 @@ ThreeBME_type ThreeBodyME::GetME(int Jab_in, int Jde_in, int J2, int tab_in, int
 //*******************************************************************
 void ThreeBodyME::SetME(int Jab_in, int Jde_in, int J2, int tab_in, int tde_in, int T2, int a_in, int b_in, int c_in, int d_in, int e_in, int f_in, ThreeBME_type V)
 {
+   if (shared_MatEl) DetachShared();
    auto elements = AccessME(Jab_in,Jde_in,J2,tab_in,tde_in,T2,a_in,b_in,c_in,d_in,e_in,f_in);
+   ThreeBME_type* matel = GetMatElData();
    double me = 0;
-   for (auto elem : elements)  me += MatEl.at(elem.first) * elem.second;
-   for (auto elem : elements)  MatEl.at(elem.first) += (V-me)*elem.second;
+   for (auto elem : elements)  me += matel[elem.first] * elem.second;
+   for (auto elem : elements)  matel[elem.first] += (V-me)*elem.second;
 }
 
 //*******************************************************************
@@ -360,7 +461,7 @@ std::vector<std::pair<size_t,double>> ThreeBodyME::AccessME(int Jab_in, int Jde_
 
 
    auto indx = it_hash->second;
-   if (indx > MatEl.size()) std::cout << "ThreeBodyME::AccessME() --  AAAAHHH indx = " << indx << "  but MatEl.size() = " << MatEl.size() << std::endl;
+   if (indx > total_dimension) std::cout << "ThreeBodyME::AccessME() --  AAAAHHH indx = " << indx << "  but total_dimension = " << total_dimension << std::endl;
 
    int J_index = 0;
    for (int Jab=Jab_min; Jab<=Jab_max; ++Jab)
@@ -456,22 +557,204 @@ int ThreeBodyME::SortOrbits(int a_in, int b_in, int c_in, int& a, int& b, int& c
 void ThreeBodyME::Erase()
 {
    MatEl.clear();
+   shared_MatEl.reset();
 }
 
 /// Free up the memory used for the matrix elements
 void ThreeBodyME::Deallocate()
 {
    std::vector<ThreeBME_type>().swap(MatEl);
+   shared_MatEl.reset();
    OrbitIndexHash.clear(); 
 }
 
 
+/// Put the matrix elements in memory which is shared by all the processes on a node using the same name,
+/// either a POSIX shared memory segment (e.g. "imsrg_3n") or a file-backed mapping (e.g. "/scratch/me3j_e14.shm").
+/// key should identify the interaction file and the truncations, so that a segment holding something else isn't used.
+/// The first process to get here creates the segment, and should read in the matrix elements and then call FinishSharedFill().
+/// The others wait for that, and attach to it read-only. If the filling fails or the process doing it dies, the segment
+/// is removed and made again, up to retries times.
+/// Returns true if the matrix elements still need to be read in by this process. If the segment can't be used,
+/// the matrix elements are allocated privately as usual, and true is returned.
+/// A shared memory segment is removed when the last process using it detaches. A file is kept, so later runs can attach to it right away.
+/// The attached processes are recorded by pid, so processes which were killed don't keep the segment around once the others are done.
+/// If they were all killed, the segment stays in /dev/shm until the next run with the same name and key uses it and removes it,
+/// or until it's deleted by hand.
+bool ThreeBodyME::AllocateShared(std::string name, uint64_t key, int retries)
+{
+  Deallocate();
+  total_dimension = 0;
+  SetupIndex();
+  bool is_file = SharedNameIsFile(name);
+  if (not is_file and name[0] != '/') name = "/" + name;
+  shared_name = name;
+  size_t header_size = SharedHeaderSize();
+  size_t data_bytes = total_dimension * sizeof(ThreeBME_type);
+  size_t total_bytes = header_size + data_bytes;
+
+  bool creator = true;
+  int fd = is_file ? open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644) : shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0 and errno == EEXIST)
+  {
+    creator = false;
+    fd = is_file ? open(name.c_str(), O_RDWR) : shm_open(name.c_str(), O_RDWR, 0644);
+  }
+  struct stat st;
+  if (fd >= 0 and fstat(fd,&st) != 0)
+  {
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0)
+  {
+    std::cout << "ThreeBodyME::AllocateShared : trouble opening " << name << " : " << strerror(errno) << ". Using private memory instead." << std::endl;
+    Allocate();
+    return true;
+  }
+  dev_t dev = st.st_dev;
+  ino_t ino = st.st_ino;
+  if (creator and ftruncate(fd, total_bytes) != 0)
+  {
+    std::cout << "ThreeBodyME::AllocateShared : couldn't make " << name << " big enough for " << data_bytes/1024./1024./1024. << " GB : " << strerror(errno) << ". Using private memory instead." << std::endl;
+    close(fd);
+    UnlinkShared(name);
+    Allocate();
+    return true;
+  }
+  if (not creator)  // wait until the creator has set the size
+  {
+    for (int itry=0; fstat(fd,&st)==0 and (size_t)st.st_size < header_size and itry<600; ++itry)
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if ((size_t)st.st_size != total_bytes)
+    {
+      std::cout << "ThreeBodyME::AllocateShared : " << name << " has size " << st.st_size << " but " << total_bytes << " is needed. Using private memory instead." << std::endl;
+      close(fd);
+      Allocate();
+      return true;
+    }
+  }
+
+  char* segment = (char*) mmap(NULL, total_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED)
+  {
+    std::cout << "ThreeBodyME::AllocateShared : trouble mapping " << name << " : " << strerror(errno) << ". Using private memory instead." << std::endl;
+    if (creator) UnlinkShared(name);
+    Allocate();
+    return true;
+  }
+  SharedThreeBodyHeader* header = (SharedThreeBodyHeader*) segment;
+  ThreeBME_type* data = (ThreeBME_type*) (segment + header_size);
+
+  if (creator)
+  {
+    header->key = key;
+    header->total_dimension = total_dimension;
+    header->filler_pid = getpid();
+    header->ready.store(0);
+    for (auto& slot : header->attached_pid) slot.store(0);
+    header->magic.store(SHARED_3B_MAGIC, std::memory_order_release);
+  }
+  else
+  {
+    // Wait for the creator to fill it. If the filling fails or the creator dies along the way, start over.
+    bool usable = false;
+    bool start_over = false;
+    for (int itry=0; itry<600 and header->magic.load(std::memory_order_acquire) != SHARED_3B_MAGIC; ++itry)
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (header->magic.load(std::memory_order_acquire) == SHARED_3B_MAGIC and header->key == key and header->total_dimension == total_dimension)
+    {
+      std::cout << "Waiting for process " << header->filler_pid << " to read the 3N matrix elements into " << name << std::endl;
+      while (header->ready.load() == 0 and ProcessIsAlive(header->filler_pid))
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      // Only one of the waiting processes gets to flag a dead filler, and that one removes the half-filled segment.
+      int64_t still_filling = 0;
+      if (header->ready.compare_exchange_strong(still_filling, -1))
+      {
+        std::cout << "ThreeBodyME::AllocateShared : process " << header->filler_pid << " died while filling " << name << ". Removing it." << std::endl;
+        UnlinkSharedIfSame(name, dev, ino);
+      }
+      usable = header->ready.load() == 1;
+      start_over = header->ready.load() == -1;
+    }
+    else
+    {
+      std::cout << "ThreeBodyME::AllocateShared : " << name << " holds different 3N matrix elements." << std::endl;
+    }
+    if (not usable)
+    {
+      munmap(segment, total_bytes);
+      if (start_over and retries>0)
+      {
+        std::cout << "ThreeBodyME::AllocateShared : trying " << name << " again." << std::endl;
+        return AllocateShared(name, key, retries-1);
+      }
+      std::cout << "ThreeBodyME::AllocateShared : can't use " << name << ". Using private memory instead." << std::endl;
+      Allocate();
+      return true;
+    }
+    if (data_bytes>0) mprotect(data, data_bytes, PROT_READ);
+  }
+
+  int islot = AttachSharedSlot(header);
+  if (islot < 0)
+    std::cout << "ThreeBodyME::AllocateShared : more than " << SHARED_3B_MAX_ATTACH << " processes are using " << name << ", so this one won't remove it." << std::endl;
+  shared_MatEl = std::shared_ptr<ThreeBME_type>( data, [header,total_bytes,name,is_file,islot,dev,ino](ThreeBME_type*)
+  {
+    bool last = DetachSharedSlot(header, islot);
+    munmap(header, total_bytes);
+    if (last and not is_file) UnlinkSharedIfSame(name, dev, ino);
+  });
+  std::cout << (creator ? "Created " : "Attached to ") << name << " with " << total_dimension << " three body matrix elements (" << data_bytes/1024./1024./1024. << " GB)" << std::endl;
+  return creator;
+}
+
+/// Called by the process which created the shared segment in AllocateShared() once the matrix elements are read in.
+/// If that failed, the segment is removed and the waiting processes start over.
+void ThreeBodyME::FinishSharedFill(bool success)
+{
+  if (not shared_MatEl) return;
+  size_t data_bytes = total_dimension * sizeof(ThreeBME_type);
+  SharedThreeBodyHeader* header = (SharedThreeBodyHeader*) ((char*)shared_MatEl.get() - SharedHeaderSize());
+  if (header->filler_pid != getpid()) return;
+  if (data_bytes>0) mprotect(shared_MatEl.get(), data_bytes, PROT_READ);
+  if (success)
+  {
+    header->ready.store(1);
+  }
+  else
+  {
+    std::cout << "ThreeBodyME::FinishSharedFill : reading failed, so removing " << shared_name << std::endl;
+    header->ready.store(-1);
+    UnlinkShared(shared_name);
+  }
+}
+
+/// Shared matrix elements can only be written by the process filling them, until FinishSharedFill().
+bool ThreeBodyME::SharedIsWritable() const
+{
+  if (not shared_MatEl) return false;
+  const SharedThreeBodyHeader* header = (const SharedThreeBodyHeader*) ((const char*)shared_MatEl.get() - SharedHeaderSize());
+  return header->filler_pid == getpid() and header->ready.load() == 0;
+}
+
+/// Give this operator its own private copy of shared matrix elements, which are read-only.
+/// This is done by SetME() before writing, so changing one operator doesn't touch the others using the segment.
+void ThreeBodyME::DetachShared()
+{
+  if (not shared_MatEl or SharedIsWritable()) return;
+  std::vector<ThreeBME_type>(shared_MatEl.get(), shared_MatEl.get()+total_dimension).swap(MatEl);
+  shared_MatEl.reset();
+}
+
+
 
 void ThreeBodyME::WriteBinary(std::ofstream& f)
 {
   f.write((char*)&E3max,sizeof(E3max));
   f.write((char*)&total_dimension,sizeof(total_dimension));
-  f.write((char*)&MatEl[0],total_dimension);
+  f.write((char*)GetMatElData(),total_dimension);
 }
 
 void ThreeBodyME::ReadBinary(std::ifstream& f)
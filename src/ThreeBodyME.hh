@@ -23,6 +23,8 @@
 #include "ModelSpace.hh"
 #include <fstream>
 #include <unordered_map>
+#include <memory>
+#include <cstdint>
 
 //typedef double ThreeBME_type;
 typedef float ThreeBME_type;
@@ -40,6 +42,8 @@ class ThreeBodyME
  public:
   ModelSpace * modelspace;
   std::vector<ThreeBME_type> MatEl;
+  std::shared_ptr<ThreeBME_type> shared_MatEl; ///< if set, the matrix elements live in memory shared with other processes, and MatEl is empty. Read-only once filled, see DetachShared()
+  std::string shared_name; ///< name of the shared memory segment or file holding shared_MatEl
   std::unordered_map<size_t, size_t> OrbitIndexHash; //
   int E3max;
   size_t total_dimension;
@@ -57,6 +61,14 @@ class ThreeBodyME
 
   size_t KeyHash(size_t,size_t,size_t,size_t,size_t,size_t) const;
   void Allocate();
+  void SetupIndex();
+  bool AllocateShared(std::string name, uint64_t key, int retries=3);
+  void FinishSharedFill(bool success);
+  bool IsShared() const {return (bool)shared_MatEl;};
+  bool SharedIsWritable() const;
+  void DetachShared();
+  ThreeBME_type* GetMatElData() {return shared_MatEl ? shared_MatEl.get() : MatEl.data();};
+  const ThreeBME_type* GetMatElData() const {return shared_MatEl ? shared_MatEl.get() : MatEl.data();};
 
   void SetModelSpace(ModelSpace *ms){modelspace = ms;};
 
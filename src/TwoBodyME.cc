@@ -44,6 +44,7 @@ TwoBodyME::TwoBodyME(ModelSpace* ms, int rJ, int rT, int p)
 
  TwoBodyME& TwoBodyME::operator+=(const TwoBodyME& rhs)
  {
+   ClearBlockStructure();
    for ( auto& itmat : MatEl )
    {
       int ch_bra = itmat.first[0];
@@ -69,6 +70,7 @@ TwoBodyME::TwoBodyME(ModelSpace* ms, int rJ, int rT, int p)
 void TwoBodyME::Allocate()
 {
   MatEl.clear();
+  ClearBlockStructure();
   for (int ch_bra=0; ch_bra<nChannels;++ch_bra)
   {
      TwoBodyChannel& tbc_bra = modelspace->GetTwoBodyChannel(ch_bra);
@@ -130,11 +132,20 @@ double TwoBodyME::GetTBME_norm(int ch_bra, int ch_ket, int a, int b, int c, int
    if (c>d) phase *= ket.Phase(tbc_ket.J);
    if (ch_bra > ch_ket)
    {
-     return phase * modelspace->phase(tbc_bra.J-tbc_ket.J) * GetMatrix(ch_ket,ch_bra)(ket_ind,bra_ind);
+     return phase * GetFlipPhase(ch_bra,ch_ket) * GetMatrix(ch_ket,ch_bra)(ket_ind,bra_ind);
    }
    return phase * GetMatrix(ch_bra,ch_ket)(bra_ind, ket_ind);
 }
 
+/// Only the blocks with ch_bra <= ch_ket are stored. The others are given by
+/// \f$ \langle bra \| X \| ket \rangle = (-1)^{J_{bra}-J_{ket}} h_X \langle ket \| X \| bra \rangle \f$,
+/// where \f$ h_X = \pm 1 \f$ for hermitian (antihermitian) X. This returns that factor.
+double TwoBodyME::GetFlipPhase(int ch_bra, int ch_ket) const
+{
+   double flip = modelspace->phase( modelspace->GetTwoBodyChannel(ch_bra).J - modelspace->GetTwoBodyChannel(ch_ket).J );
+   return antihermitian ? -flip : flip;
+}
+
 void TwoBodyME::SetTBME(int ch_bra, int ch_ket, int a, int b, int c, int d, double tbme)
 {
    TwoBodyChannel& tbc_bra =  modelspace->GetTwoBodyChannel(ch_bra);
@@ -168,7 +179,7 @@ void TwoBodyME::AddToTBME(int ch_bra, int ch_ket, int a, int b, int c, int d, do
     std::swap(ch_bra,ch_ket);
 //    swap(tbc_bra,tbc_ket);
     std::swap(bra_ind,ket_ind);
-    phase *= modelspace->phase(tbc_bra.J-tbc_ket.J);
+    phase *= GetFlipPhase(ch_ket,ch_bra);
    }
 //   cout << "Getting Matrix " << ch_bra << "," << ch_ket << "(" << bra_ind << "," << ket_ind
 //        << "), dimension = " << GetMatrix(ch_bra,ch_ket).n_rows << "x" << GetMatrix(ch_bra,ch_ket).n_cols << endl;
@@ -211,7 +222,7 @@ void TwoBodyME::AddToTBME(int ch_bra, int ch_ket, int ibra, int iket, double tbm
    {
      std::swap(ch_bra,ch_ket);
      std::swap(ibra,iket);
-     tbme *= modelspace->phase( modelspace->GetTwoBodyChannel(ch_bra).J - modelspace->GetTwoBodyChannel(ch_ket).J);
+     tbme *= GetFlipPhase(ch_ket,ch_bra);
    }
    GetMatrix(ch_bra,ch_ket)(ibra,iket) += tbme;
 
@@ -670,6 +681,7 @@ double TwoBodyME::GetTBMEmonopole(Ket & bra, Ket & ket) const
 
 void TwoBodyME::Erase()
 {
+  ClearBlockStructure();
   for ( auto& itmat : MatEl )
   {
      arma::mat& matrix = itmat.second;
@@ -714,6 +726,7 @@ void TwoBodyME::Symmetrize()
 void TwoBodyME::AntiSymmetrize()
 {
   if (rank_J>0) return;
+  ClearBlockStructure();
   for (auto& itmat : MatEl )
   {
     arma::mat& matrix = itmat.second;
@@ -736,6 +749,7 @@ void TwoBodyME::Scale(double x)
 
 void TwoBodyME::Eye()
 {
+   ClearBlockStructure();
    for ( auto& itmat : MatEl )
    {
       arma::mat& matrix = itmat.second;
@@ -744,6 +758,66 @@ void TwoBodyME::Eye()
 }
 
 
+/// Check which sub-blocks of each channel, labeled by the classes cc, vc, qc, vv, qv, qq
+/// of the bra and ket, contain nonzero matrix elements. This lets the commutators skip the
+/// blocks which are exactly zero, e.g. in a generator which only connects qq with cc.
+/// Only implemented for scalar operators.
+void TwoBodyME::FindBlockStructure()
+{
+  ClearBlockStructure();
+  if (rank_J>0 or rank_T>0 or parity>0) return;
+  for (auto& row : BlockClassUnion) row.fill(false);
+  std::map<int,std::vector<std::array<int,2>>> blocks;
+  for ( auto& itmat : MatEl )
+  {
+    int ch = itmat.first[0];
+    TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
+    auto& blocklist = blocks[ch];
+    for (int kbra=0; kbra<nKetClasses; ++kbra)
+    {
+      auto& kets_bra = GetKetIndexByClass(tbc,kbra);
+      if (kets_bra.size()<1) continue;
+      for (int kket=0; kket<nKetClasses; ++kket)
+      {
+        auto& kets_ket = GetKetIndexByClass(tbc,kket);
+        if (kets_ket.size()<1) continue;
+        if ( arma::accu(arma::abs(itmat.second.submat(kets_bra,kets_ket))) > 0 )
+        {
+          blocklist.push_back({kbra,kket});
+          BlockClassUnion[kbra][kket] = true;
+        }
+      }
+    }
+  }
+  BlockStructure = std::move(blocks);
+  block_structure_valid.value = true;
+}
+
+/// Label a two-body ket by the core/valence/qspace character of its orbits:
+/// 0=cc, 1=vc, 2=qc, 3=vv, 4=qv, 5=qq. This is the same ordering as the KetIndex_cc ... KetIndex_qq lists.
+int TwoBodyME::GetKetClass(int cvq_p, int cvq_q)
+{
+  int lo = std::min(cvq_p,cvq_q);
+  int hi = std::max(cvq_p,cvq_q);
+  if (lo==0) return hi;     // cc, vc, qc
+  if (lo==1) return hi+2;   // vv, qv
+  return 5;                 // qq
+}
+
+const arma::uvec& TwoBodyME::GetKetIndexByClass(const TwoBodyChannel& tbc, int k)
+{
+  switch (k)
+  {
+    case 0: return tbc.GetKetIndex_cc();
+    case 1: return tbc.GetKetIndex_vc();
+    case 2: return tbc.GetKetIndex_qc();
+    case 3: return tbc.GetKetIndex_vv();
+    case 4: return tbc.GetKetIndex_qv();
+    default: return tbc.GetKetIndex_qq();
+  }
+}
+
+
 int TwoBodyME::Dimension()
 {
    int dim = 0;
@@ -760,10 +834,66 @@ int TwoBodyME::size()
   int size=0;
   for ( auto& itmat : MatEl )
      size += itmat.second.size();
+  for ( auto& itfac : LowRankFactors )
+     size += itfac.second[0].size() + itfac.second[1].size();
   return size*sizeof(double);
 }
 
 
+/// Replace each channel block by its SVD, truncated to the smallest rank r for which the discarded
+/// singular values have a norm of at most tol times the norm of the block. The block is only replaced
+/// if the factors are smaller than the block itself. Nothing can be done with the matrix elements
+/// until Decompress() is called. Returns the Frobenius norm of everything that was discarded.
+double TwoBodyME::Compress(double tol)
+{
+  ClearBlockStructure();
+  double discarded = 0;
+  for ( auto& itmat : MatEl )
+  {
+    arma::mat& M = itmat.second;
+    size_t n = M.n_rows;
+    size_t m = M.n_cols;
+    if ( n==0 or m==0 ) continue;
+    arma::mat U,V;
+    arma::vec sv;
+    if ( not arma::svd_econ(U,sv,V,M) ) continue;
+    double norm2_block = arma::accu(sv%sv);
+    double norm2_tail = 0;
+    size_t r = sv.n_elem;
+    while ( r>0 and norm2_tail + sv(r-1)*sv(r-1) <= tol*tol*norm2_block )
+    {
+      norm2_tail += sv(r-1)*sv(r-1);
+      --r;
+    }
+    if ( r*(n+m) >= n*m ) continue;
+    U = U.head_cols(r);
+    U.each_row() %= sv.head(r).t();
+    LowRankFactors[itmat.first] = { U, V.head_cols(r) };
+    M.reset();
+    discarded += norm2_tail;
+  }
+  return sqrt(discarded);
+}
+
+
+/// Undo Compress(), multiplying the factors back into full channel blocks.
+/// A truncated SVD of a diagonal block isn't (anti)symmetric in general, e.g. if the truncation splits
+/// a pair of equal singular values, so those blocks are projected back onto the right symmetry.
+/// That can only bring them closer to the original blocks.
+void TwoBodyME::Decompress()
+{
+  for ( auto& itfac : LowRankFactors )
+  {
+    arma::mat& M = MatEl[itfac.first];
+    M = itfac.second[0] * itfac.second[1].t();
+    if (itfac.first[0] != itfac.first[1]) continue;
+    if (hermitian) M = 0.5*(M + M.t());
+    else if (antihermitian) M = 0.5*(M - M.t());
+  }
+  LowRankFactors.clear();
+}
+
+
 
 void TwoBodyME::WriteBinary( std::ofstream& of )
 {
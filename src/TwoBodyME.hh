@@ -25,14 +25,25 @@
 #include "ModelSpace.hh"
 #include <map>
 #include <array>
+#include <atomic>
 class TwoBodyME_ph;
 
+/// A std::atomic<bool> which can be copied, so that classes holding one keep their implicit copy constructors.
+struct CopyableAtomicFlag
+{
+  std::atomic<bool> value;
+  CopyableAtomicFlag(bool b=false) : value(b) {};
+  CopyableAtomicFlag(const CopyableAtomicFlag& other) : value(other.value.load()) {};
+  CopyableAtomicFlag& operator=(const CopyableAtomicFlag& other) {value.store(other.value.load()); return *this;};
+};
+
 /// The two-body piece of the operator, stored in a vector of maps of of armadillo matrices.
 /// The index of the vector indicates the J-coupled two-body channel of the ket state, while the
 /// map key is the two-body channel of the bra state. This is done to allow for tensor operators
 /// which connect different two-body channels without having to store all possible combinations.
 /// In the case of a scalar operator, there is only one map key for the bra state, corresponding
-/// to that of the ket state.
+/// to that of the ket state. For a tensor operator, only the blocks with ch_bra <= ch_ket are stored,
+/// and the others are reconstructed using hermiticity, see GetFlipPhase().
 /// The normalized J-coupled TBME's are stored in the matrices. However, when the TBME's are
 /// accessed by GetTBME(), they are returned as
 /// \f$ \tilde{\Gamma}_{ijkl} \equiv \sqrt{(1+\delta_{ij})(1+\delta_{kl})} \Gamma_{ijkl} \f$
@@ -59,6 +70,18 @@ class TwoBodyME
   int rank_J;
   int rank_T;
   int parity;
+  /// Optional block structure of a scalar operator, e.g. a generator which only connects certain classes of kets.
+  /// BlockStructure[ch] lists the (bra,ket) ket classes (see GetKetClass()) of the sub-blocks of channel ch
+  /// which may be nonzero. All other sub-blocks are exactly zero. An empty map means nothing is known.
+  /// It is invalidated by the setters and the non-const GetMatrix(), so anything writing to MatEl directly
+  /// should call ClearBlockStructure(). Invalidating only resets an atomic flag, so it's safe inside parallel loops.
+  std::map<int,std::vector<std::array<int,2>>> BlockStructure;
+  CopyableAtomicFlag block_structure_valid; ///< Set by FindBlockStructure(), reset by ClearBlockStructure().
+  std::array<std::array<bool,6>,6> BlockClassUnion; ///< Which class combinations are nonzero in any channel.
+  static const int nKetClasses = 6; ///< cc, vc, qc, vv, qv, qq
+  /// Channel blocks stored as a truncated SVD by Compress(), MatEl[ch] = LowRankFactors[ch][0] * LowRankFactors[ch][1].t().
+  /// The corresponding blocks of MatEl are empty until Decompress() is called.
+  std::map<std::array<int,2>,std::array<arma::mat,2>> LowRankFactors;
 
   ~TwoBodyME();
   TwoBodyME();
@@ -79,13 +102,14 @@ class TwoBodyME
   void SetAntiHermitian();
   void SetNonHermitian();
 
-  arma::mat& GetMatrix(int chbra, int chket){return MatEl.at({chbra,chket});};
+  arma::mat& GetMatrix(int chbra, int chket){if (HasBlockStructure()) ClearBlockStructure(); return MatEl.at({chbra,chket});};
   arma::mat& GetMatrix(int ch){return GetMatrix(ch,ch);};
   arma::mat& GetMatrix(std::array<int,2> a){return GetMatrix(a[0],a[1]);};
   const arma::mat& GetMatrix(int chbra, int chket)const {return  MatEl.at({chbra,chket});};
   const arma::mat& GetMatrix(int ch)const {return  GetMatrix(ch,ch);};
 
  //TwoBody setter/getters
+  double GetFlipPhase(int ch_bra, int ch_ket) const;
   double GetTBME(int ch_bra, int ch_ket, int a, int b, int c, int d) const;
   double GetTBME_norm(int ch_bra, int ch_ket, int a, int b, int c, int d) const;
   void   SetTBME(int ch_bra, int ch_ket, int a, int b, int c, int d, double tbme);
@@ -153,6 +177,17 @@ class TwoBodyME
   void PrintMatrix(int chbra,int chket) const { MatEl.at({chbra,chket}).print();};
   int Dimension();
   int size();
+  double Compress(double tol);
+  void Decompress();
+  bool IsCompressed() const {return not LowRankFactors.empty();};
+
+  void FindBlockStructure();
+  void ClearBlockStructure(){block_structure_valid.value.store(false,std::memory_order_relaxed);};
+  bool HasBlockStructure() const {return block_structure_valid.value.load(std::memory_order_relaxed);};
+  const std::vector<std::array<int,2>>& GetBlockStructure(int ch) const {return BlockStructure.at(ch);};
+  bool BlockMayBeNonzero(int class_bra, int class_ket) const {return (not HasBlockStructure()) or BlockClassUnion[class_bra][class_ket];};
+  static int GetKetClass(int cvq_p, int cvq_q);
+  static const arma::uvec& GetKetIndexByClass(const TwoBodyChannel& tbc, int k);
 
   void WriteBinary(std::ofstream&);
   void ReadBinary(std::ifstream&);
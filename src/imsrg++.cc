@@ -50,12 +50,17 @@
 #include <iomanip>
 #include <sstream>
 #include <omp.h>
+#include <future>
+#include <sys/stat.h>
 #include "IMSRG.hh"
 #include "Parameters.hh"
 
 using namespace imsrg_util;
 
+// The body is a function-try-block, so that an error thrown by the library, e.g. when a scratch Omega
+// can't be read back during a transformation, ends the run with a message instead of an abort.
 int main(int argc, char** argv)
+try
 {
   // Default parameters, and everything passed by command line args.
 #ifdef BUILDVERSION
@@ -77,6 +82,7 @@ int main(int argc, char** argv)
   string valence_generator = parameters.s("valence_generator");
   string fmt2 = parameters.s("fmt2");
   string fmt3 = parameters.s("fmt3");
+  string threebody_shared = parameters.s("3bme_shared");
   string denominator_delta_orbit = parameters.s("denominator_delta_orbit");
   string LECs = parameters.s("LECs");
   string scratch = parameters.s("scratch");
@@ -85,13 +91,24 @@ int main(int argc, char** argv)
   string occ_file = parameters.s("occ_file");
   string goose_tank = parameters.s("goose_tank");
   string write_omega = parameters.s("write_omega");
+  string omega_init = parameters.s("omega_init");
   string nucleon_mass_correction = parameters.s("nucleon_mass_correction");
+  string profile_file = parameters.s("profile_file");
+  string flowstatus_async = parameters.s("flowstatus_async");
+  string write_transformation = parameters.s("write_transformation");
+  string transform_only = parameters.s("transform_only");
+  string euler_step_control = parameters.s("euler_step_control");
+  string charge_symmetric = parameters.s("charge_symmetric");
 
   int eMax = parameters.i("emax");
   int E3max = parameters.i("e3max");
   int lmax3 = parameters.i("lmax3");
+  int emax_nat = parameters.i("emax_nat");
   int targetMass = parameters.i("A");
   int nsteps = parameters.i("nsteps");
+  int flowstatus_interval = parameters.i("flowstatus_interval");
+  int scratch_cache_mb = parameters.i("scratch_cache_mb");
+  int Hs_resync_interval = parameters.i("Hs_resync_interval");
   int file2e1max = parameters.i("file2e1max");
   int file2e2max = parameters.i("file2e2max");
   int file2lmax = parameters.i("file2lmax");
@@ -110,12 +127,15 @@ int main(int argc, char** argv)
   double BetaCM = parameters.d("BetaCM");
   double hwBetaCM = parameters.d("hwBetaCM");
   double eta_criterion = parameters.d("eta_criterion");
+  double omega_compression_tol = parameters.d("omega_compression_tol");
 
   vector<string> opnames = parameters.v("Operators");
   vector<string> opsfromfile = parameters.v("OperatorsFromFile");
 
   vector<Operator> ops;
   vector<string> spwf = parameters.v("SPWF");
+  vector<string> flowstatus_skip = parameters.v("flowstatus_skip");
+  vector<string> batch = parameters.v("batch");
 
 
   ifstream test;
@@ -142,13 +162,35 @@ int main(int argc, char** argv)
     }
     test.close();
   }
+  if (transform_only != "none" and (batch.size()>0 or valence_space.find('+')!=string::npos))
+  {
+    cout << "transform_only works with one target and one valence space at a time. exiting." << endl;
+    return 1;
+  }
+  // The truncated model space replaces the full one along the way, so it can't be reused for the next target,
+  // and the saved transformation would refer to both. brueckner2 goes back to the HF basis and Hbare, which are still full size.
+  if (emax_nat >= 0 and emax_nat < eMax and (basis != "NAT" or batch.size()>0 or write_transformation == "true" or write_transformation == "True" or method == "brueckner2"))
+  {
+    cout << "emax_nat needs basis=NAT, and doesn't work with batch, write_transformation or method=brueckner2. exiting." << endl;
+    return 1;
+  }
+  // The occupations fix the reference, so one occ_file can't serve several targets.
+  if (batch.size()>0 and occ_file != "none" and occ_file != "")
+  {
+    cout << "occ_file can't be combined with batch, since each target has its own reference. exiting." << endl;
+    return 1;
+  }
 
 
 
+  if (profile_file != "none")
+    IMSRGProfiler::trace_enabled = true;
+
   ReadWrite rw;
   rw.SetLECs_preset(LECs);
   rw.SetScratchDir(scratch);
   rw.Set3NFormat( fmt3 );
+  if (threebody_shared != "none") rw.SetThreeBodySharedName( threebody_shared );
 
 //  ModelSpace modelspace;
 
@@ -164,27 +206,47 @@ int main(int argc, char** argv)
   }
 
 
-  ModelSpace modelspace = ( reference=="default" ? ModelSpace(eMax,valence_space) : ModelSpace(eMax,reference,valence_space) );
-
-  if (occ_file != "none" and occ_file != "" )
+  // In batch mode, the interaction is read once and then each target is done in turn.
+  // The targets are given as reference:valence_space or reference:valence_space:A
+  vector<array<string,3>> targets;
+  if (batch.size() == 0)
+  {
+    targets.push_back( {reference, valence_space, to_string(targetMass)} );
+  }
+  for (auto& tag : batch)
+  {
+    array<string,3> target = {"","","-1"};
+    istringstream ss(tag);
+    for (int i=0;i<3;i++) getline(ss,target[i],':');
+    if (target[1]=="") target[1] = target[0];
+    targets.push_back(target);
+  }
+  if (batch.size() > 0)
   {
-    modelspace.Init_occ_from_file(eMax,valence_space,occ_file);
+    reference = targets[0][0];
+    valence_space = targets[0][1];
   }
 
-  if (nsteps < 0)
-    nsteps = modelspace.valence.size()>0 ? 2 : 1;
+  // Several valence spaces with the same core can be given as e.g. sd-shell+sdpf-shell.
+  // The model space is set up with the first one.
+  string first_valence_space = valence_space.substr(0, valence_space.find('+'));
+  ModelSpace modelspace = ( reference=="default" ? ModelSpace(eMax,first_valence_space) : ModelSpace(eMax,reference,first_valence_space) );
 
+  if (occ_file != "none" and occ_file != "" )
+  {
+    modelspace.Init_occ_from_file(eMax,first_valence_space,occ_file);
+  }
 
   modelspace.SetHbarOmega(hw);
-  if (targetMass>0)
-     modelspace.SetTargetMass(targetMass);
   modelspace.SetE3max(E3max);
   if (lmax3>0)
      modelspace.SetLmax3(lmax3);
   
   cout << "Making the operator..." << endl;
-  int particle_rank = input3bme=="none" ? 2 : 3;
-  Operator Hbare = Operator(modelspace,0,0,0,particle_rank);
+  int particle_rank = (input3bme=="none" or transform_only!="none") ? 2 : 3;
+  // If the 3N matrix elements are shared with other processes, they're allocated when they're read.
+  Operator Hbare = Operator(modelspace,0,0,0, threebody_shared=="none" ? particle_rank : 2);
+  Hbare.SetParticleRank(particle_rank);
   Hbare.SetHermitian();
 
 
@@ -193,10 +255,20 @@ int main(int argc, char** argv)
     Hbare.SetUseGooseTank(true);
   }
 
-  cout << "Reading interactions..." << endl;
+  // In transform-only mode, the interaction isn't needed. Just the kinetic energy, so the HF object can be made.
+  if (transform_only != "none")
+  {
+    cout << "Transforming operators with " << transform_only << ". Not reading interactions." << endl;
+    rw.File2N = inputtbme; // these are just for the headers of the output files
+    rw.File3N = input3bme;
+    rw.SetAref(modelspace.GetAref());
+    rw.SetZref(modelspace.GetZref());
+  }
+  else
+    cout << "Reading interactions..." << endl;
 
 
-  if (inputtbme != "none")
+  if (inputtbme != "none" and transform_only == "none")
   {
     if (fmt2 == "me2j")
       rw.ReadBareTBME_Darmstadt(inputtbme, Hbare,file2e1max,file2e2max,file2lmax);
@@ -220,15 +292,6 @@ int main(int argc, char** argv)
     cout << "done reading 2N" << endl;
   }
 
-  if (fmt2 != "nushellx")  // Don't need to add kinetic energy if we read a shell model interaction
-  {
-    Hbare += Trel_Op(modelspace);
-  }
-
-  if ( nucleon_mass_correction == "true" or nucleon_mass_correction == "True" )  
-  {  // correction to kinetic energy because M_proton != M_neutron
-    Hbare += Trel_Masscorrection_Op(modelspace);
-  }
   
   if (Hbare.particle_rank >=3)
   {
@@ -236,277 +299,523 @@ int main(int argc, char** argv)
     cout << "done reading 3N" << endl;
   }  
 
-
-  // Add a Lawson term. If hwBetaCM is specified, use that frequency
-  if (std::abs(BetaCM)>1e-3)
+  bool last_target = true;
+  bool default_flowfile = flowfile == parameters.DefaultFlowFile();
+  bool default_intfile = intfile == parameters.DefaultIntFile();
+  double ZeroBody_bare = Hbare.ZeroBody;
+  arma::mat OneBody_bare;
+  TwoBodyME TwoBody_bare;
+  if (targets.size()>1)
   {
-    if (hwBetaCM < 0) hwBetaCM = modelspace.GetHbarOmega();
-    ostringstream hcm_opname;
-    hcm_opname << "HCM_" << hwBetaCM;
-    Hbare += BetaCM * imsrg_util::OperatorFromString( modelspace, hcm_opname.str());
+    OneBody_bare = Hbare.OneBody;
+    TwoBody_bare = Hbare.TwoBody;
   }
 
-  cout << "Creating HF" << endl;
-  HartreeFock hf(Hbare);
-  cout << "Solving" << endl;
-  hf.Solve();
-//  cout << "EHF = " << hf.EHF << endl;
-  
-//  Operator HNO;
-  Operator& HNO = Hbare;
-  if (basis == "HF" and method !="HF")
-    HNO = hf.GetNormalOrderedH();
-  else if (basis == "oscillator")
-    HNO = Hbare.DoNormalOrdering();
-
-
-  int n_radial_points = 40;
-  double Rmax = 10.0;
-  vector<index_t> spwf_indices = modelspace.String2Index(spwf);
-  vector<double> R(n_radial_points);
-  vector<double> PSI(n_radial_points);
-  for ( index_t i=0; i< spwf.size(); ++i)
+  // Fingerprint of the interaction and the model space, written with the transformation (write_transformation=true)
+  // so that transform_only can check that it's being applied to the same problem.
+  auto transformation_fingerprint = [&]()
   {
-    for (int rstep=0;rstep<n_radial_points;++rstep) R[rstep] = Rmax/n_radial_points * rstep;
-    hf.GetRadialWF(spwf_indices[i], R, PSI);
-    ofstream wf_file (intfile + "_spwf_" + spwf[i] + ".dat");
-    for ( index_t rstep=0; rstep<R.size(); ++rstep)  wf_file << fixed << setw(10) << setprecision(7) << R[rstep] << "   " << setw(10) << setprecision(7) << PSI[rstep] << endl;
-    cout << "About to close wf file" << endl;
-//    wf_file.close();
-  }
-  if (spwf.size() > 0)   cout << "Done with SPWF" << endl;
-
-  HNO -= BetaCM * 1.5*hwBetaCM;
-  cout << "Hbare 0b = " << HNO.ZeroBody << endl;
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](string x){ for (char c : x+'|') { hash ^= (unsigned char)c; hash *= 1099511628211ULL; } };
+    // The files are checked by content rather than modification time, so copying them along with the transformation is fine.
+    for (string fname : {inputtbme, input3bme}) add( to_string(ReadWrite::FileFingerprint(fname, false)) );
+    for (string x : {fmt2, fmt3, LECs, basis, nucleon_mass_correction}) add(x);
+    for (int x : {file2e1max, file2e2max, file2lmax, file3e1max, file3e2max, file3e3max}) add(to_string(x));
+    for (int x : {modelspace.GetEmax(), modelspace.GetE3max(), modelspace.GetLmax3(), modelspace.GetTargetMass(), modelspace.GetTargetZ()}) add(to_string(x));
+    for (double x : {modelspace.GetHbarOmega(), BetaCM, hwBetaCM}) add(to_string(x));
+    add(to_string(modelspace.GetOrbitListHash()));
+    for (auto c : modelspace.core) add(to_string(c));
+    add("valence");
+    for (auto v : modelspace.valence) add(to_string(v));
+    return hash;
+  };
+
+  // Write the transformed operators. For a valence space, these are shell model files.
+  // For a single reference, the expectation values are printed and tensor operators are written out.
+  auto write_operators = [&]()
+  {
+    if (modelspace.valence.size() > 0)
+    {
+      for (index_t i=0;i<ops.size();++i)
+      {
+        if ((ops[i].GetJRank()+ops[i].GetTRank()+ops[i].GetParity())<1)
+        {
+          rw.WriteNuShellX_op(ops[i],intfile+opnames[i]+".int");
+        }
+        else
+        {
+          rw.WriteTensorOneBody(intfile+opnames[i]+"_1b.op",ops[i],opnames[i]);
+          rw.WriteTensorTwoBody(intfile+opnames[i]+"_2b.op",ops[i],opnames[i]);
+        }
+      }
+    }
+    else
+    {
+      for (index_t i=0;i<ops.size();++i)
+      {
+        Operator& op = ops[i];
+        cout << opnames[i] << " = " << ops[i].ZeroBody << endl;
+        if ( opnames[i] == "Rp2" )
+        {
+           int Z = modelspace.GetTargetZ();
+           int A = modelspace.GetTargetMass();
+           cout << " IMSRG point proton radius = " << sqrt( op.ZeroBody ) << endl; 
+           cout << " IMSRG charge radius = " << sqrt( op.ZeroBody + r2p + r2n*(A-Z)/Z + DF) << endl; 
+        }
+        if ((op.GetJRank()>0) or (op.GetTRank()>0)) // if it's a tensor, you probably want the full operator
+        {
+          cout << "Writing operator to " << intfile+opnames[i]+".op" << endl;
+          rw.WriteOperatorHuman(op,intfile+opnames[i]+".op");
+        }
+      }
+    }
+  };
 
-  if (method != "HF")
+  for (size_t itarget=0; itarget<targets.size(); ++itarget)
   {
-    cout << "Perturbative estimates of gs energy:" << endl;
-    double EMP2 = HNO.GetMP2_Energy();
-    cout << "EMP2 = " << EMP2 << endl; 
-    double EMP3 = HNO.GetMP3_Energy();
-    cout << "EMP3 = " << EMP3 << endl; 
-    cout << "To 3rd order, E = " << HNO.ZeroBody+EMP2+EMP3 << endl;
-  }
+    last_target = (itarget+1 == targets.size());
+    if (batch.size() > 0)
+    {
+      reference = targets[itarget][0];
+      valence_space = targets[itarget][1];
+      parameters.string_par["reference"] = reference;
+      parameters.string_par["valence_space"] = valence_space;
+      cout << "===================  Batch target " << itarget+1 << " of " << targets.size() << " : " << reference << "  " << valence_space << "  ===================" << endl;
+      flowfile = default_flowfile ? parameters.DefaultFlowFile() : parameters.s("flowfile") + "_" + reference + "_" + valence_space;
+      intfile  = default_intfile  ? parameters.DefaultIntFile()  : parameters.s("intfile") + "_" + reference + "_" + valence_space;
+      modelspace.Init(eMax, reference, valence_space.substr(0, valence_space.find('+')));
+      modelspace.ResetFirstPass();
+      rw.SetAref(modelspace.GetAref());
+      rw.SetZref(modelspace.GetZref());
+    }
+    if (itarget > 0)
+    {
+      Hbare.ZeroBody = ZeroBody_bare;
+      Hbare.OneBody = OneBody_bare;
+      Hbare.TwoBody = TwoBody_bare;
+    }
+    // These may be changed along the way, so they're reset for each target.
+    istringstream(targets[itarget][2]) >> targetMass;
+    method = parameters.s("method");
+    core_generator = parameters.s("core_generator");
+    use_brueckner_bch = parameters.s("use_brueckner_bch");
+    nsteps = parameters.i("nsteps");
+    smax = parameters.d("smax");
+    dsmax = parameters.d("dsmax");
+    ds_0 = parameters.d("ds_0");
+    omega_norm_max = parameters.d("omega_norm_max");
+    hwBetaCM = parameters.d("hwBetaCM");
+    opnames = parameters.v("Operators");
+    ops.clear();
+
+    // The valence spaces which branch off from the same core decoupling
+    vector<string> valence_branches;
+    {
+      istringstream ss(valence_space);
+      string branch;
+      while( getline(ss,branch,'+')) valence_branches.push_back(branch);
+    }
 
+    if (nsteps < 0)
+      nsteps = modelspace.valence.size()>0 ? 2 : 1;
+    if (targetMass>0)
+       modelspace.SetTargetMass(targetMass);
 
+    if (fmt2 != "nushellx")  // Don't need to add kinetic energy if we read a shell model interaction
+    {
+      Hbare += Trel_Op(modelspace);
+    }
 
-  // Calculate all the desired operators
-  for (auto& opname : opnames)
-  {
-    ops.emplace_back( imsrg_util::OperatorFromString(modelspace,opname) );
-  }
+    if ( nucleon_mass_correction == "true" or nucleon_mass_correction == "True" )  
+    {  // correction to kinetic energy because M_proton != M_neutron
+      Hbare += Trel_Masscorrection_Op(modelspace);
+    }
 
 
-  // the format should look like OpName^j_t_p_r^/path/to/file
-  for (auto& tag : opsfromfile)
-  {
-    istringstream ss(tag);
-    string opname,qnumbers,fname;
-    vector<int> qn(4);
-    
-    getline(ss,opname,'^');
-    getline(ss,qnumbers,'^');
-    getline(ss,fname,'^');
-    ss.str(qnumbers);
-    ss.clear();
-//    cout << " ss.str = " << ss.str() << endl;
-    for (int i=0;i<4;i++)
-    {
-      string tmp;
-      getline(ss,tmp,'_');
-      istringstream(tmp) >> qn[i];
-//      cout << i << " [" << tmp << "] " << qn[i] << endl;
-    }
-//    ss >> j; ss.ignore();
-//    ss >> t; ss.ignore();
-//    ss >> p; ss.ignore();
-//    ss >> r;
-    int j,t,p,r;
-    j = qn[0];
-    t = qn[1];
-    p = qn[2];
-    r = qn[3];
-//    cout << "Parsed tag. opname = " << opname << "  qnumbers = " << qnumbers << "  " << j << " " << t << " " << p << " " << r << "   file = " << fname << endl;
-    Operator op(modelspace,j,t,p,r);
-    rw.Read2bCurrent_Navratil( fname, op );
-    ops.push_back( op );
-    opnames.push_back( opname );
-  }
+    // Add a Lawson term. If hwBetaCM is specified, use that frequency
+    if (std::abs(BetaCM)>1e-3)
+    {
+      if (hwBetaCM < 0) hwBetaCM = modelspace.GetHbarOmega();
+      ostringstream hcm_opname;
+      hcm_opname << "HCM_" << hwBetaCM;
+      Hbare += BetaCM * imsrg_util::OperatorFromString( modelspace, hcm_opname.str());
+    }
 
+    // Transform-only mode: take the HF basis and the sequence of Omegas from a previous run
+    // with write_transformation=true, rather than solving HF and the flow again.
+    arma::mat C_transformation;
+    string omega_basename;
+    int n_omega_transformation = 0;
+    int n_omega_renormal = -1;
+    if (transform_only != "none")
+    {
+      ifstream tfile(transform_only);
+      string tag,hfbasis_file;
+      uint64_t fingerprint_file = 0;
+      map<index_t,double> holes_file;
+      while ( tfile >> tag )
+      {
+        if (tag == "fingerprint") tfile >> hex >> fingerprint_file >> dec;
+        else if (tag == "hfbasis") tfile >> hfbasis_file;
+        else if (tag == "omega") tfile >> omega_basename >> n_omega_transformation;
+        else if (tag == "renormal_order") tfile >> n_omega_renormal;
+        else if (tag == "holes")
+        {
+          int nholes, h;
+          double occ;
+          tfile >> nholes;
+          for (int i=0;i<nholes;i++)
+          {
+            tfile >> h >> occ;
+            holes_file[h] = occ;
+          }
+        }
+      }
+      if (holes_file.empty() or omega_basename == "")
+      {
+        cout << "trouble reading " << transform_only << " exiting. " << endl;
+        return 1;
+      }
+      map<index_t,double> holes_now;
+      for (auto h : modelspace.holes) holes_now[h] = modelspace.GetOrbit(h).occ;
+      if (holes_now != holes_file)
+        modelspace.SetReference(holes_file);
+      if (fingerprint_file != transformation_fingerprint())
+      {
+        cout << "The interaction or model space is not the one used to get the transformation in " << transform_only << ". exiting." << endl;
+        return 1;
+      }
+      if (not C_transformation.load(hfbasis_file, arma::arma_binary))
+      {
+        cout << "trouble reading " << hfbasis_file << " exiting. " << endl;
+        return 1;
+      }
+    }
 
-//  // This is only for testing and should be deleted
-//  if (opsfromfile.size()>1)
-//  {
-//    Operator ogt = imsrg_util::OperatorFromString( modelspace, "GamowTeller");
-//    imsrg_util::Embed1BodyIn2Body( ogt, modelspace.GetTargetMass());
-//    ogt.EraseOneBody();
-//    ops.push_back(ogt);
-//    opnames.push_back("GTembed");
-//  }
+    cout << "Creating HF" << endl;
+    HartreeFock hf(Hbare);
+    if (transform_only != "none")
+    {
+      hf.C = C_transformation;
+    }
+    else
+    {
+      cout << "Solving" << endl;
+      hf.Solve();
+      if (basis == "NAT") hf.GetNaturalOrbitals();
+    }
+  //  cout << "EHF = " << hf.EHF << endl;
+  
+  //  Operator HNO;
+    // Normally HNO just replaces Hbare to save memory, but Hbare is still needed if there are more targets to do.
+    Operator HNO_target;
+    Operator& HNO = last_target ? Hbare : HNO_target;
+    if ((basis == "HF" or basis == "NAT") and method !="HF" and transform_only == "none")
+      HNO = hf.GetNormalOrderedH();
+    else if (basis == "oscillator")
+      HNO = Hbare.DoNormalOrdering();
+    else if (not last_target)
+      HNO = Hbare;
+
+
+    int n_radial_points = 40;
+    double Rmax = 10.0;
+    vector<index_t> spwf_indices = modelspace.String2Index(spwf);
+    vector<double> R(n_radial_points);
+    vector<double> PSI(n_radial_points);
+    for ( index_t i=0; i< spwf.size(); ++i)
+    {
+      for (int rstep=0;rstep<n_radial_points;++rstep) R[rstep] = Rmax/n_radial_points * rstep;
+      hf.GetRadialWF(spwf_indices[i], R, PSI);
+      ofstream wf_file (intfile + "_spwf_" + spwf[i] + ".dat");
+      for ( index_t rstep=0; rstep<R.size(); ++rstep)  wf_file << fixed << setw(10) << setprecision(7) << R[rstep] << "   " << setw(10) << setprecision(7) << PSI[rstep] << endl;
+      cout << "About to close wf file" << endl;
+  //    wf_file.close();
+    }
+    if (spwf.size() > 0)   cout << "Done with SPWF" << endl;
 
+    HNO -= BetaCM * 1.5*hwBetaCM;
+    cout << "Hbare 0b = " << HNO.ZeroBody << endl;
 
-  for (auto& op : ops)
-  {
-     if (basis == "HF") op = hf.TransformToHFBasis(op);
-     op = op.DoNormalOrdering();
-     if (method == "MP3")
-     {
-       double dop = op.MP1_Eval( HNO );
-       cout << "Operator 1st order correction  " << dop << "  ->  " << op.ZeroBody + dop << endl;
-     }
-//     cout << endl << op.OneBody << endl;
-  }
-  auto itR2p = find(opnames.begin(),opnames.end(),"Rp2");
-  if (itR2p != opnames.end())
-  {
-    Operator& Rp2 = ops[itR2p-opnames.begin()];
-    int Z = modelspace.GetTargetZ();
-    int A = modelspace.GetTargetMass();
-    cout << " HF point proton radius = " << sqrt( Rp2.ZeroBody ) << endl; 
-    cout << " HF charge radius = " << ( std::abs(Rp2.ZeroBody)<1e-6 ? 0.0 : sqrt( Rp2.ZeroBody + r2p + r2n*(A-Z)/Z + DF) ) << endl; 
-  }
-  for (index_t i=0;i<ops.size();++i)
-  {
-    cout << opnames[i] << " = " << ops[i].ZeroBody << endl;
-  }
+    if (method != "HF" and transform_only == "none")
+    {
+      cout << "Perturbative estimates of gs energy:" << endl;
+      double EMP2 = HNO.GetMP2_Energy();
+      cout << "EMP2 = " << EMP2 << endl; 
+      double EMP3 = HNO.GetMP3_Energy();
+      cout << "EMP3 = " << EMP3 << endl; 
+      cout << "To 3rd order, E = " << HNO.ZeroBody+EMP2+EMP3 << endl;
+    }
 
 
-  cout << "HF Single particle energies:" << endl;
-//  hf.PrintSPE();
-  hf.PrintSPEandWF();
-  cout << endl;
-  
-  if ( method == "HF" or method == "MP3")
-  {
-    HNO.PrintTimes();
-    return 0;
-  }
 
+    // Calculate all the desired operators
+    for (auto& opname : opnames)
+    {
+      ops.emplace_back( imsrg_util::OperatorFromString(modelspace,opname) );
+    }
 
-  if (method == "FCI")
-  {
-    HNO = HNO.UndoNormalOrdering();
-    rw.WriteNuShellX_int(HNO,intfile+".int");
-    rw.WriteNuShellX_sps(HNO,intfile+".sp");
 
-    for (index_t i=0;i<ops.size();++i)
+    // the format should look like OpName^j_t_p_r^/path/to/file
+    for (auto& tag : opsfromfile)
     {
-      ops[i] = ops[i].UndoNormalOrdering();
-      if ((ops[i].GetJRank()+ops[i].GetTRank()+ops[i].GetParity())<1)
+      istringstream ss(tag);
+      string opname,qnumbers,fname;
+      vector<int> qn(4);
+    
+      getline(ss,opname,'^');
+      getline(ss,qnumbers,'^');
+      getline(ss,fname,'^');
+      ss.str(qnumbers);
+      ss.clear();
+  //    cout << " ss.str = " << ss.str() << endl;
+      for (int i=0;i<4;i++)
       {
-        rw.WriteNuShellX_op(ops[i],intfile+opnames[i]+".int");
+        string tmp;
+        getline(ss,tmp,'_');
+        istringstream(tmp) >> qn[i];
+  //      cout << i << " [" << tmp << "] " << qn[i] << endl;
       }
-      else
+  //    ss >> j; ss.ignore();
+  //    ss >> t; ss.ignore();
+  //    ss >> p; ss.ignore();
+  //    ss >> r;
+      int j,t,p,r;
+      j = qn[0];
+      t = qn[1];
+      p = qn[2];
+      r = qn[3];
+  //    cout << "Parsed tag. opname = " << opname << "  qnumbers = " << qnumbers << "  " << j << " " << t << " " << p << " " << r << "   file = " << fname << endl;
+      Operator op(modelspace,j,t,p,r);
+      rw.Read2bCurrent_Navratil( fname, op );
+      ops.push_back( op );
+      opnames.push_back( opname );
+    }
+
+
+  //  // This is only for testing and should be deleted
+  //  if (opsfromfile.size()>1)
+  //  {
+  //    Operator ogt = imsrg_util::OperatorFromString( modelspace, "GamowTeller");
+  //    imsrg_util::Embed1BodyIn2Body( ogt, modelspace.GetTargetMass());
+  //    ogt.EraseOneBody();
+  //    ops.push_back(ogt);
+  //    opnames.push_back("GTembed");
+  //  }
+
+
+    for (auto& op : ops)
+    {
+       if (basis == "HF" or basis == "NAT") op = hf.TransformToHFBasis(op);
+       op = op.DoNormalOrdering();
+       if (method == "MP3")
+       {
+         double dop = op.MP1_Eval( HNO );
+         cout << "Operator 1st order correction  " << dop << "  ->  " << op.ZeroBody + dop << endl;
+       }
+  //     cout << endl << op.OneBody << endl;
+    }
+    // Drop the natural orbits above emax_nat. In each (l,j,tz) block, the orbit numbered n is the n-th most occupied
+    // (see HartreeFock::GetNaturalOrbitals()), so these are the least occupied ones.
+    // From here on, modelspace is the smaller one, while hf and Hbare are still the full size, so they can't be used anymore.
+    bool nat_truncated = false;
+    if (basis == "NAT" and emax_nat >= 0 and emax_nat < eMax and method != "HF" and transform_only == "none")
+    {
+      index_t norb_nat = (emax_nat+1)*(emax_nat+2);
+      map<index_t,double> holes;
+      for (auto h : modelspace.holes) holes[h] = modelspace.GetOrbit(h).occ;
+      for (auto& orbit_list : {modelspace.holes, modelspace.core, modelspace.valence})
       {
-        rw.WriteTensorOneBody(intfile+opnames[i]+"_1b.op",ops[i],opnames[i]);
-        rw.WriteTensorTwoBody(intfile+opnames[i]+"_2b.op",ops[i],opnames[i]);
+        if (not orbit_list.empty() and *max_element(orbit_list.begin(),orbit_list.end()) >= norb_nat)
+        {
+          cout << "emax_nat = " << emax_nat << " is too small for the reference and valence space. exiting." << endl;
+          return 1;
+        }
       }
+      cout << "HF Single particle energies:" << endl;
+      hf.PrintSPEandWF();
+      cout << endl;
+      cout << "Truncating to the natural orbits with emax = " << emax_nat << endl;
+      ModelSpace ms_full(modelspace);
+      HNO.SetModelSpace(ms_full);
+      for (auto& op : ops) op.SetModelSpace(ms_full);
+      modelspace.Init(emax_nat, holes, modelspace.core, modelspace.valence);
+      modelspace.SetE2max(2*emax_nat);
+      modelspace.SetTargetMass(ms_full.GetTargetMass());
+      modelspace.SetTargetZ(ms_full.GetTargetZ());
+      modelspace.ResetFirstPass();
+      HNO = HNO.Truncate(modelspace);
+      for (auto& op : ops) op = op.Embed(modelspace); // Truncate() only does scalars
+      eMax = emax_nat;
+      nat_truncated = true;
     }
-    HNO.PrintTimes();
-    return 0;
-  }
 
-//  Operator HlowT = HNO;
-//  double Temp = hw;
-//  double Efermi = 0;
-//  Operator Eye = HNO;
-//  Eye.Eye();
-//  HlowT.ScaleFermiDirac(HNO, Temp, Efermi);  // 0 is roughly fermi surface? we can do beter...
-//  Eye.ScaleFermiDirac(HNO, Temp, Efermi);  // 0 is roughly fermi surface? we can do beter...
-//  cout << "Initial low temp trace with T = " << Temp << " and Ef = " << Efermi << ":   " << HlowT.Trace(modelspace.GetAref(),modelspace.GetZref()) <<"  with normalization  " << Eye.Trace( modelspace.GetAref(),modelspace.GetZref() ) << endl; 
-
-  IMSRGSolver imsrgsolver(HNO);
-  imsrgsolver.SetReadWrite(rw);
-  imsrgsolver.SetEtaCriterion(eta_criterion);
-  bool brueckner_restart = false;
-  
-  if (method == "NSmagnus") // "No split" magnus
-  {
-    omega_norm_max=500;
-    method = "magnus";
-  }
-  if (method.find("brueckner") != string::npos)
-  {
-    if (method=="brueckner2") brueckner_restart=true;
-    if (method=="brueckner1step")
-    { 
-       nsteps = 1;
-       core_generator = valence_generator;
-    }
-    use_brueckner_bch = "true";
-    omega_norm_max=500;
-    method = "magnus";
-  }
+    auto itR2p = find(opnames.begin(),opnames.end(),"Rp2");
+    if (itR2p != opnames.end())
+    {
+      Operator& Rp2 = ops[itR2p-opnames.begin()];
+      int Z = modelspace.GetTargetZ();
+      int A = modelspace.GetTargetMass();
+      cout << " HF point proton radius = " << sqrt( Rp2.ZeroBody ) << endl; 
+      cout << " HF charge radius = " << ( std::abs(Rp2.ZeroBody)<1e-6 ? 0.0 : sqrt( Rp2.ZeroBody + r2p + r2n*(A-Z)/Z + DF) ) << endl; 
+    }
+    for (index_t i=0;i<ops.size();++i)
+    {
+      cout << opnames[i] << " = " << ops[i].ZeroBody << endl;
+    }
 
-  if (use_brueckner_bch == "true" or use_brueckner_bch == "True")
-  {
-//    Hbare.SetUseBruecknerBCH(true);
-    HNO.SetUseBruecknerBCH(true);
-    cout << "Using Brueckner flavor of BCH" << endl;
-  }
+    if (transform_only != "none")
+    {
+      // Each Omega is read once and applied to all the operators, while the next one is read in the background.
+      // The operators are done one after the other, since each BCH transformation is already parallel.
+      ModelSpace ms2(modelspace);
+      if (n_omega_renormal >= 0) ms2.SetReference(ms2.core);
+      // This runs on a background thread, so a failed read is passed back as a null pointer and handled below.
+      auto read_omega = [&](int i)
+      {
+        omp_set_num_threads(1);
+        auto omega = make_shared<Operator>( (n_omega_renormal>=0 and i>=n_omega_renormal) ? ms2 : modelspace );
+        ReadWrite reader;
+        if (not reader.ReadOperatorBinary(*omega, IMSRGSolver::OmegaSequenceFileName(omega_basename,i))) omega.reset();
+        return omega;
+      };
+      cout << "transforming operators with " << n_omega_transformation << " Omegas" << endl;
+      future<shared_ptr<Operator>> next = async(launch::async, read_omega, 0);
+      for (int i=0; i<n_omega_transformation; i++)
+      {
+        shared_ptr<Operator> omega_ptr = next.get();
+        if (omega_ptr == nullptr)
+        {
+          cout << "ERROR: failed to read " << IMSRGSolver::OmegaSequenceFileName(omega_basename,i) << ". Exiting." << endl;
+          exit(EXIT_FAILURE);
+        }
+        Operator& omega = *omega_ptr;
+        if (i+1 < n_omega_transformation) next = async(launch::async, read_omega, i+1);
+        if (i == n_omega_renormal) // the rest of the transformation is normal ordered wrt the core
+        {
+          for (auto& op : ops)
+          {
+            op = op.UndoNormalOrdering();
+            op.SetModelSpace(ms2);
+            op = op.DoNormalOrdering();
+          }
+        }
+        for (auto& op : ops) op = op.BCH_Transform( omega );
+      }
+      cout << "Writing operator files: " << intfile << endl;
+      write_operators();
+      continue;
+    }
 
-  imsrgsolver.SetMethod(method);
-//  imsrgsolver.SetHin(Hbare);
-  imsrgsolver.SetHin(HNO);
-  imsrgsolver.SetSmax(smax);
-  imsrgsolver.SetFlowFile(flowfile);
-  imsrgsolver.SetDs(ds_0);
-  imsrgsolver.SetDsmax(dsmax);
-  imsrgsolver.SetDenominatorDelta(denominator_delta);
-  imsrgsolver.SetdOmega(domega);
-  imsrgsolver.SetOmegaNormMax(omega_norm_max);
-  imsrgsolver.SetODETolerance(ode_tolerance);
-  if (denominator_delta_orbit != "none")
-    imsrgsolver.SetDenominatorDeltaOrbit(denominator_delta_orbit);
-
-  imsrgsolver.SetGenerator(core_generator);
-  if (core_generator.find("imaginary")!=string::npos)
-  {
-   if (ds_0>1e-2)
-   {
-     ds_0 = 1e-4;
-     dsmax = 1e-2;
-     imsrgsolver.SetDs(ds_0);
-     imsrgsolver.SetDsmax(dsmax);
-   }
-  }
-  imsrgsolver.Solve();
 
-//  HlowT = imsrgsolver.Transform(HlowT);
-//  cout << "After Solve, low temp trace with T = " << Temp << " and Ef = " << Efermi << ":   " << HlowT.Trace(modelspace.GetAref(),modelspace.GetZref()) << endl; 
+    if (not nat_truncated) // otherwise they were printed before the truncation
+    {
+      cout << "HF Single particle energies:" << endl;
+    //  hf.PrintSPE();
+      hf.PrintSPEandWF();
+      cout << endl;
+    }
+  
+    if ( method == "HF" or method == "MP3")
+    {
+      HNO.PrintTimes();
+      continue;
+    }
 
-  if (method == "magnus")
-  {
-//    for (size_t i=0;i<ops.size();++i)
-//    {
-//      Operator tmp = imsrgsolver.Transform(ops[i]);
-////      rw.WriteOperatorHuman(tmp,intfile+opnames[i]+"_step1.op");
-//    }
-//    cout << endl;
-    // increase smax in case we need to do additional steps
-    smax *= 1.5;
-    imsrgsolver.SetSmax(smax);
-  }
 
+    if (method == "FCI")
+    {
+      HNO = HNO.UndoNormalOrdering();
+      rw.WriteNuShellX_int(HNO,intfile+".int");
+      rw.WriteNuShellX_sps(HNO,intfile+".sp");
 
-  if (brueckner_restart)
-  {
-     arma::mat newC = hf.C * arma::expmat( -imsrgsolver.GetOmega(0).OneBody  );
-//     if (input3bme != "none") Hbare.SetParticleRank(3);
-     HNO = hf.GetNormalOrderedH(newC);
-     imsrgsolver.SetHin(HNO);
-     imsrgsolver.s = 0;
-     imsrgsolver.Solve();
-  }
+      for (index_t i=0;i<ops.size();++i)
+      {
+        ops[i] = ops[i].UndoNormalOrdering();
+        if ((ops[i].GetJRank()+ops[i].GetTRank()+ops[i].GetParity())<1)
+        {
+          rw.WriteNuShellX_op(ops[i],intfile+opnames[i]+".int");
+        }
+        else
+        {
+          rw.WriteTensorOneBody(intfile+opnames[i]+"_1b.op",ops[i],opnames[i]);
+          rw.WriteTensorTwoBody(intfile+opnames[i]+"_2b.op",ops[i],opnames[i]);
+        }
+      }
+      HNO.PrintTimes();
+      continue;
+    }
 
-  if (nsteps > 1) // two-step decoupling, do core first
-  {
-    if (method == "magnus") smax *= 2;
+  //  Operator HlowT = HNO;
+  //  double Temp = hw;
+  //  double Efermi = 0;
+  //  Operator Eye = HNO;
+  //  Eye.Eye();
+  //  HlowT.ScaleFermiDirac(HNO, Temp, Efermi);  // 0 is roughly fermi surface? we can do beter...
+  //  Eye.ScaleFermiDirac(HNO, Temp, Efermi);  // 0 is roughly fermi surface? we can do beter...
+  //  cout << "Initial low temp trace with T = " << Temp << " and Ef = " << Efermi << ":   " << HlowT.Trace(modelspace.GetAref(),modelspace.GetZref()) <<"  with normalization  " << Eye.Trace( modelspace.GetAref(),modelspace.GetZref() ) << endl; 
+
+    IMSRGSolver imsrgsolver(HNO);
+    imsrgsolver.SetReadWrite(rw);
+    imsrgsolver.SetScratchCacheSize(scratch_cache_mb);
+    imsrgsolver.SetEtaCriterion(eta_criterion);
+    bool brueckner_restart = false;
+  
+    if (method == "NSmagnus") // "No split" magnus
+    {
+      omega_norm_max=500;
+      method = "magnus";
+    }
+    if (method.find("brueckner") != string::npos)
+    {
+      if (method=="brueckner2") brueckner_restart=true;
+      if (method=="brueckner1step")
+      { 
+         nsteps = 1;
+         core_generator = valence_generator;
+      }
+      use_brueckner_bch = "true";
+      omega_norm_max=500;
+      method = "magnus";
+    }
+
+    if (use_brueckner_bch == "true" or use_brueckner_bch == "True")
+    {
+  //    Hbare.SetUseBruecknerBCH(true);
+      HNO.SetUseBruecknerBCH(true);
+      cout << "Using Brueckner flavor of BCH" << endl;
+    }
+
+    if (charge_symmetric == "true" or charge_symmetric == "True")
+    {
+      if (modelspace.IsChargeSymmetric() and denominator_delta_orbit == "none")
+        cout << "Dropping the charge-symmetry breaking part of H. Its norm is " << HNO.MakeChargeSymmetric() << endl;
+      else
+        cout << "charge_symmetric=true needs a reference and valence space with N=Z, and no denominator_delta_orbit. Ignoring it." << endl;
+    }
 
-    imsrgsolver.SetGenerator(valence_generator);
-    modelspace.ResetFirstPass();
-    if (valence_generator.find("imaginary")!=string::npos)
+    imsrgsolver.SetMethod(method);
+  //  imsrgsolver.SetHin(Hbare);
+    imsrgsolver.SetHin(HNO);
+    imsrgsolver.SetSmax(smax);
+    imsrgsolver.SetFlowFile(flowfile);
+    imsrgsolver.SetFlowStatusInterval(flowstatus_interval);
+    imsrgsolver.SetFlowStatusAsync(flowstatus_async == "true" or flowstatus_async == "True");
+    imsrgsolver.SetFlowStatusSkip(flowstatus_skip);
+    imsrgsolver.SetDs(ds_0);
+    imsrgsolver.SetDsmax(dsmax);
+    imsrgsolver.SetDenominatorDelta(denominator_delta);
+    imsrgsolver.SetdOmega(domega);
+    imsrgsolver.SetOmegaNormMax(omega_norm_max);
+    imsrgsolver.SetODETolerance(ode_tolerance);
+    imsrgsolver.SetEulerStepControl(euler_step_control == "true" or euler_step_control == "True");
+    imsrgsolver.SetHResyncInterval(Hs_resync_interval);
+    imsrgsolver.SetOmegaCompressionTol(omega_compression_tol);
+    if (denominator_delta_orbit != "none")
+      imsrgsolver.SetDenominatorDeltaOrbit(denominator_delta_orbit);
+
+    imsrgsolver.SetGenerator(core_generator);
+    if (core_generator.find("imaginary")!=string::npos)
     {
      if (ds_0>1e-2)
      {
@@ -516,147 +825,328 @@ int main(int argc, char** argv)
        imsrgsolver.SetDsmax(dsmax);
      }
     }
-    imsrgsolver.SetSmax(smax);
+
+    // Warm start from an Omega from a previous run, e.g. written with write_omega=binary.
+    // If it was obtained with a different emax, it is embedded in (or truncated to) the current model space.
+    if (omega_init != "none")
+    {
+      Operator Omega_init(modelspace);
+      int emax_file = rw.GetOperatorBinaryEmax(omega_init);
+      if (emax_file < 0) // not a binary file. assume it was written with WriteOperatorHuman.
+      {
+        rw.ReadOperatorHuman(Omega_init, omega_init);
+      }
+      else if (emax_file == eMax)
+      {
+        rw.ReadOperatorBinary(Omega_init, omega_init);
+      }
+      else
+      {
+        ModelSpace ms_file = ( reference=="default" ? ModelSpace(emax_file,valence_branches[0]) : ModelSpace(emax_file,reference,valence_branches[0]) );
+        Operator Omega_file(ms_file);
+        rw.ReadOperatorBinary(Omega_file, omega_init);
+        Omega_init = Omega_file.Embed(modelspace);
+      }
+      if (rw.InGoodState())
+      {
+        cout << "Starting the flow from Omega in " << omega_init << " with norm " << Omega_init.Norm() << endl;
+        imsrgsolver.SetInitialOmega(Omega_init);
+      }
+      else
+      {
+        cout << "Trouble reading " << omega_init << ". Starting the flow from Omega = 0" << endl;
+      }
+    }
     imsrgsolver.Solve();
-  }
+    if (imsrgsolver.FlowFailed())
+    {
+      cout << "ERROR: the IMSRG flow failed at s = " << imsrgsolver.s << ". Exiting." << endl;
+      exit(EXIT_FAILURE);
+    }
 
+  //  HlowT = imsrgsolver.Transform(HlowT);
+  //  cout << "After Solve, low temp trace with T = " << Temp << " and Ef = " << Efermi << ":   " << HlowT.Trace(modelspace.GetAref(),modelspace.GetZref()) << endl; 
+
+    if (method == "magnus")
+    {
+  //    for (size_t i=0;i<ops.size();++i)
+  //    {
+  //      Operator tmp = imsrgsolver.Transform(ops[i]);
+  ////      rw.WriteOperatorHuman(tmp,intfile+opnames[i]+"_step1.op");
+  //    }
+  //    cout << endl;
+      // increase smax in case we need to do additional steps
+      smax *= 1.5;
+      imsrgsolver.SetSmax(smax);
+    }
 
 
-  // Transform all the operators
-  if (method == "magnus")
-  {
-    if (ops.size()>0) cout << "transforming operators" << endl;
-    for (size_t i=0;i<ops.size();++i)
+    if (brueckner_restart)
     {
-      cout << opnames[i] << " " << endl;
-      ops[i] = imsrgsolver.Transform(ops[i]);
-      cout << " (" << ops[i].ZeroBody << " ) " << endl; 
-//      rw.WriteOperatorHuman(ops[i],intfile+opnames[i]+"_step2.op");
+       arma::mat newC = hf.C * arma::expmat( -imsrgsolver.GetOmega(0).OneBody  );
+  //     if (input3bme != "none") Hbare.SetParticleRank(3);
+       HNO = hf.GetNormalOrderedH(newC);
+       imsrgsolver.SetHin(HNO);
+       imsrgsolver.s = 0;
+       imsrgsolver.Solve();
+       if (imsrgsolver.FlowFailed())
+       {
+         cout << "ERROR: the IMSRG flow failed at s = " << imsrgsolver.s << ". Exiting." << endl;
+         exit(EXIT_FAILURE);
+       }
     }
-    cout << endl;
-    // increase smax in case we need to do additional steps
-    smax *= 1.5;
-    imsrgsolver.SetSmax(smax);
-  }
 
+    // With several valence spaces, each one branches off from the core-decoupled state,
+    // so the core decoupling and the transformation of the operators by it are only done once.
+    if (valence_branches.size()>1 and nsteps<2)
+    {
+      cout << "WARNING: Several valence spaces require the two-step decoupling. Only doing " << valence_branches[0] << endl;
+      valence_branches.resize(1);
+    }
+    IMSRGSolver::Checkpoint core_checkpoint;
+    map<index_t,double> core_holes;
+    vector<Operator> ops_core;
+    int nOmega_core = 0;
+    double smax_core = smax;
+    string intfile_target = intfile;
+    string flowfile_target = flowfile;
+    if (valence_branches.size()>1)
+    {
+      core_checkpoint = imsrgsolver.GetCheckpoint();
+      for (auto h : modelspace.holes) core_holes[h] = modelspace.GetOrbit(h).occ;
+      nOmega_core = imsrgsolver.GetOmegaSize() + imsrgsolver.GetNOmegaWritten();
+      if (method == "magnus")
+      {
+        for (auto& op : ops) ops_core.push_back( imsrgsolver.Transform(op) );
+      }
+      else
+      {
+        ops_core = ops;
+      }
+    }
 
-  // If we're doing targeted/ensemble normal ordering 
-  // we now re-normal order wrt to the core
-  // and do any remaining flow.
-  ModelSpace ms2(modelspace);
-  bool renormal_order = false;
-  if (modelspace.valence.size() > 0 )
-  {
-    renormal_order = modelspace.holes.size() != modelspace.core.size();
-    if (not renormal_order)
+    for (size_t ibranch=0; ibranch<valence_branches.size(); ++ibranch)
     {
-      for (auto c : modelspace.core)
+      if (valence_branches.size()>1)
+      {
+        string branch = valence_branches[ibranch];
+        cout << "===================  Valence space " << branch << "  ===================" << endl;
+        parameters.string_par["valence_space"] = branch;
+        intfile = default_intfile ? parameters.DefaultIntFile() : intfile_target + "_" + branch;
+        // The core flow is in flowfile_target. Each branch logs the rest of its flow to its own file.
+        flowfile = default_flowfile ? parameters.DefaultFlowFile() : flowfile_target + "_" + branch;
+        imsrgsolver.SetFlowFile(flowfile);
+        if (ibranch > 0)
+        {
+          vector<index_t> core_prev = modelspace.core;
+          modelspace.Init(eMax, core_holes, branch);
+          modelspace.ResetFirstPass();
+          if (targetMass>0)
+             modelspace.SetTargetMass(targetMass);
+          if (modelspace.core != core_prev)
+          {
+            cout << "WARNING: The core of " << branch << " is not the same as the core of " << valence_branches[0] << ". Skipping it." << endl;
+            continue;
+          }
+          // The step size comes back with the checkpoint, so the branch carries on from the core flow like the first one did.
+          imsrgsolver.RestoreCheckpoint(core_checkpoint);
+          imsrgsolver.SetEtaCriterion(eta_criterion);
+          smax = smax_core;
+          ds_0 = parameters.d("ds_0");
+          dsmax = parameters.d("dsmax");
+          imsrgsolver.SetDsmax(dsmax);
+        }
+        ops = ops_core;
+      }
+
+      if (nsteps > 1) // two-step decoupling, do core first
       {
-         if ( (find( modelspace.holes.begin(), modelspace.holes.end(), c) == modelspace.holes.end()) or (std::abs(1-modelspace.GetOrbit(c).occ)>1e-6))
+        if (method == "magnus") smax *= 2;
+
+        imsrgsolver.SetGenerator(valence_generator);
+        modelspace.ResetFirstPass();
+        if (valence_generator.find("imaginary")!=string::npos)
+        {
+         if (ds_0>1e-2)
          {
-           renormal_order = true;
-           break;
+           ds_0 = 1e-4;
+           dsmax = 1e-2;
+           imsrgsolver.SetDs(ds_0);
+           imsrgsolver.SetDsmax(dsmax);
          }
+        }
+        imsrgsolver.SetSmax(smax);
+        imsrgsolver.Solve();
+        if (imsrgsolver.FlowFailed())
+        {
+          cout << "ERROR: the IMSRG flow failed at s = " << imsrgsolver.s << ". Exiting." << endl;
+          exit(EXIT_FAILURE);
+        }
       }
-    }
-  }
-  if ( renormal_order )
-  {
 
-    HNO = imsrgsolver.GetH_s();
 
-    int nOmega = imsrgsolver.GetOmegaSize() + imsrgsolver.GetNOmegaWritten();
-    cout << "Undoing NO wrt A=" << modelspace.GetAref() << " Z=" << modelspace.GetZref() << endl;
-    HNO = HNO.UndoNormalOrdering();
 
-    ms2.SetReference(ms2.core); // change the reference
-    HNO.SetModelSpace(ms2);
+      // Transform all the operators
+      if (method == "magnus")
+      {
+        if (ops.size()>0) cout << "transforming operators" << endl;
+        for (size_t i=0;i<ops.size();++i)
+        {
+          cout << opnames[i] << " " << endl;
+          ops[i] = imsrgsolver.Transform_Partial(ops[i], nOmega_core);
+          cout << " (" << ops[i].ZeroBody << " ) " << endl; 
+    //      rw.WriteOperatorHuman(ops[i],intfile+opnames[i]+"_step2.op");
+        }
+        cout << endl;
+        // increase smax in case we need to do additional steps
+        smax *= 1.5;
+        imsrgsolver.SetSmax(smax);
+      }
 
-    cout << "Doing NO wrt A=" << ms2.GetAref() << " Z=" << ms2.GetZref() << "  norbits = " << ms2.GetNumberOrbits() << endl;
-    HNO = HNO.DoNormalOrdering();
 
-    imsrgsolver.SetHin(HNO);
-    imsrgsolver.SetEtaCriterion(1e-4);
-    imsrgsolver.Solve();
-    // Change operators to the new basis, then apply the rest of the transformation
-    cout << "Final transformation on the operators..." << endl;
-    int iop = 0;
-    for (auto& op : ops)
-    {
-      cout << opnames[iop++] << endl;
-      op = op.UndoNormalOrdering();
-      op.SetModelSpace(ms2);
-      op = op.DoNormalOrdering();
-      // transform using the remaining omegas
-      op = imsrgsolver.Transform_Partial(op,nOmega);
-    }
-  }
+      // If we're doing targeted/ensemble normal ordering 
+      // we now re-normal order wrt to the core
+      // and do any remaining flow.
+      ModelSpace ms2(modelspace);
+      bool renormal_order = false;
+      int nOmega_renormal = -1;
+      if (modelspace.valence.size() > 0 )
+      {
+        renormal_order = modelspace.holes.size() != modelspace.core.size();
+        if (not renormal_order)
+        {
+          for (auto c : modelspace.core)
+          {
+             if ( (find( modelspace.holes.begin(), modelspace.holes.end(), c) == modelspace.holes.end()) or (std::abs(1-modelspace.GetOrbit(c).occ)>1e-6))
+             {
+               renormal_order = true;
+               break;
+             }
+          }
+        }
+      }
+      if ( renormal_order )
+      {
 
+        HNO = imsrgsolver.GetH_s();
+
+        int nOmega = imsrgsolver.GetOmegaSize() + imsrgsolver.GetNOmegaWritten();
+        nOmega_renormal = nOmega;
+        cout << "Undoing NO wrt A=" << modelspace.GetAref() << " Z=" << modelspace.GetZref() << endl;
+        HNO = HNO.UndoNormalOrdering();
+
+        ms2.SetReference(ms2.core); // change the reference
+        HNO.SetModelSpace(ms2);
+
+        cout << "Doing NO wrt A=" << ms2.GetAref() << " Z=" << ms2.GetZref() << "  norbits = " << ms2.GetNumberOrbits() << endl;
+        HNO = HNO.DoNormalOrdering();
+
+        imsrgsolver.SetHin(HNO);
+        imsrgsolver.SetEtaCriterion(1e-4);
+        imsrgsolver.Solve();
+        if (imsrgsolver.FlowFailed())
+        {
+          cout << "ERROR: the IMSRG flow failed at s = " << imsrgsolver.s << ". Exiting." << endl;
+          exit(EXIT_FAILURE);
+        }
+        // Change operators to the new basis, then apply the rest of the transformation
+        cout << "Final transformation on the operators..." << endl;
+        int iop = 0;
+        for (auto& op : ops)
+        {
+          cout << opnames[iop++] << endl;
+          op = op.UndoNormalOrdering();
+          op.SetModelSpace(ms2);
+          op = op.DoNormalOrdering();
+          // transform using the remaining omegas
+          op = imsrgsolver.Transform_Partial(op,nOmega);
+        }
+      }
 
-  // Write the output
 
-  // If we're doing a shell model interaction, write the
-  // interaction files to disk.
-  if (modelspace.valence.size() > 0)
-  {
-    if (valence_file_format == "antoine") // this is still being tested...
-    {
-      rw.WriteAntoine_int(imsrgsolver.GetH_s(),intfile+".ant");
-      rw.WriteAntoine_input(imsrgsolver.GetH_s(),intfile+".inp",modelspace.GetAref(),modelspace.GetZref());
-    }
-    cout << "Writing files: " << intfile << endl;
-    rw.WriteNuShellX_int(imsrgsolver.GetH_s(),intfile+".int");
-    rw.WriteNuShellX_sps(imsrgsolver.GetH_s(),intfile+".sp");
+      // Write the output
 
-    if (method == "magnus")
-    {
-       for (index_t i=0;i<ops.size();++i)
-       {
-          if ((ops[i].GetJRank()+ops[i].GetTRank()+ops[i].GetParity())<1)
-          {
-            rw.WriteNuShellX_op(ops[i],intfile+opnames[i]+".int");
-          }
-          else
-          {
-            rw.WriteTensorOneBody(intfile+opnames[i]+"_1b.op",ops[i],opnames[i]);
-            rw.WriteTensorTwoBody(intfile+opnames[i]+"_2b.op",ops[i],opnames[i]);
-          }
-       }
-    }
-  }
-  else // single ref. just print the zero body pieces out. (maybe check if its magnus?)
-  {
-    cout << "Core Energy = " << setprecision(6) << imsrgsolver.GetH_s().ZeroBody << endl;
-    for (index_t i=0;i<ops.size();++i)
-    {
-      Operator& op = ops[i];
-      cout << opnames[i] << " = " << ops[i].ZeroBody << endl;
-      if ( opnames[i] == "Rp2" )
+      // If we're doing a shell model interaction, write the
+      // interaction files to disk.
+      if (modelspace.valence.size() > 0)
       {
-         int Z = modelspace.GetTargetZ();
-         int A = modelspace.GetTargetMass();
-         cout << " IMSRG point proton radius = " << sqrt( op.ZeroBody ) << endl; 
-         cout << " IMSRG charge radius = " << sqrt( op.ZeroBody + r2p + r2n*(A-Z)/Z + DF) << endl; 
+        if (valence_file_format == "antoine") // this is still being tested...
+        {
+          rw.WriteAntoine_int(imsrgsolver.GetH_s(),intfile+".ant");
+          rw.WriteAntoine_input(imsrgsolver.GetH_s(),intfile+".inp",modelspace.GetAref(),modelspace.GetZref());
+        }
+        cout << "Writing files: " << intfile << endl;
+        rw.WriteNuShellX_int(imsrgsolver.GetH_s(),intfile+".int");
+        rw.WriteNuShellX_sps(imsrgsolver.GetH_s(),intfile+".sp");
+
+        if (method == "magnus") write_operators();
       }
-      if ((op.GetJRank()>0) or (op.GetTRank()>0)) // if it's a tensor, you probably want the full operator
+      else // single ref. just print the zero body pieces out. (maybe check if its magnus?)
       {
-        cout << "Writing operator to " << intfile+opnames[i]+".op" << endl;
-        rw.WriteOperatorHuman(op,intfile+opnames[i]+".op");
+        cout << "Core Energy = " << setprecision(6) << imsrgsolver.GetH_s().ZeroBody << endl;
+        write_operators();
       }
-    }
-  }
 
 
-//  cout << "Made it here and write_omega is " << write_omega << endl;
-  if (write_omega == "true" or write_omega == "True")
-  {
-    cout << "writing Omega to " << intfile << "_omega.op" << endl;
-    rw.WriteOperatorHuman(imsrgsolver.Omega.back(),intfile+"_omega.op");
-  }
+    //  cout << "Made it here and write_omega is " << write_omega << endl;
+      if (write_omega == "true" or write_omega == "True")
+      {
+        cout << "writing Omega to " << intfile << "_omega.op" << endl;
+        rw.WriteOperatorHuman(imsrgsolver.Omega.back(),intfile+"_omega.op");
+      }
+      else if (write_omega == "binary")
+      {
+        // omega_init applies this file as the whole transformation, so the last of several Omegas would be wrong there.
+        int n_omega = imsrgsolver.GetOmegaSize() + imsrgsolver.GetNOmegaWritten();
+        if (n_omega > 1)
+        {
+          cout << "WARNING: the transformation is made of " << n_omega << " Omegas, which can't be written as one for omega_init."
+               << " Not writing " << intfile << "_omega.bin. Use write_transformation=true to write all of them." << endl;
+        }
+        else
+        {
+          cout << "writing Omega to " << intfile << "_omega.bin" << endl;
+          rw.WriteOperatorBinary(imsrgsolver.Omega.back(),intfile+"_omega.bin",true);
+        }
+      }
+
+      // Everything needed to transform other operators later with transform_only=intfile_transformation.dat
+      if ((write_transformation == "true" or write_transformation == "True") and method == "magnus")
+      {
+        cout << "writing the transformation to " << intfile << "_transformation.dat" << endl;
+        int n_omega = imsrgsolver.WriteOmegaSequence(intfile+"_omega");
+        // Without all the pieces, the transformation file isn't written, so transform_only can't pick up a broken one.
+        if (n_omega < 0 or not hf.C.save(intfile+"_hfbasis.bin", arma::arma_binary))
+        {
+          cout << "ERROR: trouble writing the transformation, so " << intfile << "_transformation.dat is not written." << endl;
+        }
+        else
+        {
+          ofstream tfile(intfile+"_transformation.dat");
+          tfile << "fingerprint " << hex << transformation_fingerprint() << dec << endl;
+          tfile << "hfbasis " << intfile << "_hfbasis.bin" << endl;
+          tfile << "omega " << intfile << "_omega " << n_omega << endl;
+          tfile << "renormal_order " << nOmega_renormal << endl;
+          tfile << "holes " << modelspace.holes.size() << endl;
+          for (auto h : modelspace.holes) tfile << h << " " << setprecision(15) << modelspace.GetOrbit(h).occ << endl;
+        }
+      }
+    } // loop over valence spaces
+  } // loop over targets
 
 
   Hbare.PrintTimes();
+  if (profile_file != "none")
+  {
+    cout << "writing profiling info to " << profile_file << ".csv and " << profile_file << ".json" << endl;
+    Hbare.profiler.WriteTimesCSV(profile_file+".csv");
+    Hbare.profiler.WriteTraceJSON(profile_file+".json");
+  }
  
   return 0;
 }
-
+catch (std::exception& e)
+{
+  cout << "ERROR: " << e.what() << ". Exiting." << endl;
+  return EXIT_FAILURE;
+}
@@ -391,7 +391,7 @@ Operator KineticEnergy_Op(ModelSpace& modelspace)
 /// \f]
  Operator TCM_Op(ModelSpace& modelspace)
  {
-   double t_start = omp_get_wtime();
+   IMSRGProfiler::ScopedTimer st("TCM_Op");
    int E2max = modelspace.GetE2max();
    double hw = modelspace.GetHbarOmega();
    int A = modelspace.GetTargetMass();
@@ -415,36 +415,22 @@ Operator KineticEnergy_Op(ModelSpace& modelspace)
    }
 
    // Two body piece = 2*p1*p2/(2mA) = (Tcm-Trel)/A
+   Calculate_p1p2_all(TcmOp);
+   TcmOp.TwoBody *= 1.0/A;
+   // Kets above E2max are left out
    int nchan = modelspace.GetNumberTwoBodyChannels();
-   modelspace.PreCalculateMoshinsky();
-   #pragma omp parallel for schedule(dynamic,1)  // In order to make this parallel, need to precompute the Moshinsky brackets.
    for (int ch=0; ch<nchan; ++ch)
    {
       TwoBodyChannel& tbc = modelspace.GetTwoBodyChannel(ch);
-      int nkets = tbc.GetNumberKets();
-      for (int ibra=0;ibra<nkets;++ibra)
+      arma::mat& MatJJ = TcmOp.TwoBody.GetMatrix(ch);
+      for (int iket=0; iket<tbc.GetNumberKets(); ++iket)
       {
-         Ket & bra = tbc.GetKet(ibra);
-         Orbit & oi = modelspace.GetOrbit(bra.p);
-         Orbit & oj = modelspace.GetOrbit(bra.q);
-         if ( 2*(oi.n+oj.n)+oi.l+oj.l > E2max) continue;
-         for (int iket=ibra;iket<nkets;++iket)
-         {
-            
-            Ket & ket = tbc.GetKet(iket);
-            Orbit & ok = modelspace.GetOrbit(ket.p);
-            Orbit & ol = modelspace.GetOrbit(ket.q);
-            if ( 2*(ok.n+ol.n)+ok.l+ol.l > E2max) continue;
-//            double p1p2 = Calculate_p1p2(modelspace,bra,ket,tbc.J) * hw/A;
-            double p1p2 = Calculate_p1p2(modelspace,bra,ket,tbc.J) / A;
-            if (std::abs(p1p2)>1e-7)
-            {
-              TcmOp.TwoBody.SetTBME(ch,ibra,iket,p1p2);
-            }
-         }
+         Ket& ket = tbc.GetKet(iket);
+         if ( 2*(ket.op->n+ket.oq->n)+ket.op->l+ket.oq->l <= E2max) continue;
+         MatJJ.row(iket).zeros();
+         MatJJ.col(iket).zeros();
       }
    }
-   TcmOp.profiler.timer["TCM_Op"] += omp_get_wtime() - t_start;
    return TcmOp;
  }
 
@@ -636,129 +622,65 @@ Operator KineticEnergy_Op(ModelSpace& modelspace)
 
 
 
-////////////////////////////////////////////////////////////////////////////
-/////////////  IN PROGRESS...  doesn't work yet, and for now it's slower.  /
-////////////////////////////////////////////////////////////////////////////
+/// Oscillator matrix element \f$ \langle n \ell | \frac{1}{2}(p^2 \text{ or } r^2) | n' \ell \rangle \f$ in units of \f$\hbar\omega\f$ or \f$b^2\f$.
+/// The two differ only by the sign of the off-diagonal terms, which is given by offdiag_sign (+1 for p^2, -1 for r^2).
+ double HO_Quadratic_ME(int n, int np, int l, int offdiag_sign)
+ {
+   if (n == np)   return (2*n+l+1.5);
+   if (n == np+1) return offdiag_sign * sqrt(n*( n+l+0.5));
+   if (n == np-1) return offdiag_sign * sqrt(np*( np+l+0.5));
+   return 0;
+ }
+
 
- void Calculate_p1p2_all(Operator& OpIn)
+/// Fill the two-body part of a scalar operator from its matrix elements between the relative/CM oscillator
+/// states \f$ |N\Lambda,n\lambda;(LS)J\rangle \f$. With the transformation matrices \f$ T \f$ which are cached
+/// on the ModelSpace (see ModelSpace::PreCalculateLabToRelCM()), each channel is \f$ T^{T} O_{rel/CM} T \f$.
+/// relcm_me gets the {N,Lam,n,lam,L,S} of the bra and ket, and is only called for states with the same L and S.
+/// It should not depend on isospin, and needs to be thread safe.
+ void RelCMToLab(Operator& OpIn, std::function<double(const std::array<int,6>&,const std::array<int,6>&)> relcm_me)
  {
+   IMSRGProfiler::ScopedTimer st("RelCMToLab");
    ModelSpace* modelspace = OpIn.GetModelSpace();
-//   modelspace->PreCalculateMoshinsky();
-   for ( int ch : modelspace->SortedTwoBodyChannels )
+   modelspace->PreCalculateLabToRelCM();
+   int nchan = modelspace->GetNumberTwoBodyChannels();
+   #pragma omp parallel for schedule(dynamic,1)
+   for (int ch=0; ch<nchan; ++ch)
    {
-      TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
-      int J = tbc.J;
-      int parity = tbc.parity;
-//      int Tz = tbc.Tz;
-      arma::mat& MatJJ = OpIn.TwoBody.GetMatrix(ch);
-      int nkets_JJ = tbc.GetNumberKets();
-
-      // Find the maximum oscillator energy for this channel
-      Ket& ketlast = tbc.GetKet( tbc.GetNumberKets()-1 );
-      int emax_ket = 2*ketlast.op->n + 2*ketlast.oq->n + ketlast.op->l + ketlast.oq->l;
-
-      vector<array<int,6>> JacobiBasis;  // L,S,N,Lambda,n,lambda
-      for (int L=std::max(J-1,0); L<=J+1; ++L)
+      arma::mat& T = modelspace->GetLabToRelCMTransform(ch);
+      auto& basis = modelspace->GetRelCMBasis(ch);
+      int nrel = basis.size();
+      arma::mat MatRelCM(nrel,nrel,arma::fill::zeros);
+      // the basis is ordered with L,S outermost, so we only need the diagonal blocks
+      int block_start = 0;
+      for (int i=0; i<nrel; ++i)
       {
-       for ( int S=std::abs(J-L); S<=1; ++S)
-       {
-        for ( int N=0; N<=emax_ket/2; ++N )
+        if (basis[i][4]!=basis[block_start][4] or basis[i][5]!=basis[block_start][5]) block_start = i;
+        for (int j=block_start; j<=i; ++j)
         {
-         for ( int Lambda=0; Lambda<=(emax_ket-2*N); ++Lambda)
-         {
-          for ( int lambda=std::abs(L-Lambda)+(L+parity)%2; lambda<=std::min(Lambda+L,emax_ket-2*N-Lambda); lambda+=2)
-          {
-           for ( int n =0; n<=(emax_ket-2*N-Lambda-lambda)/2; ++n)
-           {
-             JacobiBasis.push_back({L,S,N,Lambda,n,lambda});
-           }
-          }
-         }
+          MatRelCM(i,j) = relcm_me(basis[i],basis[j]);
+          MatRelCM(j,i) = MatRelCM(i,j);
         }
-       }
       }
-
-
-      int nkets_Jacobi = JacobiBasis.size();
-      arma::mat MatJacobi(nkets_Jacobi,nkets_Jacobi);
-      arma::mat Trans(nkets_Jacobi,nkets_JJ);
-      int n_nonzero = 0;
-      for (int iJJ=0; iJJ<nkets_JJ; ++iJJ)
-      {
-        Ket & ket = tbc.GetKet(iJJ);
-        int la = ket.op->l;
-        int lb = ket.oq->l;
-        int na = ket.op->n;
-        int nb = ket.oq->n;
-        double ja = ket.op->j2*0.5;
-        double jb = ket.oq->j2*0.5;
-//        int ta = ket.op->n;
-//        int tb = ket.oq->n;
-        for (int iJac=0; iJac<nkets_Jacobi; ++iJac)
-        {
-          int L      = JacobiBasis[iJac][0];
-          int S      = JacobiBasis[iJac][1];
-          int N      = JacobiBasis[iJac][2];
-          int Lambda = JacobiBasis[iJac][3];
-          int n      = JacobiBasis[iJac][4];
-          int lambda = JacobiBasis[iJac][5];
-
-//          int Asym = 1; // Fix this...
-          double ninej = AngMom::NormNineJ(la,0.5,ja,lb,0.5,jb,L,S,J);
-          if (std::abs(ninej)<1e-6) continue;
-          double mosh = modelspace->GetMoshinsky(N,Lambda,n,lambda,na,la,nb,lb,L);
-          if (std::abs(mosh)<1e-6) continue;
-          Trans(iJac,iJJ) = ninej * mosh;
-          n_nonzero += 1;
-           
-        }
-      }
-      for (int i=0; i<nkets_Jacobi; ++i)
-      {
-        int Li      = JacobiBasis[i][0];
-        int Si      = JacobiBasis[i][1];
-        int Ni      = JacobiBasis[i][2];
-        int Lambdai = JacobiBasis[i][3];
-        int ni      = JacobiBasis[i][4];
-        int lambdai = JacobiBasis[i][5];
-        for (int j=0; j<nkets_Jacobi; ++j)
-        {
-          int Lj      = JacobiBasis[j][0];
-          int Sj      = JacobiBasis[j][1];
-          int Nj      = JacobiBasis[j][2];
-          int Lambdaj = JacobiBasis[j][3];
-          int nj      = JacobiBasis[j][4];
-          int lambdaj = JacobiBasis[j][5];
-          if(Li!=Lj or Si!=Sj or Lambdai!=Lambdaj or lambdai!=lambdaj) continue;
-          double tcm = 0;
-          double trel = 0;
-          if (ni == nj)
-          {
-            if      (Ni == Nj)   tcm = (2*Ni+Lambdai+1.5);
-            else if (Ni == Nj+1) tcm = sqrt(Ni*( Ni+Lambdai+0.5));
-            else if (Ni == Nj-1) tcm = sqrt(Nj*( Nj+Lambdai+0.5));
-          }
-          if (Ni == Nj)
-          {
-            if      (ni == nj)   tcm = (2*ni+lambdai+1.5);
-            else if (ni == nj+1) tcm = sqrt(ni*( ni+lambdai+0.5));
-            else if (ni == nj-1) tcm = sqrt(nj*( nj+lambdai+0.5));
-          }
-          MatJacobi(i,j) = tcm - trel;
-        }
-      }
-
-
-      MatJJ = Trans.t() * MatJacobi * Trans;
-      cout << "ch = " << ch << "   size of JJ basis = " << nkets_JJ << "  size of Jacobi Basis = " << nkets_Jacobi << "   nonzero matrix elements = " << n_nonzero << endl;
-
+      OpIn.TwoBody.GetMatrix(ch) = T.t() * MatRelCM * T;
    }
  }
 
-////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////
-
 
+/// Fill the two-body part of OpIn with the matrix elements of \f$ \vec{p}_1 \cdot \vec{p}_2 / m \f$,
+/// the same as Calculate_p1p2(), but for all channels at once using RelCMToLab().
+ void Calculate_p1p2_all(Operator& OpIn)
+ {
+   RelCMToLab(OpIn, [](const std::array<int,6>& bra, const std::array<int,6>& ket)
+   {
+      if (bra[1]!=ket[1] or bra[3]!=ket[3]) return 0.; // tcm and trel conserve Lam and lam
+      double tcm  = bra[2]==ket[2] ? HO_Quadratic_ME(bra[0],ket[0],bra[1],+1) : 0;
+      double trel = bra[0]==ket[0] ? HO_Quadratic_ME(bra[2],ket[2],bra[3],+1) : 0;
+      return tcm - trel;
+   });
+   // The 0.5 comes from t ~ 0.5 * (N+3/2) hw
+   OpIn.TwoBody *= 0.5*OpIn.GetModelSpace()->GetHbarOmega();
+ }
 
 
 
@@ -795,27 +717,9 @@ Operator KineticEnergy_Op(ModelSpace& modelspace)
 //      }
 //   }
 
-   int nchan = modelspace.GetNumberTwoBodyChannels();
-   modelspace.PreCalculateMoshinsky();
-   #pragma omp parallel for schedule(dynamic,1) 
-   for (int ch=0; ch<nchan; ++ch)
-   {
-      TwoBodyChannel& tbc = modelspace.GetTwoBodyChannel(ch);
-      int nkets = tbc.GetNumberKets();
-      for (int ibra=0;ibra<nkets;++ibra)
-      {
-         Ket & bra = tbc.GetKet(ibra);
-         for (int iket=ibra;iket<nkets;++iket)
-         {
-            Ket & ket = tbc.GetKet(iket);
-            // factor of 2 comes from limiting sum to i<j. Otherwise it would be r1*r2 + r2*r1.
-            double mat_el = 2*Calculate_r1r2(modelspace,bra,ket,tbc.J); 
-             
-            R2cmOp.TwoBody.SetTBME(ch,ibra,iket,mat_el);
-            R2cmOp.TwoBody.SetTBME(ch,iket,ibra,mat_el);
-         }
-      }
-   }
+   // factor of 2 comes from limiting sum to i<j. Otherwise it would be r1*r2 + r2*r1.
+   Calculate_r1r2_all(R2cmOp);
+   R2cmOp.TwoBody *= 2;
 //   double hw = modelspace.GetHbarOmega();
    int A = modelspace.GetTargetMass();
 //   return R2cmOp * (HBARC*HBARC/M_NUCLEON/hw)/(A*A);
@@ -967,6 +871,24 @@ Operator KineticEnergy_Op(ModelSpace& modelspace)
  }
 
 
+/// Fill the two-body part of OpIn with the matrix elements of \f$ \vec{r}_1 \cdot \vec{r}_2 \f$,
+/// the same as Calculate_r1r2(), but for all channels at once using RelCMToLab().
+ void Calculate_r1r2_all(Operator& OpIn)
+ {
+   RelCMToLab(OpIn, [](const std::array<int,6>& bra, const std::array<int,6>& ket)
+   {
+      if (bra[1]!=ket[1] or bra[3]!=ket[3]) return 0.; // r2cm and r2rel conserve Lam and lam
+      double r2cm  = bra[2]==ket[2] ? HO_Quadratic_ME(bra[0],ket[0],bra[1],-1) : 0;
+      double r2rel = bra[0]==ket[0] ? HO_Quadratic_ME(bra[2],ket[2],bra[3],-1) : 0;
+      return r2cm - r2rel;
+   });
+   // normalize and give dimension of length
+   // the 0.5 comes from the virial theorem, <V> = <T> = 1/2 (N+3/2)hw
+   double oscillator_b2 = (HBARC*HBARC/M_NUCLEON/OpIn.GetModelSpace()->GetHbarOmega());
+   OpIn.TwoBody *= oscillator_b2 * 0.5;
+ }
+
+
 
 
 /// Center of mass Hamiltonian
@@ -1076,33 +998,18 @@ Operator RSquaredOp(ModelSpace& modelspace)
    Operator Rp2Op(modelspace,0,0,0,2);
 //   double oscillator_b = (HBARC*HBARC/M_NUCLEON/modelspace.GetHbarOmega());
 
+   if (option!="matter" and option!="proton" and option!="neutron") cout << "!!! WARNING. BAD OPTION "  << option << " FOR imsrg_util::R2_p2_Op !!!" << endl;
+   Calculate_r1r2_all(Rp2Op);
    int nchan = modelspace.GetNumberTwoBodyChannels();
-   modelspace.PreCalculateMoshinsky();
-   #pragma omp parallel for schedule(dynamic,1) 
    for (int ch=0; ch<nchan; ++ch)
    {
       TwoBodyChannel& tbc = modelspace.GetTwoBodyChannel(ch);
       int Tz = tbc.Tz;
-      if (option=="proton" and Tz > 0) continue; // don't bother with nn channel
-      if (option=="neutron" and Tz < 0) continue; // don't bother with pp channel
-      int nkets = tbc.GetNumberKets();
-      for (int ibra=0;ibra<nkets;++ibra)
-      {
-         Ket & bra = tbc.GetKet(ibra);
-         double prefactor = 1; // factor to account for double counting in pn channel.
-         if (Tz==0 and (option=="proton" or option=="neutron")) prefactor = 0.5;
-//         if (option=="proton" and bra.op->tz2>0) continue;
-//         else if (option=="neutron" and bra.op->tz2<0) continue;
-         if (option!="matter" and option!="proton" and option!="neutron") cout << "!!! WARNING. BAD OPTION "  << option << " FOR imsrg_util::R2_p2_Op !!!" << endl;
-         for (int iket=ibra;iket<nkets;++iket)
-         {
-            Ket & ket = tbc.GetKet(iket);
-//            double mat_el = Calculate_r1r2(modelspace,bra,ket,tbc.J) * oscillator_b ; 
-            double mat_el = Calculate_r1r2(modelspace,bra,ket,tbc.J) * prefactor; 
-            Rp2Op.TwoBody.SetTBME(ch,ibra,iket,mat_el);
-            Rp2Op.TwoBody.SetTBME(ch,iket,ibra,mat_el);
-         }
-      }
+      double prefactor = 1; // factor to account for double counting in pn channel.
+      if (option=="proton" and Tz > 0) prefactor = 0; // don't want the nn channel
+      if (option=="neutron" and Tz < 0) prefactor = 0; // don't want the pp channel
+      if (Tz==0 and (option=="proton" or option=="neutron")) prefactor = 0.5;
+      Rp2Op.TwoBody.GetMatrix(ch) *= prefactor;
    }
    return Rp2Op;
  }
@@ -1204,16 +1111,25 @@ Operator FourierBesselCoeff(ModelSpace& modelspace, int nu, double R, vector<ind
   gsl_function F;
   F.function = &FBCIntegrand;
 
+  map<array<int,2>,array<double,2>> integrals; // the radial density only depends on n,l, so j=l+-1/2 (and p,n) share the integral
   for (auto i : index_list )
   {
     Orbit& oi = modelspace.GetOrbit(i);
-    struct FBCIntegrandParameters params = {oi.n, oi.l, modelspace.GetHbarOmega()};
-    F.params = &params;
-    //int status = gsl_integration_qawo (&F, start, epsstd::abs, epsrel, limit, workspace, table, &result, &std::abserr);
-    gsl_integration_qawo (&F, start, epsabs, epsrel, limit, workspace, table, &result, &abserr);
+    if (integrals.find({oi.n,oi.l}) == integrals.end())
+    {
+      struct FBCIntegrandParameters params = {oi.n, oi.l, modelspace.GetHbarOmega()};
+      F.params = &params;
+      //int status = gsl_integration_qawo (&F, start, epsstd::abs, epsrel, limit, workspace, table, &result, &std::abserr);
+      gsl_integration_qawo (&F, start, epsabs, epsrel, limit, workspace, table, &result, &abserr);
+      integrals[{oi.n,oi.l}] = {result,abserr};
+    }
+    result = integrals[{oi.n,oi.l}][0];
+    abserr = integrals[{oi.n,oi.l}][1];
     a_nu.OneBody(i,i) = M_PI*M_PI/R/R/R * R/nu/M_PI*(result);
     cout << "orbit,nu = " << i << "," << nu << "  => " << a_nu.OneBody(i,i) << "  from " << result << " (" << abserr << ")" << endl;
   }
+  gsl_integration_qawo_table_free(table);
+  gsl_integration_workspace_free(workspace);
   return a_nu;
 }
 
@@ -1493,6 +1409,8 @@ Operator FourierBesselCoeff(ModelSpace& modelspace, int nu, double R, vector<ind
 
 
 
+  static thread_local unordered_map<uint64_t,double> RadialIntegralList; // cache for RadialIntegral(), one per thread
+
 /// Evaluate the radial integral \f[
 /// \tilde{\mathcal{R}}^{\lambda}_{ab} = \int_{0}^{\infty} dx \tilde{g}_{n_a\ell_a}(x)x^{\lambda+2}\tilde{g}_{n_b\ell_b}(x)
 /// \f]
@@ -1502,7 +1420,27 @@ Operator FourierBesselCoeff(ModelSpace& modelspace, int nu, double R, vector<ind
 /// This implementation uses eq (6.41) from Suhonen.
 /// Note this is only valid for \f$ \ell_a+\ell_b+\lambda\f$ = even.
 /// If \f$ \ell_a+\ell_b+\lambda\f$ is odd, RadialIntegral_RpowK() is called.
+///
+/// The integrals don't depend on the oscillator frequency, so they are kept in RadialIntegralList and
+/// shared by all the multipole operators. Each thread has its own table, so it can be filled inside parallel regions,
+/// or from other threads (e.g. python), without locking. The OpenMP threads live on between parallel regions, so their tables do too.
   double RadialIntegral(int na, int la, int nb, int lb, int L)
+  {
+    if (na>nb or (na==nb and la>lb))
+    {
+      std::swap(na,nb);
+      std::swap(la,lb);
+    }
+    if (L<0) return RadialIntegral_nocache(na,la,nb,lb,L);
+    uint64_t key = ((uint64_t)na << 40) + ((uint64_t)la << 30) + ((uint64_t)nb << 20) + ((uint64_t)lb << 10) + (uint64_t)L;
+    auto it = RadialIntegralList.find(key);
+    if (it != RadialIntegralList.end()) return it->second;
+    double rint = RadialIntegral_nocache(na,la,nb,lb,L);
+    RadialIntegralList[key] = rint;
+    return rint;
+  }
+
+  double RadialIntegral_nocache(int na, int la, int nb, int lb, int L)
   {
     if ((la+lb+L)%2!=0) return RadialIntegral_RpowK(na,la,nb,lb,L);
     int tau_a = std::max((lb-la+L)/2,0);
@@ -2247,6 +2185,44 @@ Operator FourierBesselCoeff(ModelSpace& modelspace, int nu, double R, vector<ind
       hGT[i] = (gA*gA) - ((gA*gP*qsq)/(3*mpro)) + (pow(gP*qsq,2)/(12*mprosq)) + ((gM*gM*qsq)/(6*mprosq)); // " " "
       //hGT[i] = (gA*gA)*( 1.0 - (2.0/3.0)*(qsq/(qsq + mpionsq)) + (1.0/3.0)*pow((qsq/(qsq + mpionsq)),2) ) + (pow(magmom,2)/(6.0*mprosq))*pow(gV,2)*qsq; // also works, le algebra
     }
+    // The relative radial matrix elements (RBMEs) only depend on the quadrature node and on nr, lr, npr, so rather than
+    // re-evaluating them at every node for every TBME, we tabulate them once on the quadrature grid and fold in the
+    // closure denominator, form factors and weights. The GLQ integral is then a single lookup per (nr,lr,npr).
+    int nr_max = modelspace.GetEmax(); // relative n and l can go up to the maximum two-body energy 2*emax
+    int lr_max = 2*modelspace.GetEmax();
+    auto rbme_index = [&](int nr, int lr, int npr){ return (nr*(lr_max+1) + lr)*(nr_max+1) + npr; };
+    vector<double> glqF( (nr_max+1)*(lr_max+1)*(nr_max+1), 0.); // integral of the Fermi part
+    vector<double> glqGT( glqF.size(), 0.); // integral of the Gamow-Teller part
+    #pragma omp parallel for schedule(dynamic,1) collapse(2)
+    for (int nr=0; nr<=nr_max; nr++)
+    {
+      for (int lr=0; lr<=lr_max; lr++)
+      {
+        for (int npr=0; npr<=nr_max; npr++)
+        {
+          for (int i=0; i<Nquad; i++)
+          {
+            double q = nodes[i][0];
+            double RBME; // calculate via functions below this Operator
+            if (src == argstr or src == cdbstr or src == masstr)
+            {
+              RBME = CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,0,0)
+                - 2*cc*CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,0,aa)
+                + 2*cc*bb*CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,2,aa)
+                + cc*cc*CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,0,2.0*aa)
+                - 2*bb*cc*cc*CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,2,2.0*aa)
+                + cc*cc*bb*bb*CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,4,2.0*aa); // testing...
+            }
+            else
+            {
+              RBME = CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,0,0);
+            }
+            glqF[rbme_index(nr,lr,npr)] += nodes[i][1]*(q/(q + Ediff))*hF[i]*RBME; // perform the GLQ integration (F)
+            glqGT[rbme_index(nr,lr,npr)] += nodes[i][1]*(q/(q + Ediff))*hGT[i]*RBME; // perform the GLQ integration (GT)
+          } // end of for-loop wrt: GLQ
+        }
+      }
+    }
     // create the TBME of M0nu
     for (auto& itmat : M0nu_TBME.TwoBody.MatEl)
     {
@@ -2293,104 +2269,59 @@ cout<<J<<" | "<<ia<<", "<<ib<<", "<<ic<<", "<<id<<" || "
 <<ja<<", "<<jb<<", "<<jc<<", "<<jd<<" |=|  ";
           int eps_ab = 2*na + la + 2*nb + lb; // for conservation of energy in the Moshinsky brackets
           int eps_cd = 2*nc + lc + 2*nd + ld; // ...likewise
-          double sumglqF = 0; // for the GLQ integration below (F)
+          double sumglqF = 0; // for the GLQ integration (F), which has already been done in glqF
           double sumglqFas = 0; // ...anti-symmetric part (F)
           double sumglqGT = 0; // (GT)
           double sumglqGTas = 0; // (GT)
-          //double sumGLQ = 0; // (F+GT)
-          //double sumGLQas = 0; // (F+GT)
-          for (int i=0; i<Nquad; i++)
+          for (int S=0; S<=1; S++) // sum over total spin...
           {
-            double q = nodes[i][0]; // set the transfer momentum [MeV] via the impending GLQ
-            double sumB = 0; // for the pure Bessel's Matrix Elemets (BMEs)
-            double sumBas = 0; // ...anti-symmetric part
-            double sumBSdS = 0; // for the scalar product of the Bessel's functions and Sigma dot Sigma (SdS)
-            double sumBSdSas = 0; // ...anti-symmetric part
-            for (int S=0; S<=1; S++) // sum over total spin...
+            for (int L = std::abs(la-lb); L <= la+lb; L++) // ...and sum over angular momentum coupled to l_{a_f} and l_{b_f}, NOTE: get same result if used l_{a_i} and l_{b_i} (good)
             {
-              for (int L = std::abs(la-lb); L <= la+lb; L++) // ...and sum over angular momentum coupled to l_{a_f} and l_{b_f}, NOTE: get same result if used l_{a_i} and l_{b_i} (good)
+              double tempLS = (2*L + 1)*(2*S + 1); // just for efficiency, only used in the three lines below
+              double normab = sqrt(tempLS*(2*ja + 1)*(2*jb + 1)); // normalization factor for the 9j-symbol out front
+              double nNJab = normab*modelspace.GetNineJ(la,lb,L,0.5,0.5,S,ja,jb,J); // the normalized 9j-symbol out front
+              double normcd = sqrt(tempLS*(2*jc + 1)*(2*jd + 1)); // normalization factor for the second 9j-symbol
+              double nNJcd = normcd*modelspace.GetNineJ(lc,ld,L,0.5,0.5,S,jc,jd,J); // the second normalized 9j-symbol
+              double nNJdc = normcd*modelspace.GetNineJ(ld,lc,L,0.5,0.5,S,jd,jc,J); // ...anti-symmetric part
+              double sumMTF = 0; // for the Moshinsky-transformed relative BMEs (RBMEs), integrated with the Fermi form factor
+              double sumMTFas = 0; // ...anti-symmetric part
+              double sumMTGT = 0; // " " " " " ", integrated with the Gamow-Teller form factor
+              double sumMTGTas = 0; // ...anti-symmetric part
+              double tempmaxnr = floor((eps_ab - L)/2.0); // just for the limits below
+              double tempmaxnpr = floor((eps_cd - L)/2.0); // " " " " "
+              for (int nr = 0; nr <= tempmaxnr; nr++)
               {
-                double tempLS = (2*L + 1)*(2*S + 1); // just for efficiency, only used in the three lines below
-                double normab = sqrt(tempLS*(2*ja + 1)*(2*jb + 1)); // normalization factor for the 9j-symbol out front
-                double nNJab = normab*modelspace.GetNineJ(la,lb,L,0.5,0.5,S,ja,jb,J); // the normalized 9j-symbol out front
-                double normcd = sqrt(tempLS*(2*jc + 1)*(2*jd + 1)); // normalization factor for the second 9j-symbol
-                double nNJcd = normcd*modelspace.GetNineJ(lc,ld,L,0.5,0.5,S,jc,jd,J); // the second normalized 9j-symbol
-                double nNJdc = normcd*modelspace.GetNineJ(ld,lc,L,0.5,0.5,S,jd,jc,J); // ...anti-symmetric part
-                double sumMT = 0; // for the Moshinsky-transformed relative BMEs (RBMEs)
-                double sumMTas = 0; // ...anti-symmetric part
-                double tempmaxnr = floor((eps_ab - L)/2.0); // just for the limits below
-                double tempmaxnpr = floor((eps_cd - L)/2.0); // " " " " "
-                for (int nr = 0; nr <= tempmaxnr; nr++)
+                double tempmaxNcom = tempmaxnr - nr; // just for the limits below
+                for (int Ncom = 0; Ncom <= tempmaxNcom; Ncom++)
                 {
-                  double tempmaxNcom = tempmaxnr - nr; // just for the limits below
-                  for (int Ncom = 0; Ncom <= tempmaxNcom; Ncom++)
+                  int tempminlr = ceil((eps_ab - L)/2.0) - (nr + Ncom); // just for the limits below
+                  int tempmaxlr = floor((eps_ab + L)/2.0) - (nr + Ncom); // " " " " "
+                  for (int lr = tempminlr; lr <= tempmaxlr; lr++)
                   {
-                    int tempminlr = ceil((eps_ab - L)/2.0) - (nr + Ncom); // just for the limits below
-                    int tempmaxlr = floor((eps_ab + L)/2.0) - (nr + Ncom); // " " " " "
-                    for (int lr = tempminlr; lr <= tempmaxlr; lr++)
+                    int Lam = eps_ab - 2*(nr + Ncom) - lr; // via Equation () of my thesis
+                    for (int npr = 0; npr <= tempmaxnpr; npr++) // npr = n'_r in my latex notation
                     {
-                      int Lam = eps_ab - 2*(nr + Ncom) - lr; // via Equation () of my thesis
-                      for (int npr = 0; npr <= tempmaxnpr; npr++) // npr = n'_r in my latex notation
-                      {
-                        double RBME; // calculate via functions below this Operator
-                        if (src == argstr or src == cdbstr or src == masstr)
-                        {
-                          RBME = CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,0,0)
-                            - 2*cc*CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,0,aa)
-                            + 2*cc*bb*CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,2,aa)
-                            + cc*cc*CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,0,2.0*aa)
-                            - 2*bb*cc*cc*CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,2,2.0*aa)
-                            + cc*cc*bb*bb*CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,4,2.0*aa); // testing...
-                        }
-                        else
-                        {
-                          RBME = CPrbmeGen(modelspace,0,q,nr,lr,npr,lr,0,0);
-                          //RBME = CPrbmeGLQ(modelspace,Nquad,nodes,q,nr,lr,npr,lr,0,0);
-                        }
-                        double Df = modelspace.GetMoshinsky(Ncom,Lam,nr,lr,na,la,nb,lb,L); // Ragnar has -- double mosh_ab = modelspace.GetMoshinsky(N_ab,Lam_ab,n_ab,lam_ab,na,la,nb,lb,Lab);
-                        double Di =  modelspace.GetMoshinsky(Ncom,Lam,npr,lr,nc,lc,nd,ld,L);
-                        double asDi = modelspace.GetMoshinsky(Ncom,Lam,npr,lr,nd,ld,nc,lc,L); // ...anti-symmetric part
-                        double temphat = 1.0/sqrt(2*lr + 1); // just for the several lines below
-                        double tempD = Df*Di; // " " " " " "
-                        double tempDas = Df*asDi; // " " " " " "
-                        sumMT += temphat*tempD*RBME; // perform the Talmi-Moshinsky transformation
-                        sumMTas += temphat*tempDas*RBME; // ...anti-symmetric part
-                      } // end of for-loop over: npr
-                    } // end of for-loop over: lr
-                  } // end of for-loop over: Ncom
-                } // end of for-loop over: nr
-                double temprod = nNJab*nNJcd*sumMT; // just for efficiency, only used in the lines below
-                double temprodas = nNJab*nNJdc*sumMTas; // ...anti-symmetric part
-                int tempSeval = 2*S*(S + 1) - 3; // eigenvalue of S, only used in the lines below
-                sumB += temprod; // this completes Equation (4.64), modulo Jhat
-                sumBas += temprodas; // ...anti-symmetric part
-                sumBSdS += tempSeval*temprod; // this completes Equation (4.49), modulo Jhat
-                sumBSdSas += tempSeval*temprodas; // ...anti-symmetric part
-              } // end of for-loop over: L
-            } // end of for-loop over: S
-            //
-            double integrandF = (q/(q + Ediff))*(hF[i]*sumB); // Fermi part only
-            double integrandFas = (q/(q + Ediff))*(hF[i]*sumBas); // ...anti-symmetric part
-            double integrandGT = (q/(q + Ediff))*(hGT[i]*sumBSdS); // Gamow-Teller part only
-            double integrandGTas = (q/(q + Ediff))*(hGT[i]*sumBSdSas); // ...anti-symmetric part
-            //
-            /*
-            double qsq = pow(q,2);
-            double Enu = sqrt(qsq + mnusq);
-            double integrandF = (qsq/(Enu + Ediff))*((hF[i]/Enu)*sumB);
-            double integrandFas = (qsq/(Enu + Ediff))*((hF[i]/Enu)*sumBas);
-            double integrandGT = (qsq/(Enu + Ediff))*((hGT[i]/Enu)*sumBSdS);
-            double integrandGTas = (qsq/(Enu + Ediff))*((hGT[i]/Enu)*sumBSdSas);
-            */
-            //double integrand = (q/(q + Ediff))*(hF[i]*sumB + hGT[i]*sumBSdS); // F+GT full integrand
-            //double integrandas = (q/(q + Ediff))*(hF[i]*sumBas + hGT[i]*sumBSdSas); // ...anti-symmetric part
-            sumglqF += nodes[i][1]*integrandF; // perform the GLQ integration (F)
-            sumglqFas += nodes[i][1]*integrandFas; // ...anti-symmetric part (F)
-            sumglqGT += nodes[i][1]*integrandGT; // perform the GLQ integration (GT)
-            sumglqGTas += nodes[i][1]*integrandGTas; // ...anti-symmetric part (GT)
-            //sumGLQ += nodes[i][1]*integrand; // perform the GLQ integration (F+GT)
-            //sumGLQas += nodes[i][1]*integrandas; // ...anti-symmetric part (F+GT)
-          } // end of for-loop wrt: GLQ
+                      double Df = modelspace.GetMoshinsky(Ncom,Lam,nr,lr,na,la,nb,lb,L); // Ragnar has -- double mosh_ab = modelspace.GetMoshinsky(N_ab,Lam_ab,n_ab,lam_ab,na,la,nb,lb,Lab);
+                      double Di =  modelspace.GetMoshinsky(Ncom,Lam,npr,lr,nc,lc,nd,ld,L);
+                      double asDi = modelspace.GetMoshinsky(Ncom,Lam,npr,lr,nd,ld,nc,lc,L); // ...anti-symmetric part
+                      double temphat = 1.0/sqrt(2*lr + 1); // just for the several lines below
+                      double tempD = Df*Di; // " " " " " "
+                      double tempDas = Df*asDi; // " " " " " "
+                      sumMTF += temphat*tempD*glqF[rbme_index(nr,lr,npr)]; // perform the Talmi-Moshinsky transformation
+                      sumMTFas += temphat*tempDas*glqF[rbme_index(nr,lr,npr)]; // ...anti-symmetric part
+                      sumMTGT += temphat*tempD*glqGT[rbme_index(nr,lr,npr)];
+                      sumMTGTas += temphat*tempDas*glqGT[rbme_index(nr,lr,npr)];
+                    } // end of for-loop over: npr
+                  } // end of for-loop over: lr
+                } // end of for-loop over: Ncom
+              } // end of for-loop over: nr
+              int tempSeval = 2*S*(S + 1) - 3; // eigenvalue of S, only used in the lines below
+              sumglqF += nNJab*nNJcd*sumMTF; // this completes Equation (4.64), modulo Jhat
+              sumglqFas += nNJab*nNJdc*sumMTFas; // ...anti-symmetric part
+              sumglqGT += tempSeval*nNJab*nNJcd*sumMTGT; // this completes Equation (4.49), modulo Jhat
+              sumglqGTas += tempSeval*nNJab*nNJdc*sumMTGTas; // ...anti-symmetric part
+            } // end of for-loop over: L
+          } // end of for-loop over: S
           double scale = 1.0; // global factor to compare with JE
           double tempfact = scale*prefact*Jhat; // just for the lines below
           double tempnorm = cpNorm(ia,ib)*cpNorm(ic,id); // just for the lines below
@@ -2446,115 +2377,16 @@ cout<<MF<<",  "<<MGT<<",  "<<Mtbme<<endl;
 
  // Orbital angular momentum squared L^2 in the relative coordinate.
  // This was written with the deuteron in mind. Not sure if it will be useful for other systems.
+ // The matrix elements are normalized like all the others, i.e. with the 1/sqrt(1+delta_ab) for kets |aa>.
+ // Before RelCMToLab() was used here, that factor was missing, so the pp and nn elements with a==b or c==d were too big.
  Operator L2rel_Op(ModelSpace& modelspace)
  {
    Operator OpOut(modelspace, 0,0,0,2);
-
-   int nchan = modelspace.GetNumberTwoBodyChannels();
-   modelspace.PreCalculateMoshinsky();
-   #pragma omp parallel for schedule(dynamic,1) 
-   for (int ch=0; ch<nchan; ++ch)
+   RelCMToLab(OpOut, [](const std::array<int,6>& bra, const std::array<int,6>& ket)
    {
-    TwoBodyChannel& tbc = modelspace.GetTwoBodyChannel(ch);
-    int J = tbc.J;
-    int nkets = tbc.GetNumberKets();
-    for (int ibra=0;ibra<nkets;++ibra)
-    {
-     Ket & bra = tbc.GetKet(ibra);
-     for (int iket=ibra;iket<nkets;++iket)
-     {
-       Ket & ket = tbc.GetKet(iket);
-
-       Orbit & oa = modelspace.GetOrbit(bra.p);
-       Orbit & ob = modelspace.GetOrbit(bra.q);
-       Orbit & oc = modelspace.GetOrbit(ket.p);
-       Orbit & od = modelspace.GetOrbit(ket.q);
-    
-       int na = oa.n;
-       int nb = ob.n;
-       int nc = oc.n;
-       int nd = od.n;
-    
-       int la = oa.l;
-       int lb = ob.l;
-       int lc = oc.l;
-       int ld = od.l;
-    
-       double ja = oa.j2/2.0;
-       double jb = ob.j2/2.0;
-       double jc = oc.j2/2.0;
-       double jd = od.j2/2.0;
-    
-       int fab = 2*na + 2*nb + la + lb;
-       int fcd = 2*nc + 2*nd + lc + ld;
-       if (fab != fcd) continue; // L2 conserves all the quantum numbers
-    
-       double sa,sb,sc,sd;
-       sa=sb=sc=sd=0.5;
-    
-       double L2rel=0;
-    
-       for (int Lab=std::abs(la-lb); Lab<= la+lb; ++Lab)
-       {
-         for (int Sab=0; Sab<=1; ++Sab)
-         {
-           if ( std::abs(Lab-Sab)>J or Lab+Sab<J) continue;
-    
-           double njab = AngMom::NormNineJ(la,sa,ja, lb,sb,jb, Lab,Sab,J);
-           if (njab == 0) continue;
-           int Scd = Sab;
-           int Lcd = Lab;
-           double njcd = AngMom::NormNineJ(lc,sc,jc, ld,sd,jd, Lcd,Scd,J);
-           if (njcd == 0) continue;
-    
-           // Next, transform to rel / com coordinates with Moshinsky tranformation
-           for (int N_ab=0; N_ab<=fab/2; ++N_ab)  // N_ab = CoM n for a,b
-           {
-             for (int Lam_ab=0; Lam_ab<= fab-2*N_ab; ++Lam_ab) // Lam_ab = CoM l for a,b
-             {
-               int Lam_cd = Lam_ab; // tcm and trel conserve lam and Lam, ie relative and com orbital angular momentum
-               for (int lam_ab=(fab-2*N_ab-Lam_ab)%2; lam_ab<= (fab-2*N_ab-Lam_ab); lam_ab+=2) // lam_ab = relative l for a,b
-               {
-                  if (Lab<std::abs(Lam_ab-lam_ab) or Lab>(Lam_ab+lam_ab) ) continue;
-                  // factor to account for antisymmetrization
-    
-                  int asymm_factor = (std::abs(bra.op->tz2+ket.op->tz2) + std::abs(bra.op->tz2+ket.oq->tz2)*modelspace.phase( lam_ab + Sab ))/ 2;
-                  if ( asymm_factor ==0 ) continue;
-    
-                  int lam_cd = lam_ab; // tcm and trel conserve lam and Lam
-                  int n_ab = (fab - 2*N_ab-Lam_ab-lam_ab)/2; // n_ab is determined by energy conservation
-    
-                  double mosh_ab = modelspace.GetMoshinsky(N_ab,Lam_ab,n_ab,lam_ab,na,la,nb,lb,Lab);
-    
-                  if (std::abs(mosh_ab)<1e-8) continue;
-    
-                  for (int N_cd=std::max(0,N_ab-1); N_cd<=N_ab+1; ++N_cd) // N_cd = CoM n for c,d
-                  {
-                    int n_cd = (fcd - 2*N_cd-Lam_cd-lam_cd)/2; // n_cd is determined by energy conservation
-                    if (n_cd < 0) continue;
-                    if  (n_ab != n_cd or N_ab != N_cd) continue;
-    
-                    double mosh_cd = modelspace.GetMoshinsky(N_cd,Lam_cd,n_cd,lam_cd,nc,lc,nd,ld,Lcd);
-                    if (std::abs(mosh_cd)<1e-8) continue;
-    
-                    double prefactor = njab * njcd * mosh_ab * mosh_cd * asymm_factor;
-                    L2rel += lam_ab*(lam_ab+1) * prefactor;
-    
-                  } // N_cd
-               } // lam_ab
-             } // Lam_ab
-           } // N_ab
-    
-         } // Sab
-       } // Lab
-
-
-       OpOut.TwoBody.SetTBME(ch,ibra,iket,L2rel);
-       OpOut.TwoBody.SetTBME(ch,iket,ibra,L2rel);
-
-     }
-   }
-  }
+      if (bra != ket) return 0.; // L2 conserves all the quantum numbers
+      return bra[3]*(bra[3]+1.);
+   });
 
   return OpOut;
 
@@ -2595,15 +2427,122 @@ cout<<MF<<",  "<<MGT<<",  "<<Mtbme<<endl;
  }
 
 
+  /// Occupations of the orbits with \f$ 2n+l \leq \f$ emax, from the diagonal of GetSecondOrderOneBodyDensity().
   map<index_t,double> GetSecondOrderOccupations(Operator& H, int emax)
   {
-//    ModelSpace* modelspace = H.GetModelSpace();
+    ModelSpace* modelspace = H.GetModelSpace();
     map<index_t,double> hole_list;
-    cout << "GetSecondOrderOccupations : Not yet implemented" << endl;
+    arma::mat rho = GetSecondOrderOneBodyDensity(H);
+    for (index_t i=0; i<rho.n_rows; ++i)
+    {
+      Orbit& oi = modelspace->GetOrbit(i);
+      if (2*oi.n+oi.l <= emax) hole_list[i] = rho(i,i);
+    }
     return hole_list;
   }
 
 
+  /// One-body density matrix of the reference to second order in MBPT, per m-state (so the reference contributes its occupations on the diagonal).
+  /// H should be normal ordered in the HF basis, so only the 2p2h amplitudes \f$ t_{abij} = \Gamma_{abij}/(f_i+f_j-f_a-f_b) \f$ contribute:
+  /// \f[ \rho_{ab} = n_a\delta_{ab} + \frac{1}{2(2j_a+1)}\sum_{cij}\sum_J (2J+1) t^J_{acij} t^J_{bcij}
+  ///    - \frac{1}{2(2j_a+1)}\sum_{ijc}\sum_J (2J+1) t^J_{ijac} t^J_{ijbc}  \f]
+  /// where the first sum has \f$ a,b,c \f$ particles and the second has them holes.
+  /// Only the blocks connecting orbits with the same \f$ (l,j,t_z) \f$ are filled.
+  arma::mat GetSecondOrderOneBodyDensity(Operator& H)
+  {
+    IMSRGProfiler::ScopedTimer st("GetSecondOrderOneBodyDensity");
+    ModelSpace* modelspace = H.GetModelSpace();
+    int norb = modelspace->GetNumberOrbits();
+    int nchan = modelspace->GetNumberTwoBodyChannels();
+    arma::vec occ(norb);
+    for (int i=0; i<norb; ++i) occ(i) = modelspace->GetOrbit(i).occ;
+    arma::mat rho = arma::diagmat(occ);
+
+    // For each channel, T(hole ket, ket) = <ket|Gamma|hole ket> sqrt(nbar_ket n_holeket) / (e_holeket - e_ket).
+    // Then the particle part of rho comes from T.t()*T, and the hole part from T*T.t(), which is small.
+    vector<arma::mat> T(nchan);
+    vector<arma::mat> THH(nchan);
+    vector<vector<int>> hole_position(nchan);
+    #pragma omp parallel for schedule(dynamic,1)
+    for (int ch=0; ch<nchan; ++ch)
+    {
+      TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
+      int nkets = tbc.GetNumberKets();
+      const arma::mat& Gamma = H.TwoBody.MatEl.at({ch,ch});
+      vector<index_t> holekets;
+      hole_position[ch].assign(nkets,-1);
+      for (int iket=0; iket<nkets; ++iket)
+      {
+        Ket& ket = tbc.GetKet(iket);
+        if (occ(ket.p)*occ(ket.q) < 1e-8) continue;
+        hole_position[ch][iket] = holekets.size();
+        holekets.push_back(iket);
+      }
+      T[ch].zeros(holekets.size(),nkets);
+      for (index_t ih=0; ih<holekets.size(); ++ih)
+      {
+        Ket& ket_h = tbc.GetKet(holekets[ih]);
+        double n_h = occ(ket_h.p)*occ(ket_h.q);
+        double e_h = H.OneBody(ket_h.p,ket_h.p) + H.OneBody(ket_h.q,ket_h.q);
+        for (int iket=0; iket<nkets; ++iket)
+        {
+          Ket& ket = tbc.GetKet(iket);
+          double nbar = (1-occ(ket.p))*(1-occ(ket.q));
+          double denom = e_h - H.OneBody(ket.p,ket.p) - H.OneBody(ket.q,ket.q);
+          if (nbar < 1e-8 or std::abs(denom) < 1e-8) continue;
+          T[ch](ih,iket) = Gamma(iket,holekets[ih]) * sqrt(nbar*n_h) / denom;
+        }
+      }
+      THH[ch] = T[ch] * T[ch].t();
+    }
+
+    // <ac|_J in terms of the stored normalized kets: local index k, and the factor multiplying it.
+    auto ket_factor = [&](TwoBodyChannel& tbc, int a, int c, int& k)
+    {
+      k = tbc.GetLocalIndex(std::min(a,c),std::max(a,c));
+      if (k<0) return 0.;
+      if (a==c) return SQRT2;
+      if (a>c) return double(tbc.GetKet(k).Phase(tbc.J));
+      return 1.;
+    };
+
+    #pragma omp parallel for schedule(dynamic,1)
+    for (int a=0; a<norb; ++a)
+    {
+      Orbit& oa = modelspace->GetOrbit(a);
+      for (int b : H.OneBodyChannels.at({oa.l,oa.j2,oa.tz2}))
+      {
+        if (b<a) continue;
+        double rho_ab = 0;
+        for (int c=0; c<norb; ++c)
+        {
+          Orbit& oc = modelspace->GetOrbit(c);
+          int Jmin = std::abs(oa.j2-oc.j2)/2;
+          int Jmax = (oa.j2+oc.j2)/2;
+          for (int J=Jmin; J<=Jmax; ++J)
+          {
+            int ch = modelspace->GetTwoBodyChannelIndex(J,(oa.l+oc.l)%2,(oa.tz2+oc.tz2)/2);
+            TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
+            int ka,kb;
+            double fa = ket_factor(tbc,a,c,ka);
+            double fb = ket_factor(tbc,b,c,kb);
+            if (ka<0 or kb<0) continue;
+            double rho_J = arma::dot( T[ch].col(ka), T[ch].col(kb) );
+            int ha = hole_position[ch][ka];
+            int hb = hole_position[ch][kb];
+            if (ha>=0 and hb>=0) rho_J -= THH[ch](ha,hb);
+            rho_ab += (2*J+1) * fa * fb * rho_J;
+          }
+        }
+        rho_ab /= oa.j2+1;
+        rho(a,b) += rho_ab;
+        if (b!=a) rho(b,a) += rho_ab;
+      }
+    }
+    return rho;
+  }
+
+
   /// Embeds the one-body operator of op1 in the two-body part, using mass number A in the embedding.
   /// Note that the embedded operator is added to the two-body part, rather than overwriting.
   /// The one-body part is left as-is.
@@ -2786,6 +2725,300 @@ cout<<MF<<",  "<<MGT<<",  "<<Mtbme<<endl;
   }
 
 
+  /// Check Operator::DoNormalOrdering3() against the straightforward sum over ThreeBodyME::GetME_pn(),
+  /// which does the isospin recoupling for each matrix element. Returns the norm of the difference, which should be zero.
+  double NormalOrdering3Test(Operator& op)
+  {
+    ModelSpace* modelspace = op.GetModelSpace();
+    int E3max = op.GetE3max();
+    Operator opNO3(*modelspace);
+    for ( auto& itmat : opNO3.TwoBody.MatEl )
+    {
+      int ch = itmat.first[0];
+      TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
+      arma::mat& Gamma = itmat.second;
+      for (int ibra=0; ibra<tbc.GetNumberKets(); ++ibra)
+      {
+        Ket & bra = tbc.GetKet(ibra);
+        Orbit & oi = modelspace->GetOrbit(bra.p);
+        Orbit & oj = modelspace->GetOrbit(bra.q);
+        for (int iket=ibra; iket<tbc.GetNumberKets(); ++iket)
+        {
+          Ket & ket = tbc.GetKet(iket);
+          Orbit & ok = modelspace->GetOrbit(ket.p);
+          Orbit & ol = modelspace->GetOrbit(ket.q);
+          for (auto& a : modelspace->holes)
+          {
+            Orbit & oa = modelspace->GetOrbit(a);
+            if ( (2*(oi.n+oj.n+oa.n)+oi.l+oj.l+oa.l)>E3max) continue;
+            if ( (2*(ok.n+ol.n+oa.n)+ok.l+ol.l+oa.l)>E3max) continue;
+            for (int K2=std::abs(2*tbc.J-oa.j2); K2<=2*tbc.J+oa.j2; K2+=2)
+            {
+              Gamma(ibra,iket) += (K2+1) * oa.occ * op.ThreeBody.GetME_pn(tbc.J,tbc.J,K2,bra.p,bra.q,a,ket.p,ket.q,a);
+            }
+          }
+          Gamma(ibra,iket) /= (2*tbc.J+1)* sqrt((1+bra.delta_pq())*(1+ket.delta_pq()));
+        }
+      }
+    }
+    opNO3.Symmetrize();
+    Operator opNO_ref = opNO3.DoNormalOrdering2();
+    opNO_ref.ScaleZeroBody(1./3.);
+    opNO_ref.ScaleOneBody(1./2.);
+    opNO_ref += op.DoNormalOrdering2();
+
+    Operator diff = op.DoNormalOrdering3() - opNO_ref;
+    double diffnorm = sqrt( diff.ZeroBody*diff.ZeroBody + diff.Norm()*diff.Norm() );
+    cout << "NormalOrdering3Test: norm = " << opNO_ref.Norm() << "   diff = " << diff.ZeroBody << " " << diff.OneBodyNorm() << " " << diff.TwoBodyNorm() << endl;
+    return diffnorm;
+  }
+
+
+  /// Check the 9j symbols in ModelSpace::GetTensorNineJTable() against AngMom::NineJ, reading them the way the
+  /// tensor Pandya transformations do, including the transposed reads for j2>j3. Returns the largest difference.
+  double TensorNineJTableTest(ModelSpace& modelspace, int Lambda)
+  {
+    const TensorNineJTable& table = modelspace.GetTensorNineJTable(Lambda);
+    double maxdiff = 0;
+    size_t nchecked = 0;
+    int j2max = 2*modelspace.GetEmax()+1;
+    for (int j2_1=1; j2_1<=j2max; j2_1+=2)
+    {
+     for (int j2_2=1; j2_2<=j2max; j2_2+=2)
+     {
+      for (int j2_3=1; j2_3<=j2max; j2_3+=2)
+      {
+       for (int j2_4=1; j2_4<=j2max; j2_4+=2)
+       {
+        for (int X13=std::abs(j2_1-j2_3)/2; X13<=(j2_1+j2_3)/2; ++X13)
+        {
+         for (int X24=std::max(std::abs(j2_2-j2_4)/2,std::abs(X13-Lambda)); X24<=std::min((j2_2+j2_4)/2,X13+Lambda); ++X24)
+         {
+          auto ninej_col = table.GetColumn(j2_1,j2_2,j2_3,j2_4,X13,X24);
+          for (int X12=std::abs(j2_1-j2_2)/2; X12<=(j2_1+j2_2)/2; ++X12)
+          {
+           for (int X34=std::max(std::abs(j2_3-j2_4)/2,std::abs(X12-Lambda)); X34<=std::min((j2_3+j2_4)/2,X12+Lambda); ++X34)
+           {
+             double ninej = ninej_col.column[ninej_col.stride*table.Row(j2_1,j2_2,X12,X34)];
+             double ninej_ref = AngMom::NineJ(0.5*j2_1,0.5*j2_2,X12,0.5*j2_3,0.5*j2_4,X34,X13,X24,Lambda);
+             maxdiff = std::max(maxdiff, std::abs(ninej-ninej_ref));
+             ++nchecked;
+           }
+          }
+         }
+        }
+       }
+      }
+     }
+    }
+    cout << "TensorNineJTableTest: checked " << nchecked << " 9j symbols for Lambda = " << Lambda << ",  max diff = " << maxdiff << endl;
+    return maxdiff;
+  }
+
+
+  /// Check that ModelSpace::GetTensorPandyaChannelPairs() has every cross-coupled channel pair which
+  /// Operator::AddInverseTensorPandyaTransformation() reads for a tensor like op, since pairs that aren't
+  /// in the list are skipped there. This goes through the same loops as the inverse transformation.
+  /// Returns the number of reads with a nonzero 9j from pairs that aren't in the list, which should be zero.
+  int TensorPandyaPairsTest(Operator& op)
+  {
+    ModelSpace* modelspace = op.GetModelSpace();
+    int Lambda = op.GetJRank();
+    const auto& channel_pairs = modelspace->GetTensorPandyaChannelPairs(Lambda, op.GetTRank(), op.GetParity());
+    const auto& pair_index = modelspace->GetTensorPandyaPairIndex(Lambda, op.GetTRank(), op.GetParity());
+    index_t nch_cc = modelspace->TwoBodyChannels_CC.size();
+    std::vector<bool> pair_used(channel_pairs.size(),false);
+    size_t nmissing = 0;
+    for ( auto& itmat : op.TwoBody.MatEl )
+    {
+      TwoBodyChannel& tbc_bra = modelspace->GetTwoBodyChannel(itmat.first[0]);
+      TwoBodyChannel& tbc_ket = modelspace->GetTwoBodyChannel(itmat.first[1]);
+      int J1 = tbc_bra.J;
+      int J2 = tbc_ket.J;
+      for (int ibra=0; ibra<tbc_bra.GetNumberKets(); ++ibra)
+      {
+        Ket & bra = tbc_bra.GetKet(ibra);
+        for (int iket=0; iket<tbc_ket.GetNumberKets(); ++iket)
+        {
+          Ket & ket = tbc_ket.GetKet(iket);
+          // Z_ilkj and Z_jlki
+          for (auto& recoupled : { std::array<int,4>{bra.p,ket.q,ket.p,bra.q}, std::array<int,4>{bra.q,ket.q,ket.p,bra.p} })
+          {
+            Orbit & oi = modelspace->GetOrbit(recoupled[0]);
+            Orbit & ol = modelspace->GetOrbit(recoupled[1]);
+            Orbit & ok = modelspace->GetOrbit(recoupled[2]);
+            Orbit & oj = modelspace->GetOrbit(recoupled[3]);
+            int parity_bra_cc = (oi.l+ol.l)%2;
+            int parity_ket_cc = (ok.l+oj.l)%2;
+            int Tz_bra_cc = std::abs(oi.tz2+ol.tz2)/2;
+            int Tz_ket_cc = std::abs(ok.tz2+oj.tz2)/2;
+            for (int J3=std::abs(oi.j2-ol.j2)/2; J3<=(oi.j2+ol.j2)/2; ++J3)
+            {
+              for (int J4=std::max(std::abs(ok.j2-oj.j2)/2,std::abs(J3-Lambda)); J4<=std::min((ok.j2+oj.j2)/2,J3+Lambda); ++J4)
+              {
+                double ninej = AngMom::NineJ(0.5*oi.j2,0.5*ol.j2,J3,0.5*oj.j2,0.5*ok.j2,J4,J1,J2,Lambda);
+                if (std::abs(ninej) < 1e-8) continue;
+                index_t ch_bra_cc = modelspace->GetTwoBodyChannelIndex(J3,parity_bra_cc,Tz_bra_cc);
+                index_t ch_ket_cc = modelspace->GetTwoBodyChannelIndex(J4,parity_ket_cc,Tz_ket_cc);
+                int ipair = pair_index[std::min(ch_bra_cc,ch_ket_cc)*nch_cc+std::max(ch_bra_cc,ch_ket_cc)];
+                if (ipair < 0) ++nmissing;
+                else pair_used[ipair] = true;
+              }
+            }
+          }
+        }
+      }
+    }
+    size_t nused = std::count(pair_used.begin(),pair_used.end(),true);
+    cout << "TensorPandyaPairsTest: " << channel_pairs.size() << " channel pairs in the list, " << nused << " of them read.  "
+         << nmissing << " reads from pairs missing from the list" << endl;
+    return nmissing;
+  }
+
+
+  /// Check TwoBodyME::Compress() and Decompress() on a copy of op, as used for the Omegas (see IMSRGSolver::CompressOmega()).
+  /// Each decompressed block should be within tol of the original, relative to the norm of the block,
+  /// and the diagonal blocks should have the exact (anti)symmetry of op. The total error shouldn't exceed the discarded norm.
+  /// Returns the number of blocks which fail, which should be zero.
+  int OmegaCompressionTest(Operator& op, double tol)
+  {
+    TwoBodyME tb = op.TwoBody;
+    double discarded = tb.Compress(tol);
+    double size_compressed = tb.size();
+    tb.Decompress();
+    int nfail = 0;
+    double err2 = 0;
+    double max_asym = 0;
+    for ( auto& itmat : op.TwoBody.MatEl )
+    {
+      const arma::mat& M = itmat.second;
+      const arma::mat& Mdec = tb.GetMatrix(itmat.first[0],itmat.first[1]);
+      if (M.n_elem==0) continue;
+      double err = arma::norm(Mdec-M,"fro");
+      err2 += err*err;
+      bool fail = err > tol*arma::norm(M,"fro") + 1e-12;
+      if (itmat.first[0]==itmat.first[1])
+      {
+        double asym = 0;
+        if (op.IsHermitian()) asym = arma::abs(Mdec-Mdec.t()).max();
+        else if (op.IsAntiHermitian()) asym = arma::abs(Mdec+Mdec.t()).max();
+        max_asym = std::max(max_asym,asym);
+        fail = fail or asym > 0;
+      }
+      if (fail) ++nfail;
+    }
+    double err = sqrt(err2);
+    if (err > discarded*(1+1e-8) + 1e-12) ++nfail;
+    cout << "OmegaCompressionTest: tol = " << tol << "  size " << op.TwoBody.size()/1024./1024. << " MB -> " << size_compressed/1024./1024. << " MB"
+         << "  discarded norm = " << discarded << "  error = " << err << "  max (anti)symmetry violation = " << max_asym
+         << "  failed blocks: " << nfail << endl;
+    return nfail;
+  }
+
+
+  /// Compare the commutator of two charge-symmetric scalar operators computed with the isospin symmetry
+  /// (see Operator::ConstructScalarMpp_Mhh()) to the one computed without it. Returns the largest difference
+  /// of a one- or two-body matrix element, which should be at the level of round-off.
+  double ChargeSymmetryTest(Operator& X, Operator& Y)
+  {
+    bool x_cs = X.CheckChargeSymmetric();
+    bool y_cs = Y.CheckChargeSymmetric();
+    Operator Xsym = X;
+    Operator Ysym = Y;
+    Xsym.SetChargeSymmetric(x_cs);
+    Ysym.SetChargeSymmetric(y_cs);
+    Operator Xplain = X;
+    Operator Yplain = Y;
+    Xplain.SetChargeSymmetric(false);
+    Yplain.SetChargeSymmetric(false);
+
+    Operator diff = Commutator(Xsym,Ysym) - Commutator(Xplain,Yplain);
+    double maxdiff = std::abs(diff.ZeroBody);
+    if (diff.OneBody.n_elem>0) maxdiff = std::max(maxdiff, arma::abs(diff.OneBody).max());
+    for ( auto& itmat : diff.TwoBody.MatEl )
+    {
+      if (itmat.second.n_elem>0) maxdiff = std::max(maxdiff, arma::abs(itmat.second).max());
+    }
+    cout << "ChargeSymmetryTest: X charge symmetric: " << x_cs << "  Y charge symmetric: " << y_cs
+         << "  model space charge symmetric: " << X.GetModelSpace()->IsChargeSymmetric() << "   max diff = " << maxdiff << endl;
+    return maxdiff;
+  }
+
+
+  /// Check the one-body part of Operator::comm222_pp_hh_221st(), for a scalar X and a tensor Y, against a brute-force
+  /// sum over the intermediate two-body states with TwoBodyME::GetTBME_J(). Only the ch_bra<=ch_ket blocks of Y are stored,
+  /// so this tests that the other blocks of the intermediate products are rebuilt with the (anti)hermiticity of [X,Y].
+  /// Returns the largest difference of a one-body matrix element, which should be at the level of round-off.
+  double TensorCommutator221Test(Operator& X, Operator& Y)
+  {
+    ModelSpace* modelspace = X.GetModelSpace();
+    int Lambda = Y.GetJRank();
+    Operator Z = Y;
+    Z.Erase();
+    if ( (X.IsHermitian() and Y.IsHermitian()) or (X.IsAntiHermitian() and Y.IsAntiHermitian()) ) Z.SetAntiHermitian();
+    else if ( (X.IsHermitian() and Y.IsAntiHermitian()) or (X.IsAntiHermitian() and Y.IsHermitian()) ) Z.SetHermitian();
+    else Z.SetNonHermitian();
+    Z.comm222_pp_hh_221st(X,Y);
+
+    // <ci J1| X P Y - Y P X |cj J2>, where P projects onto pp states (with weights nbar_a nbar_b) or hh states (n_a n_b)
+    auto Mpphh = [&](int J1, int J2, int c, int i, int j, bool pp)
+    {
+      double m = 0;
+      for (int ch=0; ch<modelspace->GetNumberTwoBodyChannels(); ++ch)
+      {
+        TwoBodyChannel& tbc = modelspace->GetTwoBodyChannel(ch);
+        if (tbc.J!=J1 and tbc.J!=J2) continue;
+        for (int iket=0; iket<tbc.GetNumberKets(); ++iket)
+        {
+          Ket& ket = tbc.GetKet(iket);
+          double na = ket.op->occ;
+          double nb = ket.oq->occ;
+          double w = pp ? (1-na)*(1-nb) : na*nb;
+          if (w==0) continue;
+          if (ket.p==ket.q) w /= 2; // GetTBME_J includes a factor sqrt(2) for each pair of identical orbits
+          if (tbc.J==J1) m += w * X.TwoBody.GetTBME_J(J1,J1,c,i,ket.p,ket.q) * Y.TwoBody.GetTBME_J(J1,J2,ket.p,ket.q,c,j);
+          if (tbc.J==J2) m -= w * Y.TwoBody.GetTBME_J(J1,J2,c,i,ket.p,ket.q) * X.TwoBody.GetTBME_J(J2,J2,ket.p,ket.q,c,j);
+        }
+      }
+      return m;
+    };
+
+    double maxdiff = 0;
+    int norbits = modelspace->GetNumberOrbits();
+    for (int i=0; i<norbits; ++i)
+    {
+      Orbit& oi = modelspace->GetOrbit(i);
+      double ji = oi.j2/2.0;
+      for (int j : Z.OneBodyChannels.at({oi.l, oi.j2, oi.tz2}) )
+      {
+        if (j<i) continue;
+        Orbit& oj = modelspace->GetOrbit(j);
+        double jj = oj.j2/2.0;
+        double zij = 0;
+        for (int c=0; c<norbits; ++c)
+        {
+          Orbit& oc = modelspace->GetOrbit(c);
+          double jc = oc.j2/2.0;
+          for (int J1=std::abs(jc-ji); J1<=jc+ji; ++J1)
+          {
+            for (int J2=std::max(int(std::abs(jc-jj)),std::abs(Lambda-J1)); J2<=std::min(int(jc+jj),J1+Lambda); ++J2)
+            {
+              double prefactor = sqrt( (2*J1+1)*(2*J2+1) ) * modelspace->GetSixJ(J1, J2, Lambda, jj, ji, jc) * modelspace->phase(jj + jc + J1 + Lambda);
+              if (oc.occ>0)
+                zij += prefactor * ( oc.occ * Mpphh(J1,J2,c,i,j,true) + (1-oc.occ) * Mpphh(J1,J2,c,i,j,false) );
+              else
+                zij += prefactor * Mpphh(J1,J2,c,i,j,false);
+            }
+          }
+        }
+        maxdiff = std::max(maxdiff, std::abs(zij - Z.OneBody(i,j)));
+      }
+    }
+    cout << "TensorCommutator221Test: one-body norm = " << Z.OneBodyNorm() << "   max diff = " << maxdiff << endl;
+    return maxdiff;
+  }
+
+
 
 /*
   void CommutatorTest(Operator& X, Operator& Y)
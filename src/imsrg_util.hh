@@ -29,6 +29,7 @@
 #include <gsl/gsl_sf_gamma.h>
 #include <gsl/gsl_sf_bessel.h>
 #include <vector>
+#include <functional>
 
 #define HBARC 197.3269718 // hc in MeV * fm
 #define M_NUCLEON 938.9185 // average nucleon mass in MeV
@@ -44,6 +45,7 @@ namespace imsrg_util
 {
  Operator OperatorFromString(ModelSpace& modelspace, string str);
  map<index_t,double> GetSecondOrderOccupations(Operator& H, int emax);
+ arma::mat GetSecondOrderOneBodyDensity(Operator& H);
 
  Operator NumberOp(ModelSpace& modelspace, int n, int l, int j2, int tz2);
  Operator NumberOpAlln(ModelSpace& modelspace, int l, int j2, int tz2);
@@ -106,9 +108,13 @@ namespace imsrg_util
  double Calculate_p1p2(ModelSpace& modelspace, Ket & bra, Ket & ket, int J);
  void Calculate_p1p2_all(Operator& OpIn);
  double Calculate_r1r2(ModelSpace& modelspace, Ket & bra, Ket & ket, int J);
+ void Calculate_r1r2_all(Operator& OpIn);
+ void RelCMToLab(Operator& OpIn, std::function<double(const std::array<int,6>&,const std::array<int,6>&)> relcm_me);
+ double HO_Quadratic_ME(int n, int np, int l, int offdiag_sign);
  double HO_density(int n, int l, double hw, double r);
  double HO_Radial_psi(int n, int l, double hw, double r);
  double RadialIntegral(int na, int la, int nb, int lb, int L);
+ double RadialIntegral_nocache(int na, int la, int nb, int lb, int L);
  double RadialIntegral_RpowK(int na, int la, int nb, int lb, int k);
  double TalmiI(int p, double k);
  double TalmiB(int na, int la, int nb, int lb, int p);
@@ -122,6 +128,12 @@ namespace imsrg_util
  double FrequencyConversionCoeff(int n1, int l1, double hw1, int n2, int l2, double hw2);
 
  void CommutatorTest(Operator& X, Operator& Y);
+ double NormalOrdering3Test(Operator& op);
+ double TensorNineJTableTest(ModelSpace& modelspace, int Lambda);
+ int TensorPandyaPairsTest(Operator& op);
+ int OmegaCompressionTest(Operator& op, double tol);
+ double ChargeSymmetryTest(Operator& X, Operator& Y);
+ double TensorCommutator221Test(Operator& X, Operator& Y);
  void Reduce(Operator&);
  void UnReduce(Operator&);
 
@@ -11,6 +11,8 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/operators.h>
 #include <pybind11/stl.h>
+#include <pybind11/numpy.h>
+#include <pybind11/functional.h>
 
 namespace py = pybind11;
 
@@ -32,6 +34,78 @@ namespace py = pybind11;
 
   Operator HF_GetNormalOrderedH(HartreeFock& self){ return self.GetNormalOrderedH();};
 
+  // NumPy access to the operator storage.
+  // The views share memory with the armadillo matrices (which are column-major) and keep the owning
+  // python object alive. They become invalid if the matrix is reallocated, e.g. by assigning an Operator
+  // with a different model space, so take a copy if you need it to stick around.
+  // Taking a view of a two-body block marks the TwoBodyME as possibly changed (see TwoBodyME::ClearBlockStructure()),
+  // so don't keep writing through an old view after the operator has been handed to the solver.
+  py::array_t<double> ArmaMatView(arma::mat& M, py::handle owner)
+  {
+    std::vector<py::ssize_t> shape = { (py::ssize_t)M.n_rows, (py::ssize_t)M.n_cols };
+    std::vector<py::ssize_t> strides = { (py::ssize_t)sizeof(double), (py::ssize_t)(M.n_rows*sizeof(double)) };
+    return py::array_t<double>( shape, strides, M.memptr(), owner);
+  }
+
+  // Copy a whole block in. Any 2D array of the right shape is accepted and converted to double.
+  void ArmaMatCopyIn(arma::mat& M, py::array_t<double, py::array::f_style | py::array::forcecast> A)
+  {
+    if ( A.ndim()!=2 or (size_t)A.shape(0)!=M.n_rows or (size_t)A.shape(1)!=M.n_cols )
+    {
+      throw py::value_error("array has the wrong shape, expected " + to_string(M.n_rows) + "x" + to_string(M.n_cols));
+    }
+    std::copy( A.data(), A.data()+M.n_elem, M.memptr() );
+  }
+
+  py::array_t<double> Op_OneBodyArray(py::object self){ return ArmaMatView( self.cast<Operator&>().OneBody, self);};
+  void Op_SetOneBodyArray(Operator& self, py::array_t<double, py::array::f_style | py::array::forcecast> A){ ArmaMatCopyIn(self.OneBody, A);};
+
+  py::array_t<double> TB_GetMatrixArray(py::object self, int ch_bra, int ch_ket)
+  {
+    TwoBodyME& tbme = self.cast<TwoBodyME&>();
+    if (tbme.MatEl.find({ch_bra,ch_ket})==tbme.MatEl.end()) throw py::index_error("no matrix for channels " + to_string(ch_bra) + "," + to_string(ch_ket));
+    return ArmaMatView( tbme.GetMatrix(ch_bra,ch_ket), self);
+  }
+  void TB_SetMatrixArray(TwoBodyME& self, int ch_bra, int ch_ket, py::array_t<double, py::array::f_style | py::array::forcecast> A)
+  {
+    if (self.MatEl.find({ch_bra,ch_ket})==self.MatEl.end()) throw py::index_error("no matrix for channels " + to_string(ch_bra) + "," + to_string(ch_ket));
+    ArmaMatCopyIn( self.GetMatrix(ch_bra,ch_ket), A);
+  }
+  vector<array<int,2>> TB_GetChannelPairs(TwoBodyME& self)
+  {
+    vector<array<int,2>> chpairs;
+    for (auto& itmat : self.MatEl ) chpairs.push_back( itmat.first );
+    return chpairs;
+  }
+
+  // Orbit indices p,q and the channel quantum numbers J, parity, Tz for each local ket index
+  py::dict TBC_GetKetArrays(TwoBodyChannel& self)
+  {
+    int nkets = self.GetNumberKets();
+    py::array_t<int> p(nkets), q(nkets), J(nkets), parity(nkets), Tz(nkets);
+    auto p_ = p.mutable_unchecked<1>();
+    auto q_ = q.mutable_unchecked<1>();
+    auto J_ = J.mutable_unchecked<1>();
+    auto parity_ = parity.mutable_unchecked<1>();
+    auto Tz_ = Tz.mutable_unchecked<1>();
+    for (int i=0; i<nkets; ++i)
+    {
+      Ket& ket = self.GetKet(i);
+      p_(i) = ket.p;
+      q_(i) = ket.q;
+      J_(i) = self.J;
+      parity_(i) = self.parity;
+      Tz_(i) = self.Tz;
+    }
+    py::dict arrays;
+    arrays["p"] = p;
+    arrays["q"] = q;
+    arrays["J"] = J;
+    arrays["parity"] = parity;
+    arrays["Tz"] = Tz;
+    return arrays;
+  }
+
 //BOOST_PYTHON_MODULE(pyIMSRG)
 //PYBIND11_PLUGIN(pyIMSRG)
 PYBIND11_MODULE(pyIMSRG, m)
@@ -61,6 +135,10 @@ PYBIND11_MODULE(pyIMSRG, m)
       .def("GetNumberKets",&TwoBodyChannel::GetNumberKets)
       .def("GetLocalIndex",&TBCGetLocalIndex)
       .def("GetKetIndex",&TwoBodyChannel::GetKetIndex)
+      .def("GetKetArrays",&TBC_GetKetArrays)
+      .def_readonly("J",&TwoBodyChannel::J)
+      .def_readonly("parity",&TwoBodyChannel::parity)
+      .def_readonly("Tz",&TwoBodyChannel::Tz)
    ;
 
 //   class_<ModelSpace>("ModelSpace",init<>())
@@ -87,6 +165,7 @@ PYBIND11_MODULE(pyIMSRG, m)
       .def("Init_occ_from_file", &ModelSpace::Init_occ_from_file)
       .def("GetOrbitIndex_fromString", &MS_GetOrbitIndex_Str)
       .def("PreCalculateSixJ", &ModelSpace::PreCalculateSixJ)
+      .def_static("ClearTensorNineJTables", &ModelSpace::ClearTensorNineJTables)
       .def_readwrite("core", &ModelSpace::core)
    ;
 
@@ -145,7 +224,9 @@ PYBIND11_MODULE(pyIMSRG, m)
       .def("SetE3max", &Operator::SetE3max)
       .def("PrintTimes", &Operator::PrintTimes)
       .def("BCH_Transform", &Operator::BCH_Transform)
+      .def("OneBody_BCH_Transform", &Operator::OneBody_BCH_Transform)
       .def("Size", &Operator::Size)
+      .def("Embed", &Operator::Embed)
       .def("SetToCommutator", &Operator::SetToCommutator)
       .def("comm110ss", &Operator::comm110ss)
       .def("comm220ss", &Operator::comm220ss)
@@ -163,11 +244,17 @@ PYBIND11_MODULE(pyIMSRG, m)
       .def("MakeNormalized", &Operator::MakeNormalized)
       .def("MakeUnNormalized", &Operator::MakeUnNormalized)
       .def("SetOneBodyME", &OpSetOneBodyME)
+      .def("OneBodyArray", &Op_OneBodyArray)
+      .def("SetOneBodyArray", &Op_SetOneBodyArray)
    ;
 
 //   class_<arma::mat>("ArmaMat",init<>())
-   py::class_<arma::mat>(m,"ArmaMat")
+   py::class_<arma::mat>(m,"ArmaMat", py::buffer_protocol())
       .def(py::init<>())
+      .def_buffer([](arma::mat& M) -> py::buffer_info {  // so numpy.array(op.OneBody, copy=False) doesn't copy
+          return py::buffer_info( M.memptr(), sizeof(double), py::format_descriptor<double>::format(), 2,
+                                  {(py::ssize_t)M.n_rows, (py::ssize_t)M.n_cols},
+                                  {(py::ssize_t)sizeof(double), (py::ssize_t)(M.n_rows*sizeof(double))} ); })
       .def("Print",&ArmaMatPrint)
       .def(py::self *= double())
       .def(py::self * double())
@@ -184,6 +271,9 @@ PYBIND11_MODULE(pyIMSRG, m)
       .def(py::init<>())
       .def("GetTBME_J", TB_GetTBME_J)
       .def("GetTBME_J_norm", TB_GetTBME_J_norm)
+      .def("GetMatrixArray", TB_GetMatrixArray)
+      .def("SetMatrixArray", TB_SetMatrixArray)
+      .def("GetChannelPairs", TB_GetChannelPairs)
    ;
 
 //   class_<ReadWrite>("ReadWrite",init<>())
@@ -194,7 +284,7 @@ PYBIND11_MODULE(pyIMSRG, m)
       .def("ReadBareTBME_Jason", &ReadWrite::ReadBareTBME_Jason)
       .def("ReadBareTBME_Navratil", &ReadWrite::ReadBareTBME_Navratil)
       .def("ReadBareTBME_Darmstadt", &ReadWrite::ReadBareTBME_Darmstadt)
-      .def("Read_Darmstadt_3body", &ReadWrite::Read_Darmstadt_3body)
+      .def("Read_Darmstadt_3body", &ReadWrite::Read_Darmstadt_3body, py::call_guard<py::gil_scoped_release>())
 #ifndef NO_HDF5
       .def("Read3bodyHDF5", &ReadWrite::Read3bodyHDF5)
 #endif
@@ -211,6 +301,11 @@ PYBIND11_MODULE(pyIMSRG, m)
       .def("WriteOperatorHuman", &ReadWrite::WriteOperatorHuman)
       .def("ReadOperator", &ReadWrite::ReadOperator)
       .def("ReadOperatorHuman", &ReadWrite::ReadOperatorHuman)
+      .def("WriteOperatorBinary", &ReadWrite::WriteOperatorBinary, py::arg("op"), py::arg("filename"), py::arg("compress")=false, py::call_guard<py::gil_scoped_release>())
+      .def("ReadOperatorBinary", &ReadWrite::ReadOperatorBinary, py::call_guard<py::gil_scoped_release>())
+      .def("GetOperatorBinaryEmax", &ReadWrite::GetOperatorBinaryEmax)
+      .def("InGoodState", &ReadWrite::InGoodState)
+      .def("ClearErrors", &ReadWrite::ClearErrors)
       .def("CompareOperators", &ReadWrite::CompareOperators)
       .def("ReadOneBody_Takayuki", &ReadWrite::ReadOneBody_Takayuki)
       .def("ReadTwoBody_Takayuki", &ReadWrite::ReadTwoBody_Takayuki)
@@ -226,6 +321,7 @@ PYBIND11_MODULE(pyIMSRG, m)
       .def("ReadTensorOperator_Nathan",&ReadWrite::ReadTensorOperator_Nathan)
       .def("ReadRelCMOpFromJavier",&ReadWrite::ReadRelCMOpFromJavier)
       .def("Set3NFormat",&ReadWrite::Set3NFormat)
+      .def("SetThreeBodySharedName",&ReadWrite::SetThreeBodySharedName)
       .def_readwrite("InputParameters", &ReadWrite::InputParameters)
    ;
 
@@ -236,7 +332,7 @@ PYBIND11_MODULE(pyIMSRG, m)
 //   class_<HartreeFock>("HartreeFock",init<Operator&>())
    py::class_<HartreeFock>(m,"HartreeFock")
       .def(py::init<Operator&>())
-      .def("Solve",&HartreeFock::Solve)
+      .def("Solve",&HartreeFock::Solve, py::call_guard<py::gil_scoped_release>())
       .def("TransformToHFBasis",&HartreeFock::TransformToHFBasis)
       .def("GetHbare",&HartreeFock::GetHbare)
       .def("GetNormalOrderedH",&HF_GetNormalOrderedH)
@@ -251,12 +347,47 @@ PYBIND11_MODULE(pyIMSRG, m)
    Operator (IMSRGSolver::*Transform_ref)(Operator&) = &IMSRGSolver::Transform;
 
 //   class_<IMSRGSolver>("IMSRGSolver",init<Operator&>())
+   // The long-running calls (here and in ReadWrite and HartreeFock) release the GIL, so other python threads can keep going in the meantime,
+   // including other solvers and file reads. The flow status callback takes the GIL back while it runs.
+   // The ModelSpace caches are thread safe, but an Operator or ModelSpace that a running call is using must not be modified.
+   // On a running solver, other threads should only call GetLastFlowStatus, RequestStop and StopRequested.
+   py::class_<IMSRGSolver::FlowStatus>(m,"FlowStatus")
+      .def_readonly("istep",&IMSRGSolver::FlowStatus::istep)
+      .def_readonly("s",&IMSRGSolver::FlowStatus::s)
+      .def_readonly("E0",&IMSRGSolver::FlowStatus::E0)
+      .def_readonly("norm_H",&IMSRGSolver::FlowStatus::norm_H)
+      .def_readonly("trace_H",&IMSRGSolver::FlowStatus::trace_H)
+      .def_readonly("norm_omega1",&IMSRGSolver::FlowStatus::norm_omega1)
+      .def_readonly("norm_omega2",&IMSRGSolver::FlowStatus::norm_omega2)
+      .def_readonly("norm_eta1",&IMSRGSolver::FlowStatus::norm_eta1)
+      .def_readonly("norm_eta2",&IMSRGSolver::FlowStatus::norm_eta2)
+      .def_readonly("ncomm",&IMSRGSolver::FlowStatus::ncomm)
+      .def_readonly("Emp2",&IMSRGSolver::FlowStatus::Emp2)
+      .def_readonly("n_ops",&IMSRGSolver::FlowStatus::n_ops)
+      .def_readonly("walltime",&IMSRGSolver::FlowStatus::walltime)
+      .def_readonly("rss",&IMSRGSolver::FlowStatus::rss)
+      .def_readonly("max_rss",&IMSRGSolver::FlowStatus::max_rss)
+   ;
+
+   py::class_<IMSRGSolver::Checkpoint>(m,"IMSRGSolverCheckpoint")
+      .def_readonly("s",&IMSRGSolver::Checkpoint::s)
+      .def_readonly("istep",&IMSRGSolver::Checkpoint::istep)
+   ;
+
    py::class_<IMSRGSolver>(m,"IMSRGSolver")
       .def(py::init<Operator&>())
-      .def("Solve",&IMSRGSolver::Solve)
-      .def("Transform",Transform_ref)
+      .def("Solve",&IMSRGSolver::Solve, py::call_guard<py::gil_scoped_release>())
+      .def("Transform",Transform_ref, py::call_guard<py::gil_scoped_release>())
       .def("InverseTransform",&IMSRGSolver::InverseTransform)
       .def("SetFlowFile",&IMSRGSolver::SetFlowFile)
+      .def("SetFlowStatusInterval",&IMSRGSolver::SetFlowStatusInterval)
+      .def("SetFlowStatusAsync",&IMSRGSolver::SetFlowStatusAsync)
+      .def("SetFlowStatusSkip",&IMSRGSolver::SetFlowStatusSkip)
+      .def("SetFlowStatusCallback",&IMSRGSolver::SetFlowStatusCallback)
+      .def("GetLastFlowStatus",&IMSRGSolver::GetLastFlowStatus)
+      .def("RequestStop",&IMSRGSolver::RequestStop)
+      .def("StopRequested",&IMSRGSolver::StopRequested)
+      .def("FlowFailed",&IMSRGSolver::FlowFailed)
       .def("SetMethod",&IMSRGSolver::SetMethod)
       .def("SetEtaCriterion",&IMSRGSolver::SetEtaCriterion)
       .def("SetDs",&IMSRGSolver::SetDs)
@@ -274,10 +405,14 @@ PYBIND11_MODULE(pyIMSRG, m)
       .def("GetSystemDimension",&IMSRGSolver::GetSystemDimension)
       .def("GetOmega",&IMSRGSolver::GetOmega)
       .def("SetOmega",&IMSRGSolver::SetOmega)
+      .def("SetInitialOmega",&IMSRGSolver::SetInitialOmega)
+      .def("GetCheckpoint",&IMSRGSolver::GetCheckpoint)
+      .def("RestoreCheckpoint",&IMSRGSolver::RestoreCheckpoint, py::keep_alive<1,2>())
 //      .def("GetH_s",&IMSRGSolver::GetH_s,return_value_policy<reference_existing_object>())
       .def("GetH_s",&IMSRGSolver::GetH_s)
       .def("SetMagnusAdaptive",&IMSRGSolver::SetMagnusAdaptive)
       .def("SetReadWrite", &IMSRGSolver::SetReadWrite)
+      .def("SetScratchCacheSize", &IMSRGSolver::SetScratchCacheSize)
       .def_readwrite("Eta", &IMSRGSolver::Eta)
    ;
 
@@ -290,6 +425,11 @@ PYBIND11_MODULE(pyIMSRG, m)
       .def("PrintCounters",&IMSRGProfiler::PrintCounters)
       .def("PrintAll",&IMSRGProfiler::PrintAll)
       .def("PrintMemory",&IMSRGProfiler::PrintMemory)
+      .def("PrintTimerTree",&IMSRGProfiler::PrintTimerTree)
+      .def("EnableTrace",&IMSRGProfiler::EnableTrace)
+      .def("WriteTimesCSV",&IMSRGProfiler::WriteTimesCSV)
+      .def("WriteTraceJSON",&IMSRGProfiler::WriteTraceJSON)
+      .def("GetCounter",&IMSRGProfiler::GetCounter)
    ;
 
 
@@ -317,7 +457,14 @@ PYBIND11_MODULE(pyIMSRG, m)
    m.def("GetOccupations",   imsrg_util::GetOccupations);
    m.def("GetDensity",       imsrg_util::GetDensity);
    m.def("CommutatorTest",   imsrg_util::CommutatorTest);
+   m.def("NormalOrdering3Test", imsrg_util::NormalOrdering3Test);
+   m.def("TensorNineJTableTest", imsrg_util::TensorNineJTableTest);
+   m.def("TensorPandyaPairsTest", imsrg_util::TensorPandyaPairsTest);
+   m.def("OmegaCompressionTest", imsrg_util::OmegaCompressionTest);
+   m.def("ChargeSymmetryTest", imsrg_util::ChargeSymmetryTest);
+   m.def("TensorCommutator221Test", imsrg_util::TensorCommutator221Test);
    m.def("Calculate_p1p2_all",   imsrg_util::Calculate_p1p2_all);
+   m.def("Calculate_r1r2_all",   imsrg_util::Calculate_r1r2_all);
    m.def("Single_Ref_1B_Density_Matrix", imsrg_util::Single_Ref_1B_Density_Matrix);
    m.def("Get_Charge_Density", imsrg_util::Get_Charge_Density);
    m.def("Embed1BodyIn2Body",  imsrg_util::Embed1BodyIn2Body);